@@ -0,0 +1,275 @@
+// Checks the background fill planner by painting its fills into a grid of
+// colors and comparing that with the runs it was given, and measures the
+// draw calls it saves against filling every run on its own.
+//
+// The check plans random grids, of few and of many colors, with rows
+// repeated below each other and random sets of them dirty. It verifies
+// that every cell of a dirty row ends up its color and no other row is
+// touched, that fills of other colors than the default never overlap,
+// that the fills are ordered by color with the default first, and that
+// no two fills are left that could have been one.
+//
+// The measurement plans rows drawn as a colorscheme would have them: a
+// sign column, a cursorline, a visual selection, search matches and a
+// statusline, with syntax highlights splitting the text into runs of one
+// background. Once repainting the whole grid and once a few edited rows.
+//
+// Usage: background_plan_bench [--rows=N] [--cols=N] [--iterations=N]
+// Exits with 1 if a plan paints a cell wrong.
+
+#include <algorithm>
+#include "bench_util.h"
+#include "renderer/background_plan.h"
+
+constexpr uint32_t DEFAULT_BACKGROUND = 0x1E1E1E;
+// Colors are 24 bit, nothing paints this
+constexpr uint32_t UNPAINTED = 0xFF000000;
+
+struct BackgroundGrid {
+	int rows;
+	int cols;
+	// The runs of every row as the renderer hands them in
+	std::vector<std::vector<uint32_t>> run_starts;
+	std::vector<std::vector<uint32_t>> run_colors;
+};
+
+static void SetRuns(BackgroundGrid *grid, int row, const std::vector<uint32_t> &cells, BenchRandom *random) {
+	std::vector<uint32_t> *starts = &grid->run_starts[row];
+	std::vector<uint32_t> *colors = &grid->run_colors[row];
+	starts->clear();
+	colors->clear();
+	for (int col = 0; col < grid->cols; ++col) {
+		// Runs of one color come split up as well, by foreground say
+		if (col == 0 || cells[col] != cells[col - 1] || random->Below(8) == 0) {
+			starts->push_back(static_cast<uint32_t>(col));
+			colors->push_back(cells[col]);
+		}
+	}
+}
+
+static void RandomGrid(BackgroundGrid *grid, BenchRandom *random, uint32_t color_count) {
+	grid->run_starts.assign(grid->rows, {});
+	grid->run_colors.assign(grid->rows, {});
+	std::vector<uint32_t> cells(grid->cols);
+	for (int row = 0; row < grid->rows; ++row) {
+		// Rows repeat with a change or two, as blocks of a selection do
+		if (row == 0 || random->Below(3) == 0) {
+			uint32_t color = BenchRandomColor(random, DEFAULT_BACKGROUND, 2, color_count);
+			for (int col = 0; col < grid->cols; ++col) {
+				if (random->Below(6) == 0) {
+					color = BenchRandomColor(random, DEFAULT_BACKGROUND, 2, color_count);
+				}
+				cells[col] = color;
+			}
+		}
+		else if (random->Below(2)) {
+			int col = static_cast<int>(random->Below(grid->cols));
+			int end = col + 1 + static_cast<int>(random->Below(grid->cols - col));
+			std::fill(cells.begin() + col, cells.begin() + end, BenchRandomColor(random, DEFAULT_BACKGROUND, 2, color_count));
+		}
+		SetRuns(grid, row, cells, random);
+	}
+}
+
+static bool PlanRows(BackgroundPlan *plan, const BackgroundGrid *grid, const std::vector<int> &rows) {
+	BackgroundPlanBegin(plan, DEFAULT_BACKGROUND);
+	for (int row : rows) {
+		if (!BackgroundPlanAddRow(plan, row, grid->cols, grid->run_starts[row].data(),
+			grid->run_colors[row].data(), grid->run_starts[row].size())) {
+			return false;
+		}
+	}
+	BackgroundPlanFinish(plan);
+	return true;
+}
+
+static uint32_t CellColor(const BackgroundGrid *grid, int row, int col) {
+	const std::vector<uint32_t> &starts = grid->run_starts[row];
+	size_t run = std::upper_bound(starts.begin(), starts.end(), static_cast<uint32_t>(col)) - starts.begin() - 1;
+	return grid->run_colors[row][run];
+}
+
+static bool CheckPlan(const BackgroundPlan *plan, const BackgroundGrid *grid, const std::vector<int> &rows) {
+	std::vector<uint32_t> canvas(static_cast<size_t>(grid->rows) * grid->cols, UNPAINTED);
+	for (int i = 0; i < plan->fill_count; ++i) {
+		const BackgroundFill *fill = &plan->fills[i];
+		if (i > 0) {
+			const BackgroundFill *last = &plan->fills[i - 1];
+			bool in_order = last->color == fill->color || last->color == DEFAULT_BACKGROUND ||
+				(fill->color != DEFAULT_BACKGROUND && last->color < fill->color);
+			if (!in_order) {
+				fprintf(stderr, "fill %d of color %06x comes after %06x\n", i, fill->color, last->color);
+				return false;
+			}
+		}
+		for (int row = fill->row_begin; row < fill->row_end; ++row) {
+			for (int col = fill->col_begin; col < fill->col_end; ++col) {
+				uint32_t *cell = &canvas[static_cast<size_t>(row) * grid->cols + col];
+				if (*cell != UNPAINTED && *cell != DEFAULT_BACKGROUND) {
+					fprintf(stderr, "fill %d paints over cell %d,%d\n", i, row, col);
+					return false;
+				}
+				*cell = fill->color;
+			}
+		}
+
+		// Fills that touch and are alike should have been one
+		for (int j = 0; j < i; ++j) {
+			const BackgroundFill *other = &plan->fills[j];
+			bool stacked = other->col_begin == fill->col_begin && other->col_end == fill->col_end &&
+				(other->row_end == fill->row_begin || fill->row_end == other->row_begin);
+			bool beside = other->row_begin == fill->row_begin && other->row_end == fill->row_end &&
+				(other->col_end == fill->col_begin || fill->col_end == other->col_begin);
+			if (other->color == fill->color && (stacked || beside)) {
+				fprintf(stderr, "fills %d and %d of color %06x are left apart\n", j, i, fill->color);
+				return false;
+			}
+		}
+	}
+
+	std::vector<bool> dirty(grid->rows, false);
+	for (int row : rows) {
+		dirty[row] = true;
+	}
+	for (int row = 0; row < grid->rows; ++row) {
+		for (int col = 0; col < grid->cols; ++col) {
+			uint32_t expected = dirty[row] ? CellColor(grid, row, col) : UNPAINTED;
+			uint32_t painted = canvas[static_cast<size_t>(row) * grid->cols + col];
+			if (painted != expected) {
+				fprintf(stderr, "cell %d,%d is %06x instead of %06x\n", row, col, painted, expected);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool Check() {
+	BenchRandom random { 23 };
+	BackgroundPlan plan;
+	BackgroundPlanInitialize(&plan);
+	bool ok = true;
+	int plans = 0;
+	for (int round = 0; ok && round < 300; ++round) {
+		BackgroundGrid grid { 1 + static_cast<int>(random.Below(40)), 1 + static_cast<int>(random.Below(90)), {}, {} };
+		RandomGrid(&grid, &random, round % 2 ? 3 : 200);
+		ok = BackgroundPlanReserve(&plan, grid.rows, grid.cols);
+		for (int i = 0; ok && i < 20; ++i) {
+			std::vector<int> rows;
+			uint32_t dirty_chance = 1 + random.Below(100);
+			for (int row = 0; row < grid.rows; ++row) {
+				if (random.Below(100) < dirty_chance) {
+					rows.push_back(row);
+				}
+			}
+			ok = PlanRows(&plan, &grid, rows) && CheckPlan(&plan, &grid, rows);
+			++plans;
+		}
+	}
+
+	// Rows wider than the plan was sized for are refused, not written past
+	BackgroundGrid wide { 4, 100, {}, {} };
+	RandomGrid(&wide, &random, 3);
+	ok = ok && BackgroundPlanReserve(&plan, 4, 50) && !PlanRows(&plan, &wide, { 0 });
+
+	printf("check: %s, %d plans, %llu runs into %llu fills, %llu merged\n", ok ? "ok" : "FAILED", plans,
+		static_cast<unsigned long long>(plan.stats.runs), static_cast<unsigned long long>(plan.stats.fills),
+		static_cast<unsigned long long>(plan.stats.fills_merged));
+	BackgroundPlanShutdown(&plan);
+	return ok;
+}
+
+// A buffer as a colorscheme draws it, see the top
+static void ColorschemeGrid(BackgroundGrid *grid, BenchRandom *random) {
+	constexpr uint32_t SIGN_COLUMN = 0x252526;
+	constexpr uint32_t CURSORLINE = 0x2A2D2E;
+	constexpr uint32_t VISUAL = 0x264F78;
+	constexpr uint32_t SEARCH = 0x613214;
+	constexpr uint32_t STATUSLINE = 0x007ACC;
+	grid->run_starts.assign(grid->rows, {});
+	grid->run_colors.assign(grid->rows, {});
+	std::vector<uint32_t> cells(grid->cols);
+	int cursorline = grid->rows / 3;
+	int visual_begin = grid->rows / 2;
+	int visual_end = visual_begin + grid->rows / 5;
+	for (int row = 0; row < grid->rows; ++row) {
+		std::fill(cells.begin(), cells.end(), row == cursorline ? CURSORLINE : DEFAULT_BACKGROUND);
+		std::fill(cells.begin(), cells.begin() + std::min(2, grid->cols), SIGN_COLUMN);
+		if (row >= visual_begin && row < visual_end) {
+			std::fill(cells.begin() + std::min(8, grid->cols), cells.begin() + std::min(60, grid->cols), VISUAL);
+		}
+		if (random->Below(4) == 0 && grid->cols > 20) {
+			int col = 8 + static_cast<int>(random->Below(grid->cols - 16));
+			std::fill(cells.begin() + col, cells.begin() + col + 6, SEARCH);
+		}
+		if (row == grid->rows - 2) {
+			std::fill(cells.begin(), cells.end(), STATUSLINE);
+		}
+		SetRuns(grid, row, cells, random);
+	}
+}
+
+static void Measure(int rows, int cols, int iterations) {
+	BenchRandom random { 29 };
+	BackgroundGrid grid { rows, cols, {}, {} };
+	ColorschemeGrid(&grid, &random);
+	BackgroundPlan plan;
+	BackgroundPlanInitialize(&plan);
+	if (!BackgroundPlanReserve(&plan, rows, cols)) {
+		fprintf(stderr, "out of memory\n");
+		return;
+	}
+
+	std::vector<int> all_rows(rows);
+	for (int row = 0; row < rows; ++row) {
+		all_rows[row] = row;
+	}
+	// A line edited, with the statusline and the one below
+	std::vector<int> edited_rows { rows / 4, rows / 4 + 1, rows - 2 };
+	const struct {
+		const char *name;
+		const std::vector<int> *rows;
+	} flushes[] {
+		{ "full repaint", &all_rows },
+		{ "edit", &edited_rows },
+	};
+
+	for (const auto &flush : flushes) {
+		plan.stats = BackgroundPlanStats {};
+		uint64_t best_ns = UINT64_MAX;
+		for (int i = 0; i < iterations; ++i) {
+			uint64_t start = BenchNowNs();
+			PlanRows(&plan, &grid, *flush.rows);
+			uint64_t elapsed = BenchNowNs() - start;
+			best_ns = elapsed < best_ns ? elapsed : best_ns;
+		}
+		BenchKeep(static_cast<uint64_t>(plan.fill_count));
+
+		char name[64];
+		snprintf(name, sizeof(name), "  %s", flush.name);
+		BenchReport(name, best_ns, flush.rows->size(), 0);
+		// The first run sets the brush, later ones start where the last left it
+		uint64_t plans = static_cast<uint64_t>(iterations);
+		printf("    draw calls per flush: %llu fills and %llu color changes by run, %llu fills and %llu color changes planned\n",
+			static_cast<unsigned long long>(plan.stats.runs / plans),
+			static_cast<unsigned long long>(plan.stats.run_color_changes / plans),
+			static_cast<unsigned long long>(plan.stats.fills / plans),
+			static_cast<unsigned long long>(plan.stats.color_changes / plans));
+	}
+	BackgroundPlanShutdown(&plan);
+}
+
+int main(int argc, char **argv) {
+	int rows = BenchArgInt(argc, argv, "--rows", 50);
+	int cols = BenchArgInt(argc, argv, "--cols", 160);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 1000);
+	if (rows < 4 || cols <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: background_plan_bench [--rows=N] [--cols=N] [--iterations=N]\n");
+		return 2;
+	}
+
+	bool ok = Check();
+	printf("\n%d rows of %d cells, ns/event per row planned\n", rows, cols);
+	Measure(rows, cols, iterations);
+	return ok ? 0 : 1;
+}
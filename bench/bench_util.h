@@ -0,0 +1,391 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "third_party/mpack/mpack.h"
+#include "common/mpack_cursor.h"
+#include "renderer/grid.h"
+#include "renderer/style_table.h"
+
+// Shared helpers for the portable benchmarks. None of this is used by Nvy itself.
+
+inline uint64_t BenchNowNs() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+inline bool BenchReadFile(const char *path, std::vector<char> *out) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+	char chunk[64 * 1024];
+	size_t read;
+	while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+		out->insert(out->end(), chunk, chunk + read);
+	}
+	fclose(file);
+	return true;
+}
+
+// Returns the value of a `--name=value` argument, or nullptr
+inline const char *BenchArg(int argc, char **argv, const char *name) {
+	size_t name_length = strlen(name);
+	for (int i = 1; i < argc; ++i) {
+		if (!strncmp(argv[i], name, name_length) && argv[i][name_length] == '=') {
+			return &argv[i][name_length + 1];
+		}
+	}
+	return nullptr;
+}
+
+inline int BenchArgInt(int argc, char **argv, const char *name, int default_value) {
+	const char *value = BenchArg(argc, argv, name);
+	return value ? atoi(value) : default_value;
+}
+
+// Defeats dead code elimination of benchmark results
+inline void BenchKeep(uint64_t value) {
+	static volatile uint64_t sink;
+	sink = sink + value;
+}
+
+// Splits a raw stream into complete messages, returns false on malformed data
+struct BenchMessage {
+	size_t offset;
+	size_t size;
+};
+inline bool BenchFrameStream(const std::vector<char> &stream, std::vector<BenchMessage> *messages) {
+	MPackFramer framer {};
+	size_t offset = 0;
+	while (offset < stream.size()) {
+		bool invalid;
+		size_t size = MPackFramerScan(&framer, stream.data() + offset, stream.size() - offset, &invalid);
+		if (invalid) {
+			return false;
+		}
+		if (size == 0) {
+			// Trailing partial message, e.g. a recording cut off mid-message
+			break;
+		}
+		messages->push_back(BenchMessage { offset, size });
+		offset += size;
+	}
+	return true;
+}
+
+// Small deterministic generator so synthetic streams are identical between runs
+struct BenchRandom {
+	uint64_t state;
+	uint32_t Next() {
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		return static_cast<uint32_t>(state >> 33);
+	}
+	uint32_t Below(uint32_t n) {
+		return Next() % n;
+	}
+};
+
+// One of color_count colors from 0x100000 up, or default_color one time in
+// default_one_in
+inline uint32_t BenchRandomColor(BenchRandom *random, uint32_t default_color, uint32_t default_one_in,
+	uint32_t color_count) {
+	return random->Below(default_one_in) == 0 ? default_color : 0x100000 + random->Below(color_count);
+}
+
+enum class BenchCellText {
+	Ascii,
+	Cjk,
+	Emoji
+};
+
+inline void BenchWriteCellText(mpack_writer_t *writer, BenchCellText text, BenchRandom *random) {
+	switch (text) {
+	case BenchCellText::Ascii: {
+		char c = static_cast<char>('!' + random->Below(94));
+		mpack_write_str(writer, &c, 1);
+	} break;
+	case BenchCellText::Cjk: {
+		// U+4E00..U+4FFF, three bytes of UTF-8
+		uint32_t codepoint = 0x4E00 + random->Below(0x200);
+		char utf8[3] = {
+			static_cast<char>(0xE0 | (codepoint >> 12)),
+			static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)),
+			static_cast<char>(0x80 | (codepoint & 0x3F))
+		};
+		mpack_write_str(writer, utf8, 3);
+	} break;
+	case BenchCellText::Emoji: {
+		// U+1F600..U+1F64F, four bytes of UTF-8 and a surrogate pair in UTF-16
+		uint32_t codepoint = 0x1F600 + random->Below(0x50);
+		char utf8[4] = {
+			static_cast<char>(0xF0 | (codepoint >> 18)),
+			static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)),
+			static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)),
+			static_cast<char>(0x80 | (codepoint & 0x3F))
+		};
+		mpack_write_str(writer, utf8, 4);
+	} break;
+	}
+}
+
+// Writes a single grid_line parameter tuple resembling what nvim sends for a
+// line of source code: highlight changes every few cells and the trailing
+// whitespace collapsed into a single repeated cell.
+inline void BenchWriteGridLine(mpack_writer_t *writer, int row, int cols, int hl_run_length,
+	BenchCellText text, BenchRandom *random) {
+	bool wide = text != BenchCellText::Ascii;
+	int text_cols = cols - static_cast<int>(random->Below(cols / 4 + 1));
+	int text_cells = wide ? text_cols / 2 : text_cols;
+	int trailing = cols - (wide ? text_cells * 2 : text_cells);
+
+	// Each wide character is followed by an empty string cell for its right half
+	uint32_t cell_count = static_cast<uint32_t>(wide ? text_cells * 2 : text_cells) + (trailing > 0 ? 1 : 0);
+
+	mpack_start_array(writer, 4);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, row);
+	mpack_write_int(writer, 0);
+	mpack_start_array(writer, cell_count);
+	int hl_id = 1;
+	for (int i = 0; i < text_cells; ++i) {
+		bool hl_changes = i % hl_run_length == 0;
+		if (hl_changes) {
+			hl_id = 1 + static_cast<int>(random->Below(40));
+		}
+		mpack_start_array(writer, hl_changes ? 2 : 1);
+		BenchWriteCellText(writer, text, random);
+		if (hl_changes) {
+			mpack_write_int(writer, hl_id);
+		}
+		mpack_finish_array(writer);
+
+		if (wide) {
+			mpack_start_array(writer, 1);
+			mpack_write_str(writer, "", 0);
+			mpack_finish_array(writer);
+		}
+	}
+	if (trailing > 0) {
+		mpack_start_array(writer, 3);
+		mpack_write_cstr(writer, " ");
+		mpack_write_int(writer, 0);
+		mpack_write_int(writer, trailing);
+		mpack_finish_array(writer);
+	}
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+}
+
+// Writes a grid_line event for the cells [begin, end) of a row, ASCII and
+// double width CJK characters that never straddle the end of the span. One
+// cell in wide_one_in is wide and highlights are drawn from hl_ids ids.
+inline void BenchWriteGridLineSpan(mpack_writer_t *writer, int row, int begin, int end,
+	uint32_t wide_one_in, uint32_t hl_ids, BenchRandom *random) {
+	std::vector<bool> wide;
+	for (int col = begin; col < end;) {
+		bool is_wide = col + 1 < end && random->Below(wide_one_in) == 0;
+		wide.push_back(is_wide);
+		col += is_wide ? 2 : 1;
+	}
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "grid_line");
+	mpack_start_array(writer, 4);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, row);
+	mpack_write_int(writer, begin);
+	mpack_start_array(writer, static_cast<uint32_t>(end - begin));
+	for (bool is_wide : wide) {
+		bool hl_changes = random->Below(3) == 0;
+		mpack_start_array(writer, hl_changes ? 2 : 1);
+		BenchWriteCellText(writer, is_wide ? BenchCellText::Cjk : BenchCellText::Ascii, random);
+		if (hl_changes) {
+			mpack_write_int(writer, random->Below(hl_ids));
+		}
+		mpack_finish_array(writer);
+		if (is_wide) {
+			mpack_start_array(writer, 1);
+			mpack_write_str(writer, "", 0);
+			mpack_finish_array(writer);
+		}
+	}
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+}
+
+// Writes one redraw notification repainting the whole grid, plus the
+// events Nvy ignores that nvim sends alongside a repaint
+inline void BenchWriteFullRepaint(mpack_writer_t *writer, int rows, int cols, int hl_run_length,
+	BenchCellText text, BenchRandom *random) {
+	mpack_start_array(writer, 3);
+	mpack_write_int(writer, 2);
+	mpack_write_cstr(writer, "redraw");
+	mpack_start_array(writer, 5);
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "hl_group_set");
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "Normal");
+	mpack_write_int(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	mpack_start_array(writer, 1 + static_cast<uint32_t>(rows));
+	mpack_write_cstr(writer, "grid_line");
+	for (int row = 0; row < rows; ++row) {
+		BenchWriteGridLine(writer, row, cols, hl_run_length, text, random);
+	}
+	mpack_finish_array(writer);
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "win_viewport");
+	mpack_start_array(writer, 8);
+	mpack_write_int(writer, 1);
+	// nvim sends the window handle as an ext type
+	const char window_handle[1] = { 1 };
+	mpack_write_ext(writer, 1, window_handle, 1);
+	mpack_write_int(writer, 0);
+	mpack_write_int(writer, rows);
+	mpack_write_int(writer, 0);
+	mpack_write_int(writer, 0);
+	mpack_write_int(writer, 1000);
+	mpack_write_int(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "grid_cursor_goto");
+	mpack_start_array(writer, 3);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, random->Below(rows));
+	mpack_write_int(writer, random->Below(cols));
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "flush");
+	mpack_start_array(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+}
+
+// Appends `frames` full repaints to the stream
+inline void BenchGenerateRepaintStream(std::vector<char> *stream, int frames, int rows, int cols,
+	int hl_run_length, BenchCellText text, uint64_t seed) {
+	BenchRandom random { seed };
+	for (int i = 0; i < frames; ++i) {
+		char *data;
+		size_t size;
+		mpack_writer_t writer;
+		mpack_writer_init_growable(&writer, &data, &size);
+		BenchWriteFullRepaint(&writer, rows, cols, hl_run_length, text, &random);
+		if (mpack_writer_destroy(&writer) == mpack_ok) {
+			stream->insert(stream->end(), data, data + size);
+		}
+		MPACK_FREE(data);
+	}
+}
+
+// Font callbacks for benchmarks that leave the font out: every cell has the
+// same advance and a glyph index made from its character
+constexpr float BENCH_STUB_ADVANCE = 9.0f;
+
+inline float BenchStubAdvance(void *, uint32_t) {
+	return BENCH_STUB_ADVANCE;
+}
+
+inline uint16_t BenchStubGlyphIndex(void *, uint32_t cell) {
+	return static_cast<uint16_t>(cell + 100);
+}
+
+// Defines highlights 1 to highlight_count - 1 in color_count colors, so ids
+// share styles, one in color_count of them reversed. One of decorations is
+// added at the rate given in percent.
+inline void BenchDefineHighlights(HighlightAttributes *hl_attribs, StyleTable *styles, int highlight_count,
+	uint32_t color_count, const uint16_t *decorations, uint32_t decoration_count, uint32_t decorated_chance,
+	BenchRandom *random) {
+	hl_attribs[0] = HighlightAttributes { 0xD4D4D4, 0x1E1E1E, 0xFF0000, 0 };
+	StyleTableResolveAll(styles);
+	for (int id = 1; id < highlight_count; ++id) {
+		hl_attribs[id] = HighlightAttributes { 0x100000 + random->Below(color_count), DEFAULT_COLOR, DEFAULT_COLOR,
+			static_cast<uint16_t>(random->Below(color_count) == 0 ? HL_ATTRIB_REVERSE : 0) };
+		if (random->Below(100) < decorated_chance) {
+			hl_attribs[id].flags |= decorations[random->Below(decoration_count)];
+		}
+		StyleTableDefine(styles, id);
+	}
+}
+
+// What the renderer last drew, cell by cell, to check the rows a flush
+// moves and redraws against the grid
+struct BenchRaster {
+	int rows;
+	int cols;
+	std::vector<uint32_t> chars;
+	std::vector<uint16_t> hl_ids;
+	std::vector<uint8_t> flags;
+};
+
+inline void BenchRasterResize(BenchRaster *raster, int rows, int cols, uint32_t blank) {
+	size_t cell_count = static_cast<size_t>(rows) * cols;
+	raster->rows = rows;
+	raster->cols = cols;
+	raster->chars.assign(cell_count, blank);
+	raster->hl_ids.assign(cell_count, 0);
+	raster->flags.assign(cell_count, 0);
+}
+
+// Moves the drawn rows of a pending scroll through a scratch copy, as the
+// renderer blits them, and returns the number of rows moved
+inline int BenchRasterBlit(BenchRaster *raster, const GridPendingScroll *scroll) {
+	int moved_rows = scroll->bottom - scroll->top - abs(scroll->rows);
+	int source_row = scroll->rows > 0 ? scroll->top + scroll->rows : scroll->top;
+	int target_row = scroll->rows > 0 ? scroll->top : scroll->top - scroll->rows;
+	size_t width = scroll->right - scroll->left;
+	size_t band = static_cast<size_t>(moved_rows) * raster->cols;
+	size_t band_start = static_cast<size_t>(source_row) * raster->cols;
+	std::vector<uint32_t> chars(&raster->chars[band_start], &raster->chars[band_start] + band);
+	std::vector<uint16_t> hl_ids(&raster->hl_ids[band_start], &raster->hl_ids[band_start] + band);
+	std::vector<uint8_t> flags(&raster->flags[band_start], &raster->flags[band_start] + band);
+	for (int row = 0; row < moved_rows; ++row) {
+		size_t target = static_cast<size_t>(target_row + row) * raster->cols + scroll->left;
+		size_t source = static_cast<size_t>(row) * raster->cols + scroll->left;
+		memcpy(&raster->chars[target], &chars[source], width * sizeof(uint32_t));
+		memcpy(&raster->hl_ids[target], &hl_ids[source], width * sizeof(uint16_t));
+		memcpy(&raster->flags[target], &flags[source], width * sizeof(uint8_t));
+	}
+	return moved_rows;
+}
+
+inline void BenchRasterDraw(BenchRaster *raster, const Grid *grid, int row) {
+	size_t base = GridRowOffset(grid, row);
+	size_t target = static_cast<size_t>(row) * raster->cols;
+	memcpy(&raster->chars[target], &grid->chars[base], grid->cols * sizeof(uint32_t));
+	memcpy(&raster->hl_ids[target], &grid->hl_ids[base], grid->cols * sizeof(uint16_t));
+	memcpy(&raster->flags[target], &grid->flags[base], grid->cols * sizeof(uint8_t));
+}
+
+// Whether the first cols cells of a drawn row differ from the grid
+inline bool BenchRasterRowDiffers(const BenchRaster *raster, const Grid *grid, int row) {
+	size_t base = GridRowOffset(grid, row);
+	size_t raster_base = static_cast<size_t>(row) * raster->cols;
+	return memcmp(&grid->chars[base], &raster->chars[raster_base], grid->cols * sizeof(uint32_t)) ||
+		memcmp(&grid->hl_ids[base], &raster->hl_ids[raster_base], grid->cols * sizeof(uint16_t)) ||
+		memcmp(&grid->flags[base], &raster->flags[raster_base], grid->cols * sizeof(uint8_t));
+}
+
+inline void BenchReport(const char *name, uint64_t elapsed_ns, uint64_t events, uint64_t bytes) {
+	double seconds = static_cast<double>(elapsed_ns) / 1e9;
+	printf("%-28s %10.2f ms %10.1f ns/event %10.1f MB/s\n", name,
+		static_cast<double>(elapsed_ns) / 1e6,
+		events ? static_cast<double>(elapsed_ns) / static_cast<double>(events) : 0.0,
+		seconds > 0.0 ? static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds : 0.0);
+}
@@ -0,0 +1,345 @@
+// Measures the redraw command buffers the reader thread produces: the cost
+// of translating redraw notifications, and the work left on the window
+// thread when it executes commands instead of decoding msgpack itself.
+// Both paths update a plain grid, which has to come out identical.
+//
+// Usage: command_bench [--input=<raw nvim stdout capture>] [--frames=N]
+//                      [--rows=N] [--cols=N] [--iterations=N]
+//                      [--save=<file>] [--commands=<file>]
+// --save records the translated command buffers, --commands replays a
+// recording made with --save instead of translating a stream.
+
+#include "bench_util.h"
+#include "nvim/redraw_commands.h"
+#include <algorithm>
+
+// Just the cell state the renderer keeps
+struct BenchGrid {
+	int rows;
+	int cols;
+	std::vector<uint32_t> chars;
+	std::vector<uint16_t> hl_ids;
+	std::vector<uint8_t> wide;
+	int cursor_row;
+	int cursor_col;
+
+	void Resize(int new_rows, int new_cols) {
+		if (new_rows == rows && new_cols == cols) {
+			return;
+		}
+		rows = new_rows;
+		cols = new_cols;
+		size_t cell_count = static_cast<size_t>(rows) * cols;
+		chars.assign(cell_count, ' ');
+		hl_ids.assign(cell_count, 0);
+		wide.assign(cell_count, 0);
+	}
+	void Clear() {
+		std::fill(chars.begin(), chars.end(), ' ');
+		std::fill(hl_ids.begin(), hl_ids.end(), 0);
+		std::fill(wide.begin(), wide.end(), 0);
+	}
+	// Same rules as the renderer's UpdateGridLine
+	void SetCell(size_t offset, uint32_t cell_char, uint16_t hl_id) {
+		if (cell_char == REDRAW_CELL_RIGHT_HALF) {
+			chars[offset] = 0;
+			wide[offset] = 0;
+			if (offset > 0) {
+				wide[offset - 1] = 1;
+				hl_ids[offset] = hl_ids[offset - 1];
+			}
+		}
+		else {
+			if (offset > 0) {
+				wide[offset - 1] = 0;
+			}
+			chars[offset] = cell_char;
+			hl_ids[offset] = hl_id;
+			wide[offset] = 0;
+		}
+	}
+	void Scroll(int64_t top, int64_t bottom, int64_t left, int64_t right, int64_t scroll_rows) {
+		if (top < 0 || bottom > rows || left < 0 || right > cols || top >= bottom || left >= right) {
+			return;
+		}
+		bool scrolling_down = scroll_rows > 0;
+		int64_t start_row = scrolling_down ? top : bottom - 1;
+		int64_t end_row = scrolling_down ? bottom - 1 : top;
+		int64_t increment = scrolling_down ? 1 : -1;
+		for (int64_t j = start_row; scrolling_down ? j <= end_row : j >= end_row; j += increment) {
+			int64_t target_row = j - scroll_rows;
+			if (target_row < top || target_row >= bottom) {
+				continue;
+			}
+			size_t from = static_cast<size_t>(j * cols + left);
+			size_t to = static_cast<size_t>(target_row * cols + left);
+			size_t count = static_cast<size_t>(right - left);
+			memmove(&chars[to], &chars[from], count * sizeof(uint32_t));
+			memmove(&hl_ids[to], &hl_ids[from], count * sizeof(uint16_t));
+			memmove(&wide[to], &wide[from], count);
+		}
+	}
+	uint64_t Checksum() const {
+		uint64_t checksum = static_cast<uint64_t>(cursor_row) * 31 + cursor_col;
+		for (size_t i = 0; i < chars.size(); ++i) {
+			checksum = checksum * 1099511628211ull + chars[i] * 7 + hl_ids[i] * 3 + wide[i];
+		}
+		return checksum;
+	}
+};
+
+// What the window thread did before: decoding msgpack and UTF-8 per cell
+struct DirectHandler {
+	BenchGrid *grid;
+	uint64_t cells;
+
+	void OptionSet(const RedrawOptionSet *) {}
+	void GridResize(const RedrawGridResize *grid_resize) {
+		if (grid_resize->width > 0 && grid_resize->height > 0 &&
+			grid_resize->width <= INT32_MAX && grid_resize->height <= INT32_MAX) {
+			grid->Resize(static_cast<int>(grid_resize->height), static_cast<int>(grid_resize->width));
+		}
+	}
+	void GridClear(const RedrawGridClear *) {
+		grid->Clear();
+	}
+	void DefaultColorsSet(const RedrawDefaultColorsSet *) {}
+	void HlAttrDefine(const RedrawHlAttrDefine *) {}
+	void GridLine(RedrawGridLine *grid_line) {
+		int64_t grid_size = static_cast<int64_t>(grid->rows) * grid->cols;
+		int64_t offset = grid_line->row * grid->cols + grid_line->col_start;
+		RedrawCell cell;
+		while (RedrawNextCell(&grid_line->cells, &cell) && offset >= 0 && cell.repeat >= 0) {
+			uint32_t cell_char = RedrawEncodeCellText(cell.text, cell.text_length);
+			int64_t repeat = cell.text_length ? cell.repeat : 1;
+			for (int64_t i = 0; i < repeat && offset < grid_size; ++i, ++offset) {
+				grid->SetCell(static_cast<size_t>(offset), cell_char, static_cast<uint16_t>(cell.hl_id));
+				++cells;
+			}
+		}
+	}
+	void GridCursorGoto(const RedrawGridCursorGoto *cursor_goto) {
+		grid->cursor_row = static_cast<int>(cursor_goto->row);
+		grid->cursor_col = static_cast<int>(cursor_goto->col);
+	}
+	void ModeInfoSet(RedrawModeInfoSet *) {}
+	void ModeChange(const RedrawModeChange *) {}
+	void SetTitle(const RedrawSetTitle *) {}
+	void BusyStart() {}
+	void BusyStop() {}
+	void GridScroll(const RedrawGridScroll *grid_scroll) {
+		grid->Scroll(grid_scroll->top, grid_scroll->bottom, grid_scroll->left, grid_scroll->right, grid_scroll->rows);
+	}
+	void Flush() {}
+};
+
+static void DecodeDirect(const char *data, size_t size, DirectHandler *handler) {
+	MPackCursor cursor = MPackCursorInit(data, size);
+	if (MPackCursorArray(&cursor) != 3 || MPackCursorInt(&cursor) != 2) {
+		return;
+	}
+	uint32_t name_length;
+	const char *name = MPackCursorStr(&cursor, &name_length);
+	if (MPackStrEquals(name, name_length, "redraw")) {
+		RedrawDispatch(&cursor, handler);
+	}
+}
+
+// Executing the translated commands, as the reader thread does into its
+// snapshot model
+static uint64_t ExecuteCommands(const char *data, size_t size, BenchGrid *grid) {
+	RedrawCommandReader reader;
+	if (!RedrawCommandsBegin(&reader, data, size)) {
+		return 0;
+	}
+
+	uint64_t cells = 0;
+	while (const RedrawCommand *command = RedrawNextCommand(&reader)) {
+		switch (command->event) {
+		case RedrawEvent::grid_resize: {
+			const RedrawCommandGridResize *grid_resize = reinterpret_cast<const RedrawCommandGridResize *>(command);
+			grid->Resize(grid_resize->height, grid_resize->width);
+		} break;
+		case RedrawEvent::grid_clear: {
+			grid->Clear();
+		} break;
+		case RedrawEvent::grid_line: {
+			const RedrawCommandGridLine *grid_line = reinterpret_cast<const RedrawCommandGridLine *>(command);
+			int64_t grid_size = static_cast<int64_t>(grid->rows) * grid->cols;
+			int64_t offset = static_cast<int64_t>(grid_line->row) * grid->cols + grid_line->col_start;
+			const uint32_t *chars = RedrawGridLineChars(grid_line);
+			const uint16_t *hl_ids = RedrawGridLineHlIds(grid_line);
+			for (uint32_t i = 0; i < grid_line->cell_count && offset < grid_size; ++i, ++offset) {
+				grid->SetCell(static_cast<size_t>(offset), chars[i], hl_ids[i]);
+				++cells;
+			}
+		} break;
+		case RedrawEvent::grid_cursor_goto: {
+			const RedrawCommandGridCursorGoto *cursor_goto = reinterpret_cast<const RedrawCommandGridCursorGoto *>(command);
+			grid->cursor_row = cursor_goto->row;
+			grid->cursor_col = cursor_goto->col;
+		} break;
+		case RedrawEvent::grid_scroll: {
+			const RedrawCommandGridScroll *grid_scroll = reinterpret_cast<const RedrawCommandGridScroll *>(command);
+			grid->Scroll(grid_scroll->top, grid_scroll->bottom, grid_scroll->left, grid_scroll->right, grid_scroll->rows);
+		} break;
+		default: {
+		} break;
+		}
+	}
+	return cells;
+}
+
+struct CommandBuffer {
+	char *data;
+	size_t size;
+};
+
+// Splits a recording made with --save back into its command buffers
+static bool SplitRecording(const std::vector<char> &recording, std::vector<CommandBuffer> *buffers) {
+	size_t offset = 0;
+	while (offset < recording.size()) {
+		RedrawCommandReader reader;
+		if (!RedrawCommandsBegin(&reader, recording.data() + offset, recording.size() - offset)) {
+			return false;
+		}
+		// Copied so every buffer is aligned the way RedrawTranslate returns them
+		char *data = static_cast<char *>(malloc(reader.size));
+		memcpy(data, recording.data() + offset, reader.size);
+		buffers->push_back(CommandBuffer { data, reader.size });
+		offset += reader.size;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	int frames = BenchArgInt(argc, argv, "--frames", 50);
+	int rows = BenchArgInt(argc, argv, "--rows", 90);
+	int cols = BenchArgInt(argc, argv, "--cols", 300);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 5);
+
+	std::vector<CommandBuffer> buffers;
+	std::vector<char> stream;
+	std::vector<BenchMessage> messages;
+	size_t input_bytes = 0;
+	const char *recording_path = BenchArg(argc, argv, "--commands");
+	if (recording_path) {
+		std::vector<char> recording;
+		if (!BenchReadFile(recording_path, &recording) || !SplitRecording(recording, &buffers)) {
+			fprintf(stderr, "Could not read command buffers from %s\n", recording_path);
+			return 1;
+		}
+		printf("recording: %s, %zu command buffers, %zu bytes\n", recording_path, buffers.size(), recording.size());
+		input_bytes = recording.size();
+	}
+	else {
+		const char *input = BenchArg(argc, argv, "--input");
+		if (input) {
+			if (!BenchReadFile(input, &stream)) {
+				fprintf(stderr, "Could not read %s\n", input);
+				return 1;
+			}
+			printf("stream: %s, %zu bytes\n", input, stream.size());
+		}
+		else {
+			// Mix in wide characters, they take the more involved path through both decoders
+			BenchGenerateRepaintStream(&stream, frames - frames / 4, rows, cols, 6, BenchCellText::Ascii, 1);
+			BenchGenerateRepaintStream(&stream, frames / 8, rows, cols, 6, BenchCellText::Cjk, 2);
+			BenchGenerateRepaintStream(&stream, frames / 4 - frames / 8, rows, cols, 6, BenchCellText::Emoji, 3);
+			printf("stream: %d synthetic %dx%d repaints, %zu bytes\n", frames, cols, rows, stream.size());
+		}
+		if (!BenchFrameStream(stream, &messages)) {
+			fprintf(stderr, "Malformed msgpack stream\n");
+			return 1;
+		}
+		input_bytes = stream.size();
+
+		uint64_t translate_ns = UINT64_MAX;
+		for (int i = 0; i < iterations; ++i) {
+			for (CommandBuffer &buffer : buffers) {
+				free(buffer.data);
+			}
+			buffers.clear();
+
+			uint64_t start = BenchNowNs();
+			for (const BenchMessage &message : messages) {
+				CommandBuffer buffer;
+				buffer.data = RedrawTranslate(stream.data() + message.offset, message.size, &buffer.size);
+				if (buffer.data) {
+					buffers.push_back(buffer);
+				}
+			}
+			uint64_t elapsed = BenchNowNs() - start;
+			translate_ns = elapsed < translate_ns ? elapsed : translate_ns;
+		}
+		size_t command_bytes = 0;
+		for (const CommandBuffer &buffer : buffers) {
+			command_bytes += buffer.size;
+		}
+		printf("%zu messages translated into %zu command bytes (%.2fx the msgpack)\n", messages.size(),
+			command_bytes, static_cast<double>(command_bytes) / static_cast<double>(stream.size()));
+		BenchReport("translate (reader thread)", translate_ns, messages.size(), stream.size());
+
+		const char *save_path = BenchArg(argc, argv, "--save");
+		if (save_path) {
+			FILE *file = fopen(save_path, "wb");
+			if (!file) {
+				fprintf(stderr, "Could not write %s\n", save_path);
+				return 1;
+			}
+			for (const CommandBuffer &buffer : buffers) {
+				fwrite(buffer.data, 1, buffer.size, file);
+			}
+			fclose(file);
+			printf("saved %zu command buffers to %s\n", buffers.size(), save_path);
+		}
+	}
+
+	BenchGrid direct_grid {};
+	BenchGrid command_grid {};
+	uint64_t direct_ns = UINT64_MAX;
+	uint64_t execute_ns = UINT64_MAX;
+	uint64_t direct_cells = 0;
+	uint64_t command_cells = 0;
+	for (int i = 0; i < iterations; ++i) {
+		if (!messages.empty()) {
+			direct_grid = BenchGrid {};
+			direct_grid.Resize(rows, cols);
+			DirectHandler handler { &direct_grid, 0 };
+			uint64_t start = BenchNowNs();
+			for (const BenchMessage &message : messages) {
+				DecodeDirect(stream.data() + message.offset, message.size, &handler);
+			}
+			uint64_t elapsed = BenchNowNs() - start;
+			direct_ns = elapsed < direct_ns ? elapsed : direct_ns;
+			direct_cells = handler.cells;
+		}
+
+		command_grid = BenchGrid {};
+		command_grid.Resize(rows, cols);
+		command_cells = 0;
+		uint64_t start = BenchNowNs();
+		for (const CommandBuffer &buffer : buffers) {
+			command_cells += ExecuteCommands(buffer.data, buffer.size, &command_grid);
+		}
+		uint64_t elapsed = BenchNowNs() - start;
+		execute_ns = elapsed < execute_ns ? elapsed : execute_ns;
+	}
+	BenchKeep(command_grid.Checksum());
+
+	if (!messages.empty()) {
+		if (direct_cells != command_cells || direct_grid.Checksum() != command_grid.Checksum()) {
+			fprintf(stderr, "Grids differ: direct %llu cells, commands %llu cells\n",
+				static_cast<unsigned long long>(direct_cells), static_cast<unsigned long long>(command_cells));
+			return 1;
+		}
+		BenchReport("decode + apply (before)", direct_ns, direct_cells, input_bytes);
+	}
+	BenchReport("execute commands (now)", execute_ns, command_cells, input_bytes);
+	printf("%llu cells (best of %d, ns/event is per cell)\n", static_cast<unsigned long long>(command_cells), iterations);
+
+	for (CommandBuffer &buffer : buffers) {
+		free(buffer.data);
+	}
+	return 0;
+}
@@ -0,0 +1,268 @@
+// Checks the cursor blink schedule and the pixels saved under the cursor,
+// and counts the rows a session of cursor moves, mode changes and blinks
+// lays out again with the cursor drawn into the rows against drawn as an
+// overlay.
+//
+// The check resets blinking for random modes, including ones that don't
+// blink, and advances it by random steps, some of them minutes long as
+// after a suspend. Every step is compared with the schedule worked out
+// per millisecond from nvim's description: on for blinkwait, then off
+// for blinkoff and on for blinkon over and over. It also checks that the
+// pixels of a cursor rect cover it and stay on the surface.
+//
+// The measurement replays a synthetic editing session on a grid: moves
+// at typing speed, a mode change every few moves, a busy_start with
+// every write and the cursor blinking in between. Drawn into the rows,
+// every one of those marks the row under the old cursor dirty, blinks
+// included, as Nvy did before. As an overlay none of them does, only
+// the cursor's cell is drawn again.
+//
+// Usage: cursor_bench [--rows=N] [--cols=N] [--moves=N] [--iterations=N]
+// Exits with 1 if the schedule or the pixels are wrong.
+
+#include <cmath>
+#include "bench_util.h"
+#include "renderer/cursor.h"
+#include "renderer/grid.h"
+
+// Visible at now_ms for a blink reset at reset_ms, per the description
+static bool ReferenceVisible(const CursorModeInfo *mode_info, uint64_t reset_ms, uint64_t now_ms) {
+	if (mode_info->blinkwait <= 0 || mode_info->blinkon <= 0 || mode_info->blinkoff <= 0) {
+		return true;
+	}
+	uint64_t wait_end = reset_ms + mode_info->blinkwait;
+	if (now_ms < wait_end) {
+		return true;
+	}
+	uint64_t phase = (now_ms - wait_end) % (mode_info->blinkoff + mode_info->blinkon);
+	return phase >= static_cast<uint64_t>(mode_info->blinkoff);
+}
+
+static bool CheckBlink(BenchRandom *random, int *steps) {
+	for (int round = 0; round < 2000; ++round) {
+		CursorModeInfo mode_info {};
+		mode_info.blinkwait = static_cast<int32_t>(random->Below(800));
+		mode_info.blinkon = static_cast<int32_t>(random->Below(600));
+		mode_info.blinkoff = static_cast<int32_t>(random->Below(600));
+		// Most modes blink, nvim's defaults have all three set
+		if (random->Below(4) != 0) {
+			mode_info.blinkwait += 1;
+			mode_info.blinkon += 1;
+			mode_info.blinkoff += 1;
+		}
+		uint64_t now_ms = random->Next();
+		uint64_t reset_ms = now_ms;
+		CursorBlink blink {};
+		CursorBlinkReset(&blink, round % 50 ? &mode_info : nullptr, reset_ms);
+		if (round % 50 == 0) {
+			mode_info.blinkwait = 0;
+		}
+		bool blinks = mode_info.blinkwait > 0 && mode_info.blinkon > 0 && mode_info.blinkoff > 0;
+		if (!blink.visible || (blink.next_ms == CURSOR_BLINK_NEVER) == blinks) {
+			fprintf(stderr, "round %d: reset to %s, next at %llu\n", round, blink.visible ? "visible" : "hidden",
+				static_cast<unsigned long long>(blink.next_ms));
+			return false;
+		}
+
+		bool visible = true;
+		for (int i = 0; i < 40; ++i) {
+			uint32_t kind = random->Below(10);
+			now_ms += kind == 0 ? 0 : kind < 8 ? random->Below(700) : random->Below(10 * 60 * 1000);
+			bool changed = CursorBlinkAdvance(&blink, now_ms);
+			bool expected = ReferenceVisible(&mode_info, reset_ms, now_ms);
+			if (blink.visible != expected || changed != (expected != visible)) {
+				fprintf(stderr, "round %d: at %llu ms after reset %s, expected %s\n", round,
+					static_cast<unsigned long long>(now_ms - reset_ms), blink.visible ? "visible" : "hidden",
+					expected ? "visible" : "hidden");
+				return false;
+			}
+			visible = expected;
+			++*steps;
+
+			// The render thread wakes at next_ms, the cursor must not flip before it
+			if (blink.next_ms != CURSOR_BLINK_NEVER) {
+				bool at_next = ReferenceVisible(&mode_info, reset_ms, blink.next_ms);
+				bool before_next = ReferenceVisible(&mode_info, reset_ms, blink.next_ms - 1);
+				if (blink.next_ms <= now_ms || at_next == before_next || before_next != visible) {
+					fprintf(stderr, "round %d: next flip at %llu ms after reset is wrong\n", round,
+						static_cast<unsigned long long>(blink.next_ms - reset_ms));
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+static bool CheckPixels(BenchRandom *random) {
+	for (int i = 0; i < 100000; ++i) {
+		uint32_t width = 1 + random->Below(3000);
+		uint32_t height = 1 + random->Below(2000);
+		float left = static_cast<float>(random->Below(3200 * 8)) / 8.0f - 100.0f;
+		float top = static_cast<float>(random->Below(2200 * 8)) / 8.0f - 100.0f;
+		float right = left + static_cast<float>(1 + random->Below(40 * 8)) / 8.0f;
+		float bottom = top + static_cast<float>(1 + random->Below(60 * 8)) / 8.0f;
+
+		CursorPixels pixels;
+		bool on_surface = left < static_cast<float>(width) && top < static_cast<float>(height) &&
+			right > 0.0f && bottom > 0.0f && left < right && top < bottom;
+		if (CursorCoverPixels(left, top, right, bottom, width, height, &pixels) != on_surface) {
+			fprintf(stderr, "rect %g,%g %g,%g on %ux%u taken as %s the surface\n", left, top, right, bottom,
+				width, height, on_surface ? "off" : "on");
+			return false;
+		}
+		if (!on_surface) {
+			continue;
+		}
+		bool inside = pixels.left < pixels.right && pixels.top < pixels.bottom &&
+			pixels.right <= width && pixels.bottom <= height;
+		// Whatever part of the rect is on the surface, and less than a pixel more
+		bool covers = pixels.left <= fmaxf(left, 0.0f) && pixels.top <= fmaxf(top, 0.0f) &&
+			pixels.right >= fminf(right, static_cast<float>(width)) &&
+			pixels.bottom >= fminf(bottom, static_cast<float>(height)) &&
+			pixels.left + 1.0f > fmaxf(left, 0.0f) && pixels.top + 1.0f > fmaxf(top, 0.0f) &&
+			pixels.right < fminf(right, static_cast<float>(width)) + 1.0f &&
+			pixels.bottom < fminf(bottom, static_cast<float>(height)) + 1.0f;
+		if (!inside || !covers) {
+			fprintf(stderr, "rect %g,%g %g,%g on %ux%u saved as %u,%u %u,%u\n", left, top, right, bottom,
+				width, height, pixels.left, pixels.top, pixels.right, pixels.bottom);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool Check() {
+	BenchRandom random { 41 };
+	int steps = 0;
+	bool ok = CheckBlink(&random, &steps) && CheckPixels(&random);
+	printf("check: %s, %d blink steps\n", ok ? "ok" : "FAILED", steps);
+	return ok;
+}
+
+struct SessionResult {
+	uint64_t flushes;
+	uint64_t blink_frames;
+	uint64_t rows_drawn;
+	uint64_t cursor_draws;
+};
+
+// The session of the top, a flush after every event. Rows of the grid
+// are only drawn for the cursor, the text never changes.
+static SessionResult ReplaySession(Grid *grid, int moves, bool overlay) {
+	BenchRandom random { 43 };
+	CursorModeInfo modes[2] {
+		{ CursorShape::Block, 0, 700, 400, 250 },
+		{ CursorShape::Vertical, 0, 700, 400, 250 },
+	};
+	int mode = 0;
+	int row = 0;
+	int col = 0;
+	uint64_t now_ms = 0;
+	CursorBlink blink {};
+	CursorBlinkReset(&blink, &modes[mode], now_ms);
+	GridClearDirty(grid);
+
+	SessionResult result {};
+	auto flush = [&]() {
+		++result.flushes;
+		for (int dirty = GridNextDirtyRow(grid, 0); dirty >= 0; dirty = GridNextDirtyRow(grid, dirty + 1)) {
+			++result.rows_drawn;
+		}
+		GridClearDirty(grid);
+		result.cursor_draws += blink.visible;
+	};
+	for (int i = 0; i < moves; ++i) {
+		// Typing speed, with a pause to read now and then
+		uint64_t next_ms = now_ms + (random.Below(20) ? 80 + random.Below(200) : 1000 + random.Below(4000));
+		while (blink.next_ms <= next_ms) {
+			uint64_t blink_ms = blink.next_ms;
+			if (CursorBlinkAdvance(&blink, blink_ms)) {
+				if (!overlay) {
+					GridMarkDirty(grid, row, col, col + 2);
+				}
+				++result.blink_frames;
+				flush();
+			}
+		}
+		now_ms = next_ms;
+
+		if (!overlay) {
+			GridMarkDirty(grid, row, col, col + 2);
+		}
+		uint32_t event = random.Below(16);
+		if (event == 0) {
+			mode ^= 1;
+		}
+		else if (event == 1 && !overlay) {
+			// busy_start of a write, busy_stop follows before the flush
+			GridMarkDirty(grid, row, col, col + 2);
+		}
+		int step = random.Below(4) ? 1 : 1 + static_cast<int>(random.Below(grid->rows));
+		row = static_cast<int>((row + (random.Below(2) ? step : grid->rows - step % grid->rows)) % grid->rows);
+		col = static_cast<int>(random.Below(grid->cols));
+		CursorBlinkReset(&blink, &modes[mode], now_ms);
+		flush();
+	}
+	return result;
+}
+
+static void Measure(int rows, int cols, int moves, int iterations) {
+	Grid grid {};
+	if (!GridResize(&grid, rows, cols)) {
+		fprintf(stderr, "out of memory\n");
+		return;
+	}
+
+	const struct {
+		const char *name;
+		bool overlay;
+	} policies[] {
+		{ "  cursor in rows", false },
+		{ "  cursor overlay", true },
+	};
+	for (const auto &policy : policies) {
+		SessionResult result = ReplaySession(&grid, moves, policy.overlay);
+		printf("%s: %llu flushes, %llu of them blinks, %llu rows laid out, %llu cursor cells drawn\n", policy.name,
+			static_cast<unsigned long long>(result.flushes), static_cast<unsigned long long>(result.blink_frames),
+			static_cast<unsigned long long>(result.rows_drawn), static_cast<unsigned long long>(result.cursor_draws));
+	}
+
+	// What a blink or a flush costs the render thread before drawing, when
+	// its wait ends at the blink's next_ms or a snapshot arrives
+	CursorModeInfo mode_info { CursorShape::Block, 0, 700, 400, 250 };
+	CursorBlink blink {};
+	CursorBlinkReset(&blink, &mode_info, 0);
+	uint64_t best_ns = UINT64_MAX;
+	uint64_t steps = 100000;
+	for (int i = 0; i < iterations; ++i) {
+		uint64_t now_ms = blink.next_ms;
+		uint64_t start = BenchNowNs();
+		for (uint64_t step = 0; step < steps; ++step) {
+			BenchKeep(CursorBlinkAdvance(&blink, now_ms));
+			now_ms += 1 + (step & 511);
+		}
+		uint64_t elapsed = BenchNowNs() - start;
+		best_ns = elapsed < best_ns ? elapsed : best_ns;
+	}
+	BenchReport("  blink advance", best_ns, steps, 0);
+	GridFree(&grid);
+}
+
+int main(int argc, char **argv) {
+	int rows = BenchArgInt(argc, argv, "--rows", 50);
+	int cols = BenchArgInt(argc, argv, "--cols", 200);
+	int moves = BenchArgInt(argc, argv, "--moves", 5000);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 20);
+	if (rows <= 0 || cols <= 0 || moves <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: cursor_bench [--rows=N] [--cols=N] [--moves=N] [--iterations=N]\n");
+		return 2;
+	}
+
+	if (!Check()) {
+		return 1;
+	}
+	printf("%dx%d grid, %d cursor moves\n", rows, cols, moves);
+	Measure(rows, cols, moves, iterations);
+	return 0;
+}
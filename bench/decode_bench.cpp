@@ -0,0 +1,204 @@
+// Compares decoding redraw notifications through an mpack node tree (the way
+// Nvy used to) against walking them in place with MPackCursor.
+//
+// Usage: decode_bench [--input=<raw nvim stdout capture>] [--frames=N]
+//                     [--rows=N] [--cols=N] [--iterations=N]
+// Without --input a synthetic stream of full-screen repaints is generated.
+
+#include "bench_util.h"
+
+struct DecodeTotals {
+	uint64_t checksum;
+	uint64_t cells;
+	uint64_t events;
+};
+
+static bool TreeMatch(mpack_node_t node, const char *str_to_match) {
+	// Same prefix match the tree based RendererRedraw used
+	return strncmp(mpack_node_str(node), str_to_match, mpack_node_strlen(node)) == 0;
+}
+
+static void DecodeWithTree(const char *data, size_t size, DecodeTotals *totals) {
+	mpack_tree_t tree;
+	mpack_tree_init_data(&tree, data, size);
+	mpack_tree_parse(&tree);
+	if (mpack_tree_error(&tree) != mpack_ok) {
+		mpack_tree_destroy(&tree);
+		return;
+	}
+
+	mpack_node_t root = mpack_tree_root(&tree);
+	if (mpack_node_array_at(root, 0).data->value.i != 2 ||
+		!TreeMatch(mpack_node_array_at(root, 1), "redraw")) {
+		mpack_tree_destroy(&tree);
+		return;
+	}
+
+	mpack_node_t params = mpack_node_array_at(root, 2);
+	size_t event_count = mpack_node_array_length(params);
+	for (size_t i = 0; i < event_count; ++i) {
+		mpack_node_t event = mpack_node_array_at(params, i);
+		mpack_node_t name = mpack_node_array_at(event, 0);
+		size_t tuple_count = mpack_node_array_length(event);
+		totals->events += tuple_count - 1;
+
+		if (TreeMatch(name, "grid_line")) {
+			for (size_t j = 1; j < tuple_count; ++j) {
+				mpack_node_t grid_line = mpack_node_array_at(event, j);
+				uint64_t row = mpack_node_array_at(grid_line, 1).data->value.u;
+				uint64_t col = mpack_node_array_at(grid_line, 2).data->value.u;
+				totals->checksum += row * 131 + col;
+
+				mpack_node_t cells = mpack_node_array_at(grid_line, 3);
+				size_t cell_count = mpack_node_array_length(cells);
+				for (size_t k = 0; k < cell_count; ++k) {
+					mpack_node_t cell = mpack_node_array_at(cells, k);
+					size_t cell_length = mpack_node_array_length(cell);
+					mpack_node_t text = mpack_node_array_at(cell, 0);
+					size_t text_length = mpack_node_strlen(text);
+					uint64_t first = text_length ? static_cast<uint8_t>(mpack_node_str(text)[0]) : 0;
+					uint64_t hl = cell_length > 1 ? mpack_node_array_at(cell, 1).data->value.u : 0;
+					uint64_t repeat = cell_length > 2 ? mpack_node_array_at(cell, 2).data->value.u : 1;
+					totals->checksum += first * 31 + hl * 7 + repeat + text_length;
+					++totals->cells;
+				}
+			}
+		}
+		else if (TreeMatch(name, "grid_cursor_goto")) {
+			for (size_t j = 1; j < tuple_count; ++j) {
+				mpack_node_t goto_params = mpack_node_array_at(event, j);
+				totals->checksum += mpack_node_array_at(goto_params, 1).data->value.u * 3 +
+					mpack_node_array_at(goto_params, 2).data->value.u;
+			}
+		}
+	}
+
+	mpack_tree_destroy(&tree);
+}
+
+static void DecodeWithCursor(const char *data, size_t size, DecodeTotals *totals) {
+	MPackCursor cursor = MPackCursorInit(data, size);
+	if (MPackCursorArray(&cursor) != 3 || MPackCursorInt(&cursor) != 2) {
+		return;
+	}
+	uint32_t name_length;
+	const char *name = MPackCursorStr(&cursor, &name_length);
+	if (!MPackStrEquals(name, name_length, "redraw")) {
+		return;
+	}
+
+	uint32_t event_count = MPackCursorArray(&cursor);
+	for (uint32_t i = 0; i < event_count && MPackCursorOk(&cursor); ++i) {
+		uint32_t event_length = MPackCursorArray(&cursor);
+		uint32_t event_name_length;
+		const char *event_name = MPackCursorStr(&cursor, &event_name_length);
+		uint32_t tuple_count = event_length - 1;
+		totals->events += tuple_count;
+
+		if (MPackStrEquals(event_name, event_name_length, "grid_line")) {
+			for (uint32_t j = 0; j < tuple_count; ++j) {
+				uint32_t param_count = MPackCursorArray(&cursor);
+				MPackCursorInt(&cursor);
+				uint64_t row = static_cast<uint64_t>(MPackCursorInt(&cursor));
+				uint64_t col = static_cast<uint64_t>(MPackCursorInt(&cursor));
+				totals->checksum += row * 131 + col;
+
+				uint32_t cell_count = MPackCursorArray(&cursor);
+				for (uint32_t k = 0; k < cell_count; ++k) {
+					uint32_t cell_length = MPackCursorArray(&cursor);
+					uint32_t text_length;
+					const char *text = MPackCursorStr(&cursor, &text_length);
+					uint64_t first = text_length ? static_cast<uint8_t>(text[0]) : 0;
+					uint64_t hl = cell_length > 1 ? static_cast<uint64_t>(MPackCursorInt(&cursor)) : 0;
+					uint64_t repeat = cell_length > 2 ? static_cast<uint64_t>(MPackCursorInt(&cursor)) : 1;
+					MPackCursorSkipN(&cursor, cell_length > 3 ? cell_length - 3 : 0);
+					totals->checksum += first * 31 + hl * 7 + repeat + text_length;
+					++totals->cells;
+				}
+				MPackCursorSkipN(&cursor, param_count - 4);
+			}
+		}
+		else if (MPackStrEquals(event_name, event_name_length, "grid_cursor_goto")) {
+			for (uint32_t j = 0; j < tuple_count; ++j) {
+				uint32_t param_count = MPackCursorArray(&cursor);
+				MPackCursorInt(&cursor);
+				uint64_t row = static_cast<uint64_t>(MPackCursorInt(&cursor));
+				uint64_t col = static_cast<uint64_t>(MPackCursorInt(&cursor));
+				totals->checksum += row * 3 + col;
+				MPackCursorSkipN(&cursor, param_count - 3);
+			}
+		}
+		else {
+			MPackCursorSkipN(&cursor, tuple_count);
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	int frames = BenchArgInt(argc, argv, "--frames", 50);
+	int rows = BenchArgInt(argc, argv, "--rows", 90);
+	int cols = BenchArgInt(argc, argv, "--cols", 300);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 5);
+
+	std::vector<char> stream;
+	const char *input = BenchArg(argc, argv, "--input");
+	if (input) {
+		if (!BenchReadFile(input, &stream)) {
+			fprintf(stderr, "Could not read %s\n", input);
+			return 1;
+		}
+		printf("stream: %s, %zu bytes\n", input, stream.size());
+	}
+	else {
+		BenchGenerateRepaintStream(&stream, frames, rows, cols, 6, BenchCellText::Ascii, 1);
+		printf("stream: %d synthetic %dx%d repaints, %zu bytes\n", frames, cols, rows, stream.size());
+	}
+
+	std::vector<BenchMessage> messages;
+	uint64_t frame_start = BenchNowNs();
+	if (!BenchFrameStream(stream, &messages)) {
+		fprintf(stderr, "Malformed msgpack stream\n");
+		return 1;
+	}
+	BenchReport("framing", BenchNowNs() - frame_start, messages.size(), stream.size());
+
+	DecodeTotals tree_totals {};
+	DecodeTotals cursor_totals {};
+	uint64_t tree_ns = UINT64_MAX;
+	uint64_t cursor_ns = UINT64_MAX;
+	for (int i = 0; i < iterations; ++i) {
+		tree_totals = {};
+		uint64_t start = BenchNowNs();
+		for (const BenchMessage &message : messages) {
+			DecodeWithTree(stream.data() + message.offset, message.size, &tree_totals);
+		}
+		uint64_t elapsed = BenchNowNs() - start;
+		tree_ns = elapsed < tree_ns ? elapsed : tree_ns;
+
+		cursor_totals = {};
+		start = BenchNowNs();
+		for (const BenchMessage &message : messages) {
+			DecodeWithCursor(stream.data() + message.offset, message.size, &cursor_totals);
+		}
+		elapsed = BenchNowNs() - start;
+		cursor_ns = elapsed < cursor_ns ? elapsed : cursor_ns;
+	}
+	BenchKeep(tree_totals.checksum + cursor_totals.checksum);
+
+	if (tree_totals.checksum != cursor_totals.checksum || tree_totals.cells != cursor_totals.cells) {
+		fprintf(stderr, "Decoders disagree: tree %llu/%llu cursor %llu/%llu\n",
+			static_cast<unsigned long long>(tree_totals.checksum), static_cast<unsigned long long>(tree_totals.cells),
+			static_cast<unsigned long long>(cursor_totals.checksum), static_cast<unsigned long long>(cursor_totals.cells));
+		return 1;
+	}
+
+	printf("%llu events, %llu cells (best of %d)\n", static_cast<unsigned long long>(cursor_totals.events),
+		static_cast<unsigned long long>(cursor_totals.cells), iterations);
+	BenchReport("mpack tree", tree_ns, tree_totals.events, stream.size());
+	BenchReport("cursor", cursor_ns, cursor_totals.events, stream.size());
+	printf("%-28s %10.1f ns/cell tree, %.1f ns/cell cursor, %.2fx faster\n", "per cell",
+		static_cast<double>(tree_ns) / static_cast<double>(tree_totals.cells),
+		static_cast<double>(cursor_ns) / static_cast<double>(cursor_totals.cells),
+		static_cast<double>(tree_ns) / static_cast<double>(cursor_ns));
+	return 0;
+}
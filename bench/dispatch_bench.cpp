@@ -0,0 +1,398 @@
+// Measures the cost of dispatching a redraw event by name: the prefix
+// strncmp chain RendererRedraw used to run, an exact compare chain, and
+// the compile-time perfect hash behind RedrawDispatch.
+//
+// Usage: dispatch_bench [--events=N] [--iterations=N]
+// The batch is a single redraw notification with one small parameter
+// tuple per event, mixing handled events with ones Nvy ignores.
+
+#include "bench_util.h"
+#include "nvim/redraw_events.h"
+
+// Events nvim sends that Nvy skips, so the chains also pay for misses
+constexpr const char *IGNORED_EVENT_NAMES[] {
+	"hl_group_set",
+	"win_viewport",
+	"msg_showmode",
+	"msg_ruler",
+	"mouse_on",
+	"mouse_off"
+};
+constexpr uint32_t IGNORED_EVENT_COUNT = sizeof(IGNORED_EVENT_NAMES) / sizeof(IGNORED_EVENT_NAMES[0]);
+
+static RedrawEvent PrefixChain(const char *name, uint32_t name_length) {
+	// Same match and order as the strncmp chain RendererRedraw used
+	const auto Is = [&](const char *event_name) {
+		return strncmp(name, event_name, name_length) == 0;
+	};
+	if (Is("option_set")) return RedrawEvent::option_set;
+	else if (Is("grid_resize")) return RedrawEvent::grid_resize;
+	else if (Is("grid_clear")) return RedrawEvent::grid_clear;
+	else if (Is("default_colors_set")) return RedrawEvent::default_colors_set;
+	else if (Is("hl_attr_define")) return RedrawEvent::hl_attr_define;
+	else if (Is("grid_line")) return RedrawEvent::grid_line;
+	else if (Is("grid_cursor_goto")) return RedrawEvent::grid_cursor_goto;
+	else if (Is("mode_info_set")) return RedrawEvent::mode_info_set;
+	else if (Is("mode_change")) return RedrawEvent::mode_change;
+	else if (Is("set_title")) return RedrawEvent::set_title;
+	else if (Is("busy_start")) return RedrawEvent::busy_start;
+	else if (Is("busy_stop")) return RedrawEvent::busy_stop;
+	else if (Is("grid_scroll")) return RedrawEvent::grid_scroll;
+	else if (Is("flush")) return RedrawEvent::flush;
+	return RedrawEvent::unknown;
+}
+
+static RedrawEvent ExactChain(const char *name, uint32_t name_length) {
+	for (uint32_t i = 0; i < REDRAW_EVENT_COUNT; ++i) {
+		if (MPackStrEquals(name, name_length, REDRAW_EVENT_NAMES[i])) {
+			return static_cast<RedrawEvent>(i);
+		}
+	}
+	return RedrawEvent::unknown;
+}
+
+// Writes one parameter tuple matching the schema of the event
+static void WriteTuple(mpack_writer_t *writer, RedrawEvent event, BenchRandom *random) {
+	switch (event) {
+	case RedrawEvent::option_set: {
+		mpack_start_array(writer, 2);
+		mpack_write_cstr(writer, "guifont");
+		mpack_write_cstr(writer, "Consolas:h14");
+		mpack_finish_array(writer);
+	} break;
+	case RedrawEvent::grid_resize: {
+		mpack_start_array(writer, 3);
+		mpack_write_int(writer, 1);
+		mpack_write_int(writer, 300);
+		mpack_write_int(writer, 90);
+		mpack_finish_array(writer);
+	} break;
+	case RedrawEvent::default_colors_set: {
+		mpack_start_array(writer, 5);
+		mpack_write_int(writer, 0xFFFFFF);
+		mpack_write_int(writer, 0x1E1E1E);
+		mpack_write_int(writer, 0xFF0000);
+		mpack_write_int(writer, 0);
+		mpack_write_int(writer, 0);
+		mpack_finish_array(writer);
+	} break;
+	case RedrawEvent::hl_attr_define: {
+		mpack_start_array(writer, 4);
+		mpack_write_int(writer, 1 + random->Below(200));
+		mpack_start_map(writer, 2);
+		mpack_write_cstr(writer, "foreground");
+		mpack_write_int(writer, random->Next() & 0xFFFFFF);
+		mpack_write_cstr(writer, "bold");
+		mpack_write_bool(writer, true);
+		mpack_finish_map(writer);
+		mpack_start_map(writer, 0);
+		mpack_finish_map(writer);
+		mpack_start_array(writer, 0);
+		mpack_finish_array(writer);
+		mpack_finish_array(writer);
+	} break;
+	case RedrawEvent::grid_line: {
+		mpack_start_array(writer, 4);
+		mpack_write_int(writer, 1);
+		mpack_write_int(writer, random->Below(90));
+		mpack_write_int(writer, random->Below(200));
+		mpack_start_array(writer, 2);
+		mpack_start_array(writer, 2);
+		mpack_write_cstr(writer, "x");
+		mpack_write_int(writer, 3);
+		mpack_finish_array(writer);
+		mpack_start_array(writer, 3);
+		mpack_write_cstr(writer, " ");
+		mpack_write_int(writer, 0);
+		mpack_write_int(writer, 4);
+		mpack_finish_array(writer);
+		mpack_finish_array(writer);
+		mpack_finish_array(writer);
+	} break;
+	case RedrawEvent::mode_info_set: {
+		mpack_start_array(writer, 2);
+		mpack_write_bool(writer, true);
+		mpack_start_array(writer, 1);
+		mpack_start_map(writer, 2);
+		mpack_write_cstr(writer, "cursor_shape");
+		mpack_write_cstr(writer, "block");
+		mpack_write_cstr(writer, "attr_id");
+		mpack_write_int(writer, 0);
+		mpack_finish_map(writer);
+		mpack_finish_array(writer);
+		mpack_finish_array(writer);
+	} break;
+	case RedrawEvent::mode_change: {
+		mpack_start_array(writer, 2);
+		mpack_write_cstr(writer, "normal");
+		mpack_write_int(writer, 0);
+		mpack_finish_array(writer);
+	} break;
+	case RedrawEvent::set_title: {
+		mpack_start_array(writer, 1);
+		mpack_write_cstr(writer, "main.cpp");
+		mpack_finish_array(writer);
+	} break;
+	case RedrawEvent::grid_scroll: {
+		mpack_start_array(writer, 7);
+		mpack_write_int(writer, 1);
+		mpack_write_int(writer, 0);
+		mpack_write_int(writer, 89);
+		mpack_write_int(writer, 0);
+		mpack_write_int(writer, 300);
+		mpack_write_int(writer, 1);
+		mpack_write_int(writer, 0);
+		mpack_finish_array(writer);
+	} break;
+	case RedrawEvent::grid_clear:
+	case RedrawEvent::grid_cursor_goto: {
+		mpack_start_array(writer, 3);
+		mpack_write_int(writer, 1);
+		mpack_write_int(writer, random->Below(90));
+		mpack_write_int(writer, random->Below(300));
+		mpack_finish_array(writer);
+	} break;
+	default: {
+		// busy_start, busy_stop, flush and the ignored events
+		mpack_start_array(writer, 0);
+		mpack_finish_array(writer);
+	} break;
+	}
+}
+
+// Counts what the dispatcher hands out, so the typed decode can't be optimized away
+struct CountingHandler {
+	uint64_t calls[REDRAW_EVENT_COUNT];
+	uint64_t checksum;
+
+	void OptionSet(const RedrawOptionSet *option_set) {
+		++calls[static_cast<int>(RedrawEvent::option_set)];
+		checksum += option_set->value_str_length;
+	}
+	void GridResize(const RedrawGridResize *grid_resize) {
+		++calls[static_cast<int>(RedrawEvent::grid_resize)];
+		checksum += grid_resize->width * grid_resize->height;
+	}
+	void GridClear(const RedrawGridClear *grid_clear) {
+		++calls[static_cast<int>(RedrawEvent::grid_clear)];
+		checksum += grid_clear->grid;
+	}
+	void DefaultColorsSet(const RedrawDefaultColorsSet *default_colors) {
+		++calls[static_cast<int>(RedrawEvent::default_colors_set)];
+		checksum += default_colors->rgb_bg;
+	}
+	void HlAttrDefine(const RedrawHlAttrDefine *hl_attr_define) {
+		++calls[static_cast<int>(RedrawEvent::hl_attr_define)];
+		checksum += hl_attr_define->attributes.foreground + hl_attr_define->attributes.flags;
+	}
+	void GridLine(RedrawGridLine *grid_line) {
+		++calls[static_cast<int>(RedrawEvent::grid_line)];
+		RedrawCell cell;
+		while (RedrawNextCell(&grid_line->cells, &cell)) {
+			checksum += static_cast<uint64_t>(cell.hl_id * 7 + cell.repeat);
+		}
+	}
+	void GridCursorGoto(const RedrawGridCursorGoto *cursor_goto) {
+		++calls[static_cast<int>(RedrawEvent::grid_cursor_goto)];
+		checksum += cursor_goto->row * 3 + cursor_goto->col;
+	}
+	void ModeInfoSet(RedrawModeInfoSet *mode_info_set) {
+		++calls[static_cast<int>(RedrawEvent::mode_info_set)];
+		RedrawModeInfo mode_info;
+		while (RedrawNextModeInfo(&mode_info_set->mode_infos, &mode_info)) {
+			checksum += mode_info.cursor_shape_length;
+		}
+	}
+	void ModeChange(const RedrawModeChange *mode_change) {
+		++calls[static_cast<int>(RedrawEvent::mode_change)];
+		checksum += mode_change->mode_index;
+	}
+	void SetTitle(const RedrawSetTitle *set_title) {
+		++calls[static_cast<int>(RedrawEvent::set_title)];
+		checksum += set_title->title_length;
+	}
+	void BusyStart() {
+		++calls[static_cast<int>(RedrawEvent::busy_start)];
+	}
+	void BusyStop() {
+		++calls[static_cast<int>(RedrawEvent::busy_stop)];
+	}
+	void GridScroll(const RedrawGridScroll *grid_scroll) {
+		++calls[static_cast<int>(RedrawEvent::grid_scroll)];
+		checksum += grid_scroll->rows;
+	}
+	void Flush() {
+		++calls[static_cast<int>(RedrawEvent::flush)];
+	}
+};
+
+struct EventName {
+	const char *name;
+	uint32_t length;
+};
+
+// The lookup has to be exact, a prefix or an extension of a name is not the event
+static bool CheckLookup() {
+	for (uint32_t i = 0; i < REDRAW_EVENT_COUNT; ++i) {
+		const char *name = REDRAW_EVENT_NAMES[i];
+		uint32_t length = static_cast<uint32_t>(strlen(name));
+		if (RedrawEventFromName(name, length) != static_cast<RedrawEvent>(i)) {
+			fprintf(stderr, "Lookup failed for %s\n", name);
+			return false;
+		}
+		if (RedrawEventFromName(name, length - 1) != RedrawEvent::unknown) {
+			fprintf(stderr, "Prefix of %s matched\n", name);
+			return false;
+		}
+		char extended[64];
+		snprintf(extended, sizeof(extended), "%s_", name);
+		if (RedrawEventFromName(extended, length + 1) != RedrawEvent::unknown) {
+			fprintf(stderr, "Extension of %s matched\n", name);
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < IGNORED_EVENT_COUNT; ++i) {
+		const char *name = IGNORED_EVENT_NAMES[i];
+		if (RedrawEventFromName(name, static_cast<uint32_t>(strlen(name))) != RedrawEvent::unknown) {
+			fprintf(stderr, "Ignored event %s matched\n", name);
+			return false;
+		}
+	}
+	return RedrawEventFromName("", 0) == RedrawEvent::unknown &&
+		RedrawEventFromName("f", 1) == RedrawEvent::unknown;
+}
+
+int main(int argc, char **argv) {
+	int event_count = BenchArgInt(argc, argv, "--events", 10000);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 200);
+	if (event_count <= 0 || iterations <= 0) {
+		fprintf(stderr, "--events and --iterations must be positive\n");
+		return 1;
+	}
+
+	if (!CheckLookup()) {
+		return 1;
+	}
+
+	// Roughly one in four events is one Nvy ignores
+	BenchRandom random { 1 };
+	std::vector<RedrawEvent> expected;
+	char *data;
+	size_t size;
+	mpack_writer_t writer;
+	mpack_writer_init_growable(&writer, &data, &size);
+	mpack_start_array(&writer, 3);
+	mpack_write_int(&writer, 2);
+	mpack_write_cstr(&writer, "redraw");
+	mpack_start_array(&writer, static_cast<uint32_t>(event_count));
+	for (int i = 0; i < event_count; ++i) {
+		uint32_t pick = random.Below(REDRAW_EVENT_COUNT + REDRAW_EVENT_COUNT / 3);
+		RedrawEvent event = pick < REDRAW_EVENT_COUNT ? static_cast<RedrawEvent>(pick) : RedrawEvent::unknown;
+		expected.push_back(event);
+		mpack_start_array(&writer, 2);
+		mpack_write_cstr(&writer, event == RedrawEvent::unknown ?
+			IGNORED_EVENT_NAMES[random.Below(IGNORED_EVENT_COUNT)] : REDRAW_EVENT_NAMES[pick]);
+		WriteTuple(&writer, event, &random);
+		mpack_finish_array(&writer);
+	}
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	if (mpack_writer_destroy(&writer) != mpack_ok) {
+		fprintf(stderr, "Failed to write the event batch\n");
+		return 1;
+	}
+	printf("batch: %d events, %zu bytes\n", event_count, size);
+
+	// Pull the names out of the batch, so the name lookups are timed on their own
+	std::vector<EventName> names;
+	MPackCursor cursor = MPackCursorInit(data, size);
+	MPackCursorArray(&cursor);
+	MPackCursorInt(&cursor);
+	MPackCursorSkip(&cursor);
+	uint32_t batch_length = MPackCursorArray(&cursor);
+	for (uint32_t i = 0; i < batch_length; ++i) {
+		uint32_t event_length = MPackCursorArray(&cursor);
+		EventName name;
+		name.name = MPackCursorStr(&cursor, &name.length);
+		names.push_back(name);
+		MPackCursorSkipN(&cursor, event_length - 1);
+	}
+	if (!MPackCursorOk(&cursor) || names.size() != expected.size()) {
+		fprintf(stderr, "Failed to read back the event batch\n");
+		MPACK_FREE(data);
+		return 1;
+	}
+
+	for (size_t i = 0; i < names.size(); ++i) {
+		RedrawEvent prefix = PrefixChain(names[i].name, names[i].length);
+		RedrawEvent exact = ExactChain(names[i].name, names[i].length);
+		RedrawEvent hashed = RedrawEventFromName(names[i].name, names[i].length);
+		if (prefix != expected[i] || exact != expected[i] || hashed != expected[i]) {
+			fprintf(stderr, "Dispatchers disagree on event %zu (%.*s)\n", i,
+				static_cast<int>(names[i].length), names[i].name);
+			MPACK_FREE(data);
+			return 1;
+		}
+	}
+
+	const auto Time = [&](auto lookup) {
+		uint64_t best = UINT64_MAX;
+		for (int i = 0; i < iterations; ++i) {
+			uint64_t sum = 0;
+			uint64_t start = BenchNowNs();
+			for (const EventName &name : names) {
+				sum += static_cast<uint64_t>(lookup(name.name, name.length));
+			}
+			uint64_t elapsed = BenchNowNs() - start;
+			BenchKeep(sum);
+			best = elapsed < best ? elapsed : best;
+		}
+		return best;
+	};
+	uint64_t prefix_ns = Time(PrefixChain);
+	uint64_t exact_ns = Time(ExactChain);
+	uint64_t hash_ns = Time(RedrawEventFromName);
+
+	// Full dispatch, including decoding every tuple into its typed arguments
+	uint64_t dispatch_ns = UINT64_MAX;
+	CountingHandler handler {};
+	for (int i = 0; i < iterations; ++i) {
+		handler = {};
+		MPackCursor params = MPackCursorInit(data, size);
+		uint64_t start = BenchNowNs();
+		MPackCursorArray(&params);
+		MPackCursorInt(&params);
+		MPackCursorSkip(&params);
+		bool ok = RedrawDispatch(&params, &handler);
+		uint64_t elapsed = BenchNowNs() - start;
+		if (!ok) {
+			fprintf(stderr, "RedrawDispatch failed on the event batch\n");
+			MPACK_FREE(data);
+			return 1;
+		}
+		dispatch_ns = elapsed < dispatch_ns ? elapsed : dispatch_ns;
+	}
+	BenchKeep(handler.checksum);
+	MPACK_FREE(data);
+
+	for (uint32_t i = 0; i < REDRAW_EVENT_COUNT; ++i) {
+		uint64_t expected_calls = 0;
+		for (RedrawEvent event : expected) {
+			expected_calls += event == static_cast<RedrawEvent>(i);
+		}
+		if (handler.calls[i] != expected_calls) {
+			fprintf(stderr, "RedrawDispatch called %s %llu times, expected %llu\n", REDRAW_EVENT_NAMES[i],
+				static_cast<unsigned long long>(handler.calls[i]), static_cast<unsigned long long>(expected_calls));
+			return 1;
+		}
+	}
+
+	printf("best of %d iterations\n", iterations);
+	BenchReport("strncmp prefix chain", prefix_ns, names.size(), 0);
+	BenchReport("exact compare chain", exact_ns, names.size(), 0);
+	BenchReport("perfect hash", hash_ns, names.size(), 0);
+	BenchReport("RedrawDispatch (decode)", dispatch_ns, names.size(), size);
+	printf("%-28s %10.2fx faster than the prefix chain\n", "perfect hash",
+		static_cast<double>(prefix_ns) / static_cast<double>(hash_ns ? hash_ns : 1));
+	return 0;
+}
@@ -0,0 +1,300 @@
+// Checks the frame scheduler against a fake clock and compares the frames
+// and latency of each policy with drawing every flush, as Nvy did before.
+//
+// Every scenario is a list of times nvim's flushes arrive at, replayed
+// through a model of the render thread: a flush is applied when it
+// arrives, or once the frame being drawn is finished, and the scheduler
+// either draws at once or has the thread wait until the frame is due.
+// Timed waits end on the first tick of the system timer at or after they
+// are due, drawing takes a fixed time.
+// Both are replayed with a 1 ms timer, as with timeBeginPeriod(1), and
+// with Windows' default of 15.625 ms.
+//
+// The check replays every scenario, and random ones, under every policy.
+// It verifies that every flush ends up in a frame and none is left
+// pending, that frames start at least an interval apart, that no flush
+// waits longer than an interval and a timer tick, and that a flush after
+// an idle interval is drawn at once, except under PowerSave.
+//
+// Usage: frame_scheduler_bench [--draw-us=N] [--refresh-hz=N] [--max-fps=N]
+// Exits with 1 if a check fails.
+
+#include <cinttypes>
+#include "bench_util.h"
+#include "renderer/frame_scheduler.h"
+
+constexpr uint64_t MS = 1000000;
+constexpr uint64_t NEVER = UINT64_MAX;
+
+struct Scenario {
+	const char *name;
+	void (*generate)(BenchRandom *random, std::vector<uint64_t> *flushes);
+};
+
+// :terminal output, a flush every 200 us for 2 s
+static void TerminalFlood(BenchRandom *, std::vector<uint64_t> *flushes) {
+	for (uint64_t t = 0; t < 2000 * MS; t += MS / 5) {
+		flushes->push_back(t);
+	}
+}
+
+// Key repeat scrolling a buffer, 3 flushes a key 1 ms apart at 30 keys/s
+static void FastScroll(BenchRandom *, std::vector<uint64_t> *flushes) {
+	for (uint64_t key = 0; key < 90; ++key) {
+		for (uint64_t i = 0; i < 3; ++i) {
+			flushes->push_back(key * 33 * MS + i * MS);
+		}
+	}
+}
+
+// A flush per keystroke, 80 to 250 ms apart
+static void Typing(BenchRandom *random, std::vector<uint64_t> *flushes) {
+	uint64_t t = 0;
+	for (int i = 0; i < 100; ++i) {
+		t += (80 + random->Below(170)) * MS;
+		flushes->push_back(t);
+	}
+}
+
+// Bursts and pauses of any length
+static void Mixed(BenchRandom *random, std::vector<uint64_t> *flushes) {
+	uint64_t t = 0;
+	for (int i = 0; i < 2000; ++i) {
+		uint32_t kind = random->Below(10);
+		t += kind < 6 ? random->Below(static_cast<uint32_t>(MS)) : kind < 9 ? random->Below(20 * MS) : random->Below(300 * MS);
+		flushes->push_back(t);
+	}
+}
+
+static const Scenario SCENARIOS[] {
+	{ "terminal flood", TerminalFlood },
+	{ "fast scroll", FastScroll },
+	{ "typing", Typing },
+	{ "mixed", Mixed },
+};
+
+struct ReplayResult {
+	uint64_t frames;
+	uint64_t flushes_drawn;
+	uint64_t total_latency_ns;
+	uint64_t max_latency_ns;
+	uint64_t end_ns;
+};
+
+// When a wait for due_ns started at now_ns ends, rounded up to whole
+// milliseconds as the render thread's timed wait on the snapshot channel
+// takes them
+static uint64_t TimerFires(uint64_t now_ns, uint64_t due_ns, uint64_t resolution_ns) {
+	uint64_t delay_ms = due_ns > now_ns ? (due_ns - now_ns + MS - 1) / MS : 0;
+	uint64_t fires = now_ns + delay_ms * MS;
+	return (fires + resolution_ns - 1) / resolution_ns * resolution_ns;
+}
+
+// Replays flushes the way the render thread handles them, checking every
+// frame as it goes. Returns false on the first check that fails.
+static bool Replay(FrameScheduler *scheduler, const std::vector<uint64_t> &flushes, uint64_t draw_ns,
+	uint64_t resolution_ns, ReplayResult *result) {
+	*result = ReplayResult {};
+	uint64_t now = 0;
+	uint64_t timer = NEVER;
+	// Bounds for the check, see the top
+	uint64_t last_start = 0;
+	bool drawn = false;
+	uint64_t max_wait = scheduler->interval_ns + resolution_ns + MS;
+
+	auto draw = [&]() {
+		uint32_t pending = scheduler->pending_flushes;
+		uint64_t waited = now - scheduler->pending_since_ns;
+		if (drawn && now - last_start < scheduler->interval_ns) {
+			fprintf(stderr, "frame at %" PRIu64 " us, %" PRIu64 " us after the last\n", now / 1000,
+				(now - last_start) / 1000);
+			return false;
+		}
+		if (waited > max_wait) {
+			fprintf(stderr, "frame at %" PRIu64 " us drew a flush %" PRIu64 " us late\n", now / 1000, waited / 1000);
+			return false;
+		}
+		FrameSchedulerFrameDrawn(scheduler, now, now + draw_ns);
+		result->frames += 1;
+		result->flushes_drawn += pending;
+		result->total_latency_ns += waited;
+		result->max_latency_ns = waited > result->max_latency_ns ? waited : result->max_latency_ns;
+		drawn = true;
+		last_start = now;
+		now += draw_ns;
+		timer = NEVER;
+		return true;
+	};
+
+	size_t next = 0;
+	while (next < flushes.size() || timer != NEVER) {
+		uint64_t arrival = next < flushes.size() ? flushes[next] : NEVER;
+		if (arrival <= timer) {
+			now = arrival > now ? arrival : now;
+			++next;
+			bool idle = scheduler->pending_flushes == 0 && (!drawn || now - last_start >= scheduler->interval_ns) &&
+				scheduler->policy != FramePolicy::PowerSave;
+			if (FrameSchedulerFlush(scheduler, now)) {
+				if (!draw()) {
+					return false;
+				}
+			}
+			else if (idle) {
+				fprintf(stderr, "flush at %" PRIu64 " us after an idle interval waited\n", now / 1000);
+				return false;
+			}
+			else if (scheduler->pending_flushes == 1) {
+				timer = TimerFires(now, scheduler->due_ns, resolution_ns);
+			}
+			continue;
+		}
+
+		now = timer > now ? timer : now;
+		timer = NEVER;
+		if (FrameSchedulerTick(scheduler, now)) {
+			if (!draw()) {
+				return false;
+			}
+		}
+		else if (scheduler->pending_flushes) {
+			timer = TimerFires(now, scheduler->due_ns, resolution_ns);
+		}
+	}
+	result->end_ns = now;
+
+	if (scheduler->pending_flushes != 0 || result->flushes_drawn != flushes.size()) {
+		fprintf(stderr, "%" PRIu64 " of %zu flushes drawn, %u pending\n", result->flushes_drawn, flushes.size(),
+			scheduler->pending_flushes);
+		return false;
+	}
+	return true;
+}
+
+// Every flush drawn as it is handled, frames queue up behind each other
+static void ReplayUnpaced(const std::vector<uint64_t> &flushes, uint64_t draw_ns, ReplayResult *result) {
+	*result = ReplayResult {};
+	uint64_t now = 0;
+	for (uint64_t arrival : flushes) {
+		now = arrival > now ? arrival : now;
+		uint64_t waited = now - arrival;
+		result->total_latency_ns += waited;
+		result->max_latency_ns = waited > result->max_latency_ns ? waited : result->max_latency_ns;
+		++result->frames;
+		++result->flushes_drawn;
+		now += draw_ns;
+	}
+	result->end_ns = now;
+}
+
+static const struct {
+	const char *name;
+	FramePolicy policy;
+} POLICIES[] {
+	{ "low-latency", FramePolicy::LowLatency },
+	{ "max-fps", FramePolicy::Capped },
+	{ "power-save", FramePolicy::PowerSave },
+};
+static const uint64_t TIMER_RESOLUTIONS[] { MS, 15625000 };
+
+static bool Check() {
+	BenchRandom random { 47 };
+	int replays = 0;
+	uint64_t frames = 0;
+	for (int round = 0; round < 200; ++round) {
+		std::vector<uint64_t> flushes;
+		const Scenario *scenario = &SCENARIOS[round % (sizeof(SCENARIOS) / sizeof(SCENARIOS[0]))];
+		scenario->generate(&random, &flushes);
+		uint32_t refresh_hz = round % 3 ? 60 : 30 + random.Below(220);
+		uint32_t max_fps = random.Below(4) ? 1 + random.Below(240) : 0;
+		uint64_t draw_ns = random.Below(static_cast<uint32_t>(30 * MS));
+		for (const auto &policy : POLICIES) {
+			for (uint64_t resolution_ns : TIMER_RESOLUTIONS) {
+				FrameScheduler scheduler;
+				FrameSchedulerInitialize(&scheduler, policy.policy, max_fps);
+				FrameSchedulerSetRefreshRate(&scheduler, refresh_hz);
+				ReplayResult result;
+				if (!Replay(&scheduler, flushes, draw_ns, resolution_ns, &result)) {
+					fprintf(stderr, "%s, %s at %u Hz capped at %u fps, drawing for %" PRIu64 " us, %" PRIu64 " us timer\n",
+						scenario->name, policy.name, refresh_hz, max_fps, draw_ns / 1000, resolution_ns / 1000);
+					printf("check: FAILED\n");
+					return false;
+				}
+				if (scheduler.stats.frames != result.frames || scheduler.stats.flushes != flushes.size() ||
+					scheduler.stats.flushes != result.frames + scheduler.stats.flushes_coalesced) {
+					fprintf(stderr, "%s, %s: stats don't add up\n", scenario->name, policy.name);
+					printf("check: FAILED\n");
+					return false;
+				}
+				frames += result.frames;
+				++replays;
+			}
+		}
+	}
+	printf("check: ok, %d replays, %" PRIu64 " frames\n", replays, frames);
+	return true;
+}
+
+static void PrintResult(const char *name, const ReplayResult *result, uint64_t flushes) {
+	double seconds = static_cast<double>(result->end_ns) / 1e9;
+	printf("    %-28s %6" PRIu64 " frames for %6" PRIu64 " flushes, %7.1f fps, latency mean %7.2f ms max %8.2f ms\n", name,
+		result->frames, flushes, seconds > 0.0 ? static_cast<double>(result->frames) / seconds : 0.0,
+		result->frames ? static_cast<double>(result->total_latency_ns) / static_cast<double>(result->frames) / 1e6 : 0.0,
+		static_cast<double>(result->max_latency_ns) / 1e6);
+}
+
+static void Measure(uint64_t draw_ns, uint32_t refresh_hz, uint32_t max_fps) {
+	printf("%u Hz, max-fps %u, %.2f ms a frame, latency from a frame's first flush\n", refresh_hz, max_fps,
+		static_cast<double>(draw_ns) / 1e6);
+	BenchRandom random { 53 };
+	for (const Scenario &scenario : SCENARIOS) {
+		std::vector<uint64_t> flushes;
+		scenario.generate(&random, &flushes);
+		printf("  %s\n", scenario.name);
+
+		ReplayResult result;
+		ReplayUnpaced(flushes, draw_ns, &result);
+		PrintResult("every flush", &result, flushes.size());
+		for (const auto &policy : POLICIES) {
+			for (uint64_t resolution_ns : TIMER_RESOLUTIONS) {
+				FrameScheduler scheduler;
+				FrameSchedulerInitialize(&scheduler, policy.policy, max_fps);
+				FrameSchedulerSetRefreshRate(&scheduler, refresh_hz);
+				Replay(&scheduler, flushes, draw_ns, resolution_ns, &result);
+				char name[64];
+				snprintf(name, sizeof(name), "%s, %.1f ms timer", policy.name, static_cast<double>(resolution_ns) / 1e6);
+				PrintResult(name, &result, flushes.size());
+			}
+		}
+	}
+
+	// What deciding costs the render thread per flush
+	std::vector<uint64_t> flood;
+	TerminalFlood(&random, &flood);
+	FrameScheduler scheduler;
+	FrameSchedulerInitialize(&scheduler, FramePolicy::LowLatency, 0);
+	uint64_t start = BenchNowNs();
+	for (uint64_t t : flood) {
+		if (FrameSchedulerFlush(&scheduler, t)) {
+			FrameSchedulerFrameDrawn(&scheduler, t, t);
+		}
+	}
+	uint64_t elapsed = BenchNowNs() - start;
+	BenchKeep(scheduler.stats.frames);
+	BenchReport("  schedule a flush", elapsed, flood.size(), 0);
+}
+
+int main(int argc, char **argv) {
+	int draw_us = BenchArgInt(argc, argv, "--draw-us", 4000);
+	int refresh_hz = BenchArgInt(argc, argv, "--refresh-hz", 60);
+	int max_fps = BenchArgInt(argc, argv, "--max-fps", 30);
+	if (draw_us < 0 || refresh_hz <= 0 || max_fps < 0) {
+		fprintf(stderr, "usage: frame_scheduler_bench [--draw-us=N] [--refresh-hz=N] [--max-fps=N]\n");
+		return 2;
+	}
+
+	if (!Check()) {
+		return 1;
+	}
+	Measure(static_cast<uint64_t>(draw_us) * 1000, static_cast<uint32_t>(refresh_hz), static_cast<uint32_t>(max_fps));
+	return 0;
+}
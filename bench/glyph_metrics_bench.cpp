@@ -0,0 +1,190 @@
+// Checks and measures the per cell font metrics table against a stub
+// source standing in for DirectWrite, which makes up metrics from the cell
+// and counts how often it is asked.
+//
+// The check looks up random ASCII, CJK and surrogate pair cells, enough of
+// the latter for the hash table to grow several times, and verifies every
+// value and that the source is asked once per cell and font. Then it
+// invalidates the table, as a font change does, and checks again.
+//
+// Usage: glyph_metrics_bench [--rows=N] [--iterations=N]
+// Exits with 1 if a lookup disagrees with the source.
+
+#include "bench_util.h"
+#include "renderer/glyph_metrics.h"
+
+constexpr int COLS = 200;
+
+struct StubFont {
+	// Stands in for the font size, changes every value
+	uint32_t generation;
+	uint64_t advances_measured;
+	uint64_t glyph_indices_looked_up;
+	// Calls per cell and kind, to catch repeated questions
+	std::vector<uint8_t> asked;
+	bool asked_twice;
+};
+
+static size_t AskedIndex(uint32_t cell, int kind) {
+	// BMP cells, then surrogate pairs by their low 16 bits of each half
+	size_t index = cell < 0x10000 ? cell : 0x10000 + ((cell >> 16) & 0x3FF) * 0x400 + (cell & 0x3FF);
+	return index * 2 + kind;
+}
+
+static void Ask(StubFont *font, uint32_t cell, int kind) {
+	uint8_t *asked = &font->asked[AskedIndex(cell, kind)];
+	font->asked_twice |= *asked != 0;
+	*asked = 1;
+}
+
+static float StubAdvance(uint32_t generation, uint32_t cell) {
+	return static_cast<float>((cell * 2654435761u + generation) % 1000) / 64.0f;
+}
+
+static uint16_t StubGlyphIndex(uint32_t generation, uint32_t cell) {
+	// Every seventh cell is missing from the font
+	return (cell + generation) % 7 ? static_cast<uint16_t>(1 + (cell + generation) % 60000) : 0;
+}
+
+static float MeasureAdvance(void *context, uint32_t cell) {
+	StubFont *font = static_cast<StubFont *>(context);
+	++font->advances_measured;
+	Ask(font, cell, 0);
+	return StubAdvance(font->generation, cell);
+}
+
+static uint16_t LookupGlyphIndex(void *context, uint32_t cell) {
+	StubFont *font = static_cast<StubFont *>(context);
+	++font->glyph_indices_looked_up;
+	Ask(font, cell, 1);
+	return StubGlyphIndex(font->generation, cell);
+}
+
+static uint32_t RandomCell(BenchRandom *random) {
+	switch (random->Below(4)) {
+	case 0: {
+		return ' ' + random->Below(95);
+	}
+	case 1: {
+		return 0x4E00 + random->Below(0x5200);
+	}
+	case 2: {
+		return random->Below(0x10000);
+	}
+	default: {
+		return (0xD800 + random->Below(0x400)) << 16 | (0xDC00 + random->Below(0x400));
+	}
+	}
+}
+
+static bool CheckRound(GlyphMetrics *metrics, StubFont *font, BenchRandom *random, int lookups) {
+	for (int i = 0; i < lookups; ++i) {
+		uint32_t cell = RandomCell(random);
+		if (random->Below(2)) {
+			float advance = GlyphMetricsAdvance(metrics, cell);
+			if (advance != StubAdvance(font->generation, cell)) {
+				fprintf(stderr, "cell %08x: advance %f, expected %f\n", cell, advance, StubAdvance(font->generation, cell));
+				return false;
+			}
+		}
+		else {
+			uint16_t glyph_index = GlyphMetricsGlyphIndex(metrics, cell);
+			if (glyph_index != StubGlyphIndex(font->generation, cell)) {
+				fprintf(stderr, "cell %08x: glyph %u, expected %u\n", cell, glyph_index, StubGlyphIndex(font->generation, cell));
+				return false;
+			}
+		}
+	}
+	if (font->asked_twice) {
+		fprintf(stderr, "the source was asked about a cell twice\n");
+		return false;
+	}
+	return true;
+}
+
+static bool Check() {
+	StubFont font {};
+	font.asked.assign(AskedIndex(0xDBFFDFFF, 1) + 1, 0);
+	GlyphMetrics *metrics = new GlyphMetrics;
+	GlyphMetricsInitialize(metrics, GlyphMetricsSource { &font, MeasureAdvance, LookupGlyphIndex });
+	BenchRandom random { 16 };
+
+	bool ok = CheckRound(metrics, &font, &random, 1000000);
+	uint64_t first_asked = font.advances_measured + font.glyph_indices_looked_up;
+	uint32_t astral_capacity = metrics->astral_capacity;
+
+	// A new font size, everything is asked again
+	GlyphMetricsInvalidate(metrics);
+	++font.generation;
+	font.asked.assign(font.asked.size(), 0);
+	ok = ok && CheckRound(metrics, &font, &random, 1000000);
+
+	printf("check: %s, %llu lookups, %llu then %llu cells asked, %u astral slots\n", ok ? "ok" : "FAILED",
+		static_cast<unsigned long long>(metrics->stats.lookups), static_cast<unsigned long long>(first_asked),
+		static_cast<unsigned long long>(font.advances_measured + font.glyph_indices_looked_up - first_asked),
+		astral_capacity);
+	GlyphMetricsShutdown(metrics);
+	delete metrics;
+	return ok;
+}
+
+// Rows as the renderer walks them: a glyph lookup per ASCII cell, and an
+// advance per other cell and per ASCII cell missing from the font
+static void Measure(int rows, int iterations) {
+	StubFont font {};
+	font.asked.assign(AskedIndex(0xDBFFDFFF, 1) + 1, 0);
+	BenchRandom random { 17 };
+	std::vector<uint32_t> cells(static_cast<size_t>(rows) * COLS);
+	const struct {
+		const char *name;
+		uint32_t (*cell)(BenchRandom *random);
+	} texts[] {
+		{ "ascii", [](BenchRandom *random) { return ' ' + random->Below(95); } },
+		{ "cjk", [](BenchRandom *random) { return 0x4E00 + random->Below(0x200); } },
+		{ "emoji", [](BenchRandom *random) { return 0xD83DDE00 + random->Below(0x50); } },
+	};
+
+	GlyphMetrics *metrics = new GlyphMetrics;
+	for (const auto &text : texts) {
+		for (uint32_t &cell : cells) {
+			cell = text.cell(&random);
+		}
+
+		GlyphMetricsInitialize(metrics, GlyphMetricsSource { &font, MeasureAdvance, LookupGlyphIndex });
+		uint64_t best_ns = UINT64_MAX;
+		float sum = 0.0f;
+		for (int i = 0; i < iterations; ++i) {
+			uint64_t start = BenchNowNs();
+			for (uint32_t cell : cells) {
+				if (cell > 0xFF || !GlyphMetricsInPrimaryFont(metrics, cell)) {
+					sum += GlyphMetricsAdvance(metrics, cell);
+				}
+			}
+			uint64_t elapsed = BenchNowNs() - start;
+			best_ns = elapsed < best_ns ? elapsed : best_ns;
+		}
+		BenchKeep(static_cast<uint64_t>(sum));
+
+		char name[64];
+		snprintf(name, sizeof(name), "  %s", text.name);
+		BenchReport(name, best_ns, cells.size(), 0);
+		printf("    %llu of %llu lookups asked the font\n", static_cast<unsigned long long>(metrics->stats.measured),
+			static_cast<unsigned long long>(metrics->stats.lookups));
+		GlyphMetricsShutdown(metrics);
+	}
+	delete metrics;
+}
+
+int main(int argc, char **argv) {
+	int rows = BenchArgInt(argc, argv, "--rows", 1000);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 5);
+	if (rows <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: glyph_metrics_bench [--rows=N] [--iterations=N]\n");
+		return 2;
+	}
+
+	bool ok = Check();
+	printf("\n%d rows of %d cells, ns/event per cell\n", rows, COLS);
+	Measure(rows, iterations);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,311 @@
+// Checks the glyph runs of rows drawn without a text layout against a per
+// cell reference and the GSUB feature check against tables made up for
+// it, then measures scanning and building rows with the glyph table
+// against looking every cell up in the font metrics.
+//
+// The check builds random rows of random lengths, with highlights drawn
+// plain, bold, italic or decorated, wide cells and cells outside printable
+// ASCII mixed in at different rates. A row must be drawn directly exactly
+// when it has none of those, and then come out as one glyph run per style,
+// blank runs left out, with the font's glyphs and advances of a cell.
+//
+// Usage: glyph_row_bench [--rows=N] [--iterations=N]
+// Exits with 1 if a row or a table is classified or built wrong.
+
+#include "bench_util.h"
+#include "common/transcode.h"
+#include "renderer/glyph_row.h"
+#include "renderer/grid.h"
+
+constexpr int COLS = 200;
+constexpr int HIGHLIGHTS = 64;
+constexpr TranscodeScanRules SCAN_RULES { 0x20, 0x5F, GRID_CELL_WIDE };
+
+struct TestRow {
+	std::vector<uint32_t> chars;
+	std::vector<uint16_t> hl_ids;
+	std::vector<uint8_t> flags;
+	std::vector<uint32_t> run_starts;
+	std::vector<uint64_t> special;
+	size_t run_count;
+	// What GlyphRowBuild made of it
+	std::vector<uint16_t> glyph_indices;
+	std::vector<GlyphRowRun> glyph_runs;
+	int glyph_run_count;
+};
+
+// Highlights of four colors, decorated at the rate given in percent
+static void DefineHighlights(HighlightAttributes *hl_attribs, StyleTable *styles, BenchRandom *random,
+	uint32_t decorated_chance) {
+	const uint16_t decorations[] { HL_ATTRIB_BOLD, HL_ATTRIB_ITALIC, HL_ATTRIB_UNDERLINE, HL_ATTRIB_STRIKETHROUGH };
+	BenchDefineHighlights(hl_attribs, styles, HIGHLIGHTS, 4, decorations, 4, decorated_chance, random);
+}
+
+static void ScanRow(TestRow *row) {
+	size_t cols = row->chars.size();
+	row->run_starts.resize(cols);
+	row->special.resize((cols + 63) / 64);
+	row->glyph_indices.resize(cols);
+	row->glyph_runs.resize(cols);
+	row->run_count = TranscodeScanRow(row->chars.data(), row->hl_ids.data(), row->flags.data(), cols,
+		&SCAN_RULES, row->run_starts.data(), row->special.data());
+}
+
+// Text with indentation and runs of blanks, a special cell at the rate
+// given in tenths of a percent
+static void RandomRow(TestRow *row, BenchRandom *random, int cols, uint32_t special_chance, int hl_ids) {
+	row->chars.resize(cols);
+	row->hl_ids.resize(cols);
+	row->flags.assign(cols, 0);
+	uint16_t hl_id = 0;
+	bool blank = true;
+	for (int col = 0; col < cols; ++col) {
+		if (random->Below(6) == 0) {
+			hl_id = static_cast<uint16_t>(random->Below(hl_ids));
+			blank = random->Below(3) == 0;
+		}
+		row->hl_ids[col] = hl_id;
+		row->chars[col] = blank ? ' ' : ' ' + random->Below(95);
+		if (random->Below(1000) < special_chance) {
+			const uint32_t specials[] { 0, 0x1F, 0x7F, 0xE9, 0x4E00, 0xD83DDE00 };
+			row->chars[col] = specials[random->Below(6)];
+			row->flags[col] = random->Below(2) ? GRID_CELL_WIDE : 0;
+		}
+	}
+	ScanRow(row);
+}
+
+static bool BuildRow(const GlyphRow *glyph_row, StyleTable *styles, TestRow *row) {
+	return GlyphRowBuild(glyph_row, styles, row->chars.data(), row->hl_ids.data(), row->special.data(),
+		row->run_starts.data(), row->run_count, static_cast<int>(row->chars.size()), row->glyph_indices.data(),
+		row->glyph_runs.data(), &row->glyph_run_count);
+}
+
+static bool CheckRow(const GlyphRow *glyph_row, StyleTable *styles, const TestRow *row, bool built) {
+	int cols = static_cast<int>(row->chars.size());
+	bool expected_direct = glyph_row->enabled && cols <= glyph_row->capacity;
+	for (int col = 0; col < cols; ++col) {
+		const HighlightStyle *style = StyleTableGet(styles, row->hl_ids[col]);
+		expected_direct = expected_direct && row->chars[col] >= 0x20 && row->chars[col] < 0x7F &&
+			!(row->flags[col] & GRID_CELL_WIDE) && style->font_weight == STYLE_FONT_WEIGHT_NORMAL &&
+			style->font_style == STYLE_FONT_STYLE_NORMAL && style->decorations == 0;
+	}
+	if (built != expected_direct) {
+		fprintf(stderr, "a row of %d cells is %s instead of %s\n", cols, built ? "direct" : "laid out",
+			expected_direct ? "direct" : "laid out");
+		return false;
+	}
+	if (!built) {
+		return true;
+	}
+
+	int run = 0;
+	for (int col = 0; col < cols;) {
+		uint16_t style_id = StyleTableStyleId(styles, row->hl_ids[col]);
+		int end = col + 1;
+		bool blank = row->chars[col] == ' ';
+		while (end < cols && StyleTableStyleId(styles, row->hl_ids[end]) == style_id) {
+			blank = blank && row->chars[end] == ' ';
+			++end;
+		}
+		if (!blank) {
+			const GlyphRowRun *built_run = &row->glyph_runs[run];
+			if (run >= row->glyph_run_count || built_run->col_begin != col || built_run->col_end != end ||
+				built_run->style_id != style_id) {
+				fprintf(stderr, "glyph run %d of a row of %d cells should be %d-%d in style %u\n", run, cols,
+					col, end, style_id);
+				return false;
+			}
+			++run;
+		}
+		col = end;
+	}
+	if (run != row->glyph_run_count) {
+		fprintf(stderr, "a row of %d cells has %d glyph runs instead of %d\n", cols, row->glyph_run_count, run);
+		return false;
+	}
+	for (int col = 0; col < cols; ++col) {
+		if (row->glyph_indices[col] != BenchStubGlyphIndex(nullptr, row->chars[col]) ||
+			glyph_row->advances[col] != BENCH_STUB_ADVANCE) {
+			fprintf(stderr, "cell %d of a row of %d cells has glyph %u advancing %f\n", col, cols,
+				row->glyph_indices[col], glyph_row->advances[col]);
+			return false;
+		}
+	}
+	return true;
+}
+
+// A GSUB table with just a feature list, the offsets of all features 0
+static std::vector<uint8_t> MakeGsub(std::initializer_list<const char *> tags, uint16_t major_version = 1) {
+	std::vector<uint8_t> gsub { 0, static_cast<uint8_t>(major_version), 0, 0, 0, 10, 0, 10, 0, 0 };
+	gsub.push_back(0);
+	gsub.push_back(static_cast<uint8_t>(tags.size()));
+	for (const char *tag : tags) {
+		gsub.insert(gsub.end(), tag, tag + 4);
+		gsub.insert(gsub.end(), { 0, 0 });
+	}
+	return gsub;
+}
+
+static bool CheckGsub() {
+	const struct {
+		std::vector<uint8_t> gsub;
+		size_t truncate;
+		bool substitutes;
+		bool substitutes_without_liga;
+	} cases[] {
+		{ MakeGsub({}), 0, false, false },
+		{ MakeGsub({ "ccmp", "locl", "frac", "ss01" }), 0, false, false },
+		{ MakeGsub({ "ccmp", "liga" }), 0, true, false },
+		{ MakeGsub({ "kern", "calt" }), 0, true, true },
+		{ MakeGsub({ "rlig" }), 0, true, true },
+		{ MakeGsub({ "ccmp", "locl" }), 3, true, true },
+		{ MakeGsub({ "ccmp" }, 2), 0, true, true },
+		{ { 0, 1, 0, 0, 0, 10, 0, 0, 0, 0 }, 0, false, false },
+		{ { 0, 1, 0 }, 0, true, true },
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		size_t size = cases[i].gsub.size() - cases[i].truncate;
+		bool substitutes = GlyphRowFontSubstitutes(cases[i].gsub.data(), size, true);
+		bool substitutes_without_liga = GlyphRowFontSubstitutes(cases[i].gsub.data(), size, false);
+		if (substitutes != cases[i].substitutes || substitutes_without_liga != cases[i].substitutes_without_liga) {
+			fprintf(stderr, "GSUB table %zu is taken for %s\n", i, substitutes ? "substituting" : "plain");
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool Check() {
+	BenchRandom random { 31 };
+	std::vector<HighlightAttributes> hl_attribs(STYLE_TABLE_HIGHLIGHTS);
+	StyleTable *styles = new StyleTable;
+	GlyphMetrics *metrics = new GlyphMetrics;
+	GlyphRow glyph_row;
+	GlyphRowInitialize(&glyph_row);
+	bool ok = StyleTableInitialize(styles, hl_attribs.data()) && GlyphRowReserve(&glyph_row, 250);
+	GlyphMetricsInitialize(metrics, GlyphMetricsSource { nullptr, BenchStubAdvance, BenchStubGlyphIndex });
+	GlyphRowSetFont(&glyph_row, metrics, BENCH_STUB_ADVANCE, true);
+
+	TestRow row;
+	int rows = 0;
+	uint64_t rows_direct = 0;
+	uint64_t glyph_runs = 0;
+	for (int round = 0; ok && round < 200; ++round) {
+		DefineHighlights(hl_attribs.data(), styles, &random, round % 3 == 0 ? 0 : 10);
+		// Fonts that need shaping are never drawn directly
+		GlyphRowSetFont(&glyph_row, metrics, BENCH_STUB_ADVANCE, round % 7 != 0);
+		for (int i = 0; ok && i < 50; ++i) {
+			int cols = 1 + static_cast<int>(random.Below(260));
+			uint32_t special_chance = random.Below(3) == 0 ? 0 : random.Below(20);
+			RandomRow(&row, &random, cols, special_chance, 1 + random.Below(HIGHLIGHTS - 1));
+			bool built = BuildRow(&glyph_row, styles, &row);
+			ok = CheckRow(&glyph_row, styles, &row, built);
+			++rows;
+			rows_direct += built;
+			glyph_runs += row.glyph_run_count;
+		}
+	}
+	ok = ok && CheckGsub();
+
+	printf("check: %s, %d rows, %llu drawn directly in %llu glyph runs, %llu laid out\n", ok ? "ok" : "FAILED",
+		rows, static_cast<unsigned long long>(rows_direct), static_cast<unsigned long long>(glyph_runs),
+		static_cast<unsigned long long>(rows - rows_direct));
+	GlyphRowShutdown(&glyph_row);
+	GlyphMetricsShutdown(metrics);
+	StyleTableShutdown(styles);
+	delete metrics;
+	delete styles;
+	return ok;
+}
+
+static void Measure(int rows, int iterations) {
+	BenchRandom random { 37 };
+	std::vector<HighlightAttributes> hl_attribs(STYLE_TABLE_HIGHLIGHTS);
+	StyleTable *styles = new StyleTable;
+	GlyphMetrics *metrics = new GlyphMetrics;
+	GlyphRow glyph_row;
+	GlyphRowInitialize(&glyph_row);
+	if (!StyleTableInitialize(styles, hl_attribs.data()) || !GlyphRowReserve(&glyph_row, COLS)) {
+		fprintf(stderr, "out of memory\n");
+		return;
+	}
+	GlyphMetricsInitialize(metrics, GlyphMetricsSource { nullptr, BenchStubAdvance, BenchStubGlyphIndex });
+	GlyphRowSetFont(&glyph_row, metrics, BENCH_STUB_ADVANCE, true);
+	std::vector<uint16_t> glyph_indices(COLS);
+
+	// Plain highlights and ASCII text, then a bold keyword or a non-ASCII
+	// character in a few rows, then in many
+	const struct {
+		const char *name;
+		uint32_t decorated_chance;
+		uint32_t special_chance;
+	} texts[] {
+		{ "plain", 0, 0 },
+		{ "some bold", 2, 1 },
+		{ "much bold", 20, 5 },
+	};
+	std::vector<TestRow> test_rows(rows);
+	for (const auto &text : texts) {
+		DefineHighlights(hl_attribs.data(), styles, &random, text.decorated_chance);
+		for (TestRow &row : test_rows) {
+			RandomRow(&row, &random, COLS, text.special_chance, 16);
+		}
+
+		uint64_t rows_direct = 0;
+		uint64_t glyph_runs = 0;
+		uint64_t best_ns = UINT64_MAX;
+		for (int i = 0; i < iterations; ++i) {
+			uint64_t start = BenchNowNs();
+			for (TestRow &row : test_rows) {
+				ScanRow(&row);
+				bool built = BuildRow(&glyph_row, styles, &row);
+				rows_direct += built;
+				glyph_runs += row.glyph_run_count;
+			}
+			uint64_t elapsed = BenchNowNs() - start;
+			best_ns = elapsed < best_ns ? elapsed : best_ns;
+		}
+		char name[64];
+		snprintf(name, sizeof(name), "  scan and build %s", text.name);
+		BenchReport(name, best_ns, static_cast<uint64_t>(rows) * COLS, 0);
+		printf("    %.0f%% of rows drawn directly, %.1f glyph runs per row\n",
+			100.0 * static_cast<double>(rows_direct) / static_cast<double>(rows * iterations),
+			static_cast<double>(glyph_runs) / static_cast<double>(rows_direct + 1));
+	}
+
+	// Glyph indices from the font metrics, as the text layout path takes them
+	uint64_t best_ns = UINT64_MAX;
+	for (int i = 0; i < iterations; ++i) {
+		uint64_t start = BenchNowNs();
+		for (const TestRow &row : test_rows) {
+			for (int col = 0; col < COLS; ++col) {
+				glyph_indices[col] = GlyphMetricsGlyphIndex(metrics, row.chars[col]);
+			}
+			BenchKeep(glyph_indices[COLS - 1]);
+		}
+		uint64_t elapsed = BenchNowNs() - start;
+		best_ns = elapsed < best_ns ? elapsed : best_ns;
+	}
+	BenchReport("  metrics lookups", best_ns, static_cast<uint64_t>(rows) * COLS, 0);
+
+	GlyphRowShutdown(&glyph_row);
+	GlyphMetricsShutdown(metrics);
+	StyleTableShutdown(styles);
+	delete metrics;
+	delete styles;
+}
+
+int main(int argc, char **argv) {
+	int rows = BenchArgInt(argc, argv, "--rows", 50);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 200);
+	if (rows <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: glyph_row_bench [--rows=N] [--iterations=N]\n");
+		return 2;
+	}
+
+	bool ok = Check();
+	printf("\n%d rows of %d cells, ns/event per cell\n", rows, COLS);
+	Measure(rows, iterations);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+// Redraw throughput over the portable UI state, for tracking regressions
+// between releases. Every scenario is a synthetic stream of redraw
+// notifications that is translated into command buffers (the reader
+// thread's work) and applied to a UiState (the work of the reader
+// thread's snapshot model, short of publishing snapshots).
+//
+// Usage: grid_bench [--scenario=<name>] [--frames=N] [--iterations=N]
+// Scenarios: full_repaint, scroll, syntax_dense, cjk, emoji, huge_4k
+//
+// ns/event is per redraw event, MB/s relative to the msgpack stream. Each
+// scenario checks that every cell it sends ends up in the grid. The apply
+// includes finding the dirty rows on every flush, as the renderer does,
+// and counts the scrolls it would move drawn rows for with a blit.
+
+#include "bench_util.h"
+#include "nvim/redraw_commands.h"
+#include "renderer/ui_state.h"
+
+struct Scenario {
+	const char *name;
+	const char *description;
+	int rows;
+	int cols;
+	void (*generate)(const Scenario *scenario, int frames, std::vector<char> *stream);
+	// Cells the stream writes into the grid, for checking the apply
+	uint64_t (*expected_cells)(const Scenario *scenario, int frames);
+};
+
+static void WriteNotification(std::vector<char> *stream, void (*write_events)(mpack_writer_t *, void *), void *context) {
+	char *data;
+	size_t size;
+	mpack_writer_t writer;
+	mpack_writer_init_growable(&writer, &data, &size);
+	mpack_start_array(&writer, 3);
+	mpack_write_int(&writer, 2);
+	mpack_write_cstr(&writer, "redraw");
+	write_events(&writer, context);
+	mpack_finish_array(&writer);
+	if (mpack_writer_destroy(&writer) == mpack_ok) {
+		stream->insert(stream->end(), data, data + size);
+	}
+	MPACK_FREE(data);
+}
+
+struct SetupContext {
+	int rows;
+	int cols;
+};
+
+// What nvim sends on attach: the grid size, colors and a handful of highlights
+static void WriteSetupEvents(mpack_writer_t *writer, void *context) {
+	const SetupContext *setup = static_cast<const SetupContext *>(context);
+	constexpr int HIGHLIGHT_COUNT = 40;
+	mpack_start_array(writer, 3);
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "grid_resize");
+	mpack_start_array(writer, 3);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, setup->cols);
+	mpack_write_int(writer, setup->rows);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "default_colors_set");
+	mpack_start_array(writer, 5);
+	mpack_write_int(writer, 0xD4D4D4);
+	mpack_write_int(writer, 0x1E1E1E);
+	mpack_write_int(writer, 0xFF0000);
+	mpack_write_int(writer, 0);
+	mpack_write_int(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	mpack_start_array(writer, 1 + HIGHLIGHT_COUNT);
+	mpack_write_cstr(writer, "hl_attr_define");
+	for (int i = 1; i <= HIGHLIGHT_COUNT; ++i) {
+		mpack_start_array(writer, 4);
+		mpack_write_int(writer, i);
+		mpack_start_map(writer, 2);
+		mpack_write_cstr(writer, "foreground");
+		mpack_write_int(writer, 0x102030 * i);
+		mpack_write_cstr(writer, i % 3 ? "bold" : "italic");
+		mpack_write_true(writer);
+		mpack_finish_map(writer);
+		mpack_start_map(writer, 0);
+		mpack_finish_map(writer);
+		mpack_start_array(writer, 0);
+		mpack_finish_array(writer);
+		mpack_finish_array(writer);
+	}
+	mpack_finish_array(writer);
+
+	mpack_finish_array(writer);
+}
+
+static void GenerateSetup(const Scenario *scenario, std::vector<char> *stream) {
+	SetupContext setup { scenario->rows, scenario->cols };
+	WriteNotification(stream, WriteSetupEvents, &setup);
+}
+
+static void GenerateRepaints(const Scenario *scenario, int frames, std::vector<char> *stream) {
+	GenerateSetup(scenario, stream);
+	BenchCellText text = BenchCellText::Ascii;
+	int hl_run_length = 6;
+	if (!strcmp(scenario->name, "cjk")) {
+		text = BenchCellText::Cjk;
+	}
+	else if (!strcmp(scenario->name, "emoji")) {
+		text = BenchCellText::Emoji;
+	}
+	else if (!strcmp(scenario->name, "syntax_dense")) {
+		hl_run_length = 1;
+	}
+	BenchGenerateRepaintStream(stream, frames, scenario->rows, scenario->cols, hl_run_length, text, 1);
+}
+
+static uint64_t RepaintCells(const Scenario *scenario, int frames) {
+	return static_cast<uint64_t>(frames) * scenario->rows * scenario->cols;
+}
+
+struct ScrollContext {
+	int rows;
+	int cols;
+	BenchRandom *random;
+};
+
+// Scrolling down a line at a time, the way holding <C-e> does: the grid
+// moves up a row and the new bottom row is drawn
+static void WriteScrollEvents(mpack_writer_t *writer, void *context) {
+	const ScrollContext *scroll = static_cast<const ScrollContext *>(context);
+	mpack_start_array(writer, 4);
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "grid_scroll");
+	mpack_start_array(writer, 7);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, 0);
+	mpack_write_int(writer, scroll->rows - 1);
+	mpack_write_int(writer, 0);
+	mpack_write_int(writer, scroll->cols);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "grid_line");
+	BenchWriteGridLine(writer, scroll->rows - 2, scroll->cols, 6, BenchCellText::Ascii, scroll->random);
+	mpack_finish_array(writer);
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "grid_cursor_goto");
+	mpack_start_array(writer, 3);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, scroll->rows - 2);
+	mpack_write_int(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "flush");
+	mpack_start_array(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+
+	mpack_finish_array(writer);
+}
+
+static void GenerateScroll(const Scenario *scenario, int frames, std::vector<char> *stream) {
+	GenerateSetup(scenario, stream);
+	// Start from a full screen, as after opening a file
+	BenchGenerateRepaintStream(stream, 1, scenario->rows, scenario->cols, 6, BenchCellText::Ascii, 1);
+	BenchRandom random { 2 };
+	ScrollContext scroll { scenario->rows, scenario->cols, &random };
+	for (int i = 0; i < frames; ++i) {
+		WriteNotification(stream, WriteScrollEvents, &scroll);
+	}
+}
+
+static uint64_t ScrollCells(const Scenario *scenario, int frames) {
+	return static_cast<uint64_t>(scenario->rows) * scenario->cols + static_cast<uint64_t>(frames) * scenario->cols;
+}
+
+// A 3840x2160 window at 8x16 pixel cells
+constexpr int HUGE_ROWS = 135;
+constexpr int HUGE_COLS = 480;
+
+static const Scenario SCENARIOS[] {
+	{ "full_repaint", "80% ASCII lines, highlight runs of 6", 60, 200, GenerateRepaints, RepaintCells },
+	{ "scroll", "one line scrolled in per frame", 60, 200, GenerateScroll, ScrollCells },
+	{ "syntax_dense", "highlight changes on every cell", 60, 200, GenerateRepaints, RepaintCells },
+	{ "cjk", "double width CJK text", 60, 200, GenerateRepaints, RepaintCells },
+	{ "emoji", "double width surrogate pairs", 60, 200, GenerateRepaints, RepaintCells },
+	{ "huge_4k", "full repaints of a 4K sized grid", HUGE_ROWS, HUGE_COLS, GenerateRepaints, RepaintCells },
+};
+
+struct CommandBuffer {
+	char *data;
+	size_t size;
+};
+
+static bool RunScenario(const Scenario *scenario, int frames, int iterations) {
+	std::vector<char> stream;
+	scenario->generate(scenario, frames, &stream);
+	std::vector<BenchMessage> messages;
+	if (!BenchFrameStream(stream, &messages)) {
+		fprintf(stderr, "%s: malformed msgpack stream\n", scenario->name);
+		return false;
+	}
+
+	uint64_t translate_ns = UINT64_MAX;
+	uint64_t apply_ns = UINT64_MAX;
+	uint64_t events = 0;
+	uint64_t cells = 0;
+	uint64_t flushes = 0;
+	uint64_t dirty_rows = 0;
+	uint64_t dirty_cells = 0;
+	uint64_t scroll_blits = 0;
+	uint64_t marks_coalesced = 0;
+	std::vector<CommandBuffer> buffers;
+	for (int i = 0; i < iterations; ++i) {
+		for (CommandBuffer &buffer : buffers) {
+			free(buffer.data);
+		}
+		buffers.clear();
+
+		uint64_t start = BenchNowNs();
+		for (const BenchMessage &message : messages) {
+			CommandBuffer buffer;
+			buffer.data = RedrawTranslate(stream.data() + message.offset, message.size, &buffer.size);
+			if (buffer.data) {
+				buffers.push_back(buffer);
+			}
+		}
+		uint64_t elapsed = BenchNowNs() - start;
+		translate_ns = elapsed < translate_ns ? elapsed : translate_ns;
+
+		UiState *ui = new UiState {};
+		UiStateInitialize(ui);
+		events = 0;
+		flushes = 0;
+		dirty_rows = 0;
+		dirty_cells = 0;
+		scroll_blits = 0;
+		start = BenchNowNs();
+		for (const CommandBuffer &buffer : buffers) {
+			RedrawCommandReader reader;
+			RedrawCommandsBegin(&reader, buffer.data, buffer.size);
+			while (const RedrawCommand *command = RedrawNextCommand(&reader)) {
+				UiStateApply(ui, command);
+				++events;
+				if (command->event == RedrawEvent::flush) {
+					// The rows the renderer would draw
+					Grid *grid = &ui->grid;
+					for (int row = GridNextDirtyRow(grid, 0); row >= 0; row = GridNextDirtyRow(grid, row + 1)) {
+						++dirty_rows;
+						dirty_cells += grid->dirty_spans[row].end - grid->dirty_spans[row].begin;
+					}
+					scroll_blits += grid->pending_scroll_count;
+					GridClearDirty(grid);
+					++flushes;
+				}
+			}
+		}
+		elapsed = BenchNowNs() - start;
+		apply_ns = elapsed < apply_ns ? elapsed : apply_ns;
+		marks_coalesced = ui->grid.damage.marks_coalesced;
+		BenchKeep(ui->grid.chars[GridRowOffset(&ui->grid, ui->grid.rows - 1) + ui->grid.cols - 1] + ui->cursor.row);
+
+		// Counted outside the timed loop
+		cells = 0;
+		for (const CommandBuffer &buffer : buffers) {
+			RedrawCommandReader reader;
+			RedrawCommandsBegin(&reader, buffer.data, buffer.size);
+			while (const RedrawCommand *command = RedrawNextCommand(&reader)) {
+				if (command->event == RedrawEvent::grid_line) {
+					cells += reinterpret_cast<const RedrawCommandGridLine *>(command)->cell_count;
+				}
+			}
+		}
+		bool grid_matches = ui->grid.rows == scenario->rows && ui->grid.cols == scenario->cols &&
+			ui->hl_attribs[0].background == 0x1E1E1E;
+		UiStateShutdown(ui);
+		delete ui;
+		if (!grid_matches || cells != scenario->expected_cells(scenario, frames)) {
+			fprintf(stderr, "%s: applied %llu cells, expected %llu\n", scenario->name,
+				static_cast<unsigned long long>(cells),
+				static_cast<unsigned long long>(scenario->expected_cells(scenario, frames)));
+			return false;
+		}
+	}
+	for (CommandBuffer &buffer : buffers) {
+		free(buffer.data);
+	}
+
+	printf("\n%s: %s, %dx%d, %zu messages, %zu bytes, %llu events, %llu cells\n", scenario->name,
+		scenario->description, scenario->cols, scenario->rows, messages.size(), stream.size(),
+		static_cast<unsigned long long>(events), static_cast<unsigned long long>(cells));
+	BenchReport("  translate", translate_ns, events, stream.size());
+	BenchReport("  apply", apply_ns, events, stream.size());
+	BenchReport("  total", translate_ns + apply_ns, events, stream.size());
+	printf("  %.2f ns/cell\n", static_cast<double>(translate_ns + apply_ns) / static_cast<double>(cells));
+	if (flushes > 0) {
+		printf("  %.1f of %d rows dirty per flush, %.0f dirty cells, %.1f row draws avoided, %.1f scroll blits\n",
+			static_cast<double>(dirty_rows) / static_cast<double>(flushes), scenario->rows,
+			static_cast<double>(dirty_cells) / static_cast<double>(flushes),
+			static_cast<double>(marks_coalesced) / static_cast<double>(flushes),
+			static_cast<double>(scroll_blits) / static_cast<double>(flushes));
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	const char *only = BenchArg(argc, argv, "--scenario");
+	int frames = BenchArgInt(argc, argv, "--frames", 60);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 5);
+	if (frames < 1 || iterations < 1) {
+		fprintf(stderr, "--frames and --iterations have to be positive\n");
+		return 1;
+	}
+
+	bool found = false;
+	for (const Scenario &scenario : SCENARIOS) {
+		if (only && strcmp(only, scenario.name)) {
+			continue;
+		}
+		found = true;
+		if (!RunScenario(&scenario, frames, iterations)) {
+			return 1;
+		}
+	}
+	if (!found) {
+		fprintf(stderr, "Unknown scenario %s\n", only);
+		return 1;
+	}
+	printf("\nbest of %d, %d frames per scenario\n", iterations, frames);
+	return 0;
+}
@@ -0,0 +1,696 @@
+// Nvy's nvim side without a window: starts `nvim --embed` over pipes (or
+// attaches to a server), does the same handshake as NvimInitialize and
+// NvimSendUIAttach, and translates redraws on a reader thread like Nvy.
+// The commands are then applied to a UiState on the main thread, without
+// the snapshots Nvy hands to its render thread, and the dirty rows are
+// counted into runs and background plans instead of drawn. A script
+// drives nvim while frames/s and the latency from every keystroke to the
+// flush that applies its redraws are measured.
+//
+// Usage: headless [--script=<file>] [--repeat=N] [--rows=N] [--cols=N]
+//                 [--nvim=<path>] [--server=<address>] [--record=<file>]
+//                 [--key-timeout-ms=N] [-- <nvim arguments>]
+//
+// Script lines, # starts a comment:
+//   keys <keys>           nvim_input in key notation, waits for the next flush
+//   type <text>           sends every character as its own keystroke
+//   command <ex command>  nvim_command, waits for the response
+//   sleep <ms>            keeps applying redraws for a while
+//   resize <rows> <cols>  nvim_ui_try_resize, waits for the next flush
+// Without --script a built-in one fills a buffer, scrolls through it and
+// types into it.
+
+#include "bench_util.h"
+#include "common/clock.h"
+#include "common/mpack_cursor.h"
+#include "nvim/message_reader.h"
+#include "nvim/nvim_messages.h"
+#include "nvim/pending_requests.h"
+#include "nvim/redraw_commands.h"
+#include "nvim/stream_recorder.h"
+#include "nvim/transport.h"
+#include "renderer/background_plan.h"
+#include "renderer/ui_state.h"
+#include <algorithm>
+#include <condition_variable>
+#include <csignal>
+#include <mutex>
+#include <thread>
+
+constexpr uint64_t MS = 1'000'000;
+constexpr uint64_t STARTUP_TIMEOUT_NS = 10'000 * MS;
+constexpr uint64_t REQUEST_TIMEOUT_NS = 5'000 * MS;
+constexpr size_t MAX_SCRIPT_LINE_LENGTH = 1024;
+// Nvy's default size for nvim's stdout pipe
+constexpr size_t PIPE_BUFFER_SIZE = 1024 * 1024;
+
+static const char *DEFAULT_SCRIPT = R"(# Fill a scratch buffer with syntax highlighted text
+command enew
+command setlocal buftype=nofile filetype=c
+command call setline(1, map(range(1, 5000), 'printf("int line_%d = %d; /* %s */", v:val, v:val * 7, repeat("lorem ipsum ", 6))'))
+keys gg
+# Scroll through it a line and a page at a time
+keys <C-e><C-e><C-e><C-e><C-e><C-e><C-e><C-e><C-e><C-e>
+keys <C-e>
+keys <C-e>
+keys <C-e>
+keys <C-e>
+keys <C-e>
+keys <C-e>
+keys <C-e>
+keys <C-e>
+keys <C-e>
+keys <C-e>
+keys <C-f>
+keys <C-f>
+keys <C-f>
+keys <C-f>
+keys <C-f>
+keys <C-b>
+keys <C-b>
+keys <C-b>
+keys G
+keys gg
+# Type into it
+keys O
+type int typed_in_insert_mode = 42; /* keystroke to flush latency */
+keys <Esc>
+keys u
+keys 50%
+keys zz
+keys <C-d>
+keys <C-u>
+)";
+
+enum class StepKind {
+	Keys,
+	Type,
+	Command,
+	Sleep,
+	Resize
+};
+
+struct ScriptStep {
+	StepKind kind;
+	// Keys, text or command
+	char *text;
+	int rows;
+	int cols;
+	int milliseconds;
+};
+
+struct HeadlessClient {
+	Transport transport;
+	StreamRecorder *recorder;
+	int64_t next_msg_id;
+	PendingRequests pending_requests;
+	MessageReader *reader;
+	UiState ui;
+
+	// The reader thread wakes the main thread through these
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool woken;
+
+	int64_t last_response_id;
+	int64_t api_level;
+	bool vimenter_requested;
+	uint64_t request_errors;
+
+	// Set while a keystroke waits for its flush
+	bool awaiting_flush;
+	uint64_t keys_sent_ns;
+	std::vector<uint64_t> key_latencies;
+	uint64_t keys_without_redraw;
+
+	uint64_t flushes;
+	// Rows the renderer would have drawn on those flushes, and the runs
+	// they split into by highlight id and by style
+	uint64_t rows_drawn;
+	uint64_t hl_runs;
+	uint64_t style_runs;
+	// Their backgrounds planned as the renderer does
+	BackgroundPlan background_plan;
+	std::vector<uint32_t> run_starts;
+	std::vector<uint32_t> run_colors;
+	uint64_t commands_applied;
+	uint64_t apply_ns;
+	uint64_t redraw_messages;
+};
+
+static int64_t RegisterRequest(HeadlessClient *client, NvimRequest request) {
+	int64_t msg_id = client->next_msg_id++;
+	PendingRequestsAdd(&client->pending_requests, msg_id, request, ClockNowNs());
+	return msg_id;
+}
+
+static bool Send(HeadlessClient *client, const TransportBuffer *buffers, int buffer_count) {
+	if (client->recorder) {
+		for (int i = 0; i < buffer_count; ++i) {
+			StreamRecorderWrite(client->recorder, StreamDirection::Outbound, buffers[i].data, buffers[i].size);
+		}
+	}
+	return TransportWrite(&client->transport, buffers, buffer_count);
+}
+
+static bool Send(HeadlessClient *client, const char *data, size_t size) {
+	TransportBuffer buffer { data, size };
+	return Send(client, &buffer, 1);
+}
+
+static size_t ReadNvimOutput(void *context, char *buffer, size_t size) {
+	HeadlessClient *client = static_cast<HeadlessClient *>(context);
+	size_t bytes_read = TransportRead(&client->transport, buffer, size);
+	if (bytes_read > 0 && client->recorder) {
+		StreamRecorderWrite(client->recorder, StreamDirection::Inbound, buffer, bytes_read);
+	}
+	return bytes_read;
+}
+
+static void WakeMainThread(void *context) {
+	HeadlessClient *client = static_cast<HeadlessClient *>(context);
+	std::lock_guard<std::mutex> lock(client->mutex);
+	client->woken = true;
+	client->wake.notify_one();
+}
+
+// Same as Nvy, redraws are translated on the reader thread
+static void TranslateNvimMessage(void *, ReaderMessage *message) {
+	size_t commands_size;
+	char *commands = RedrawTranslate(message->data, message->size, &commands_size);
+	if (!commands) {
+		return;
+	}
+
+	free(message->heap_data);
+	message->data = commands;
+	message->size = commands_size;
+	message->heap_data = commands;
+	message->kind = NVIM_MESSAGE_REDRAW_COMMANDS;
+}
+
+// Counts the runs of the dirty rows and plans their backgrounds
+static void DrawDirtyRows(HeadlessClient *client) {
+	Grid *grid = &client->ui.grid;
+	StyleTable *styles = &client->ui.styles;
+	BackgroundPlan *plan = &client->background_plan;
+	BackgroundPlanReserve(plan, grid->rows, grid->cols);
+	BackgroundPlanBegin(plan, StyleTableGet(styles, 0)->background_rgb);
+	for (int row = GridNextDirtyRow(grid, 0); row >= 0; row = GridNextDirtyRow(grid, row + 1)) {
+		const uint16_t *hl_ids = &grid->hl_ids[GridRowOffset(grid, row)];
+		StyleRowRuns runs = StyleTableCountRuns(styles, hl_ids, grid->cols);
+		client->hl_runs += static_cast<uint64_t>(runs.hl_runs);
+		client->style_runs += static_cast<uint64_t>(runs.style_runs);
+		++client->rows_drawn;
+
+		client->run_starts.clear();
+		client->run_colors.clear();
+		for (int col = 0; col < grid->cols; ++col) {
+			if (col == 0 || StyleTableStyleId(styles, hl_ids[col]) != StyleTableStyleId(styles, hl_ids[col - 1])) {
+				client->run_starts.push_back(static_cast<uint32_t>(col));
+				client->run_colors.push_back(StyleTableGet(styles, hl_ids[col])->background_rgb);
+			}
+		}
+		BackgroundPlanAddRow(plan, row, grid->cols, client->run_starts.data(), client->run_colors.data(),
+			client->run_starts.size());
+	}
+	BackgroundPlanFinish(plan);
+	GridClearDirty(grid);
+}
+
+static void ApplyRedrawCommands(HeadlessClient *client, const ReaderMessage *message) {
+	uint64_t start = ClockNowNs();
+	RedrawCommandReader reader;
+	RedrawCommandsBegin(&reader, message->data, message->size);
+	while (const RedrawCommand *command = RedrawNextCommand(&reader)) {
+		UiStateApply(&client->ui, command);
+		++client->commands_applied;
+		if (command->event != RedrawEvent::flush) {
+			continue;
+		}
+
+		DrawDirtyRows(client);
+
+		uint64_t now = ClockNowNs();
+		++client->flushes;
+		if (client->awaiting_flush) {
+			client->key_latencies.push_back(now - client->keys_sent_ns);
+			client->awaiting_flush = false;
+		}
+	}
+	client->apply_ns += ClockNowNs() - start;
+	++client->redraw_messages;
+}
+
+static void ProcessRpcMessage(HeadlessClient *client, const ReaderMessage *message) {
+	MPackCursor cursor = MPackCursorInit(message->data, message->size);
+	uint32_t elements = MPackCursorArray(&cursor);
+	int64_t type = MPackCursorInt(&cursor);
+	if (!MPackCursorOk(&cursor) || elements < 3) {
+		return;
+	}
+
+	if (type == 1 && elements == 4) {
+		int64_t msg_id = MPackCursorInt(&cursor);
+		bool failed = !MPackCursorIsNil(&cursor);
+		MPackCursorSkip(&cursor);
+		uint8_t method;
+		if (PendingRequestsRetire(&client->pending_requests, msg_id, ClockNowNs(), &method)) {
+			if (method == vim_get_api_info) {
+				client->api_level = NvimParseApiLevel(reinterpret_cast<const char *>(cursor.pos),
+					static_cast<size_t>(cursor.end - cursor.pos));
+			}
+		}
+		if (failed) {
+			++client->request_errors;
+		}
+		client->last_response_id = msg_id > client->last_response_id ? msg_id : client->last_response_id;
+	}
+	else if (type == 0 && elements == 4) {
+		// Nothing but 'vimenter' is expected, anything else is answered too
+		// so nvim isn't left waiting
+		int64_t msg_id = MPackCursorInt(&cursor);
+		uint32_t length;
+		const char *method = MPackCursorStr(&cursor, &length);
+		if (MPackCursorOk(&cursor) && MPackStrEquals(method, length, "vimenter")) {
+			client->vimenter_requested = true;
+		}
+		char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
+		Send(client, data, NvimEncodeResponse(data, msg_id));
+	}
+}
+
+// Applies nvim's output until `done` returns true. Returns false if the
+// deadline passed or the stream ended first.
+template<typename Condition>
+static bool PumpUntil(HeadlessClient *client, uint64_t deadline_ns, Condition done) {
+	MessageReader *reader = client->reader;
+	while (!done()) {
+		// Everything queued before the stream ended is still drained below
+		bool finished = reader->finished.load();
+		if (!finished) {
+			std::unique_lock<std::mutex> lock(client->mutex);
+			if (!client->woken) {
+				if (ClockNowNs() >= deadline_ns) {
+					return false;
+				}
+				client->wake.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadline_ns)));
+			}
+			client->woken = false;
+		}
+
+		MessageReaderBeginDrain(reader);
+		ReaderMessage message;
+		while (MessageReaderPop(reader, &message)) {
+			if (message.kind == NVIM_MESSAGE_REDRAW_COMMANDS) {
+				ApplyRedrawCommands(client, &message);
+			}
+			else {
+				ProcessRpcMessage(client, &message);
+			}
+			MessageReaderRelease(reader, &message);
+		}
+		if (finished) {
+			return done();
+		}
+	}
+	return true;
+}
+
+static bool AwaitResponse(HeadlessClient *client, int64_t msg_id) {
+	return PumpUntil(client, ClockNowNs() + REQUEST_TIMEOUT_NS, [&]() {
+		return client->last_response_id >= msg_id;
+	});
+}
+
+static bool AwaitFlush(HeadlessClient *client, uint64_t flushes, uint64_t timeout_ns) {
+	return PumpUntil(client, ClockNowNs() + timeout_ns, [&]() {
+		return client->flushes > flushes;
+	});
+}
+
+// The messages NvimInitialize and NvimSendUIAttach send, in the same order
+static bool Handshake(HeadlessClient *client, bool embedded, int rows, int cols) {
+	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
+	int64_t msg_id = RegisterRequest(client, vim_get_api_info);
+	if (!Send(client, data, NvimEncodeApiInfoRequest(data, msg_id)) || !AwaitResponse(client, msg_id)) {
+		fprintf(stderr, "nvim didn't answer nvim_get_api_info\n");
+		return false;
+	}
+	if (client->api_level < MIN_NVIM_API_LEVEL) {
+		fprintf(stderr, "nvim api level %lld is too old\n", static_cast<long long>(client->api_level));
+		return false;
+	}
+
+	char set_var_data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
+	size_t set_var_size = NvimEncodeSetVar(set_var_data, "nvy", 1);
+	if (embedded) {
+		msg_id = RegisterRequest(client, nvim_command);
+		TransportBuffer buffers[] {
+			{ set_var_data, set_var_size },
+			{ data, NvimEncodeCommand(data, msg_id, NVIM_VIMENTER_AUTOCMD) }
+		};
+		if (!Send(client, buffers, 2) || !AwaitResponse(client, msg_id)) {
+			fprintf(stderr, "nvim didn't answer the VimEnter autocmd\n");
+			return false;
+		}
+	}
+	else if (!Send(client, set_var_data, set_var_size)) {
+		return false;
+	}
+
+	if (!Send(client, data, NvimEncodeUIAttach(data, rows, cols))) {
+		return false;
+	}
+	// An embedded nvim draws once it has started up
+	bool ready = PumpUntil(client, ClockNowNs() + STARTUP_TIMEOUT_NS, [&]() {
+		return (!embedded || client->vimenter_requested) && client->flushes > 0;
+	});
+	if (!ready) {
+		fprintf(stderr, "nvim didn't draw after nvim_ui_attach\n");
+	}
+	return ready;
+}
+
+static bool ParseScript(char *script, std::vector<ScriptStep> *steps) {
+	int line_number = 0;
+	for (char *line = strtok(script, "\n"); line; line = strtok(nullptr, "\n")) {
+		++line_number;
+		size_t length = strlen(line);
+		if (length > 0 && line[length - 1] == '\r') {
+			line[--length] = '\0';
+		}
+		while (*line == ' ' || *line == '\t') {
+			++line;
+		}
+		if (*line == '\0' || *line == '#') {
+			continue;
+		}
+
+		char *argument = strchr(line, ' ');
+		if (argument) {
+			*argument++ = '\0';
+		}
+		ScriptStep step {};
+		step.text = argument;
+		bool valid = argument && *argument;
+		if (!strcmp(line, "keys")) {
+			step.kind = StepKind::Keys;
+		}
+		else if (!strcmp(line, "type")) {
+			step.kind = StepKind::Type;
+		}
+		else if (!strcmp(line, "command")) {
+			step.kind = StepKind::Command;
+		}
+		else if (!strcmp(line, "sleep")) {
+			step.kind = StepKind::Sleep;
+			valid = valid && sscanf(argument, "%d", &step.milliseconds) == 1 && step.milliseconds >= 0;
+		}
+		else if (!strcmp(line, "resize")) {
+			step.kind = StepKind::Resize;
+			valid = valid && sscanf(argument, "%d %d", &step.rows, &step.cols) == 2 && step.rows > 0 && step.cols > 0;
+		}
+		else {
+			valid = false;
+		}
+		if (!valid || (step.text && strlen(step.text) >= MAX_SCRIPT_LINE_LENGTH)) {
+			fprintf(stderr, "Invalid script line %d: %s\n", line_number, line);
+			return false;
+		}
+		steps->push_back(step);
+	}
+	return true;
+}
+
+// Sends keys and waits for the flush they cause. Keys that don't redraw
+// anything within the timeout are counted separately.
+static bool SendKeys(HeadlessClient *client, const char *keys, uint64_t key_timeout_ns) {
+	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
+	size_t size = NvimEncodeInput(data, RegisterRequest(client, nvim_input), keys);
+	uint64_t flushes = client->flushes;
+	client->awaiting_flush = true;
+	client->keys_sent_ns = ClockNowNs();
+	if (!Send(client, data, size)) {
+		return false;
+	}
+	if (!AwaitFlush(client, flushes, key_timeout_ns)) {
+		if (client->reader->finished.load()) {
+			return false;
+		}
+		client->awaiting_flush = false;
+		++client->keys_without_redraw;
+	}
+	return true;
+}
+
+static bool RunStep(HeadlessClient *client, const ScriptStep *step, uint64_t key_timeout_ns) {
+	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
+	switch (step->kind) {
+	case StepKind::Keys: {
+		return SendKeys(client, step->text, key_timeout_ns);
+	} break;
+	case StepKind::Type: {
+		for (const char *c = step->text; *c; ++c) {
+			// '<' starts key notation
+			char key[2] { *c, '\0' };
+			if (!SendKeys(client, *c == '<' ? "<lt>" : key, key_timeout_ns)) {
+				return false;
+			}
+		}
+	} break;
+	case StepKind::Command: {
+		int64_t msg_id = RegisterRequest(client, nvim_command);
+		if (!Send(client, data, NvimEncodeCommand(data, msg_id, step->text)) || !AwaitResponse(client, msg_id)) {
+			return false;
+		}
+	} break;
+	case StepKind::Sleep: {
+		PumpUntil(client, ClockNowNs() + static_cast<uint64_t>(step->milliseconds) * MS, []() { return false; });
+		return !client->reader->finished.load();
+	} break;
+	case StepKind::Resize: {
+		uint64_t flushes = client->flushes;
+		if (!Send(client, data, NvimEncodeResize(data, step->rows, step->cols))) {
+			return false;
+		}
+		AwaitFlush(client, flushes, key_timeout_ns);
+	} break;
+	}
+	return true;
+}
+
+static double Percentile(const std::vector<uint64_t> &sorted, int percentile) {
+	size_t index = (sorted.size() - 1) * static_cast<size_t>(percentile) / 100;
+	return static_cast<double>(sorted[index]) / 1000.0;
+}
+
+static void ReportRun(HeadlessClient *client, uint64_t run_ns, uint64_t flushes_before, size_t steps) {
+	double seconds = static_cast<double>(run_ns) / 1e9;
+	uint64_t frames = client->flushes - flushes_before;
+	printf("\nscript: %zu steps in %.3f s\n", steps, seconds);
+	printf("  frames                 %llu, %.1f frames/s\n", static_cast<unsigned long long>(frames),
+		static_cast<double>(frames) / seconds);
+
+	std::vector<uint64_t> latencies = client->key_latencies;
+	if (!latencies.empty()) {
+		std::sort(latencies.begin(), latencies.end());
+		printf("  keystroke to flush     %zu keys, p50 %.1f us  p90 %.1f us  p99 %.1f us  max %.1f us\n",
+			latencies.size(), Percentile(latencies, 50), Percentile(latencies, 90), Percentile(latencies, 99),
+			static_cast<double>(latencies.back()) / 1000.0);
+	}
+	if (client->keys_without_redraw > 0) {
+		printf("  keys without a redraw  %llu\n", static_cast<unsigned long long>(client->keys_without_redraw));
+	}
+
+	MessageReader *reader = client->reader;
+	printf("  nvim output            %llu messages, %.2f MB, %llu reader wakeups\n",
+		static_cast<unsigned long long>(reader->messages_read.load()),
+		static_cast<double>(reader->bytes_read.load()) / (1024.0 * 1024.0),
+		static_cast<unsigned long long>(reader->wakeups.load()));
+	if (client->commands_applied > 0) {
+		printf("  apply                  %llu redraw events, %.1f ns/event\n",
+			static_cast<unsigned long long>(client->commands_applied),
+			static_cast<double>(client->apply_ns) / static_cast<double>(client->commands_applied));
+	}
+	if (client->flushes > 0) {
+		printf("  damage                 %.1f rows drawn per frame, %llu row draws avoided\n",
+			static_cast<double>(client->rows_drawn) / static_cast<double>(client->flushes),
+			static_cast<unsigned long long>(client->ui.grid.damage.marks_coalesced));
+	}
+	if (client->rows_drawn > 0) {
+		printf("  runs per row           %.1f by highlight id, %.1f by style, %d styles\n",
+			static_cast<double>(client->hl_runs) / static_cast<double>(client->rows_drawn),
+			static_cast<double>(client->style_runs) / static_cast<double>(client->rows_drawn),
+			client->ui.styles.style_count);
+		const BackgroundPlanStats *plan_stats = &client->background_plan.stats;
+		printf("  background fills       %llu by run with %llu color changes, %llu planned with %llu\n",
+			static_cast<unsigned long long>(plan_stats->runs),
+			static_cast<unsigned long long>(plan_stats->run_color_changes),
+			static_cast<unsigned long long>(plan_stats->fills),
+			static_cast<unsigned long long>(plan_stats->color_changes));
+	}
+	for (int i = 0; i < NVIM_REQUEST_COUNT; ++i) {
+		const LatencyHistogram *latency = &client->pending_requests.latencies[i];
+		if (latency->count > 0) {
+			printf("  %-22s %llu requests, p50 <%llu us  p99 <%llu us  max %.1f us\n", NVIM_REQUEST_NAMES[i],
+				static_cast<unsigned long long>(latency->count),
+				static_cast<unsigned long long>(LatencyHistogramPercentileUs(latency, 50)),
+				static_cast<unsigned long long>(LatencyHistogramPercentileUs(latency, 99)),
+				static_cast<double>(latency->max_ns) / 1000.0);
+		}
+	}
+	if (client->request_errors > 0) {
+		printf("  requests nvim rejected %llu\n", static_cast<unsigned long long>(client->request_errors));
+	}
+	printf("  grid                   %dx%d, cursor at %d,%d\n", client->ui.grid.cols, client->ui.grid.rows,
+		client->ui.cursor.row, client->ui.cursor.col);
+}
+
+int main(int argc, char **argv) {
+	// Writing to an nvim that exited fails instead of killing us
+	signal(SIGPIPE, SIG_IGN);
+
+	const char *script_path = BenchArg(argc, argv, "--script");
+	const char *nvim_path = BenchArg(argc, argv, "--nvim");
+	const char *server = BenchArg(argc, argv, "--server");
+	const char *record_path = BenchArg(argc, argv, "--record");
+	int repeat = BenchArgInt(argc, argv, "--repeat", 1);
+	int rows = BenchArgInt(argc, argv, "--rows", 50);
+	int cols = BenchArgInt(argc, argv, "--cols", 160);
+	int key_timeout_ms = BenchArgInt(argc, argv, "--key-timeout-ms", 1000);
+	if (repeat < 1 || rows < 1 || cols < 1 || key_timeout_ms < 1) {
+		fprintf(stderr, "--repeat, --rows, --cols and --key-timeout-ms have to be positive\n");
+		return 1;
+	}
+
+	std::vector<char> script;
+	if (script_path) {
+		if (!BenchReadFile(script_path, &script)) {
+			fprintf(stderr, "Could not read %s\n", script_path);
+			return 1;
+		}
+	}
+	else {
+		script.assign(DEFAULT_SCRIPT, DEFAULT_SCRIPT + strlen(DEFAULT_SCRIPT));
+	}
+	script.push_back('\0');
+	std::vector<ScriptStep> steps;
+	if (!ParseScript(script.data(), &steps)) {
+		return 1;
+	}
+
+	HeadlessClient *client = new HeadlessClient {};
+	client->next_msg_id = 0;
+	client->last_response_id = -1;
+	client->api_level = -1;
+	if (!UiStateInitialize(&client->ui)) {
+		return 1;
+	}
+	BackgroundPlanInitialize(&client->background_plan);
+	if (record_path) {
+		client->recorder = new StreamRecorder {};
+		if (!StreamRecorderOpen(client->recorder, fopen(record_path, "wb"), true)) {
+			fprintf(stderr, "Could not open %s\n", record_path);
+			return 1;
+		}
+	}
+
+	uint64_t start = ClockNowNs();
+	bool embedded = !server;
+	if (embedded) {
+		// nvim --embed, then everything after --
+		std::vector<char *> nvim_argv;
+		nvim_argv.push_back(const_cast<char *>(nvim_path ? nvim_path : "nvim"));
+		nvim_argv.push_back(const_cast<char *>("--embed"));
+		for (int i = 1; i < argc; ++i) {
+			if (!strcmp(argv[i], "--")) {
+				nvim_argv.insert(nvim_argv.end(), argv + i + 1, argv + argc);
+				break;
+			}
+		}
+		nvim_argv.push_back(nullptr);
+		if (!TransportSpawn(&client->transport, nvim_argv.data(), PIPE_BUFFER_SIZE)) {
+			fprintf(stderr, "Could not start %s\n", nvim_argv[0]);
+			return 1;
+		}
+	}
+	else if (!TransportConnect(&client->transport, server, 0)) {
+		fprintf(stderr, "Could not connect to %s\n", server);
+		return 1;
+	}
+
+	client->reader = new MessageReader {};
+	if (!MessageReaderInitialize(client->reader, DEFAULT_READER_RING_SIZE, ReadNvimOutput, WakeMainThread,
+		TranslateNvimMessage, client)) {
+		return 1;
+	}
+	std::thread reader_thread(MessageReaderRun, client->reader);
+
+	bool success = Handshake(client, embedded, rows, cols);
+	if (success) {
+		printf("startup: %.1f ms to the first flush, nvim api level %lld\n",
+			static_cast<double>(ClockNowNs() - start) / 1e6, static_cast<long long>(client->api_level));
+
+		uint64_t flushes_before = client->flushes;
+		client->key_latencies.clear();
+		uint64_t run_start = ClockNowNs();
+		for (int i = 0; i < repeat && success; ++i) {
+			for (const ScriptStep &step : steps) {
+				if (!RunStep(client, &step, static_cast<uint64_t>(key_timeout_ms) * MS)) {
+					fprintf(stderr, "nvim went away during the script\n");
+					success = false;
+					break;
+				}
+			}
+		}
+		if (success) {
+			ReportRun(client, ClockNowNs() - run_start, flushes_before, steps.size() * static_cast<size_t>(repeat));
+		}
+	}
+
+	// Quit an embedded nvim, a server is only detached from
+	if (embedded && !client->reader->finished.load()) {
+		char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
+		Send(client, data, NvimEncodeCommand(data, RegisterRequest(client, nvim_command), "qa!"));
+		PumpUntil(client, ClockNowNs() + REQUEST_TIMEOUT_NS, []() { return false; });
+	}
+	// nvim closing its output means it is exiting, otherwise it is killed
+	uint32_t exit_code = 0;
+	bool exited = embedded && client->reader->finished.load() && TransportWaitForExit(&client->transport, &exit_code);
+	if (!success && exited) {
+		// The reason nvim failed is usually on its stderr
+		char buffer[4096];
+		size_t size;
+		while ((size = TransportReadError(&client->transport, buffer, sizeof(buffer))) > 0) {
+			fwrite(buffer, 1, size, stderr);
+		}
+	}
+	// The reader thread is done with the transport before it is released.
+	// It may be waiting for room in a full ring, what is left is dropped.
+	TransportCancel(&client->transport);
+	ReaderMessage message;
+	while (!client->reader->finished.load()) {
+		while (MessageReaderPop(client->reader, &message)) {
+			MessageReaderRelease(client->reader, &message);
+		}
+		std::this_thread::yield();
+	}
+	reader_thread.join();
+	TransportClose(&client->transport);
+	if (client->recorder) {
+		StreamRecorderClose(client->recorder);
+		delete client->recorder;
+	}
+	MessageReaderShutdown(client->reader);
+	delete client->reader;
+	BackgroundPlanShutdown(&client->background_plan);
+	UiStateShutdown(&client->ui);
+	delete client;
+
+	if (exited && exit_code != 0) {
+		fprintf(stderr, "nvim exited with %u\n", exit_code);
+		success = false;
+	}
+	return success ? 0 : 1;
+}
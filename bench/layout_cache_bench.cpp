@@ -0,0 +1,260 @@
+// Checks the row layout cache against a plain least recently used list,
+// then measures hashing and looking up rows and the hit rate of redraws
+// the renderer commonly does.
+//
+// The check looks up and inserts random rows from a pool of near
+// duplicates (rows one cell, highlight or flag apart), invalidates now and
+// then and changes the row length, and verifies every hit, every eviction
+// and that each layout is released exactly once.
+//
+// Usage: layout_cache_bench [--operations=N] [--iterations=N]
+// Exits with 1 if the cache disagrees with the list.
+
+#include <algorithm>
+#include "bench_util.h"
+#include "renderer/layout_cache.h"
+
+constexpr int COLS = 200;
+constexpr int ROWS = 60;
+
+struct Row {
+	std::vector<uint32_t> chars;
+	std::vector<uint16_t> hl_ids;
+	std::vector<uint8_t> flags;
+};
+
+static LayoutCacheRow Key(const Row &row) {
+	return LayoutCacheRow { row.chars.data(), row.hl_ids.data(), row.flags.data(), static_cast<int>(row.chars.size()) };
+}
+
+static Row RandomRow(int cols, BenchRandom *random) {
+	Row row;
+	for (int i = 0; i < cols; ++i) {
+		row.chars.push_back(' ' + random->Below(95));
+		row.hl_ids.push_back(static_cast<uint16_t>(random->Below(4)));
+		row.flags.push_back(0);
+	}
+	return row;
+}
+
+// Layouts are ids here, released ones are counted to catch leaks and
+// double releases
+static std::vector<int> release_counts;
+static void ReleaseLayout(void *layout) {
+	++release_counts[reinterpret_cast<uintptr_t>(layout)];
+}
+
+struct ReferenceEntry {
+	int row;
+	uintptr_t layout;
+};
+
+static bool Check(int operations) {
+	LayoutCache *cache = new LayoutCache;
+	LayoutCacheInitialize(cache, ReleaseLayout);
+	BenchRandom random { 15 };
+	release_counts.assign(1, 0);
+
+	// Near duplicates of a few rows, in two lengths
+	std::vector<Row> pool;
+	for (int cols : { COLS, COLS / 2 }) {
+		for (int i = 0; i < 200; ++i) {
+			Row row = RandomRow(cols, &random);
+			pool.push_back(row);
+			Row variant = row;
+			switch (random.Below(3)) {
+			case 0: {
+				variant.chars[random.Below(cols)] ^= 1;
+			} break;
+			case 1: {
+				variant.hl_ids[random.Below(cols)] ^= 1;
+			} break;
+			case 2: {
+				variant.flags[random.Below(cols)] ^= 1;
+			} break;
+			}
+			pool.push_back(variant);
+		}
+	}
+
+	// Most recently used first
+	std::vector<ReferenceEntry> reference;
+	int cols = COLS;
+	uintptr_t next_layout = 1;
+	bool ok = true;
+	for (int i = 0; i < operations && ok; ++i) {
+		if (random.Below(2000) == 0) {
+			LayoutCacheInvalidate(cache);
+			reference.clear();
+			continue;
+		}
+		if (random.Below(5000) == 0) {
+			cols = cols == COLS ? COLS / 2 : COLS;
+		}
+
+		// Lengths alternate in halves of the pool, the 400 rows of a
+		// length don't fit, so the cache keeps evicting
+		int index = static_cast<int>(random.Below(400)) + (cols == COLS ? 0 : 400);
+		LayoutCacheRow key = Key(pool[index]);
+		uint64_t hash = LayoutCacheHash(cache, &key);
+		uintptr_t found = reinterpret_cast<uintptr_t>(LayoutCacheFind(cache, hash, &key));
+
+		auto match = std::find_if(reference.begin(), reference.end(),
+			[&](const ReferenceEntry &entry) { return entry.row == index; });
+		uintptr_t expected = match != reference.end() ? match->layout : 0;
+		if (found != expected) {
+			fprintf(stderr, "operation %d: row %d found layout %zu, expected %zu\n",
+				i, index, static_cast<size_t>(found), static_cast<size_t>(expected));
+			ok = false;
+			break;
+		}
+		if (match != reference.end()) {
+			ReferenceEntry entry = *match;
+			reference.erase(match);
+			reference.insert(reference.begin(), entry);
+			continue;
+		}
+
+		// A different length starts the cache over
+		if (!reference.empty() && static_cast<int>(pool[reference.front().row].chars.size()) != key.cols) {
+			reference.clear();
+		}
+		release_counts.push_back(0);
+		if (!LayoutCacheInsert(cache, hash, &key, reinterpret_cast<void *>(next_layout))) {
+			fprintf(stderr, "operation %d: insert failed\n", i);
+			ok = false;
+			break;
+		}
+		reference.insert(reference.begin(), ReferenceEntry { index, next_layout++ });
+		if (reference.size() > LAYOUT_CACHE_ENTRIES) {
+			reference.pop_back();
+		}
+	}
+
+	// Everything but the entries still cached was released once
+	for (const ReferenceEntry &entry : reference) {
+		if (release_counts[entry.layout] != 0) {
+			fprintf(stderr, "layout %zu released while cached\n", static_cast<size_t>(entry.layout));
+			ok = false;
+		}
+		release_counts[entry.layout] = 1;
+	}
+	for (size_t layout = 1; layout < next_layout && ok; ++layout) {
+		if (release_counts[layout] != 1) {
+			fprintf(stderr, "layout %zu released %d times\n", layout, release_counts[layout]);
+			ok = false;
+		}
+	}
+	LayoutCacheShutdown(cache);
+	for (const ReferenceEntry &entry : reference) {
+		if (ok && release_counts[entry.layout] != 2) {
+			fprintf(stderr, "layout %zu not released on shutdown\n", static_cast<size_t>(entry.layout));
+			ok = false;
+		}
+	}
+
+	printf("check: %s, %d operations, %llu hits, %llu misses, %llu evictions, %llu invalidations\n",
+		ok ? "ok" : "FAILED", operations, static_cast<unsigned long long>(cache->stats.hits),
+		static_cast<unsigned long long>(cache->stats.misses), static_cast<unsigned long long>(cache->stats.evictions),
+		static_cast<unsigned long long>(cache->stats.invalidations));
+	delete cache;
+	return ok;
+}
+
+static void IgnoreLayout(void *) {
+}
+
+// Draws rows of a screen as the renderer would, a layout per miss
+struct Trace {
+	const char *name;
+	const char *description;
+	// Changes the screen for a frame, returns the rows drawn
+	int (*frame)(std::vector<Row> *screen, int frame, BenchRandom *random, int *drawn);
+};
+
+// The cursor moving up and down: the row it left, the row it is on and
+// the statusline with the new position, which cycles through 40 lines
+static int CursorFrame(std::vector<Row> *screen, int frame, BenchRandom *, int *drawn) {
+	int row = frame % 80 < 40 ? frame % 40 : 39 - frame % 40;
+	screen->back().chars[COLS - 4] = '0' + row / 10;
+	screen->back().chars[COLS - 3] = '0' + row % 10;
+	drawn[0] = row;
+	drawn[1] = row > 0 ? row - 1 : row + 1;
+	drawn[2] = ROWS - 1;
+	return 3;
+}
+
+// Typing into a line: the line changes every frame, as does the
+// statusline's column
+static int TypingFrame(std::vector<Row> *screen, int frame, BenchRandom *random, int *drawn) {
+	int col = frame % (COLS - 20);
+	(*screen)[10].chars[col] = ' ' + random->Below(95);
+	screen->back().chars[COLS - 4] = '0' + col / 10 % 10;
+	screen->back().chars[COLS - 3] = '0' + col % 10;
+	drawn[0] = 10;
+	drawn[1] = ROWS - 1;
+	return 2;
+}
+
+static const Trace TRACES[] {
+	{ "cursor_moves", "j and k over 40 lines", CursorFrame },
+	{ "typing", "inserting text into a line", TypingFrame },
+};
+
+static void Measure(int iterations) {
+	constexpr int FRAMES = 20000;
+	BenchRandom random { 16 };
+	LayoutCache *cache = new LayoutCache;
+	for (const Trace &trace : TRACES) {
+		uint64_t best_ns = UINT64_MAX;
+		uint64_t lookups = 0;
+		for (int i = 0; i < iterations; ++i) {
+			LayoutCacheInitialize(cache, IgnoreLayout);
+			std::vector<Row> screen;
+			for (int row = 0; row < ROWS; ++row) {
+				screen.push_back(RandomRow(COLS, &random));
+			}
+
+			lookups = 0;
+			uint64_t start = BenchNowNs();
+			for (int frame = 0; frame < FRAMES; ++frame) {
+				int drawn[ROWS];
+				int count = trace.frame(&screen, frame, &random, drawn);
+				for (int j = 0; j < count; ++j) {
+					LayoutCacheRow key = Key(screen[drawn[j]]);
+					uint64_t hash = LayoutCacheHash(cache, &key);
+					if (!LayoutCacheFind(cache, hash, &key)) {
+						LayoutCacheInsert(cache, hash, &key, &screen);
+					}
+				}
+				lookups += count;
+			}
+			uint64_t elapsed = BenchNowNs() - start;
+			best_ns = elapsed < best_ns ? elapsed : best_ns;
+			if (i + 1 < iterations) {
+				LayoutCacheShutdown(cache);
+			}
+		}
+
+		printf("\n%s: %s, %d columns\n", trace.name, trace.description, COLS);
+		BenchReport("  hash and lookup", best_ns, lookups, lookups * COLS * 7);
+		printf("  %.1f%% of rows drawn hit, %llu evictions\n",
+			100.0 * static_cast<double>(cache->stats.hits) / static_cast<double>(lookups),
+			static_cast<unsigned long long>(cache->stats.evictions));
+		LayoutCacheShutdown(cache);
+	}
+	delete cache;
+}
+
+int main(int argc, char **argv) {
+	int operations = BenchArgInt(argc, argv, "--operations", 200000);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 5);
+	if (operations <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: layout_cache_bench [--operations=N] [--iterations=N]\n");
+		return 2;
+	}
+
+	bool ok = Check(operations);
+	Measure(iterations);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,331 @@
+// Measures end to end throughput of nvim output going through an anonymous
+// pipe to a consumer thread, comparing a blocking handoff per message (the
+// way Nvy used to SendMessage every message to the window thread) against
+// MessageReader's byte ring and SPSC queue. Every message that reaches the
+// consumer is checked against the framed input stream.
+//
+// Usage: reader_bench [--frames=N] [--rows=N] [--cols=N] [--large-every=N]
+//                     [--ring-size=<KB>] [--pipe-size=<KB>] [--write-size=<KB>]
+//                     [--consumer-ns=N] [--iterations=N]
+// The default ring is the minimum size so wrapping and the heap fallback for
+// oversized messages (every --large-every frames) are exercised too.
+
+#include "bench_util.h"
+#include "nvim/message_reader.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static bool BenchPipe(int fds[2], size_t pipe_size) {
+#ifdef _WIN32
+	return _pipe(fds, static_cast<unsigned int>(pipe_size), _O_BINARY) == 0;
+#else
+	if (pipe(fds) != 0) {
+		return false;
+	}
+#ifdef F_SETPIPE_SZ
+	// Best effort, unprivileged processes are capped by /proc/sys/fs/pipe-max-size
+	fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(pipe_size));
+#endif
+	return true;
+#endif
+}
+
+static size_t BenchPipeRead(int fd, char *buffer, size_t size) {
+#ifdef _WIN32
+	int bytes = _read(fd, buffer, static_cast<unsigned int>(size));
+#else
+	ssize_t bytes = read(fd, buffer, size);
+#endif
+	return bytes > 0 ? static_cast<size_t>(bytes) : 0;
+}
+
+static bool BenchPipeWrite(int fd, const char *data, size_t size) {
+	while (size > 0) {
+#ifdef _WIN32
+		int bytes = _write(fd, data, static_cast<unsigned int>(size));
+#else
+		ssize_t bytes = write(fd, data, size);
+#endif
+		if (bytes <= 0) {
+			return false;
+		}
+		data += bytes;
+		size -= static_cast<size_t>(bytes);
+	}
+	return true;
+}
+
+static void BenchPipeClose(int fd) {
+#ifdef _WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+}
+
+static uint64_t HashBytes(const char *data, size_t size) {
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; ++i) {
+		hash = (hash ^ static_cast<uint8_t>(data[i])) * 1099511628211ull;
+	}
+	return hash;
+}
+
+struct ExpectedMessage {
+	size_t size;
+	uint64_t hash;
+};
+
+// Stands in for the window thread: verifies the message, walks it the way
+// the redraw decoder would and optionally burns some extra time
+struct Consumer {
+	const std::vector<ExpectedMessage> *expected;
+	uint64_t consumer_ns;
+	size_t next;
+	uint64_t mismatches;
+	uint64_t elements;
+
+	void Consume(const char *data, size_t size) {
+		if (next >= expected->size() || (*expected)[next].size != size ||
+			(*expected)[next].hash != HashBytes(data, size)) {
+			++mismatches;
+		}
+		++next;
+
+		MPackCursor cursor = MPackCursorInit(data, size);
+		MPackCursorSkip(&cursor);
+		elements += MPackCursorOk(&cursor) ? 1 : 0;
+
+		if (consumer_ns) {
+			uint64_t until = BenchNowNs() + consumer_ns;
+			while (BenchNowNs() < until) {
+			}
+		}
+	}
+};
+
+static void WriteStream(int fd, const std::vector<char> *stream, size_t write_size) {
+	size_t offset = 0;
+	while (offset < stream->size()) {
+		size_t size = stream->size() - offset < write_size ? stream->size() - offset : write_size;
+		if (!BenchPipeWrite(fd, stream->data() + offset, size)) {
+			break;
+		}
+		offset += size;
+	}
+	BenchPipeClose(fd);
+}
+
+// Reader thread frames into a growing buffer and blocks until the consumer
+// has processed each message before reading on
+static uint64_t RunBlockingHandoff(const std::vector<char> &stream, Consumer *consumer,
+	size_t pipe_size, size_t write_size) {
+	int fds[2];
+	if (!BenchPipe(fds, pipe_size)) {
+		return 0;
+	}
+
+	std::mutex mutex;
+	std::condition_variable handed_off;
+	std::condition_variable processed;
+	const char *pending_data = nullptr;
+	size_t pending_size = 0;
+	bool done = false;
+
+	uint64_t start = BenchNowNs();
+	std::thread writer(WriteStream, fds[1], &stream, write_size);
+	std::thread reader([&]() {
+		size_t capacity = 1024 * 1024;
+		char *buffer = static_cast<char *>(malloc(capacity));
+		size_t buffer_used = 0;
+		MPackFramer framer {};
+		while (true) {
+			if (buffer_used == capacity) {
+				capacity *= 2;
+				buffer = static_cast<char *>(realloc(buffer, capacity));
+			}
+			size_t bytes = BenchPipeRead(fds[0], buffer + buffer_used, capacity - buffer_used);
+			if (bytes == 0) {
+				break;
+			}
+			buffer_used += bytes;
+
+			size_t consumed = 0;
+			bool invalid = false;
+			while (consumed < buffer_used) {
+				size_t message_size = MPackFramerScan(&framer, buffer + consumed, buffer_used - consumed, &invalid);
+				if (message_size == 0) {
+					break;
+				}
+				std::unique_lock<std::mutex> lock(mutex);
+				pending_data = buffer + consumed;
+				pending_size = message_size;
+				handed_off.notify_one();
+				processed.wait(lock, [&]() { return pending_data == nullptr; });
+				consumed += message_size;
+			}
+			memmove(buffer, buffer + consumed, buffer_used - consumed);
+			buffer_used -= consumed;
+		}
+		free(buffer);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		done = true;
+		handed_off.notify_one();
+	});
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		handed_off.wait(lock, [&]() { return pending_data != nullptr || done; });
+		if (pending_data) {
+			consumer->Consume(pending_data, pending_size);
+			pending_data = nullptr;
+			processed.notify_one();
+		}
+		else {
+			break;
+		}
+	}
+	lock.unlock();
+	uint64_t elapsed = BenchNowNs() - start;
+
+	reader.join();
+	writer.join();
+	BenchPipeClose(fds[0]);
+	return elapsed;
+}
+
+struct RingContext {
+	int fd;
+	std::atomic<uint32_t> wake_signal;
+};
+
+static size_t RingRead(void *context, char *buffer, size_t size) {
+	return BenchPipeRead(static_cast<RingContext *>(context)->fd, buffer, size);
+}
+
+static void RingWake(void *context) {
+	RingContext *ring_context = static_cast<RingContext *>(context);
+	ring_context->wake_signal.fetch_add(1);
+	ring_context->wake_signal.notify_one();
+}
+
+static uint64_t RunMessageReader(const std::vector<char> &stream, Consumer *consumer,
+	size_t pipe_size, size_t write_size, size_t ring_size, MessageReader *reader) {
+	int fds[2];
+	if (!BenchPipe(fds, pipe_size)) {
+		return 0;
+	}
+	RingContext context { fds[0], 0 };
+	if (!MessageReaderInitialize(reader, ring_size, RingRead, RingWake, nullptr, &context)) {
+		return 0;
+	}
+
+	uint64_t start = BenchNowNs();
+	std::thread writer(WriteStream, fds[1], &stream, write_size);
+	std::thread reader_thread(MessageReaderRun, reader);
+
+	uint32_t seen = 0;
+	while (true) {
+		context.wake_signal.wait(seen);
+		seen = context.wake_signal.load();
+
+		// Same order as the window thread's WM_NVIM_MESSAGE handler
+		bool finished = reader->finished.load();
+		MessageReaderBeginDrain(reader);
+		ReaderMessage message;
+		while (MessageReaderPop(reader, &message)) {
+			consumer->Consume(message.data, message.size);
+			MessageReaderRelease(reader, &message);
+		}
+		if (finished) {
+			break;
+		}
+	}
+	uint64_t elapsed = BenchNowNs() - start;
+
+	reader_thread.join();
+	writer.join();
+	BenchPipeClose(fds[0]);
+	MessageReaderShutdown(reader);
+	return elapsed;
+}
+
+int main(int argc, char **argv) {
+	int frames = BenchArgInt(argc, argv, "--frames", 300);
+	int rows = BenchArgInt(argc, argv, "--rows", 60);
+	int cols = BenchArgInt(argc, argv, "--cols", 200);
+	int large_every = BenchArgInt(argc, argv, "--large-every", 50);
+	size_t ring_size = static_cast<size_t>(BenchArgInt(argc, argv, "--ring-size", 1024)) * 1024;
+	size_t pipe_size = static_cast<size_t>(BenchArgInt(argc, argv, "--pipe-size", 1024)) * 1024;
+	size_t write_size = static_cast<size_t>(BenchArgInt(argc, argv, "--write-size", 64)) * 1024;
+	uint64_t consumer_ns = static_cast<uint64_t>(BenchArgInt(argc, argv, "--consumer-ns", 20000));
+	int iterations = BenchArgInt(argc, argv, "--iterations", 3);
+	if (write_size == 0) {
+		write_size = 1;
+	}
+
+	// Regular repaints with the occasional one too large for the ring
+	std::vector<char> stream;
+	for (int i = 0; i < frames; ++i) {
+		bool large = large_every > 0 && i % large_every == large_every - 1;
+		BenchGenerateRepaintStream(&stream, 1, large ? rows * 40 : rows, cols, 6, BenchCellText::Ascii, i + 1);
+	}
+
+	std::vector<BenchMessage> messages;
+	if (!BenchFrameStream(stream, &messages)) {
+		fprintf(stderr, "Malformed msgpack stream\n");
+		return 1;
+	}
+	std::vector<ExpectedMessage> expected;
+	for (const BenchMessage &message : messages) {
+		expected.push_back(ExpectedMessage { message.size, HashBytes(stream.data() + message.offset, message.size) });
+	}
+	printf("stream: %zu messages, %zu bytes, ring %zu KB, consumer %llu ns/message\n", messages.size(),
+		stream.size(), ring_size / 1024, static_cast<unsigned long long>(consumer_ns));
+
+	uint64_t blocking_ns = UINT64_MAX;
+	uint64_t ring_ns = UINT64_MAX;
+	MessageReader *reader = new MessageReader {};
+	for (int i = 0; i < iterations; ++i) {
+		Consumer blocking_consumer { &expected, consumer_ns, 0, 0, 0 };
+		uint64_t elapsed = RunBlockingHandoff(stream, &blocking_consumer, pipe_size, write_size);
+		if (blocking_consumer.mismatches || blocking_consumer.next != expected.size()) {
+			fprintf(stderr, "Blocking handoff delivered %zu/%zu messages, %llu mismatched\n",
+				blocking_consumer.next, expected.size(), static_cast<unsigned long long>(blocking_consumer.mismatches));
+			return 1;
+		}
+		blocking_ns = elapsed < blocking_ns ? elapsed : blocking_ns;
+
+		delete reader;
+		reader = new MessageReader {};
+		Consumer ring_consumer { &expected, consumer_ns, 0, 0, 0 };
+		elapsed = RunMessageReader(stream, &ring_consumer, pipe_size, write_size, ring_size, reader);
+		if (ring_consumer.mismatches || ring_consumer.next != expected.size() ||
+			reader->bytes_read.load() != stream.size()) {
+			fprintf(stderr, "MessageReader delivered %zu/%zu messages, %llu mismatched\n",
+				ring_consumer.next, expected.size(), static_cast<unsigned long long>(ring_consumer.mismatches));
+			return 1;
+		}
+		BenchKeep(blocking_consumer.elements + ring_consumer.elements);
+		ring_ns = elapsed < ring_ns ? elapsed : ring_ns;
+	}
+
+	printf("best of %d, last reader run: %llu wakeups, %llu stalls, %llu heap messages\n", iterations,
+		static_cast<unsigned long long>(reader->wakeups.load()),
+		static_cast<unsigned long long>(reader->producer_stalls.load()),
+		static_cast<unsigned long long>(reader->heap_messages.load()));
+	BenchReport("blocking handoff", blocking_ns, messages.size(), stream.size());
+	BenchReport("ring + spsc queue", ring_ns, messages.size(), stream.size());
+	delete reader;
+	return 0;
+}
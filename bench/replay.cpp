@@ -0,0 +1,368 @@
+// Replays a recording made with `Nvy --record=<file>` through the same
+// decode and grid update path Nvy runs, without drawing anything. Runs as
+// fast as possible by default, or paced like the original session with
+// --realtime, and reports throughput and the cost of every event type.
+//
+// Usage: replay --recording=<file> [--realtime] [--speed=<percent>]
+//               [--generate] [--frames=N] [--rows=N] [--cols=N]
+// --generate first writes a synthetic recording of 60 fps repaints to
+// --recording, split into reads of random size, and then replays it.
+//
+// The fast run is repeated with timers around every event to attribute
+// cost, both runs have to leave the grid in the same state.
+
+#include "bench_util.h"
+#include <thread>
+#include "common/mapped_file.h"
+#include "nvim/redraw_commands.h"
+#include "nvim/stream_recorder.h"
+#include "renderer/grid.h"
+
+struct ReplayStats {
+	uint64_t records;
+	uint64_t duration_ns;
+	uint64_t inbound_bytes;
+	uint64_t outbound_records;
+	uint64_t outbound_bytes;
+	uint64_t messages;
+	uint64_t redraw_messages;
+	uint64_t commands;
+	uint64_t cells;
+
+	// Only filled in when profiling
+	RedrawTranslateProfile translate;
+	uint64_t apply_ns[REDRAW_EVENT_COUNT];
+	uint64_t slowest_message_ns;
+	uint64_t slowest_message_time_ns;
+	uint64_t max_lateness_ns;
+};
+
+struct Replay {
+	Grid grid;
+	int cursor_row;
+	int cursor_col;
+	bool profile;
+	ReplayStats stats;
+
+	// The start of a message continued in the next record
+	std::vector<char> carry;
+	MPackFramer framer;
+	bool invalid;
+};
+
+// The grid side of RendererExecute
+static void ApplyCommand(Replay *replay, const RedrawCommand *command) {
+	switch (command->event) {
+	case RedrawEvent::grid_resize: {
+		const RedrawCommandGridResize *grid_resize = reinterpret_cast<const RedrawCommandGridResize *>(command);
+		GridResize(&replay->grid, grid_resize->height, grid_resize->width);
+	} break;
+	case RedrawEvent::grid_clear: {
+		if (replay->grid.chars) {
+			GridClear(&replay->grid);
+		}
+	} break;
+	case RedrawEvent::grid_line: {
+		const RedrawCommandGridLine *grid_line = reinterpret_cast<const RedrawCommandGridLine *>(command);
+		if (GridUpdateLine(&replay->grid, grid_line)) {
+			replay->stats.cells += grid_line->cell_count;
+		}
+	} break;
+	case RedrawEvent::grid_cursor_goto: {
+		const RedrawCommandGridCursorGoto *cursor_goto = reinterpret_cast<const RedrawCommandGridCursorGoto *>(command);
+		replay->cursor_row = cursor_goto->row;
+		replay->cursor_col = cursor_goto->col;
+	} break;
+	case RedrawEvent::grid_scroll: {
+		GridScroll(&replay->grid, reinterpret_cast<const RedrawCommandGridScroll *>(command));
+	} break;
+	default: {
+	} break;
+	}
+}
+
+static void ProcessMessage(Replay *replay, const char *data, size_t size, uint64_t record_time_ns) {
+	ReplayStats *stats = &replay->stats;
+	++stats->messages;
+	uint64_t start = replay->profile ? BenchNowNs() : 0;
+
+	size_t commands_size;
+	char *commands = RedrawTranslate(data, size, &commands_size, replay->profile ? &stats->translate : nullptr);
+	if (!commands) {
+		// Responses and requests, Nvy handles these on the window thread
+		return;
+	}
+	++stats->redraw_messages;
+
+	RedrawCommandReader reader;
+	RedrawCommandsBegin(&reader, commands, commands_size);
+	while (const RedrawCommand *command = RedrawNextCommand(&reader)) {
+		++stats->commands;
+		if (replay->profile) {
+			uint64_t apply_start = BenchNowNs();
+			ApplyCommand(replay, command);
+			stats->apply_ns[static_cast<uint32_t>(command->event)] += BenchNowNs() - apply_start;
+		}
+		else {
+			ApplyCommand(replay, command);
+		}
+	}
+	free(commands);
+
+	if (replay->profile) {
+		uint64_t elapsed = BenchNowNs() - start;
+		if (elapsed > stats->slowest_message_ns) {
+			stats->slowest_message_ns = elapsed;
+			stats->slowest_message_time_ns = record_time_ns;
+		}
+	}
+}
+
+// Returns how many bytes were consumed by complete messages
+static size_t FrameMessages(Replay *replay, const char *data, size_t size, uint64_t record_time_ns) {
+	size_t consumed = 0;
+	while (consumed < size) {
+		size_t message_size = MPackFramerScan(&replay->framer, data + consumed, size - consumed, &replay->invalid);
+		if (message_size == 0) {
+			break;
+		}
+		ProcessMessage(replay, data + consumed, message_size, record_time_ns);
+		consumed += message_size;
+	}
+	return consumed;
+}
+
+static void FeedInbound(Replay *replay, const StreamRecord *record) {
+	if (replay->invalid) {
+		return;
+	}
+	// Messages within a single record are decoded straight from the mapping
+	if (replay->carry.empty()) {
+		size_t consumed = FrameMessages(replay, record->data, record->size, record->time_ns);
+		replay->carry.assign(record->data + consumed, record->data + record->size);
+	}
+	else {
+		replay->carry.insert(replay->carry.end(), record->data, record->data + record->size);
+		size_t consumed = FrameMessages(replay, replay->carry.data(), replay->carry.size(), record->time_ns);
+		replay->carry.erase(replay->carry.begin(), replay->carry.begin() + consumed);
+	}
+}
+
+// Returns the elapsed time, or 0 if the recording is malformed
+static uint64_t RunReplay(const MappedFile *file, Replay *replay, bool realtime, int speed_percent) {
+	StreamRecordingReader reader;
+	if (!StreamRecordingBegin(&reader, file->data, file->size)) {
+		return 0;
+	}
+
+	uint64_t start = BenchNowNs();
+	StreamRecord record;
+	while (StreamRecordingNext(&reader, &record)) {
+		ReplayStats *stats = &replay->stats;
+		++stats->records;
+		stats->duration_ns = record.time_ns;
+		if (realtime) {
+			uint64_t due = start + record.time_ns * 100 / static_cast<uint64_t>(speed_percent);
+			uint64_t now = BenchNowNs();
+			if (now < due) {
+				std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+			}
+			else if (now - due > stats->max_lateness_ns) {
+				stats->max_lateness_ns = now - due;
+			}
+		}
+
+		if (record.direction == StreamDirection::Outbound) {
+			++stats->outbound_records;
+			stats->outbound_bytes += record.size;
+			continue;
+		}
+		stats->inbound_bytes += record.size;
+		FeedInbound(replay, &record);
+	}
+	uint64_t elapsed = BenchNowNs() - start;
+
+	if (reader.offset != reader.size) {
+		printf("recording ends in a truncated record at byte %zu\n", reader.offset);
+	}
+	if (replay->invalid) {
+		printf("malformed msgpack in the recording, replay stopped early\n");
+	}
+	return elapsed > 0 ? elapsed : 1;
+}
+
+static uint64_t GridChecksum(const Replay *replay) {
+	uint64_t checksum = static_cast<uint64_t>(replay->cursor_row) * 31 + static_cast<uint64_t>(replay->cursor_col);
+	const Grid *grid = &replay->grid;
+	for (int row = 0; row < grid->rows; ++row) {
+		size_t base = GridRowOffset(grid, row);
+		for (size_t i = base; i < base + grid->cols; ++i) {
+			checksum = checksum * 1099511628211ull + grid->chars[i] * 7 + grid->hl_ids[i] * 3 + grid->flags[i];
+		}
+	}
+	return checksum;
+}
+
+static void WriteGridResize(std::vector<char> *stream, int rows, int cols) {
+	char *data;
+	size_t size;
+	mpack_writer_t writer;
+	mpack_writer_init_growable(&writer, &data, &size);
+	mpack_start_array(&writer, 3);
+	mpack_write_int(&writer, 2);
+	mpack_write_cstr(&writer, "redraw");
+	mpack_start_array(&writer, 1);
+	mpack_start_array(&writer, 2);
+	mpack_write_cstr(&writer, "grid_resize");
+	mpack_start_array(&writer, 3);
+	mpack_write_int(&writer, 1);
+	mpack_write_int(&writer, cols);
+	mpack_write_int(&writer, rows);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	if (mpack_writer_destroy(&writer) == mpack_ok) {
+		stream->insert(stream->end(), data, data + size);
+	}
+	MPACK_FREE(data);
+}
+
+// Writes a session of 60 fps repaints the way Nvy records one, nvim's
+// output arriving in reads of varying size with the odd key sent back
+static bool GenerateRecording(const char *path, int frames, int rows, int cols) {
+	std::vector<char> stream;
+	WriteGridResize(&stream, rows, cols);
+	BenchGenerateRepaintStream(&stream, frames - frames / 4, rows, cols, 6, BenchCellText::Ascii, 1);
+	BenchGenerateRepaintStream(&stream, frames / 8, rows, cols, 6, BenchCellText::Cjk, 2);
+	BenchGenerateRepaintStream(&stream, frames / 4 - frames / 8, rows, cols, 6, BenchCellText::Emoji, 3);
+
+	StreamRecorder *recorder = new StreamRecorder {};
+	if (!StreamRecorderOpen(recorder, fopen(path, "wb"), true)) {
+		delete recorder;
+		return false;
+	}
+	constexpr uint64_t FRAME_NS = 16'666'667;
+	constexpr char KEY_MESSAGE[] = "\x94\x00\x01\xaanvim_input\x91\xa1j";
+	BenchRandom random { 7 };
+	size_t offset = 0;
+	while (offset < stream.size()) {
+		uint64_t time_ns = static_cast<uint64_t>(static_cast<double>(offset) / static_cast<double>(stream.size()) *
+			static_cast<double>(frames) * FRAME_NS);
+		size_t read_size = 1 + random.Below(64 * 1024);
+		if (read_size > stream.size() - offset) {
+			read_size = stream.size() - offset;
+		}
+		StreamRecorderWriteAt(recorder, StreamDirection::Inbound, time_ns, stream.data() + offset, read_size);
+		offset += read_size;
+		if (random.Below(8) == 0) {
+			StreamRecorderWriteAt(recorder, StreamDirection::Outbound, time_ns, KEY_MESSAGE, sizeof(KEY_MESSAGE) - 1);
+		}
+	}
+	bool written = !recorder->failed;
+	printf("generated %s: %zu bytes of nvim output in %llu records\n", path, stream.size(),
+		static_cast<unsigned long long>(recorder->records_written));
+	StreamRecorderClose(recorder);
+	delete recorder;
+	return written;
+}
+
+static void PrintEventCosts(const ReplayStats *stats) {
+	printf("\n%-20s %10s %14s %14s %12s\n", "event", "count", "decode ns/ev", "apply ns/ev", "total ms");
+	for (uint32_t i = 0; i < REDRAW_EVENT_COUNT; ++i) {
+		uint64_t count = stats->translate.count[i];
+		if (count == 0) {
+			continue;
+		}
+		uint64_t decode_ns = stats->translate.ns[i];
+		uint64_t apply_ns = stats->apply_ns[i];
+		printf("%-20s %10llu %14.1f %14.1f %12.2f\n", REDRAW_EVENT_NAMES[i], static_cast<unsigned long long>(count),
+			static_cast<double>(decode_ns) / static_cast<double>(count),
+			static_cast<double>(apply_ns) / static_cast<double>(count),
+			static_cast<double>(decode_ns + apply_ns) / 1e6);
+	}
+	printf("slowest message: %.2f ms, %.3f s into the recording\n", static_cast<double>(stats->slowest_message_ns) / 1e6,
+		static_cast<double>(stats->slowest_message_time_ns) / 1e9);
+}
+
+int main(int argc, char **argv) {
+	const char *path = BenchArg(argc, argv, "--recording");
+	if (!path) {
+		fprintf(stderr, "Usage: replay --recording=<file> [--realtime] [--speed=<percent>] [--generate]\n");
+		return 1;
+	}
+	bool realtime = false;
+	bool generate = false;
+	for (int i = 1; i < argc; ++i) {
+		realtime |= !strcmp(argv[i], "--realtime");
+		generate |= !strcmp(argv[i], "--generate");
+	}
+	int speed_percent = BenchArgInt(argc, argv, "--speed", 100);
+	if (speed_percent <= 0) {
+		speed_percent = 100;
+	}
+
+	if (generate && !GenerateRecording(path, BenchArgInt(argc, argv, "--frames", 120),
+		BenchArgInt(argc, argv, "--rows", 60), BenchArgInt(argc, argv, "--cols", 200))) {
+		fprintf(stderr, "Could not write %s\n", path);
+		return 1;
+	}
+
+	MappedFile file;
+	if (!MappedFileOpen(&file, path)) {
+		fprintf(stderr, "Could not map %s\n", path);
+		return 1;
+	}
+
+	// Paced replays are about reproducing a session, they always profile
+	Replay *fast = nullptr;
+	uint64_t fast_ns = 0;
+	if (!realtime) {
+		fast = new Replay {};
+		fast_ns = RunReplay(&file, fast, false, speed_percent);
+	}
+	Replay *profiled = new Replay {};
+	profiled->profile = true;
+	uint64_t profiled_ns = RunReplay(&file, profiled, realtime, speed_percent);
+	if (profiled_ns == 0) {
+		fprintf(stderr, "%s is not a recording of format version %u\n", path, STREAM_RECORDING_VERSION);
+		return 1;
+	}
+
+	const ReplayStats *stats = &profiled->stats;
+	printf("recording: %s, %zu bytes, %llu records, %.3f s long\n", path, file.size,
+		static_cast<unsigned long long>(stats->records), static_cast<double>(stats->duration_ns) / 1e9);
+	printf("inbound: %llu bytes, %llu messages (%llu redraw, %llu commands, %llu cells)\n",
+		static_cast<unsigned long long>(stats->inbound_bytes), static_cast<unsigned long long>(stats->messages),
+		static_cast<unsigned long long>(stats->redraw_messages), static_cast<unsigned long long>(stats->commands),
+		static_cast<unsigned long long>(stats->cells));
+	printf("outbound: %llu bytes in %llu records\n", static_cast<unsigned long long>(stats->outbound_bytes),
+		static_cast<unsigned long long>(stats->outbound_records));
+	if (realtime) {
+		printf("paced at %d%%, fell behind the recording by at most %.2f ms\n", speed_percent,
+			static_cast<double>(stats->max_lateness_ns) / 1e6);
+	}
+
+	if (fast) {
+		if (GridChecksum(fast) != GridChecksum(profiled) || fast->stats.commands != stats->commands) {
+			fprintf(stderr, "Profiled replay diverged from the fast one\n");
+			return 1;
+		}
+		BenchReport("replay (events)", fast_ns, fast->stats.commands, fast->stats.inbound_bytes);
+		BenchReport("replay (messages)", fast_ns, fast->stats.messages, fast->stats.inbound_bytes);
+		printf("%.0f events/s\n", static_cast<double>(fast->stats.commands) * 1e9 / static_cast<double>(fast_ns));
+	}
+	BenchReport(realtime ? "paced replay (events)" : "profiled replay (events)", profiled_ns,
+		stats->commands, stats->inbound_bytes);
+	PrintEventCosts(stats);
+
+	BenchKeep(GridChecksum(profiled));
+	if (fast) {
+		GridFree(&fast->grid);
+		delete fast;
+	}
+	GridFree(&profiled->grid);
+	delete profiled;
+	MappedFileClose(&file);
+	return 0;
+}
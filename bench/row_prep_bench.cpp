@@ -0,0 +1,359 @@
+// Checks the work pool and the row packets it prepares, then measures how
+// preparing the dirty rows of a flush scales with the pool's threads.
+//
+// The pool check runs items of very uneven cost, so threads run dry and
+// steal, on pools of every size up to --threads, and verifies every item
+// ran exactly once. The packet check prepares random grids with random
+// dirty rows on the same pools and compares every packet with one made
+// serially from the same row: scan, style runs, glyph runs or text, and
+// layout cache hash.
+//
+// The measurement prepares full repaints of synthetic grids, source code
+// with a few bold keywords and non-ASCII characters, so rows go either
+// way, on pools of 1, 2, 4, ... threads. A pool thread spinning on a
+// machine with fewer cores than threads only slows the rest down, so the
+// numbers there say little. Also measures a run of empty items, the cost
+// of waking the pool that flushes below ROW_PREP_PARALLEL_CELLS skip.
+//
+// Usage: row_prep_bench [--threads=N] [--iterations=N]
+// Exits with 1 if an item or a packet comes out wrong.
+
+#include <atomic>
+#include "bench_util.h"
+#include "renderer/row_prep.h"
+
+constexpr int HIGHLIGHTS = 64;
+constexpr TranscodeScanRules SCAN_RULES { 0x20, 0x5F, GRID_CELL_WIDE };
+
+static void ReleaseLayout(void *) {
+}
+
+// What a packet is prepared from, besides the grid
+struct PrepInputs {
+	std::vector<HighlightAttributes> hl_attribs;
+	StyleTable *styles;
+	GlyphMetrics *metrics;
+	GlyphRow glyph_row;
+	LayoutCache *layout_cache;
+};
+
+static bool InitializeInputs(PrepInputs *inputs, int cols) {
+	inputs->hl_attribs.assign(STYLE_TABLE_HIGHLIGHTS, HighlightAttributes {});
+	inputs->styles = new StyleTable;
+	inputs->metrics = new GlyphMetrics;
+	inputs->layout_cache = new LayoutCache;
+	GlyphRowInitialize(&inputs->glyph_row);
+	LayoutCacheInitialize(inputs->layout_cache, ReleaseLayout);
+	GlyphMetricsInitialize(inputs->metrics, GlyphMetricsSource { nullptr, BenchStubAdvance, BenchStubGlyphIndex });
+	if (!StyleTableInitialize(inputs->styles, inputs->hl_attribs.data()) ||
+		!GlyphRowReserve(&inputs->glyph_row, cols)) {
+		return false;
+	}
+	GlyphRowSetFont(&inputs->glyph_row, inputs->metrics, BENCH_STUB_ADVANCE, true);
+	return true;
+}
+
+static void ShutdownInputs(PrepInputs *inputs) {
+	GlyphRowShutdown(&inputs->glyph_row);
+	LayoutCacheShutdown(inputs->layout_cache);
+	GlyphMetricsShutdown(inputs->metrics);
+	StyleTableShutdown(inputs->styles);
+	delete inputs->layout_cache;
+	delete inputs->metrics;
+	delete inputs->styles;
+}
+
+// Highlights of eight colors, bold at the rate given in percent
+static void DefineHighlights(PrepInputs *inputs, BenchRandom *random, uint32_t bold_chance) {
+	const uint16_t decorations[] { HL_ATTRIB_BOLD };
+	BenchDefineHighlights(inputs->hl_attribs.data(), inputs->styles, HIGHLIGHTS, 8, decorations, 1, bold_chance, random);
+}
+
+// Indented text in runs of highlights, a non-ASCII cell at the rate given
+// in tenths of a percent
+static void FillGrid(Grid *grid, BenchRandom *random, uint32_t special_chance) {
+	for (int row = 0; row < grid->rows; ++row) {
+		size_t base = GridRowOffset(grid, row);
+		int indent = static_cast<int>(random->Below(5)) * 4;
+		int room = grid->cols - indent < 100 ? grid->cols - indent : 100;
+		int length = room > 0 ? indent + static_cast<int>(random->Below(room)) : 0;
+		uint16_t hl_id = 0;
+		for (int col = 0; col < grid->cols; ++col) {
+			if (random->Below(6) == 0) {
+				hl_id = static_cast<uint16_t>(random->Below(HIGHLIGHTS));
+			}
+			bool text = col >= indent && col < length;
+			grid->chars[base + col] = text ? ' ' + random->Below(95) : ' ';
+			grid->hl_ids[base + col] = text ? hl_id : 0;
+			grid->flags[base + col] = 0;
+			if (random->Below(1000) < special_chance) {
+				const uint32_t specials[] { 0xE9, 0x2192, 0x4E00, 0xD83DDE00 };
+				grid->chars[base + col] = specials[random->Below(4)];
+				grid->flags[base + col] = random->Below(4) == 0 ? GRID_CELL_WIDE : 0;
+			}
+		}
+	}
+}
+
+// A packet as the renderer would have made it on its own, row by row
+static bool CheckPacket(const RowPacket *packet, const Grid *grid, PrepInputs *inputs) {
+	int cols = grid->cols;
+	size_t base = GridRowOffset(grid, packet->row);
+	const uint32_t *chars = &grid->chars[base];
+	const uint16_t *hl_ids = &grid->hl_ids[base];
+	std::vector<uint32_t> run_starts(cols);
+	std::vector<uint64_t> special((cols + 63) / 64);
+	size_t run_count = TranscodeScanRow(chars, hl_ids, &grid->flags[base], cols, &SCAN_RULES,
+		run_starts.data(), special.data());
+	if (packet->run_count != run_count || memcmp(packet->run_starts, run_starts.data(), run_count * sizeof(uint32_t)) ||
+		memcmp(packet->special_cells, special.data(), special.size() * sizeof(uint64_t))) {
+		fprintf(stderr, "row %d was scanned wrong\n", packet->row);
+		return false;
+	}
+
+	size_t style_run = 0;
+	for (int col = 0; col < cols; ++col) {
+		uint16_t style_id = StyleTableStyleId(inputs->styles, hl_ids[col]);
+		if (col > 0 && style_id == StyleTableStyleId(inputs->styles, hl_ids[col - 1])) {
+			continue;
+		}
+		if (style_run >= packet->style_run_count || packet->style_starts[style_run] != static_cast<uint32_t>(col) ||
+			packet->style_colors[style_run] != StyleTableStyle(inputs->styles, style_id)->background_rgb) {
+			fprintf(stderr, "style run %zu of row %d should start at %d\n", style_run, packet->row, col);
+			return false;
+		}
+		++style_run;
+	}
+	if (style_run != packet->style_run_count) {
+		fprintf(stderr, "row %d has %zu style runs instead of %zu\n", packet->row, packet->style_run_count, style_run);
+		return false;
+	}
+
+	std::vector<uint16_t> glyph_indices(cols);
+	std::vector<GlyphRowRun> glyph_runs(cols);
+	int glyph_run_count;
+	bool direct = GlyphRowBuild(&inputs->glyph_row, inputs->styles, chars, hl_ids, special.data(), run_starts.data(),
+		run_count, cols, glyph_indices.data(), glyph_runs.data(), &glyph_run_count);
+	if (packet->direct != direct) {
+		fprintf(stderr, "row %d is %s\n", packet->row, packet->direct ? "direct" : "laid out");
+		return false;
+	}
+	if (direct) {
+		bool same_runs = packet->glyph_run_count == glyph_run_count;
+		for (int i = 0; same_runs && i < glyph_run_count; ++i) {
+			same_runs = packet->glyph_runs[i].col_begin == glyph_runs[i].col_begin &&
+				packet->glyph_runs[i].col_end == glyph_runs[i].col_end &&
+				packet->glyph_runs[i].style_id == glyph_runs[i].style_id;
+		}
+		if (!same_runs || memcmp(packet->glyph_indices, glyph_indices.data(), cols * sizeof(uint16_t))) {
+			fprintf(stderr, "the glyph runs of row %d differ\n", packet->row);
+			return false;
+		}
+		return true;
+	}
+
+	std::vector<uint16_t> text(cols * 2);
+	size_t text_length = TranscodeCellsToUtf16(chars, cols, text.data());
+	LayoutCacheRow key { chars, hl_ids, &grid->flags[base], cols };
+	if (packet->text_length != text_length || memcmp(packet->text, text.data(), text_length * sizeof(uint16_t)) ||
+		packet->layout_hash != LayoutCacheHash(inputs->layout_cache, &key)) {
+		fprintf(stderr, "the text of row %d differs\n", packet->row);
+		return false;
+	}
+	return true;
+}
+
+// Busy work of a cost that varies a lot between items
+struct PoolCheck {
+	std::vector<std::atomic<int>> runs;
+	std::vector<uint32_t> costs;
+	// Items write only their own, BenchKeep isn't safe across threads
+	std::vector<uint64_t> results;
+	std::atomic<bool> bad_worker;
+	int thread_count;
+};
+
+static void CheckItem(void *context, int item, int worker) {
+	PoolCheck *check = static_cast<PoolCheck *>(context);
+	check->runs[item].fetch_add(1, std::memory_order_relaxed);
+	if (worker < 0 || worker >= check->thread_count) {
+		check->bad_worker.store(true);
+	}
+	uint64_t value = static_cast<uint64_t>(item);
+	for (uint32_t i = 0; i < check->costs[item]; ++i) {
+		value = value * 6364136223846793005ull + 1;
+	}
+	check->results[item] = value;
+}
+
+static bool CheckPool(int max_threads) {
+	BenchRandom random { 41 };
+	for (int thread_count = 1; thread_count <= max_threads; ++thread_count) {
+		WorkPool pool;
+		if (!WorkPoolInitialize(&pool, thread_count)) {
+			fprintf(stderr, "out of memory\n");
+			return false;
+		}
+		for (int round = 0; round < 200; ++round) {
+			int count = static_cast<int>(random.Below(300));
+			PoolCheck check { std::vector<std::atomic<int>>(count), std::vector<uint32_t>(count),
+				std::vector<uint64_t>(count), {}, thread_count };
+			for (int i = 0; i < count; ++i) {
+				check.costs[i] = random.Below(8) == 0 ? random.Below(20000) : random.Below(50);
+			}
+			WorkPoolRun(&pool, count, CheckItem, &check);
+			for (int i = 0; i < count; ++i) {
+				if (check.runs[i].load() != 1) {
+					fprintf(stderr, "item %d of %d ran %d times on %d threads\n", i, count, check.runs[i].load(),
+						thread_count);
+					WorkPoolShutdown(&pool);
+					return false;
+				}
+			}
+			if (check.bad_worker.load()) {
+				fprintf(stderr, "an item ran on a worker outside of %d threads\n", thread_count);
+				WorkPoolShutdown(&pool);
+				return false;
+			}
+		}
+		WorkPoolShutdown(&pool);
+	}
+	return true;
+}
+
+static bool CheckPackets(int max_threads) {
+	BenchRandom random { 43 };
+	PrepInputs inputs;
+	Grid grid {};
+	bool ok = InitializeInputs(&inputs, 300);
+	uint64_t rows = 0;
+	uint64_t rows_direct = 0;
+	for (int thread_count = 1; ok && thread_count <= max_threads; ++thread_count) {
+		RowPrep prep;
+		ok = RowPrepInitialize(&prep, thread_count);
+		for (int round = 0; ok && round < 40; ++round) {
+			int grid_rows = 1 + static_cast<int>(random.Below(120));
+			int grid_cols = 1 + static_cast<int>(random.Below(300));
+			ok = GridResize(&grid, grid_rows, grid_cols) || (grid.rows == grid_rows && grid.cols == grid_cols);
+			ok = ok && RowPrepReserve(&prep, grid_rows, grid_cols);
+			DefineHighlights(&inputs, &random, random.Below(2) ? 0 : 5);
+			FillGrid(&grid, &random, random.Below(3) == 0 ? 0 : random.Below(10));
+
+			// All rows, most or a few
+			GridClearDirty(&grid);
+			uint32_t dirty_chance = round % 3 == 0 ? 100 : round % 3 == 1 ? 80 : 5;
+			for (int row = 0; row < grid_rows; ++row) {
+				if (random.Below(100) < dirty_chance) {
+					GridMarkDirty(&grid, row, 0, grid_cols);
+				}
+			}
+			ok = ok && RowPrepRun(&prep, &grid, inputs.styles, &inputs.glyph_row, inputs.layout_cache, &SCAN_RULES);
+
+			int expected_row = GridNextDirtyRow(&grid, 0);
+			for (int i = 0; ok && i < prep.packet_count; ++i) {
+				ok = prep.packets[i].row == expected_row && CheckPacket(&prep.packets[i], &grid, &inputs);
+				expected_row = GridNextDirtyRow(&grid, expected_row + 1);
+			}
+			if (ok && expected_row >= 0) {
+				fprintf(stderr, "row %d wasn't prepared\n", expected_row);
+				ok = false;
+			}
+		}
+		rows += prep.stats.rows;
+		rows_direct += prep.stats.rows_direct;
+		RowPrepShutdown(&prep);
+	}
+	printf("packets: %llu rows prepared on up to %d threads, %llu of them direct\n",
+		static_cast<unsigned long long>(rows), max_threads, static_cast<unsigned long long>(rows_direct));
+	GridFree(&grid);
+	ShutdownInputs(&inputs);
+	return ok;
+}
+
+static void EmptyItem(void *, int, int) {
+}
+
+static void Measure(int max_threads, int iterations) {
+	const struct {
+		int rows;
+		int cols;
+	} grids[] {
+		{ 50, 200 },
+		{ 120, 400 },
+	};
+
+	for (const auto &size : grids) {
+		BenchRandom random { 47 };
+		PrepInputs inputs;
+		Grid grid {};
+		if (!InitializeInputs(&inputs, size.cols) || !GridResize(&grid, size.rows, size.cols)) {
+			fprintf(stderr, "out of memory\n");
+			return;
+		}
+		DefineHighlights(&inputs, &random, 3);
+		FillGrid(&grid, &random, 2);
+		printf("\nfull repaints of %d rows of %d cells, ns/event per cell\n", size.rows, size.cols);
+
+		uint64_t serial_ns = 0;
+		for (int thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+			RowPrep prep;
+			if (!RowPrepInitialize(&prep, thread_count) || !RowPrepReserve(&prep, size.rows, size.cols)) {
+				fprintf(stderr, "out of memory\n");
+				return;
+			}
+			GridMarkAllDirty(&grid);
+			uint64_t best_ns = UINT64_MAX;
+			for (int i = 0; i < iterations; ++i) {
+				uint64_t start = BenchNowNs();
+				RowPrepRun(&prep, &grid, inputs.styles, &inputs.glyph_row, inputs.layout_cache, &SCAN_RULES);
+				uint64_t elapsed = BenchNowNs() - start;
+				best_ns = elapsed < best_ns ? elapsed : best_ns;
+			}
+			serial_ns = thread_count == 1 ? best_ns : serial_ns;
+
+			char name[64];
+			snprintf(name, sizeof(name), "  prepare, %d threads", thread_count);
+			BenchReport(name, best_ns, static_cast<uint64_t>(size.rows) * size.cols, 0);
+			printf("    %.2fx of 1 thread, %.1f steals per repaint, %.0f%% of rows direct\n",
+				static_cast<double>(serial_ns) / static_cast<double>(best_ns),
+				static_cast<double>(prep.pool.stats.steals) / static_cast<double>(iterations),
+				100.0 * static_cast<double>(prep.stats.rows_direct) / static_cast<double>(prep.stats.rows));
+			RowPrepShutdown(&prep);
+		}
+		GridFree(&grid);
+		ShutdownInputs(&inputs);
+	}
+
+	printf("\nwaking the pool, ns/event per run of 8 empty items\n");
+	for (int thread_count = 2; thread_count <= max_threads; thread_count *= 2) {
+		WorkPool pool;
+		if (!WorkPoolInitialize(&pool, thread_count)) {
+			fprintf(stderr, "out of memory\n");
+			return;
+		}
+		int runs = iterations * 10;
+		uint64_t start = BenchNowNs();
+		for (int i = 0; i < runs; ++i) {
+			WorkPoolRun(&pool, 8, EmptyItem, nullptr);
+		}
+		char name[64];
+		snprintf(name, sizeof(name), "  empty run, %d threads", thread_count);
+		BenchReport(name, BenchNowNs() - start, static_cast<uint64_t>(runs), 0);
+		WorkPoolShutdown(&pool);
+	}
+}
+
+int main(int argc, char **argv) {
+	int max_threads = BenchArgInt(argc, argv, "--threads", 16);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 200);
+	if (max_threads < 1 || max_threads > WORK_POOL_MAX_THREADS || iterations <= 0) {
+		fprintf(stderr, "usage: row_prep_bench [--threads=N] [--iterations=N]\n");
+		return 2;
+	}
+
+	bool ok = CheckPool(max_threads);
+	ok = ok && CheckPackets(max_threads > 4 ? 4 : max_threads);
+	printf("check: %s\n", ok ? "ok" : "FAILED");
+	Measure(max_threads, iterations);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+// Checks and measures scrolling through the grid's row map. Full width
+// scrolls only rotate the row map, and the renderer moves the rows it
+// already drew with a blit instead of laying them out again.
+//
+// The check plays random frames of grid_line and grid_scroll events, with
+// the rows scrolled into view redrawn the way nvim does, against a grid one
+// column wider, whose scrolls never span its full width and so copy cells
+// as every scroll used to. At each flush it also applies the pending
+// scrolls and dirty rows to a simulated retained raster, as the renderer
+// does, which has to match the grid.
+//
+// Usage: scroll_bench [--frames=N] [--iterations=N]
+// Exits with 1 if the grid or the raster disagree.
+
+#include <algorithm>
+#include "bench_util.h"
+#include "nvim/redraw_commands.h"
+#include "renderer/grid.h"
+
+constexpr int ROWS = 40;
+constexpr int COLS = 60;
+// A 3840x2160 window at 8x16 pixel cells
+constexpr int HUGE_ROWS = 135;
+constexpr int HUGE_COLS = 480;
+
+struct CheckStats {
+	uint64_t flushes;
+	uint64_t scrolls;
+	uint64_t blits;
+	uint64_t rows_moved;
+	uint64_t rows_drawn;
+};
+
+static void WriteGridScroll(mpack_writer_t *writer, int top, int bottom, int left, int right, int rows) {
+	mpack_start_array(writer, 2);
+	mpack_write_cstr(writer, "grid_scroll");
+	mpack_start_array(writer, 7);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, top);
+	mpack_write_int(writer, bottom);
+	mpack_write_int(writer, left);
+	mpack_write_int(writer, right);
+	mpack_write_int(writer, rows);
+	mpack_write_int(writer, 0);
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+}
+
+// One frame of random edits and scrolls, ending in a flush. Now and then
+// there are more scrolls than the grid queues.
+static void WriteFrame(std::vector<char> *stream, BenchRandom *random) {
+	char *data;
+	size_t size;
+	mpack_writer_t writer;
+	mpack_writer_init_growable(&writer, &data, &size);
+
+	// Events are counted as they're written, the array is sized after
+	uint32_t event_count = 0;
+	mpack_writer_t event_writer;
+	char *event_data;
+	size_t event_size;
+	mpack_writer_init_growable(&event_writer, &event_data, &event_size);
+	int op_count = random->Below(10) == 0 ? GRID_MAX_PENDING_SCROLLS + 4 : 1 + static_cast<int>(random->Below(6));
+	for (int op = 0; op < op_count; ++op) {
+		if (random->Below(3) == 0) {
+			int row = static_cast<int>(random->Below(ROWS));
+			int begin = static_cast<int>(random->Below(COLS));
+			int end = begin + 1 + static_cast<int>(random->Below(COLS - begin));
+			BenchWriteGridLineSpan(&event_writer, row, begin, end, 4, 40, random);
+			++event_count;
+			continue;
+		}
+
+		int top = static_cast<int>(random->Below(ROWS - 1));
+		int bottom = top + 1 + static_cast<int>(random->Below(ROWS - top));
+		bool full_width = random->Below(3) != 0;
+		int left = full_width ? 0 : static_cast<int>(random->Below(COLS - 1));
+		int right = full_width ? COLS : left + 1 + static_cast<int>(random->Below(COLS - left));
+		int height = bottom - top;
+		int rows = 1 + static_cast<int>(random->Below(random->Below(8) == 0 ? height + 2 : (height + 1) / 2));
+		rows = random->Below(2) ? rows : -rows;
+		WriteGridScroll(&event_writer, top, bottom, left, right, rows);
+		++event_count;
+
+		// nvim redraws what was scrolled into view right away
+		int first = rows > 0 ? std::max(bottom - rows, top) : top;
+		int last = rows > 0 ? bottom : std::min(top - rows, bottom);
+		for (int row = first; row < last; ++row) {
+			BenchWriteGridLineSpan(&event_writer, row, left, right, 4, 40, random);
+			++event_count;
+		}
+	}
+	mpack_start_array(&event_writer, 2);
+	mpack_write_cstr(&event_writer, "flush");
+	mpack_start_array(&event_writer, 0);
+	mpack_finish_array(&event_writer);
+	mpack_finish_array(&event_writer);
+	++event_count;
+
+	if (mpack_writer_destroy(&event_writer) == mpack_ok) {
+		mpack_start_array(&writer, 3);
+		mpack_write_int(&writer, 2);
+		mpack_write_cstr(&writer, "redraw");
+		mpack_start_array(&writer, event_count);
+		mpack_write_object_bytes(&writer, event_data, event_size);
+		mpack_finish_array(&writer);
+		mpack_finish_array(&writer);
+	}
+	MPACK_FREE(event_data);
+	if (mpack_writer_destroy(&writer) == mpack_ok) {
+		stream->insert(stream->end(), data, data + size);
+	}
+	MPACK_FREE(data);
+}
+
+// Moves the drawn rows of every pending scroll, then draws the dirty rows,
+// as RendererFlush does. Every other flush takes the path for line heights
+// that don't line up with pixels and redraws the scrolled regions instead.
+static void DrawFlush(Grid *grid, BenchRaster *raster, bool blit, CheckStats *stats) {
+	if (!blit) {
+		GridMarkScrollsDirty(grid);
+	}
+	for (int i = 0; i < grid->pending_scroll_count; ++i) {
+		stats->rows_moved += BenchRasterBlit(raster, &grid->pending_scrolls[i]);
+		++stats->blits;
+	}
+	for (int row = GridNextDirtyRow(grid, 0); row >= 0; row = GridNextDirtyRow(grid, row + 1)) {
+		BenchRasterDraw(raster, grid, row);
+		++stats->rows_drawn;
+	}
+	GridClearDirty(grid);
+	++stats->flushes;
+}
+
+// Compares the first cols cells of every row, returns the first row that
+// differs or -1
+static int FirstDifferentRow(const Grid *grid, const Grid *reference, const BenchRaster *raster) {
+	for (int row = 0; row < grid->rows; ++row) {
+		size_t base = GridRowOffset(grid, row);
+		size_t reference_base = GridRowOffset(reference, row);
+		if (memcmp(&grid->chars[base], &reference->chars[reference_base], grid->cols * sizeof(uint32_t)) ||
+			memcmp(&grid->hl_ids[base], &reference->hl_ids[reference_base], grid->cols * sizeof(uint16_t)) ||
+			memcmp(&grid->flags[base], &reference->flags[reference_base], grid->cols * sizeof(uint8_t)) ||
+			BenchRasterRowDiffers(raster, grid, row)) {
+			return row;
+		}
+	}
+	return -1;
+}
+
+static bool Check(int frames) {
+	Grid grid {};
+	Grid reference {};
+	GridResize(&grid, ROWS, COLS);
+	GridResize(&reference, ROWS, COLS + 1);
+	BenchRaster raster;
+	BenchRasterResize(&raster, ROWS, COLS, ' ');
+	GridClearDirty(&grid);
+
+	BenchRandom random { 14 };
+	CheckStats stats {};
+	bool ok = true;
+	for (int frame = 0; frame < frames && ok; ++frame) {
+		std::vector<char> stream;
+		WriteFrame(&stream, &random);
+		size_t commands_size;
+		char *commands = RedrawTranslate(stream.data(), stream.size(), &commands_size);
+		if (!commands) {
+			fprintf(stderr, "frame %d: translation failed\n", frame);
+			return false;
+		}
+
+		RedrawCommandReader reader;
+		RedrawCommandsBegin(&reader, commands, commands_size);
+		while (const RedrawCommand *command = RedrawNextCommand(&reader)) {
+			switch (command->event) {
+			case RedrawEvent::grid_line: {
+				const RedrawCommandGridLine *grid_line = reinterpret_cast<const RedrawCommandGridLine *>(command);
+				GridUpdateLine(&grid, grid_line);
+				GridUpdateLine(&reference, grid_line);
+			} break;
+			case RedrawEvent::grid_scroll: {
+				const RedrawCommandGridScroll *grid_scroll = reinterpret_cast<const RedrawCommandGridScroll *>(command);
+				GridScroll(&grid, grid_scroll);
+				GridScroll(&reference, grid_scroll);
+				++stats.scrolls;
+			} break;
+			case RedrawEvent::flush: {
+				DrawFlush(&grid, &raster, frame % 2 == 0, &stats);
+				int row = FirstDifferentRow(&grid, &reference, &raster);
+				if (row >= 0) {
+					fprintf(stderr, "frame %d: row %d differs\n", frame, row);
+					ok = false;
+				}
+			} break;
+			default: {
+			} break;
+			}
+		}
+		free(commands);
+	}
+
+	printf("check: %s, %d frames, %llu scrolls, %llu blits moved %llu rows, %llu rows drawn\n",
+		ok ? "ok" : "FAILED", frames, static_cast<unsigned long long>(stats.scrolls),
+		static_cast<unsigned long long>(stats.blits), static_cast<unsigned long long>(stats.rows_moved),
+		static_cast<unsigned long long>(stats.rows_drawn));
+	GridFree(&grid);
+	GridFree(&reference);
+	return ok;
+}
+
+// What every scroll did before the row map, the rows laid out again after
+// it are counted below
+static void CopyScroll(Grid *grid, int rows) {
+	for (int row = 0; row < grid->rows - rows; ++row) {
+		size_t target = static_cast<size_t>(row) * grid->cols;
+		size_t source = static_cast<size_t>(row + rows) * grid->cols;
+		memcpy(&grid->chars[target], &grid->chars[source], grid->cols * sizeof(uint32_t));
+		memcpy(&grid->hl_ids[target], &grid->hl_ids[source], grid->cols * sizeof(uint16_t));
+		memcpy(&grid->flags[target], &grid->flags[source], grid->cols * sizeof(uint8_t));
+	}
+}
+
+static void Measure(int rows, int cols, int iterations) {
+	constexpr int SCROLLS = 10000;
+	Grid grid {};
+	GridResize(&grid, rows, cols);
+	RedrawCommandGridScroll scroll {};
+	scroll.top = 0;
+	scroll.bottom = rows;
+	scroll.left = 0;
+	scroll.right = cols;
+	scroll.rows = 1;
+
+	uint64_t row_map_ns = UINT64_MAX;
+	uint64_t copy_ns = UINT64_MAX;
+	uint64_t rows_to_draw = 0;
+	for (int i = 0; i < iterations; ++i) {
+		GridClearDirty(&grid);
+		rows_to_draw = 0;
+		uint64_t start = BenchNowNs();
+		for (int j = 0; j < SCROLLS; ++j) {
+			GridScroll(&grid, &scroll);
+			for (int row = GridNextDirtyRow(&grid, 0); row >= 0; row = GridNextDirtyRow(&grid, row + 1)) {
+				++rows_to_draw;
+			}
+			GridClearDirty(&grid);
+		}
+		uint64_t elapsed = BenchNowNs() - start;
+		row_map_ns = elapsed < row_map_ns ? elapsed : row_map_ns;
+
+		start = BenchNowNs();
+		for (int j = 0; j < SCROLLS; ++j) {
+			CopyScroll(&grid, 1);
+		}
+		elapsed = BenchNowNs() - start;
+		copy_ns = elapsed < copy_ns ? elapsed : copy_ns;
+	}
+	BenchKeep(grid.chars[0] + grid.row_map[0]);
+
+	printf("\n%dx%d, one row scrolls\n", cols, rows);
+	BenchReport("  row map", row_map_ns, SCROLLS, 0);
+	BenchReport("  copying rows", copy_ns, SCROLLS, 0);
+	printf("  %.1f rows to lay out per scroll, %d before\n",
+		static_cast<double>(rows_to_draw) / SCROLLS, rows - 1);
+	GridFree(&grid);
+}
+
+int main(int argc, char **argv) {
+	int frames = BenchArgInt(argc, argv, "--frames", 2000);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 5);
+	if (frames <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: scroll_bench [--frames=N] [--iterations=N]\n");
+		return 2;
+	}
+
+	bool ok = Check(frames);
+	Measure(ROWS, COLS, iterations);
+	Measure(HUGE_ROWS, HUGE_COLS, iterations);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,696 @@
+// Checks the grid snapshots that carry nvim's redraw events from the
+// thread applying them to the thread drawing them, and measures what
+// building and applying a snapshot costs against copying the grid.
+//
+// The check runs the two sides on their own threads. The applying side
+// plays random frames of grid_line, grid_scroll (full and part width),
+// grid_clear, grid_resize, hl_attr_define, default_colors_set, cursor and
+// mode events through a SnapshotModel, publishing at every flush. Before
+// each flush it records a checksum of its state. The drawing side takes
+// the latest snapshot at an uneven pace, so some are folded into the
+// next, applies it to a mirror UiState and draws the mirror into a
+// raster the way the renderer does: blitting the pending scrolls, then
+// copying the dirty rows. Rows showing a redefined highlight have to be
+// drawn again. Mirror, raster and snapshot rows have to agree,
+// the mirror's checksum has to match the one recorded for the snapshot,
+// and the scrolls and highlights a snapshot carries have to be those of
+// the flushes folded into it. Build it with -fsanitize=thread to check
+// the handoff itself.
+//
+// The measurement replays a scrolling session and a typing session on a
+// 480x135 grid (a 4K window), timing the applying side's flushes with
+// the rows shared against copying every row, and the drawing side's
+// apply, and runs both sides on their own threads for the throughput of
+// the whole handoff.
+//
+// Usage: snapshot_bench [--frames=N] [--iterations=N]
+// Exits with 1 if the mirror, the raster, a checksum or the changes
+// disagree, or the mirror compares rows that didn't change.
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "bench_util.h"
+#include "nvim/redraw_commands.h"
+#include "renderer/grid_snapshot.h"
+
+constexpr int HL_IDS = 40;
+constexpr int HUGE_ROWS = 135;
+constexpr int HUGE_COLS = 480;
+
+// The events of a frame, wrapped into a redraw notification by Finish
+struct FrameWriter {
+	mpack_writer_t writer;
+	char *data;
+	size_t size;
+	uint32_t event_count;
+};
+
+static void FrameBegin(FrameWriter *frame) {
+	mpack_writer_init_growable(&frame->writer, &frame->data, &frame->size);
+	frame->event_count = 0;
+}
+
+static void EventBegin(FrameWriter *frame, const char *name, uint32_t param_count) {
+	mpack_start_array(&frame->writer, 2);
+	mpack_write_cstr(&frame->writer, name);
+	mpack_start_array(&frame->writer, param_count);
+	++frame->event_count;
+}
+
+static void EventEnd(FrameWriter *frame) {
+	mpack_finish_array(&frame->writer);
+	mpack_finish_array(&frame->writer);
+}
+
+// Returns the translated commands of the frame, nullptr on failure
+static char *FrameFinish(FrameWriter *frame, size_t *commands_size) {
+	char *commands = nullptr;
+	if (mpack_writer_destroy(&frame->writer) == mpack_ok) {
+		char *data;
+		size_t size;
+		mpack_writer_t writer;
+		mpack_writer_init_growable(&writer, &data, &size);
+		mpack_start_array(&writer, 3);
+		mpack_write_int(&writer, 2);
+		mpack_write_cstr(&writer, "redraw");
+		mpack_start_array(&writer, frame->event_count);
+		mpack_write_object_bytes(&writer, frame->data, frame->size);
+		mpack_finish_array(&writer);
+		mpack_finish_array(&writer);
+		if (mpack_writer_destroy(&writer) == mpack_ok) {
+			commands = RedrawTranslate(data, size, commands_size);
+		}
+		MPACK_FREE(data);
+	}
+	MPACK_FREE(frame->data);
+	return commands;
+}
+
+static void WriteGridLine(FrameWriter *frame, int row, int begin, int end, BenchRandom *random) {
+	BenchWriteGridLineSpan(&frame->writer, row, begin, end, 6, HL_IDS, random);
+	++frame->event_count;
+}
+
+static void WriteGridScroll(FrameWriter *frame, int top, int bottom, int left, int right, int rows) {
+	EventBegin(frame, "grid_scroll", 7);
+	mpack_write_int(&frame->writer, 1);
+	mpack_write_int(&frame->writer, top);
+	mpack_write_int(&frame->writer, bottom);
+	mpack_write_int(&frame->writer, left);
+	mpack_write_int(&frame->writer, right);
+	mpack_write_int(&frame->writer, rows);
+	mpack_write_int(&frame->writer, 0);
+	EventEnd(frame);
+}
+
+static void WriteIntEvent(FrameWriter *frame, const char *name, int a, int b, int c) {
+	EventBegin(frame, name, 3);
+	mpack_write_int(&frame->writer, a);
+	mpack_write_int(&frame->writer, b);
+	mpack_write_int(&frame->writer, c);
+	EventEnd(frame);
+}
+
+static void WriteHlAttrDefine(FrameWriter *frame, int id, BenchRandom *random) {
+	mpack_writer_t *writer = &frame->writer;
+	EventBegin(frame, "hl_attr_define", 4);
+	mpack_write_int(writer, id);
+	mpack_start_map(writer, 3);
+	mpack_write_cstr(writer, "foreground");
+	mpack_write_int(writer, random->Below(0x1000000));
+	mpack_write_cstr(writer, "background");
+	mpack_write_int(writer, random->Below(0x1000000));
+	mpack_write_cstr(writer, "bold");
+	mpack_write_bool(writer, random->Below(2));
+	mpack_finish_map(writer);
+	mpack_start_map(writer, 0);
+	mpack_finish_map(writer);
+	mpack_start_array(writer, 0);
+	mpack_finish_array(writer);
+	EventEnd(frame);
+}
+
+static void WriteModeInfoSet(FrameWriter *frame) {
+	mpack_writer_t *writer = &frame->writer;
+	EventBegin(frame, "mode_info_set", 2);
+	mpack_write_bool(writer, true);
+	mpack_start_array(writer, 3);
+	const char *shapes[] { "block", "vertical", "horizontal" };
+	for (int i = 0; i < 3; ++i) {
+		mpack_start_map(writer, 4);
+		mpack_write_cstr(writer, "cursor_shape");
+		mpack_write_cstr(writer, shapes[i]);
+		mpack_write_cstr(writer, "blinkwait");
+		mpack_write_int(writer, 700);
+		mpack_write_cstr(writer, "blinkon");
+		mpack_write_int(writer, 400 + i);
+		mpack_write_cstr(writer, "blinkoff");
+		mpack_write_int(writer, 250);
+		mpack_finish_map(writer);
+	}
+	mpack_finish_array(writer);
+	EventEnd(frame);
+}
+
+static void WriteModeChange(FrameWriter *frame, int mode) {
+	EventBegin(frame, "mode_change", 2);
+	mpack_write_cstr(&frame->writer, mode ? "insert" : "normal");
+	mpack_write_int(&frame->writer, mode);
+	EventEnd(frame);
+}
+
+static void WriteFlush(FrameWriter *frame) {
+	EventBegin(frame, "flush", 0);
+	EventEnd(frame);
+}
+
+// One frame of random events short of the flush, the grid is rows x cols
+// when it starts and may be resized by it
+static void WriteRandomFrame(FrameWriter *frame, int *rows, int *cols, BenchRandom *random) {
+	if (random->Below(200) == 0) {
+		*rows = 4 + static_cast<int>(random->Below(40));
+		*cols = 8 + static_cast<int>(random->Below(80));
+		WriteIntEvent(frame, "grid_resize", 1, *cols, *rows);
+	}
+	if (random->Below(100) == 0) {
+		EventBegin(frame, "grid_clear", 1);
+		mpack_write_int(&frame->writer, 1);
+		EventEnd(frame);
+	}
+	if (random->Below(150) == 0) {
+		EventBegin(frame, "default_colors_set", 5);
+		mpack_write_int(&frame->writer, random->Below(0x1000000));
+		mpack_write_int(&frame->writer, random->Below(0x1000000));
+		mpack_write_int(&frame->writer, random->Below(0x1000000));
+		mpack_write_int(&frame->writer, 0);
+		mpack_write_int(&frame->writer, 0);
+		EventEnd(frame);
+	}
+	for (uint32_t i = random->Below(8) == 0 ? 1 + random->Below(4) : 0; i > 0; --i) {
+		WriteHlAttrDefine(frame, 1 + static_cast<int>(random->Below(HL_IDS - 1)), random);
+	}
+
+	// Now and then more scrolls than the grid queues
+	int op_count = random->Below(12) == 0 ? GRID_MAX_PENDING_SCROLLS + 4 : static_cast<int>(random->Below(6));
+	for (int op = 0; op < op_count; ++op) {
+		if (random->Below(3) == 0) {
+			int row = static_cast<int>(random->Below(*rows));
+			int begin = static_cast<int>(random->Below(*cols));
+			int end = begin + 1 + static_cast<int>(random->Below(*cols - begin));
+			WriteGridLine(frame, row, begin, end, random);
+			continue;
+		}
+
+		int top = static_cast<int>(random->Below(*rows - 1));
+		int bottom = top + 1 + static_cast<int>(random->Below(*rows - top));
+		bool full_width = random->Below(3) != 0;
+		int left = full_width ? 0 : static_cast<int>(random->Below(*cols - 1));
+		int right = full_width ? *cols : left + 1 + static_cast<int>(random->Below(*cols - left));
+		int height = bottom - top;
+		int scrolled = 1 + static_cast<int>(random->Below(random->Below(8) == 0 ? height + 2 : (height + 1) / 2));
+		scrolled = random->Below(2) ? scrolled : -scrolled;
+		WriteGridScroll(frame, top, bottom, left, right, scrolled);
+
+		// nvim redraws what was scrolled into view right away
+		int first = scrolled > 0 ? std::max(bottom - scrolled, top) : top;
+		int last = scrolled > 0 ? bottom : std::min(top - scrolled, bottom);
+		for (int row = first; row < last; ++row) {
+			WriteGridLine(frame, row, left, right, random);
+		}
+	}
+
+	if (random->Below(2)) {
+		WriteIntEvent(frame, "grid_cursor_goto", 1, static_cast<int>(random->Below(*rows)),
+			static_cast<int>(random->Below(*cols)));
+	}
+	if (random->Below(10) == 0) {
+		WriteModeChange(frame, static_cast<int>(random->Below(3)));
+	}
+	if (random->Below(20) == 0) {
+		EventBegin(frame, random->Below(2) ? "busy_start" : "busy_stop", 0);
+		EventEnd(frame);
+	}
+}
+
+static uint64_t Mix(uint64_t hash, uint64_t value) {
+	return (hash ^ value) * 0x100000001B3ull;
+}
+
+// Everything a snapshot carries, for comparing the two sides
+static uint64_t Checksum(const UiState *ui) {
+	uint64_t hash = 0xCBF29CE484222325ull;
+	const Grid *grid = &ui->grid;
+	hash = Mix(hash, static_cast<uint64_t>(grid->rows) << 32 | static_cast<uint32_t>(grid->cols));
+	for (int row = 0; grid->memory && row < grid->rows; ++row) {
+		size_t offset = GridRowOffset(grid, row);
+		for (int col = 0; col < grid->cols; ++col) {
+			hash = Mix(hash, static_cast<uint64_t>(grid->chars[offset + col]) << 24 |
+				static_cast<uint64_t>(grid->hl_ids[offset + col]) << 8 | grid->flags[offset + col]);
+		}
+	}
+	for (int id = 0; id < HL_IDS; ++id) {
+		const HighlightAttributes *attribs = &ui->hl_attribs[id];
+		hash = Mix(hash, static_cast<uint64_t>(attribs->foreground) << 32 | attribs->background);
+		hash = Mix(hash, static_cast<uint64_t>(attribs->special) << 16 | attribs->flags);
+	}
+	int mode = ui->cursor.mode_info ? static_cast<int>(ui->cursor.mode_info - ui->cursor_mode_infos) : -1;
+	hash = Mix(hash, static_cast<uint64_t>(mode + 1) << 48 | static_cast<uint64_t>(ui->cursor.row) << 24 |
+		static_cast<uint64_t>(ui->cursor.col));
+	hash = Mix(hash, ui->cursor_mode_infos[mode >= 0 ? mode : 0].blinkon);
+	return Mix(hash, ui->busy);
+}
+
+// Moves the drawn rows of every pending scroll, then draws the dirty rows,
+// as RendererFlush does
+static void DrawFlush(Grid *grid, BenchRaster *raster, uint64_t *rows_drawn) {
+	if (raster->rows != grid->rows || raster->cols != grid->cols) {
+		BenchRasterResize(raster, grid->rows, grid->cols, 0);
+	}
+	for (int i = 0; i < grid->pending_scroll_count; ++i) {
+		BenchRasterBlit(raster, &grid->pending_scrolls[i]);
+	}
+	for (int row = GridNextDirtyRow(grid, 0); row >= 0; row = GridNextDirtyRow(grid, row + 1)) {
+		BenchRasterDraw(raster, grid, row);
+		++*rows_drawn;
+	}
+	GridClearDirty(grid);
+}
+
+// The first row where the mirror, the raster and the snapshot differ, -1 if none
+static int FirstDifferentRow(const Grid *grid, const BenchRaster *raster, const GridSnapshot *snapshot) {
+	if (grid->rows != snapshot->rows || grid->cols != snapshot->cols) {
+		return 0;
+	}
+	size_t cols = grid->cols;
+	for (int row = 0; row < grid->rows; ++row) {
+		size_t base = GridRowOffset(grid, row);
+		const SnapshotRow *snapshot_row = snapshot->row_data[row];
+		if (memcmp(&grid->chars[base], snapshot_row->chars, cols * sizeof(uint32_t)) ||
+			memcmp(&grid->hl_ids[base], snapshot_row->hl_ids, cols * sizeof(uint16_t)) ||
+			memcmp(&grid->flags[base], snapshot_row->flags, cols * sizeof(uint8_t)) ||
+			BenchRasterRowDiffers(raster, grid, row)) {
+			return row;
+		}
+	}
+	return -1;
+}
+
+struct DrawSide {
+	UiState mirror;
+	SnapshotMirror rows;
+	BenchRaster raster;
+	uint64_t last_sequence;
+	uint64_t snapshots;
+	uint64_t rows_drawn;
+};
+
+// What the applying side had before each flush, recorded before the
+// snapshot is published
+struct FlushRecord {
+	uint64_t checksum;
+	int rows;
+	int cols;
+	GridPendingScroll scrolls[GRID_MAX_PENDING_SCROLLS];
+	int scroll_count;
+	int highlight_count;
+	bool default_colors_changed;
+	bool cursor_changed;
+};
+
+static void RecordFlush(const SnapshotModel *model, FlushRecord *record) {
+	const Grid *grid = &model->ui.grid;
+	record->checksum = Checksum(&model->ui);
+	record->rows = grid->rows;
+	record->cols = grid->cols;
+	record->scroll_count = grid->pending_scroll_count;
+	memcpy(record->scrolls, grid->pending_scrolls, sizeof(record->scrolls));
+	record->highlight_count = model->defined_count;
+	record->default_colors_changed = model->default_colors_changed;
+	record->cursor_changed = model->cursor_changed;
+}
+
+// Checks what the snapshot says changed against the flushes folded into
+// it, those after the one drawn last
+static bool CheckChanges(const GridSnapshot *snapshot, uint64_t last_sequence, const std::vector<FlushRecord> *records) {
+	FlushRecord expected {};
+	bool scrolls_dropped = false;
+	for (uint64_t sequence = last_sequence + 1; sequence <= snapshot->sequence; ++sequence) {
+		const FlushRecord *record = &(*records)[sequence];
+		bool resized = sequence > last_sequence + 1 && (record->rows != expected.rows || record->cols != expected.cols);
+		if (resized || expected.scroll_count + record->scroll_count > GRID_MAX_PENDING_SCROLLS) {
+			scrolls_dropped = true;
+		}
+		if (!scrolls_dropped) {
+			memcpy(&expected.scrolls[expected.scroll_count], record->scrolls,
+				record->scroll_count * sizeof(GridPendingScroll));
+			expected.scroll_count += record->scroll_count;
+		}
+		expected.rows = record->rows;
+		expected.cols = record->cols;
+		expected.highlight_count += record->highlight_count;
+		expected.default_colors_changed |= record->default_colors_changed;
+		expected.cursor_changed |= record->cursor_changed;
+	}
+	int scroll_count = scrolls_dropped ? 0 : expected.scroll_count;
+	bool ok = snapshot->flushes == snapshot->sequence - last_sequence && snapshot->scrolls_dropped == scrolls_dropped &&
+		snapshot->scroll_count == scroll_count &&
+		!memcmp(snapshot->scrolls, expected.scrolls, scroll_count * sizeof(GridPendingScroll)) &&
+		snapshot->highlight_count == expected.highlight_count &&
+		snapshot->default_colors_changed == expected.default_colors_changed &&
+		snapshot->cursor_changed == expected.cursor_changed;
+	if (!ok) {
+		fprintf(stderr, "snapshot %llu: the changes of flushes %llu to %llu are folded wrong\n",
+			static_cast<unsigned long long>(snapshot->sequence), static_cast<unsigned long long>(last_sequence + 1),
+			static_cast<unsigned long long>(snapshot->sequence));
+	}
+	return ok;
+}
+
+// The first row showing a highlight the snapshot redefines that isn't
+// dirty, -1 if none. Such rows have to be drawn again even where their
+// cells didn't change, every row when the default colors change.
+static int FirstStaleRow(const Grid *grid, const GridSnapshot *snapshot) {
+	std::vector<bool> redefined(STYLE_TABLE_HIGHLIGHTS, snapshot->default_colors_changed);
+	for (int i = 0; i < snapshot->highlight_count; ++i) {
+		redefined[snapshot->highlights[i].id] = true;
+	}
+	for (int row = 0; row < grid->rows; ++row) {
+		const uint16_t *hl_ids = &grid->hl_ids[GridRowOffset(grid, row)];
+		if (GridNextDirtyRow(grid, row) != row &&
+			std::any_of(hl_ids, hl_ids + grid->cols, [&](uint16_t id) { return redefined[id]; })) {
+			return row;
+		}
+	}
+	return -1;
+}
+
+// Draws the mirror, returns false if it disagrees with the snapshot
+static bool CheckDrawn(DrawSide *side, const GridSnapshot *snapshot, const std::vector<FlushRecord> *records) {
+	if (side->mirror.grid.memory) {
+		int row = FirstDifferentRow(&side->mirror.grid, &side->raster, snapshot);
+		if (row >= 0) {
+			fprintf(stderr, "snapshot %llu: row %d differs\n", static_cast<unsigned long long>(snapshot->sequence), row);
+			return false;
+		}
+	}
+	if (Checksum(&side->mirror) != (*records)[snapshot->sequence].checksum) {
+		fprintf(stderr, "snapshot %llu: highlights or cursor differ\n",
+			static_cast<unsigned long long>(snapshot->sequence));
+		return false;
+	}
+	return true;
+}
+
+// Applies the snapshot and draws it, returns false if records are given
+// and they disagree
+static bool DrawSnapshot(DrawSide *side, GridSnapshot *snapshot, const std::vector<FlushRecord> *records) {
+	bool ok = !records || CheckChanges(snapshot, side->last_sequence, records);
+	GridSnapshotApply(&side->mirror, &side->rows, snapshot);
+	if (side->mirror.grid.memory) {
+		int row = records ? FirstStaleRow(&side->mirror.grid, snapshot) : -1;
+		if (row >= 0) {
+			fprintf(stderr, "snapshot %llu: row %d shows a redefined highlight but isn't drawn\n",
+				static_cast<unsigned long long>(snapshot->sequence), row);
+			ok = false;
+		}
+		DrawFlush(&side->mirror.grid, &side->raster, &side->rows_drawn);
+	}
+	ok = ok && (!records || CheckDrawn(side, snapshot, records));
+	side->last_sequence = snapshot->sequence;
+	++side->snapshots;
+	GridSnapshotFree(snapshot);
+	return ok;
+}
+
+// Takes snapshots until the applying side is done and the last one is taken
+static void DrawLoop(SnapshotChannel *channel, DrawSide *side, const std::atomic<bool> *done,
+	const std::vector<FlushRecord> *records, uint64_t seed, bool *ok) {
+	BenchRandom random { seed };
+	for (;;) {
+		bool was_done = done->load();
+		GridSnapshot *snapshot = SnapshotChannelTake(channel);
+		if (!snapshot) {
+			if (was_done) {
+				return;
+			}
+			SnapshotChannelWait(channel, 1000000);
+			continue;
+		}
+		if (!DrawSnapshot(side, snapshot, records)) {
+			*ok = false;
+			return;
+		}
+		// Now and then fall behind, so snapshots get folded
+		if (seed && random.Below(8) == 0) {
+			std::this_thread::sleep_for(std::chrono::microseconds(random.Below(300)));
+		}
+	}
+}
+
+static bool Check(int frames) {
+	SnapshotModel *model = static_cast<SnapshotModel *>(calloc(1, sizeof(SnapshotModel)));
+	DrawSide *side = new DrawSide {};
+	SnapshotChannel channel;
+	SnapshotChannelInitialize(&channel);
+	if (!model || !SnapshotModelInitialize(model) || !UiStateInitialize(&side->mirror)) {
+		fprintf(stderr, "out of memory\n");
+		return false;
+	}
+
+	// Written before the snapshot it belongs to is published
+	std::vector<FlushRecord> records(frames + 2);
+	std::atomic<bool> done { false };
+	bool draw_ok = true;
+	std::thread draw_thread(DrawLoop, &channel, side, &done, &records, 29, &draw_ok);
+
+	BenchRandom random { 27 };
+	int rows = 30;
+	int cols = 70;
+	bool ok = true;
+	for (int frame = 0; frame <= frames && ok; ++frame) {
+		FrameWriter events;
+		FrameBegin(&events);
+		if (frame == 0) {
+			WriteIntEvent(&events, "grid_resize", 1, cols, rows);
+			WriteModeInfoSet(&events);
+		}
+		else {
+			WriteRandomFrame(&events, &rows, &cols, &random);
+		}
+		FrameWriter flush;
+		FrameBegin(&flush);
+		WriteFlush(&flush);
+
+		size_t events_size, flush_size;
+		char *event_commands = FrameFinish(&events, &events_size);
+		char *flush_commands = FrameFinish(&flush, &flush_size);
+		if (!event_commands || !flush_commands) {
+			fprintf(stderr, "frame %d: translation failed\n", frame);
+			ok = false;
+		}
+		else {
+			SnapshotModelApply(model, event_commands, events_size, &channel);
+			RecordFlush(model, &records[model->sequence + 1]);
+			ok = SnapshotModelApply(model, flush_commands, flush_size, &channel) == 1;
+		}
+		free(event_commands);
+		free(flush_commands);
+	}
+	done.store(true);
+	SnapshotChannelWake(&channel);
+	draw_thread.join();
+
+	uint64_t last = side->last_sequence;
+	if (ok && draw_ok && last != model->sequence) {
+		fprintf(stderr, "the last snapshot drawn is %llu of %llu\n", static_cast<unsigned long long>(last),
+			static_cast<unsigned long long>(model->sequence));
+		ok = false;
+	}
+	ok = ok && draw_ok;
+	printf("check: %s, %d frames, %llu snapshots drawn, %llu folded, %llu rows copied, %llu shared, "
+		"%llu compared, %llu updated\n", ok ? "ok" : "FAILED", frames,
+		static_cast<unsigned long long>(side->snapshots), static_cast<unsigned long long>(channel.folded.load()),
+		static_cast<unsigned long long>(model->stats.rows_copied),
+		static_cast<unsigned long long>(model->stats.rows_shared),
+		static_cast<unsigned long long>(side->rows.stats.rows_compared),
+		static_cast<unsigned long long>(side->rows.stats.rows_updated));
+
+	SnapshotMirrorShutdown(&side->rows);
+	SnapshotChannelShutdown(&channel);
+	UiStateShutdown(&side->mirror);
+	delete side;
+	SnapshotModelShutdown(model);
+	free(model);
+	return ok;
+}
+
+enum class Session {
+	Scrolling,
+	Typing
+};
+
+// Translated frames of a session, each ending in a flush
+static std::vector<char *> WriteSession(Session session, int frames, std::vector<size_t> *sizes) {
+	BenchRandom random { 31 };
+	std::vector<char *> commands;
+	for (int frame = 0; frame <= frames; ++frame) {
+		FrameWriter events;
+		FrameBegin(&events);
+		if (frame == 0) {
+			WriteIntEvent(&events, "grid_resize", 1, HUGE_COLS, HUGE_ROWS);
+			WriteModeInfoSet(&events);
+			for (int row = 0; row < HUGE_ROWS; ++row) {
+				WriteGridLine(&events, row, 0, HUGE_COLS, &random);
+			}
+		}
+		else if (session == Session::Scrolling) {
+			// A line at a time, the status line and command line stay
+			WriteGridScroll(&events, 0, HUGE_ROWS - 2, 0, HUGE_COLS, 1);
+			WriteGridLine(&events, HUGE_ROWS - 3, 0, HUGE_COLS, &random);
+			WriteGridLine(&events, HUGE_ROWS - 2, 0, HUGE_COLS, &random);
+		}
+		else {
+			int row = static_cast<int>(random.Below(HUGE_ROWS - 2));
+			int col = static_cast<int>(random.Below(HUGE_COLS - 1));
+			WriteGridLine(&events, row, col, HUGE_COLS, &random);
+			WriteIntEvent(&events, "grid_cursor_goto", 1, row, col + 1);
+		}
+		WriteFlush(&events);
+		size_t size;
+		commands.push_back(FrameFinish(&events, &size));
+		sizes->push_back(size);
+	}
+	return commands;
+}
+
+// What a snapshot costs when every row is copied, and a mirror that
+// compares every row
+static void CopyGrid(const Grid *grid, Grid *copy) {
+	for (int row = 0; row < grid->rows; ++row) {
+		size_t source = GridRowOffset(grid, row);
+		size_t target = GridRowOffset(copy, row);
+		memcpy(&copy->chars[target], &grid->chars[source], grid->cols * sizeof(uint32_t));
+		memcpy(&copy->hl_ids[target], &grid->hl_ids[source], grid->cols * sizeof(uint16_t));
+		memcpy(&copy->flags[target], &grid->flags[source], grid->cols * sizeof(uint8_t));
+	}
+}
+
+// Returns false if the mirror compared rows it had, in a session where
+// each snapshot is taken before the next flush
+static bool MeasureSession(const char *name, Session session, int frames, int iterations) {
+	std::vector<size_t> sizes;
+	std::vector<char *> commands = WriteSession(session, frames, &sizes);
+	uint64_t apply_ns = UINT64_MAX;
+	uint64_t draw_ns = UINT64_MAX;
+	uint64_t copy_ns = UINT64_MAX;
+	uint64_t threaded_ns = UINT64_MAX;
+	SnapshotModelStats model_stats {};
+	SnapshotMirrorStats mirror_stats {};
+	uint64_t folded = 0;
+
+	for (int i = 0; i < iterations; ++i) {
+		SnapshotModel *model = static_cast<SnapshotModel *>(calloc(1, sizeof(SnapshotModel)));
+		DrawSide *side = new DrawSide {};
+		SnapshotChannel channel;
+		SnapshotChannelInitialize(&channel);
+		SnapshotModelInitialize(model);
+		UiStateInitialize(&side->mirror);
+		SnapshotModelApply(model, commands[0], sizes[0], &channel);
+		DrawSnapshot(side, SnapshotChannelTake(&channel), nullptr);
+		side->rows.stats = SnapshotMirrorStats {};
+		SnapshotModelStats stats_before = model->stats;
+
+		// Both sides in turn on one thread, timed apart
+		uint64_t apply = 0;
+		uint64_t draw = 0;
+		for (int frame = 1; frame <= frames; ++frame) {
+			uint64_t start = BenchNowNs();
+			SnapshotModelApply(model, commands[frame], sizes[frame], &channel);
+			uint64_t applied = BenchNowNs();
+			GridSnapshot *snapshot = SnapshotChannelTake(&channel);
+			GridSnapshotApply(&side->mirror, &side->rows, snapshot);
+			GridSnapshotFree(snapshot);
+			GridClearDirty(&side->mirror.grid);
+			draw += BenchNowNs() - applied;
+			apply += applied - start;
+		}
+		apply_ns = apply < apply_ns ? apply : apply_ns;
+		draw_ns = draw < draw_ns ? draw : draw_ns;
+		model_stats = model->stats;
+		model_stats.rows_copied -= stats_before.rows_copied;
+		model_stats.rows_shared -= stats_before.rows_shared;
+		mirror_stats = side->rows.stats;
+
+		// The same flushes copying the whole grid instead
+		Grid copy {};
+		GridResize(&copy, HUGE_ROWS, HUGE_COLS);
+		uint64_t start = BenchNowNs();
+		for (int frame = 1; frame <= frames; ++frame) {
+			CopyGrid(&model->ui.grid, &copy);
+			CopyGrid(&copy, &side->mirror.grid);
+			BenchKeep(copy.chars[frame % HUGE_COLS]);
+		}
+		uint64_t elapsed = BenchNowNs() - start;
+		copy_ns = elapsed < copy_ns ? elapsed : copy_ns;
+		GridFree(&copy);
+
+		// Both sides on their own threads, the drawing side keeping up
+		// as well as it can
+		std::atomic<bool> done { false };
+		bool ok = true;
+		start = BenchNowNs();
+		std::thread draw_thread(DrawLoop, &channel, side, &done, nullptr, 0, &ok);
+		for (int frame = 1; frame <= frames; ++frame) {
+			SnapshotModelApply(model, commands[frame], sizes[frame], &channel);
+		}
+		done.store(true);
+		SnapshotChannelWake(&channel);
+		draw_thread.join();
+		elapsed = BenchNowNs() - start;
+		threaded_ns = elapsed < threaded_ns ? elapsed : threaded_ns;
+		folded = channel.folded.load();
+
+		SnapshotMirrorShutdown(&side->rows);
+		SnapshotChannelShutdown(&channel);
+		UiStateShutdown(&side->mirror);
+		delete side;
+		SnapshotModelShutdown(model);
+		free(model);
+	}
+	for (char *frame_commands : commands) {
+		free(frame_commands);
+	}
+
+	printf("\n%s, %dx%d, %d flushes\n", name, HUGE_COLS, HUGE_ROWS, frames);
+	BenchReport("  apply and publish", apply_ns, frames, 0);
+	BenchReport("  take and mirror", draw_ns, frames, 0);
+	BenchReport("  copying the grid", copy_ns, frames, 0);
+	BenchReport("  two threads", threaded_ns, frames, 0);
+	printf("  %.1f rows copied and %.1f shared per flush, %.1f compared and %.1f updated by the mirror, "
+		"%llu flushes folded on two threads\n",
+		static_cast<double>(model_stats.rows_copied) / frames, static_cast<double>(model_stats.rows_shared) / frames,
+		static_cast<double>(mirror_stats.rows_compared) / frames,
+		static_cast<double>(mirror_stats.rows_updated) / frames, static_cast<unsigned long long>(folded));
+	if (mirror_stats.rows_compared > model_stats.rows_copied) {
+		fprintf(stderr, "the mirror compared rows it had already\n");
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	int frames = BenchArgInt(argc, argv, "--frames", 5000);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 5);
+	if (frames <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: snapshot_bench [--frames=N] [--iterations=N]\n");
+		return 2;
+	}
+
+	if (!Check(frames)) {
+		return 1;
+	}
+	bool ok = MeasureSession("scrolling", Session::Scrolling, frames, iterations);
+	ok = MeasureSession("typing", Session::Typing, frames, iterations) && ok;
+	return ok ? 0 : 1;
+}
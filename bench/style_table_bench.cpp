@@ -0,0 +1,318 @@
+// Checks the resolved highlight styles against resolving the attributes on
+// every draw, as the renderer did, and measures both per highlight run,
+// along with how many fewer runs rows split into by style than by id.
+//
+// The check defines random highlights (default colors, reverse, every
+// flag) through UiState, changes the default colors now and then and
+// defines enough distinct ones at times to fill the table. After each
+// change it verifies every defined style, that no two styles are alike,
+// that drawing effects carry the colors of their style, and that each
+// effect is released once, not while a style still holds it.
+//
+// Usage: style_table_bench [--operations=N] [--iterations=N]
+// Exits with 1 if a style disagrees with the attributes.
+
+#include <algorithm>
+#include <array>
+#include "bench_util.h"
+#include "renderer/ui_state.h"
+
+constexpr int COLS = 200;
+constexpr int ROWS = 1000;
+constexpr int HIGHLIGHTS = 300;
+
+// Drawing effects are ids here, with the colors they were made with
+struct StubEffect {
+	StyleColor foreground;
+	StyleColor special;
+	int releases;
+};
+static std::vector<StubEffect> effects;
+
+static void *CreateEffect(void *, const HighlightStyle *style) {
+	effects.push_back(StubEffect { style->foreground, style->special, 0 });
+	return reinterpret_cast<void *>(effects.size());
+}
+
+static void ReleaseEffect(void *, void *drawing_effect) {
+	++effects[reinterpret_cast<uintptr_t>(drawing_effect) - 1].releases;
+}
+
+static bool ColorEquals(StyleColor a, StyleColor b) {
+	return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+// The renderer's color logic before styles were resolved ahead of time
+static uint32_t ForegroundColor(const HighlightAttributes *defaults, const HighlightAttributes *hl_attribs) {
+	if (hl_attribs->flags & HL_ATTRIB_REVERSE) {
+		return hl_attribs->background == DEFAULT_COLOR ? defaults->background : hl_attribs->background;
+	}
+	return hl_attribs->foreground == DEFAULT_COLOR ? defaults->foreground : hl_attribs->foreground;
+}
+
+static uint32_t BackgroundColor(const HighlightAttributes *defaults, const HighlightAttributes *hl_attribs) {
+	if (hl_attribs->flags & HL_ATTRIB_REVERSE) {
+		return hl_attribs->foreground == DEFAULT_COLOR ? defaults->foreground : hl_attribs->foreground;
+	}
+	return hl_attribs->background == DEFAULT_COLOR ? defaults->background : hl_attribs->background;
+}
+
+static uint32_t SpecialColor(const HighlightAttributes *defaults, const HighlightAttributes *hl_attribs) {
+	return hl_attribs->special == DEFAULT_COLOR ? defaults->special : hl_attribs->special;
+}
+
+// D2D1::ColorF(UINT32)
+static StyleColor ColorF(uint32_t rgb) {
+	return StyleColor {
+		static_cast<float>((rgb >> 16) & 0xFF) / 255.0f,
+		static_cast<float>((rgb >> 8) & 0xFF) / 255.0f,
+		static_cast<float>(rgb & 0xFF) / 255.0f,
+		1.0f
+	};
+}
+
+static bool CheckStyle(UiState *ui, int id) {
+	const HighlightAttributes *defaults = &ui->hl_attribs[0];
+	const HighlightAttributes *hl_attribs = &ui->hl_attribs[id];
+	HighlightStyle *style = StyleTableGet(&ui->styles, id);
+	uint16_t flags = hl_attribs->flags;
+	bool ok = ColorEquals(style->foreground, ColorF(ForegroundColor(defaults, hl_attribs))) &&
+		ColorEquals(style->background, ColorF(BackgroundColor(defaults, hl_attribs))) &&
+		ColorEquals(style->special, flags & (HL_ATTRIB_UNDERLINE | HL_ATTRIB_UNDERCURL) ?
+			ColorF(SpecialColor(defaults, hl_attribs)) : StyleColor {}) &&
+		(style->font_weight == STYLE_FONT_WEIGHT_BOLD) == ((flags & HL_ATTRIB_BOLD) != 0) &&
+		(style->font_style == STYLE_FONT_STYLE_ITALIC) == ((flags & HL_ATTRIB_ITALIC) != 0) &&
+		style->decorations == (flags & (HL_ATTRIB_STRIKETHROUGH | HL_ATTRIB_UNDERLINE | HL_ATTRIB_UNDERCURL));
+	if (!ok) {
+		fprintf(stderr, "highlight %d: style differs from its attributes\n", id);
+		return false;
+	}
+
+	if (style->drawing_effect) {
+		const StubEffect *effect = &effects[reinterpret_cast<uintptr_t>(style->drawing_effect) - 1];
+		if (effect->releases != 0 || !ColorEquals(effect->foreground, style->foreground) ||
+			!ColorEquals(effect->special, style->special)) {
+			fprintf(stderr, "highlight %d: stale drawing effect\n", id);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Highlights drawn alike have to share a style, so no two are alike
+static bool CheckDistinct(UiState *ui) {
+	std::vector<std::array<uint32_t, 13>> keys;
+	for (int i = 0; i < ui->styles.style_count; ++i) {
+		const HighlightStyle *style = StyleTableStyle(&ui->styles, static_cast<uint16_t>(i));
+		std::array<uint32_t, 13> key;
+		memcpy(&key[0], &style->foreground, sizeof(StyleColor));
+		memcpy(&key[4], &style->background, sizeof(StyleColor));
+		memcpy(&key[8], &style->special, sizeof(StyleColor));
+		key[12] = static_cast<uint32_t>(style->font_weight) << 16 | style->font_style << 8 | style->decorations;
+		keys.push_back(key);
+	}
+	std::sort(keys.begin(), keys.end());
+	if (std::adjacent_find(keys.begin(), keys.end()) != keys.end()) {
+		fprintf(stderr, "two styles are alike\n");
+		return false;
+	}
+	return true;
+}
+
+static bool Check(int operations) {
+	UiState *ui = new UiState {};
+	if (!UiStateInitialize(ui)) {
+		return false;
+	}
+	StyleTableSetEffectSource(&ui->styles, StyleEffectSource { nullptr, CreateEffect, ReleaseEffect });
+	effects.clear();
+	BenchRandom random { 17 };
+
+	bool ok = true;
+	int highest_id = 0;
+	for (int i = 0; i < operations && ok; ++i) {
+		if (random.Below(5000) == 0) {
+			// More distinct highlights than the table holds, it has to
+			// drop the ones nothing uses anymore
+			for (int j = 0; j < STYLE_TABLE_CAPACITY + 5000; ++j) {
+				RedrawCommandHlAttrDefine hl_attr_define {};
+				hl_attr_define.id = 1 + static_cast<int32_t>(random.Below(HIGHLIGHTS));
+				hl_attr_define.flags_mask = 0xFFFF;
+				hl_attr_define.attributes.foreground = random.Below(0x1000000);
+				hl_attr_define.attributes.background = random.Below(0x1000000);
+				UiStateDefineHighlight(ui, &hl_attr_define);
+			}
+			highest_id = HIGHLIGHTS > highest_id ? HIGHLIGHTS : highest_id;
+			ok = CheckDistinct(ui);
+		}
+		else if (random.Below(200) == 0) {
+			RedrawCommandDefaultColorsSet default_colors {};
+			default_colors.rgb_fg = random.Below(0x1000000);
+			default_colors.rgb_bg = random.Below(0x1000000);
+			default_colors.rgb_sp = random.Below(0x1000000);
+			UiStateSetDefaultColors(ui, &default_colors);
+		}
+		else {
+			// Mostly redefinitions, some identical to what they replace
+			RedrawCommandHlAttrDefine hl_attr_define {};
+			// Now and then past the ids defined so far
+			hl_attr_define.id = 1 + static_cast<int32_t>(random.Below(random.Below(50) ? HIGHLIGHTS : 4 * HIGHLIGHTS));
+			hl_attr_define.flags_mask = 0xFFFF;
+			if (random.Below(3) == 0) {
+				hl_attr_define.attributes = ui->hl_attribs[hl_attr_define.id];
+			}
+			else {
+				hl_attr_define.attributes.foreground = BenchRandomColor(&random, DEFAULT_COLOR, 4, 0xF00000);
+				hl_attr_define.attributes.background = BenchRandomColor(&random, DEFAULT_COLOR, 4, 0xF00000);
+				hl_attr_define.attributes.special = BenchRandomColor(&random, DEFAULT_COLOR, 4, 0xF00000);
+				hl_attr_define.attributes.flags = static_cast<uint16_t>(random.Below(64));
+			}
+			UiStateDefineHighlight(ui, &hl_attr_define);
+			highest_id = hl_attr_define.id > highest_id ? hl_attr_define.id : highest_id;
+		}
+
+		// Draw a few, which makes their effects
+		for (int j = 0; j < 4; ++j) {
+			StyleTableDrawingEffect(&ui->styles, StyleTableGet(&ui->styles, static_cast<int>(random.Below(highest_id + 1))));
+		}
+		for (int id = 0; id <= highest_id && ok; ++id) {
+			ok = CheckStyle(ui, id);
+		}
+	}
+
+	// Every effect not held by a style was released once, the rest are on
+	// shutdown
+	ok = ok && CheckDistinct(ui);
+	size_t held = 0;
+	for (int i = 0; i < ui->styles.style_count; ++i) {
+		held += StyleTableStyle(&ui->styles, static_cast<uint16_t>(i))->drawing_effect != nullptr;
+	}
+	size_t released = 0;
+	for (const StubEffect &effect : effects) {
+		if (effect.releases > 1) {
+			fprintf(stderr, "drawing effect released %d times\n", effect.releases);
+			ok = false;
+		}
+		released += effect.releases;
+	}
+	ok = ok && released + held == effects.size();
+	StyleTableStats stats = ui->styles.stats;
+	UiStateShutdown(ui);
+	for (const StubEffect &effect : effects) {
+		if (ok && effect.releases != 1) {
+			fprintf(stderr, "drawing effect not released on shutdown\n");
+			ok = false;
+		}
+	}
+
+	printf("check: %s, %d operations, %llu styles resolved, %llu rebuilds, %zu drawing effects made\n",
+		ok ? "ok" : "FAILED", operations, static_cast<unsigned long long>(stats.resolved),
+		static_cast<unsigned long long>(stats.rebuilds), effects.size());
+	delete ui;
+	return ok;
+}
+
+// What drawing a run took before: resolving its colors, converting them
+// and allocating its drawing effect
+struct OldEffect {
+	StyleColor foreground;
+	StyleColor special;
+	uint32_t ref_count;
+};
+
+static void Measure(int iterations) {
+	UiState *ui = new UiState {};
+	UiStateInitialize(ui);
+	StyleTableSetEffectSource(&ui->styles, StyleEffectSource { nullptr, CreateEffect, ReleaseEffect });
+	BenchRandom random { 18 };
+	RedrawCommandDefaultColorsSet default_colors { {}, 0xD4D4D4, 0x1E1E1E, 0xFF0000 };
+	UiStateSetDefaultColors(ui, &default_colors);
+	// Like a colorscheme's syntax groups: a dozen colors, the odd
+	// background, bold or italic, so many ids are drawn alike
+	const uint32_t palette[] {
+		0xC586C0, 0x569CD6, 0x4EC9B0, 0xDCDCAA, 0xCE9178, 0x9CDCFE,
+		0x6A9955, 0xB5CEA8, 0xD16969, 0xD7BA7D, 0x808080, DEFAULT_COLOR
+	};
+	for (int id = 1; id <= HIGHLIGHTS; ++id) {
+		RedrawCommandHlAttrDefine hl_attr_define {};
+		hl_attr_define.id = id;
+		hl_attr_define.attributes.foreground = palette[random.Below(12)];
+		hl_attr_define.attributes.background = random.Below(8) ? DEFAULT_COLOR : palette[random.Below(4)];
+		hl_attr_define.attributes.special = DEFAULT_COLOR;
+		hl_attr_define.attributes.flags = static_cast<uint16_t>(
+			(random.Below(8) ? 0 : HL_ATTRIB_BOLD) | (random.Below(8) ? 0 : HL_ATTRIB_ITALIC));
+		UiStateDefineHighlight(ui, &hl_attr_define);
+	}
+
+	// Syntax dense rows, runs of 1 to 8 cells
+	std::vector<uint16_t> runs;
+	std::vector<uint16_t> row_hl_ids;
+	uint64_t hl_runs = 0;
+	uint64_t style_runs = 0;
+	for (int row = 0; row < ROWS; ++row) {
+		row_hl_ids.clear();
+		while (row_hl_ids.size() < COLS) {
+			uint16_t id = static_cast<uint16_t>(1 + random.Below(HIGHLIGHTS));
+			runs.push_back(id);
+			row_hl_ids.insert(row_hl_ids.end(), 1 + random.Below(8), id);
+		}
+		StyleRowRuns row_runs = StyleTableCountRuns(&ui->styles, row_hl_ids.data(), COLS);
+		hl_runs += static_cast<uint64_t>(row_runs.hl_runs);
+		style_runs += static_cast<uint64_t>(row_runs.style_runs);
+	}
+
+	uint64_t old_ns = UINT64_MAX;
+	uint64_t new_ns = UINT64_MAX;
+	for (int i = 0; i < iterations; ++i) {
+		float sum = 0.0f;
+		uint64_t start = BenchNowNs();
+		for (uint16_t id : runs) {
+			const HighlightAttributes *defaults = &ui->hl_attribs[0];
+			const HighlightAttributes *hl_attribs = &ui->hl_attribs[id];
+			OldEffect *effect = new OldEffect {
+				ColorF(ForegroundColor(defaults, hl_attribs)), ColorF(SpecialColor(defaults, hl_attribs)), 1
+			};
+			StyleColor background = ColorF(BackgroundColor(defaults, hl_attribs));
+			sum += effect->foreground.r + effect->special.g + background.b + (hl_attribs->flags & HL_ATTRIB_BOLD);
+			// Handed to DirectWrite, so the allocation can't be elided
+			BenchKeep(reinterpret_cast<uintptr_t>(effect) & 1);
+			delete effect;
+		}
+		uint64_t elapsed = BenchNowNs() - start;
+		old_ns = elapsed < old_ns ? elapsed : old_ns;
+
+		start = BenchNowNs();
+		for (uint16_t id : runs) {
+			HighlightStyle *style = StyleTableGet(&ui->styles, id);
+			void *effect = StyleTableDrawingEffect(&ui->styles, style);
+			sum += style->foreground.r + style->special.g + style->background.b + style->font_weight +
+				static_cast<float>(reinterpret_cast<uintptr_t>(effect) & 1);
+		}
+		elapsed = BenchNowNs() - start;
+		new_ns = elapsed < new_ns ? elapsed : new_ns;
+		BenchKeep(static_cast<uint64_t>(sum));
+	}
+
+	printf("\n%zu highlight runs over %d rows, ns/event per run\n", runs.size(), ROWS);
+	BenchReport("  resolve per run", old_ns, runs.size(), 0);
+	BenchReport("  style table", new_ns, runs.size(), 0);
+	printf("  %llu drawing effects for %zu runs\n",
+		static_cast<unsigned long long>(ui->styles.stats.effects_created), runs.size() * iterations);
+	printf("  %d highlights in %d styles, %.1f runs per row by highlight id, %.1f by style\n", HIGHLIGHTS,
+		ui->styles.style_count, static_cast<double>(hl_runs) / ROWS, static_cast<double>(style_runs) / ROWS);
+	UiStateShutdown(ui);
+	delete ui;
+}
+
+int main(int argc, char **argv) {
+	int operations = BenchArgInt(argc, argv, "--operations", 20000);
+	int iterations = BenchArgInt(argc, argv, "--iterations", 5);
+	if (operations <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: style_table_bench [--operations=N] [--iterations=N]\n");
+		return 2;
+	}
+
+	bool ok = Check(operations);
+	Measure(iterations);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,440 @@
+// Checks the vectorized text kernels against the scalar ones and measures
+// them at every level the CPU supports: bulk decoding of single ASCII
+// character cells, the repeat fills, unpacking cells into UTF-16 for
+// DirectWrite, grid_line translation as a whole, and the row scan that
+// splits rows into highlight runs and finds the cells drawn one by one,
+// on rows of 200, 500 and 1000 columns.
+//
+// Usage: transcode_bench [--iterations=N] [--level=scalar|sse4.1|avx2]
+// --level caps the levels measured. Exits with 1 if any level disagrees
+// with the per-cell reference.
+
+#include "bench_util.h"
+#include "common/transcode.h"
+#include "nvim/redraw_commands.h"
+
+constexpr int ROWS = 50;
+constexpr int COLS = 160;
+
+struct ExpectedLine {
+	std::vector<uint32_t> chars;
+	std::vector<uint16_t> hl_ids;
+};
+
+// Writes a grid_line with every kind of cell the bulk path has to stop
+// at, recording what the per-cell path makes of each
+static void WriteMixedGridLine(mpack_writer_t *writer, int row, BenchRandom *random, ExpectedLine *expected) {
+	uint32_t cell_count = random->Below(300);
+	mpack_start_array(writer, 4);
+	mpack_write_int(writer, 1);
+	mpack_write_int(writer, row);
+	mpack_write_int(writer, 0);
+	mpack_start_array(writer, cell_count);
+	uint16_t hl_id = 0;
+	const auto Expect = [&](const char *text, uint32_t length, uint32_t repeat) {
+		for (uint32_t i = 0; i < repeat; ++i) {
+			expected->chars.push_back(RedrawEncodeCellText(text, length));
+			expected->hl_ids.push_back(hl_id);
+		}
+	};
+	for (uint32_t i = 0; i < cell_count; ++i) {
+		char text[3] = { static_cast<char>(' ' + random->Below(95)) };
+		uint32_t pick = random->Below(100);
+		if (pick < 70) {
+			mpack_start_array(writer, 1);
+			mpack_write_str(writer, text, 1);
+			Expect(text, 1, 1);
+		}
+		else if (pick < 83) {
+			// Highlight ids from 128 on no longer fit a positive fixint
+			hl_id = static_cast<uint16_t>(random->Below(pick < 80 ? 128 : 1000));
+			mpack_start_array(writer, 2);
+			mpack_write_str(writer, text, 1);
+			mpack_write_int(writer, hl_id);
+			Expect(text, 1, 1);
+		}
+		else if (pick < 88) {
+			hl_id = static_cast<uint16_t>(random->Below(128));
+			uint32_t repeat = 1 + random->Below(40);
+			mpack_start_array(writer, 3);
+			mpack_write_str(writer, text, 1);
+			mpack_write_int(writer, hl_id);
+			mpack_write_int(writer, repeat);
+			Expect(text, 1, repeat);
+		}
+		else if (pick < 92) {
+			uint32_t codepoint = 0x4E00 + random->Below(0x200);
+			char utf8[3] = {
+				static_cast<char>(0xE0 | (codepoint >> 12)),
+				static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)),
+				static_cast<char>(0x80 | (codepoint & 0x3F))
+			};
+			mpack_start_array(writer, 1);
+			mpack_write_str(writer, utf8, 3);
+			Expect(utf8, 3, 1);
+		}
+		else if (pick < 95) {
+			mpack_start_array(writer, 1);
+			mpack_write_str(writer, "", 0);
+			Expect("", 0, 1);
+		}
+		else if (pick < 98) {
+			// A lone lead byte, the bulk path must not take it for ASCII
+			text[0] = static_cast<char>(0x80 + random->Below(0x80));
+			mpack_start_array(writer, 1);
+			mpack_write_str(writer, text, 1);
+			Expect(text, 1, 1);
+		}
+		else {
+			text[1] = text[0];
+			mpack_start_array(writer, 1);
+			mpack_write_str(writer, text, 2);
+			Expect(text, 2, 1);
+		}
+		mpack_finish_array(writer);
+	}
+	mpack_finish_array(writer);
+	mpack_finish_array(writer);
+}
+
+static bool CheckTranslation(const char *level_name) {
+	BenchRandom random { 7 };
+	for (int message = 0; message < 200; ++message) {
+		std::vector<ExpectedLine> expected(1 + random.Below(8));
+		// Without a trailing event the last cell ends the message, which
+		// the vector loads must not read past
+		bool trailing_flush = random.Below(2) == 0;
+
+		char *data;
+		size_t size;
+		mpack_writer_t writer;
+		mpack_writer_init_growable(&writer, &data, &size);
+		mpack_start_array(&writer, 3);
+		mpack_write_int(&writer, 2);
+		mpack_write_cstr(&writer, "redraw");
+		mpack_start_array(&writer, trailing_flush ? 2 : 1);
+		mpack_start_array(&writer, 1 + static_cast<uint32_t>(expected.size()));
+		mpack_write_cstr(&writer, "grid_line");
+		for (size_t row = 0; row < expected.size(); ++row) {
+			WriteMixedGridLine(&writer, static_cast<int>(row), &random, &expected[row]);
+		}
+		mpack_finish_array(&writer);
+		if (trailing_flush) {
+			mpack_start_array(&writer, 2);
+			mpack_write_cstr(&writer, "flush");
+			mpack_start_array(&writer, 0);
+			mpack_finish_array(&writer);
+			mpack_finish_array(&writer);
+		}
+		mpack_finish_array(&writer);
+		mpack_finish_array(&writer);
+		if (mpack_writer_destroy(&writer) != mpack_ok) {
+			fprintf(stderr, "failed to write a grid_line message\n");
+			return false;
+		}
+
+		// Exactly sized, so reading past the message is caught by ASan
+		char *message_data = static_cast<char *>(malloc(size));
+		memcpy(message_data, data, size);
+		MPACK_FREE(data);
+		size_t commands_size;
+		char *commands = RedrawTranslate(message_data, size, &commands_size);
+		free(message_data);
+
+		bool ok = commands != nullptr;
+		size_t lines = 0;
+		RedrawCommandReader reader;
+		if (ok && RedrawCommandsBegin(&reader, commands, commands_size)) {
+			const RedrawCommand *command;
+			while (ok && (command = RedrawNextCommand(&reader))) {
+				if (command->event != RedrawEvent::grid_line) {
+					continue;
+				}
+				const RedrawCommandGridLine *grid_line = reinterpret_cast<const RedrawCommandGridLine *>(command);
+				ok = lines < expected.size();
+				if (!ok) {
+					break;
+				}
+				ExpectedLine *line = &expected[lines++];
+				ok = grid_line->cell_count == line->chars.size() && (line->chars.empty() ||
+					(!memcmp(RedrawGridLineChars(grid_line), line->chars.data(), line->chars.size() * sizeof(uint32_t)) &&
+					!memcmp(RedrawGridLineHlIds(grid_line), line->hl_ids.data(), line->hl_ids.size() * sizeof(uint16_t))));
+			}
+		}
+		free(commands);
+		if (!ok || lines != expected.size()) {
+			fprintf(stderr, "%s: grid_line translation of message %d differs from the per-cell decoding\n",
+				level_name, message);
+			return false;
+		}
+	}
+	return true;
+}
+
+// A row of highlight runs, mostly printable ASCII with the characters at
+// either end of the plain range, wide cells and surrogate pairs mixed in
+static void RandomScanRow(BenchRandom *random, size_t count, uint32_t special_chance,
+	std::vector<uint32_t> *chars, std::vector<uint16_t> *hl_ids, std::vector<uint8_t> *flags) {
+	chars->resize(count);
+	hl_ids->resize(count);
+	flags->resize(count);
+	uint16_t hl_id = static_cast<uint16_t>(random->Below(0x10000));
+	for (size_t i = 0; i < count; ++i) {
+		if (random->Below(8) == 0) {
+			hl_id = random->Below(4) ? static_cast<uint16_t>(random->Below(0x10000)) : hl_id ^ 0x8000;
+		}
+		(*hl_ids)[i] = hl_id;
+		(*chars)[i] = ' ' + random->Below(95);
+		(*flags)[i] = 0;
+		if (random->Below(100) < special_chance) {
+			const uint32_t specials[] { 0, 0x1F, 0x7F, 0xFF, 0x4E00, 0xD83DDE00, 0xFFFFFFFF };
+			(*chars)[i] = specials[random->Below(7)];
+			(*flags)[i] = static_cast<uint8_t>(1 << random->Below(8));
+		}
+	}
+}
+
+static bool CheckScanRow(const char *level_name) {
+	BenchRandom random { 13 };
+	const TranscodeScanRules rules[] {
+		{ 0x20, 0x5F, 1 },
+		{ 0x20, 0x5F, 0xFF },
+		{ 0, 0, 0 },
+		{ 0, 0xFFFFFFFF, 0 },
+		{ 0x80000000, 0x80000000, 0x80 },
+	};
+	std::vector<uint32_t> chars;
+	std::vector<uint16_t> hl_ids;
+	std::vector<uint8_t> flags;
+	for (size_t count = 0; count < 1100; count += count < 300 ? 1 : 97) {
+		for (uint32_t special_chance : { 0u, 3u, 60u }) {
+			RandomScanRow(&random, count, special_chance, &chars, &hl_ids, &flags);
+			const TranscodeScanRules *rule = &rules[random.Below(5)];
+			// Exactly sized, so reading or writing past the row is caught by ASan
+			std::vector<uint32_t> run_starts(count);
+			std::vector<uint64_t> special((count + 63) / 64, ~0ull);
+			size_t run_count = TranscodeScanRow(chars.data(), hl_ids.data(), flags.data(), count, rule,
+				run_starts.data(), special.data());
+
+			size_t expected_runs = 0;
+			bool ok = true;
+			for (size_t i = 0; i < count; ++i) {
+				if (i == 0 || hl_ids[i] != hl_ids[i - 1]) {
+					ok = ok && expected_runs < run_count && run_starts[expected_runs] == i;
+					++expected_runs;
+				}
+				bool expected_special = chars[i] - rule->plain_first >= rule->plain_count ||
+					(flags[i] & rule->special_flags);
+				ok = ok && ((special[i / 64] >> (i % 64)) & 1) == expected_special;
+			}
+			if (count % 64) {
+				ok = ok && (special[count / 64] >> (count % 64)) == 0;
+			}
+			if (!ok || run_count != expected_runs) {
+				fprintf(stderr, "%s: scan of %zu cells with %u%% special ones differs from the per-cell one\n",
+					level_name, count, special_chance);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool CheckKernels(const char *level_name) {
+	BenchRandom random { 11 };
+
+	// Cell runs broken up at random, decoded from every offset
+	std::vector<uint8_t> cells;
+	for (int i = 0; i < 4000; ++i) {
+		uint32_t pick = random.Below(100);
+		uint8_t c = static_cast<uint8_t>(' ' + random.Below(95));
+		if (pick < 90) {
+			cells.insert(cells.end(), { 0x91, 0xA1, c });
+		}
+		else if (pick < 94) {
+			cells.insert(cells.end(), { 0x91, 0xA1, static_cast<uint8_t>(c | 0x80) });
+		}
+		else if (pick < 97) {
+			cells.insert(cells.end(), { 0x92, 0xA1, c, 1 });
+		}
+		else {
+			cells.insert(cells.end(), { 0x91, 0xA2, c, c });
+		}
+	}
+	std::vector<uint32_t> chars(64);
+	std::vector<uint32_t> expected_chars(64);
+	for (size_t offset = 0; offset < cells.size(); ++offset) {
+		size_t size = cells.size() - offset < 100 ? cells.size() - offset : 1 + random.Below(100);
+		size_t max_cells = random.Below(65);
+		size_t count = TranscodeAsciiCells(&cells[offset], size, chars.data(), max_cells);
+		TranscodeLevel level = TranscodeGetLevel();
+		TranscodeSetLevel(TranscodeLevel::Scalar);
+		size_t expected_count = TranscodeAsciiCells(&cells[offset], size, expected_chars.data(), max_cells);
+		TranscodeSetLevel(level);
+		if (count != expected_count || memcmp(chars.data(), expected_chars.data(), count * sizeof(uint32_t))) {
+			fprintf(stderr, "%s: ascii cells at offset %zu decode to %zu cells instead of %zu\n",
+				level_name, offset, count, expected_count);
+			return false;
+		}
+	}
+
+	// Fills must stop exactly at the count, whatever the alignment
+	for (size_t count = 0; count < 100; ++count) {
+		for (size_t offset = 0; offset < 8; ++offset) {
+			uint32_t fill32[128];
+			uint16_t fill16[128];
+			memset(fill32, 0, sizeof(fill32));
+			memset(fill16, 0, sizeof(fill16));
+			TranscodeFill32(fill32 + offset, 0xDEADBEEF, count);
+			TranscodeFill16(fill16 + offset, 0xBEEF, count);
+			for (size_t i = 0; i < 128; ++i) {
+				bool inside = i >= offset && i < offset + count;
+				if (fill32[i] != (inside ? 0xDEADBEEF : 0) || fill16[i] != (inside ? 0xBEEF : 0)) {
+					fprintf(stderr, "%s: fill of %zu at offset %zu is wrong at %zu\n", level_name, count, offset, i);
+					return false;
+				}
+			}
+		}
+	}
+
+	// Rows from all BMP to mostly surrogate pairs, of every length
+	for (uint32_t pair_chance : { 0u, 2u, 50u }) {
+		for (size_t count = 0; count < 200; ++count) {
+			std::vector<uint32_t> row(count);
+			for (uint32_t &cell : row) {
+				cell = random.Below(100) < pair_chance ?
+					((0xD800 + random.Below(0x400)) << 16) | (0xDC00 + random.Below(0x400)) :
+					random.Below(0x10000);
+			}
+			std::vector<uint16_t> utf16(count * 2 + 1, 0);
+			std::vector<uint16_t> expected_utf16(count * 2 + 1, 0);
+			size_t length = TranscodeCellsToUtf16(row.data(), count, utf16.data());
+			size_t expected_length = 0;
+			for (uint32_t cell : row) {
+				if (cell > 0xFFFF) {
+					expected_utf16[expected_length++] = static_cast<uint16_t>(cell >> 16);
+				}
+				expected_utf16[expected_length++] = static_cast<uint16_t>(cell);
+			}
+			if (length != expected_length || utf16 != expected_utf16) {
+				fprintf(stderr, "%s: %zu cells with %u%% surrogate pairs unpack wrong\n", level_name, count, pair_chance);
+				return false;
+			}
+		}
+	}
+	return CheckScanRow(level_name) && CheckTranslation(level_name);
+}
+
+static void Measure(const char *level_name, int iterations) {
+	char name[64];
+
+	// A row of single ASCII character cells as nvim sends them
+	std::vector<uint8_t> cells;
+	BenchRandom random { 3 };
+	for (int i = 0; i < COLS; ++i) {
+		cells.insert(cells.end(), { 0x91, 0xA1, static_cast<uint8_t>('!' + random.Below(94)) });
+	}
+	std::vector<uint32_t> chars(COLS);
+	int rows = iterations * ROWS;
+	uint64_t start = BenchNowNs();
+	for (int i = 0; i < rows; ++i) {
+		BenchKeep(TranscodeAsciiCells(cells.data(), cells.size(), chars.data(), COLS));
+	}
+	snprintf(name, sizeof(name), "ascii cells (%s)", level_name);
+	BenchReport(name, BenchNowNs() - start, static_cast<uint64_t>(rows) * COLS, static_cast<uint64_t>(rows) * cells.size());
+
+	start = BenchNowNs();
+	for (int i = 0; i < rows; ++i) {
+		TranscodeFill32(chars.data(), static_cast<uint32_t>(i), COLS);
+	}
+	BenchKeep(chars[COLS - 1]);
+	snprintf(name, sizeof(name), "fill (%s)", level_name);
+	BenchReport(name, BenchNowNs() - start, static_cast<uint64_t>(rows) * COLS, static_cast<uint64_t>(rows) * COLS * 4);
+
+	// ConvertToWide on an ASCII row and on a row with a few emoji
+	std::vector<uint16_t> utf16(COLS * 2);
+	for (bool emoji : { false, true }) {
+		for (int i = 0; i < COLS; ++i) {
+			chars[i] = emoji && random.Below(16) == 0 ? 0xD83DDE00 : '!' + random.Below(94);
+		}
+		start = BenchNowNs();
+		for (int i = 0; i < rows; ++i) {
+			BenchKeep(TranscodeCellsToUtf16(chars.data(), COLS, utf16.data()));
+		}
+		snprintf(name, sizeof(name), "to utf16 %s (%s)", emoji ? "emoji" : "ascii", level_name);
+		BenchReport(name, BenchNowNs() - start, static_cast<uint64_t>(rows) * COLS, static_cast<uint64_t>(rows) * COLS * 4);
+	}
+
+	// Rows as the renderer scans them before drawing, ASCII text with a
+	// few wide cells
+	for (int cols : { 200, 500, 1000 }) {
+		std::vector<uint32_t> row_chars;
+		std::vector<uint16_t> hl_ids;
+		std::vector<uint8_t> flags;
+		RandomScanRow(&random, cols, 2, &row_chars, &hl_ids, &flags);
+		std::vector<uint32_t> run_starts(cols);
+		std::vector<uint64_t> special((cols + 63) / 64);
+		const TranscodeScanRules rules { 0x20, 0x5F, 1 };
+		int scans = rows * COLS / cols;
+		start = BenchNowNs();
+		for (int i = 0; i < scans; ++i) {
+			BenchKeep(TranscodeScanRow(row_chars.data(), hl_ids.data(), flags.data(), cols, &rules,
+				run_starts.data(), special.data()));
+		}
+		snprintf(name, sizeof(name), "scan %d cols (%s)", cols, level_name);
+		BenchReport(name, BenchNowNs() - start, static_cast<uint64_t>(scans) * cols, static_cast<uint64_t>(scans) * cols * 7);
+	}
+
+	// Whole repaints, the ASCII one mostly takes the bulk path
+	for (BenchCellText text : { BenchCellText::Ascii, BenchCellText::Cjk }) {
+		std::vector<char> stream;
+		BenchGenerateRepaintStream(&stream, iterations, ROWS, COLS, 8, text, 5);
+		std::vector<BenchMessage> messages;
+		BenchFrameStream(stream, &messages);
+		start = BenchNowNs();
+		for (const BenchMessage &message : messages) {
+			size_t commands_size;
+			char *commands = RedrawTranslate(stream.data() + message.offset, message.size, &commands_size);
+			BenchKeep(commands_size);
+			free(commands);
+		}
+		snprintf(name, sizeof(name), "translate %s (%s)", text == BenchCellText::Ascii ? "ascii" : "cjk", level_name);
+		BenchReport(name, BenchNowNs() - start, static_cast<uint64_t>(iterations) * ROWS * COLS, stream.size());
+	}
+}
+
+int main(int argc, char **argv) {
+	int iterations = BenchArgInt(argc, argv, "--iterations", 200);
+	if (iterations <= 0) {
+		fprintf(stderr, "--iterations must be positive\n");
+		return 1;
+	}
+	TranscodeLevel max_level = TranscodeDetectLevel();
+	printf("detected: %s, events are cells\n", TranscodeLevelName(max_level));
+	if (const char *level_arg = BenchArg(argc, argv, "--level")) {
+		bool known = false;
+		for (TranscodeLevel level : { TranscodeLevel::Scalar, TranscodeLevel::Sse41, TranscodeLevel::Avx2 }) {
+			if (!strcmp(level_arg, TranscodeLevelName(level))) {
+				max_level = level < max_level ? level : max_level;
+				known = true;
+			}
+		}
+		if (!known) {
+			fprintf(stderr, "unknown level %s\n", level_arg);
+			return 1;
+		}
+	}
+
+	for (TranscodeLevel level : { TranscodeLevel::Scalar, TranscodeLevel::Sse41, TranscodeLevel::Avx2 }) {
+		if (level > max_level) {
+			break;
+		}
+		TranscodeSetLevel(level);
+		const char *level_name = TranscodeLevelName(level);
+		if (!CheckKernels(level_name)) {
+			return 1;
+		}
+		Measure(level_name, iterations);
+	}
+	return 0;
+}
@@ -0,0 +1,427 @@
+// Round trip latency and request throughput over each nvim transport.
+// Without --server it starts a stub msgpack-rpc server, which answers every
+// request with its own params, and runs against it over a child process's
+// pipes (this executable with --stub), a Unix domain socket and loopback
+// TCP. With --server it measures a running `nvim --listen <address>`.
+//
+// Usage: transport_bench [--server=<address>] [--requests=N] [--batch=N]
+//                        [--payload=N] [--iterations=N]
+//
+// Throughput compares writing every request on its own against gathering
+// --batch of them into a single TransportWrite. Every response is checked
+// against the request it answers.
+
+#include "bench_util.h"
+#include "common/mpack_cursor.h"
+#include "common/mpack_helper.h"
+#include "nvim/transport.h"
+#include <algorithm>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+constexpr size_t STUB_READ_SIZE = 64 * 1024;
+
+static bool WriteAll(int fd, const char *data, size_t size) {
+	while (size > 0) {
+		ssize_t bytes = write(fd, data, size);
+		if (bytes <= 0) {
+			return false;
+		}
+		data += bytes;
+		size -= static_cast<size_t>(bytes);
+	}
+	return true;
+}
+
+// Answers [0, id, method, params] with [1, id, nil, params] until the
+// stream ends. Responses to everything a read returned go out together.
+static void ServeRequests(int in_fd, int out_fd) {
+	std::vector<char> pending;
+	size_t pending_start = 0;
+	MPackFramer framer {};
+	char *responses;
+	size_t responses_size;
+	char read_buffer[STUB_READ_SIZE];
+	while (true) {
+		ssize_t bytes = read(in_fd, read_buffer, sizeof(read_buffer));
+		if (bytes <= 0) {
+			return;
+		}
+		pending.insert(pending.end(), read_buffer, read_buffer + bytes);
+
+		mpack_writer_t writer;
+		mpack_writer_init_growable(&writer, &responses, &responses_size);
+		while (true) {
+			bool invalid;
+			size_t message_size = MPackFramerScan(&framer, pending.data() + pending_start, pending.size() - pending_start, &invalid);
+			if (invalid) {
+				mpack_writer_destroy(&writer);
+				MPACK_FREE(responses);
+				return;
+			}
+			if (message_size == 0) {
+				break;
+			}
+			MPackCursor cursor = MPackCursorInit(pending.data() + pending_start, message_size);
+			uint32_t elements = MPackCursorArray(&cursor);
+			int64_t type = MPackCursorInt(&cursor);
+			int64_t msg_id = MPackCursorInt(&cursor);
+			MPackCursorSkip(&cursor);
+			if (MPackCursorOk(&cursor) && elements == 4 && type == 0) {
+				mpack_start_array(&writer, 4);
+				mpack_write_int(&writer, 1);
+				mpack_write_i64(&writer, msg_id);
+				mpack_write_nil(&writer);
+				mpack_write_object_bytes(&writer, reinterpret_cast<const char *>(cursor.pos), static_cast<size_t>(cursor.end - cursor.pos));
+				mpack_finish_array(&writer);
+			}
+			pending_start += message_size;
+		}
+		mpack_writer_destroy(&writer);
+		bool written = WriteAll(out_fd, responses, responses_size);
+		MPACK_FREE(responses);
+		if (!written) {
+			return;
+		}
+
+		pending.erase(pending.begin(), pending.begin() + static_cast<ptrdiff_t>(pending_start));
+		pending_start = 0;
+	}
+}
+
+// Accepts a single connection and serves it on its own thread
+struct StubListener {
+	int listen_fd;
+	std::thread thread;
+};
+
+static void StartListener(StubListener *listener) {
+	listener->thread = std::thread([listener]() {
+		int connection = accept(listener->listen_fd, nullptr, nullptr);
+		if (connection >= 0) {
+			ServeRequests(connection, connection);
+			close(connection);
+		}
+	});
+}
+
+static bool ListenUnixSocket(StubListener *listener, const char *path) {
+	sockaddr_un address {};
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+	unlink(path);
+	listener->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener->listen_fd < 0 ||
+		bind(listener->listen_fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+		listen(listener->listen_fd, 1) != 0) {
+		return false;
+	}
+	StartListener(listener);
+	return true;
+}
+
+// Listens on an ephemeral loopback port, written to `address` as host:port
+static bool ListenTcp(StubListener *listener, char *address, size_t address_size) {
+	sockaddr_in socket_address {};
+	socket_address.sin_family = AF_INET;
+	socket_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socket_address.sin_port = 0;
+	listener->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	socklen_t length = sizeof(socket_address);
+	if (listener->listen_fd < 0 ||
+		bind(listener->listen_fd, reinterpret_cast<const sockaddr *>(&socket_address), sizeof(socket_address)) != 0 ||
+		listen(listener->listen_fd, 1) != 0 ||
+		getsockname(listener->listen_fd, reinterpret_cast<sockaddr *>(&socket_address), &length) != 0) {
+		return false;
+	}
+	snprintf(address, address_size, "127.0.0.1:%d", ntohs(socket_address.sin_port));
+	StartListener(listener);
+	return true;
+}
+
+static void StopListener(StubListener *listener) {
+	if (listener->thread.joinable()) {
+		listener->thread.join();
+	}
+	close(listener->listen_fd);
+}
+
+// Frames the responses read from a transport
+struct ResponseReader {
+	Transport *transport;
+	std::vector<char> buffer;
+	size_t start;
+	size_t end;
+	MPackFramer framer;
+};
+
+// Returns the next response's id, -1 if the stream ended or a response
+// doesn't answer a request without an error
+static int64_t ReadResponse(ResponseReader *reader) {
+	while (true) {
+		bool invalid;
+		size_t message_size = MPackFramerScan(&reader->framer, reader->buffer.data() + reader->start,
+			reader->end - reader->start, &invalid);
+		if (invalid) {
+			return -1;
+		}
+		if (message_size > 0) {
+			MPackCursor cursor = MPackCursorInit(reader->buffer.data() + reader->start, message_size);
+			uint32_t elements = MPackCursorArray(&cursor);
+			int64_t type = MPackCursorInt(&cursor);
+			int64_t msg_id = MPackCursorInt(&cursor);
+			bool no_error = MPackCursorIsNil(&cursor);
+			reader->start += message_size;
+			if (!MPackCursorOk(&cursor) || elements != 4 || type != 1 || !no_error) {
+				return -1;
+			}
+			return msg_id;
+		}
+
+		// Keep the pending response at the start of the buffer
+		memmove(reader->buffer.data(), reader->buffer.data() + reader->start, reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+		if (reader->buffer.size() - reader->end < STUB_READ_SIZE) {
+			reader->buffer.resize(reader->buffer.size() * 2);
+		}
+		size_t bytes = TransportRead(reader->transport, reader->buffer.data() + reader->end, reader->buffer.size() - reader->end);
+		if (bytes == 0) {
+			return -1;
+		}
+		reader->end += bytes;
+	}
+}
+
+// nvim_eval("<payload>") works against nvim too, the payload is a string
+// literal of spaces
+static size_t EncodeRequest(char *data, size_t capacity, int64_t msg_id, const char *expression) {
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, data, capacity);
+	MPackStartRequest(msg_id, "nvim_eval", &writer);
+	mpack_start_array(&writer, 1);
+	mpack_write_cstr(&writer, expression);
+	mpack_finish_array(&writer);
+	return MPackFinishMessage(&writer);
+}
+
+struct BenchOptions {
+	int requests;
+	int batch;
+	int iterations;
+	std::vector<char> expression;
+};
+
+static bool MeasureLatency(const char *name, Transport *transport, ResponseReader *reader, const BenchOptions *options,
+	int64_t *next_msg_id) {
+	std::vector<char> request(options->expression.size() + 64);
+	std::vector<uint64_t> round_trips;
+	round_trips.reserve(static_cast<size_t>(options->requests));
+	for (int i = 0; i < options->requests; ++i) {
+		int64_t msg_id = (*next_msg_id)++;
+		size_t size = EncodeRequest(request.data(), request.size(), msg_id, options->expression.data());
+		TransportBuffer buffer { request.data(), size };
+		uint64_t start = BenchNowNs();
+		if (!TransportWrite(transport, &buffer, 1) || ReadResponse(reader) != msg_id) {
+			fprintf(stderr, "%s: request %lld went unanswered\n", name, static_cast<long long>(msg_id));
+			return false;
+		}
+		round_trips.push_back(BenchNowNs() - start);
+	}
+
+	std::sort(round_trips.begin(), round_trips.end());
+	const auto Percentile = [&](int percentile) {
+		return static_cast<double>(round_trips[round_trips.size() * percentile / 100]) / 1000.0;
+	};
+	printf("  round trip          p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+		Percentile(50), Percentile(99), static_cast<double>(round_trips.back()) / 1000.0);
+	return true;
+}
+
+// Writes every request, `batch` per TransportWrite, while a thread reads
+// the responses. Returns the time until the last response arrived.
+static bool MeasureThroughput(const char *name, Transport *transport, ResponseReader *reader, const BenchOptions *options,
+	int batch, int64_t *next_msg_id, uint64_t *elapsed_ns, size_t *bytes) {
+	const size_t request_capacity = options->expression.size() + 64;
+	std::vector<char> requests(request_capacity * static_cast<size_t>(options->requests));
+	std::vector<TransportBuffer> buffers(static_cast<size_t>(options->requests));
+	int64_t first_msg_id = *next_msg_id;
+	*bytes = 0;
+	for (int i = 0; i < options->requests; ++i) {
+		char *request = requests.data() + request_capacity * static_cast<size_t>(i);
+		size_t size = EncodeRequest(request, request_capacity, (*next_msg_id)++, options->expression.data());
+		buffers[static_cast<size_t>(i)] = TransportBuffer { request, size };
+		*bytes += size;
+	}
+
+	bool responses_match = true;
+	uint64_t start = BenchNowNs();
+	std::thread response_thread([&]() {
+		for (int i = 0; i < options->requests; ++i) {
+			if (ReadResponse(reader) != first_msg_id + i) {
+				responses_match = false;
+				return;
+			}
+		}
+	});
+	bool written = true;
+	for (int i = 0; i < options->requests && written; i += batch) {
+		int count = std::min(batch, options->requests - i);
+		written = TransportWrite(transport, &buffers[static_cast<size_t>(i)], count);
+	}
+	response_thread.join();
+	*elapsed_ns = BenchNowNs() - start;
+
+	if (!written || !responses_match) {
+		fprintf(stderr, "%s: responses didn't match the requests\n", name);
+		return false;
+	}
+	return true;
+}
+
+static bool RunTransport(const char *name, Transport *transport, const BenchOptions *options) {
+	printf("\n%s\n", name);
+	ResponseReader reader {
+		.transport = transport,
+		.buffer = std::vector<char>(4 * STUB_READ_SIZE),
+		.start = 0,
+		.end = 0,
+		.framer = {}
+	};
+	int64_t next_msg_id = 1;
+	if (!MeasureLatency(name, transport, &reader, options, &next_msg_id)) {
+		return false;
+	}
+
+	const int batches[] { 1, options->batch };
+	for (int batch : batches) {
+		uint64_t best_ns = UINT64_MAX;
+		size_t bytes = 0;
+		uint64_t writes_before = transport->writes;
+		for (int i = 0; i < options->iterations; ++i) {
+			uint64_t elapsed_ns;
+			if (!MeasureThroughput(name, transport, &reader, options, batch, &next_msg_id, &elapsed_ns, &bytes)) {
+				return false;
+			}
+			best_ns = elapsed_ns < best_ns ? elapsed_ns : best_ns;
+		}
+		char label[64];
+		snprintf(label, sizeof(label), "  %d per write (%llu writes)", batch,
+			static_cast<unsigned long long>((transport->writes - writes_before) / static_cast<uint64_t>(options->iterations)));
+		BenchReport(label, best_ns, static_cast<uint64_t>(options->requests), bytes);
+	}
+	return true;
+}
+
+static bool CheckAddressParsing() {
+	struct {
+		const char *address;
+		TransportKind kind;
+	} cases[] {
+		{ "127.0.0.1:6666", TransportKind::Tcp },
+		{ "localhost:6666", TransportKind::Tcp },
+		{ "[::1]:6666", TransportKind::Tcp },
+		{ "/tmp/nvim.sock", TransportKind::LocalSocket },
+		{ "nvim.sock", TransportKind::LocalSocket },
+		{ "./nvim:6666", TransportKind::LocalSocket },
+		{ "\\\\.\\pipe\\nvim-1234-0", TransportKind::LocalSocket },
+		{ "localhost:", TransportKind::LocalSocket },
+		{ ":6666", TransportKind::LocalSocket },
+	};
+	for (const auto &test : cases) {
+		if (TransportAddressKind(test.address) != test.kind) {
+			fprintf(stderr, "%s parsed as the wrong kind of address\n", test.address);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc == 2 && !strcmp(argv[1], "--stub")) {
+		ServeRequests(STDIN_FILENO, STDOUT_FILENO);
+		return 0;
+	}
+
+	BenchOptions options {
+		.requests = BenchArgInt(argc, argv, "--requests", 10000),
+		.batch = BenchArgInt(argc, argv, "--batch", 16),
+		.iterations = BenchArgInt(argc, argv, "--iterations", 3),
+		.expression = {}
+	};
+	int payload = BenchArgInt(argc, argv, "--payload", 16);
+	if (options.requests < 1 || options.batch < 1 || options.batch > MAX_TRANSPORT_BUFFERS ||
+		options.iterations < 1 || payload < 0) {
+		fprintf(stderr, "--batch has to be between 1 and %d, the other options positive\n", MAX_TRANSPORT_BUFFERS);
+		return 1;
+	}
+	// A vimscript string literal nvim_eval hands back
+	options.expression.assign(static_cast<size_t>(payload) + 3, ' ');
+	options.expression.front() = '\'';
+	options.expression[options.expression.size() - 2] = '\'';
+	options.expression.back() = '\0';
+
+	if (!CheckAddressParsing()) {
+		return 1;
+	}
+
+	if (const char *server = BenchArg(argc, argv, "--server")) {
+		Transport transport;
+		if (!TransportConnect(&transport, server, 0)) {
+			fprintf(stderr, "Could not connect to %s\n", server);
+			return 1;
+		}
+		bool success = RunTransport(server, &transport, &options);
+		TransportClose(&transport);
+		return success ? 0 : 1;
+	}
+
+	bool success = true;
+	{
+		char *const stub_argv[] { argv[0], const_cast<char *>("--stub"), nullptr };
+		Transport transport;
+		if (!TransportSpawn(&transport, stub_argv, 0)) {
+			fprintf(stderr, "Could not start %s --stub\n", argv[0]);
+			return 1;
+		}
+		success = RunTransport("child process pipes", &transport, &options);
+		TransportClose(&transport);
+	}
+
+	char socket_path[64];
+	snprintf(socket_path, sizeof(socket_path), "/tmp/nvy-transport-bench-%d.sock", static_cast<int>(getpid()));
+	StubListener unix_listener {};
+	if (success && ListenUnixSocket(&unix_listener, socket_path)) {
+		Transport transport;
+		success = TransportConnect(&transport, socket_path, 0) && RunTransport("unix domain socket", &transport, &options);
+		TransportClose(&transport);
+		StopListener(&unix_listener);
+		unlink(socket_path);
+	}
+	else if (success) {
+		fprintf(stderr, "Could not listen on %s\n", socket_path);
+		success = false;
+	}
+
+	char tcp_address[64];
+	StubListener tcp_listener {};
+	if (success && ListenTcp(&tcp_listener, tcp_address, sizeof(tcp_address))) {
+		Transport transport;
+		success = TransportConnect(&transport, tcp_address, 0) && RunTransport("loopback tcp", &transport, &options);
+		TransportClose(&transport);
+		StopListener(&tcp_listener);
+	}
+	else if (success) {
+		fprintf(stderr, "Could not listen on loopback tcp\n");
+		success = false;
+	}
+
+	if (success) {
+		printf("\n%d requests with a %d byte payload, best of %d\n", options.requests, payload, options.iterations);
+	}
+	return success ? 0 : 1;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include <cstddef>
+
+// Data written by different threads is kept this far apart so the threads
+// don't contend for the same line, and arrays scanned in bulk start on one
+constexpr size_t CACHE_LINE_SIZE = 64;
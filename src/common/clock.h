@@ -0,0 +1,9 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Monotonic time in nanoseconds, only meaningful as a difference
+inline uint64_t ClockNowNs() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
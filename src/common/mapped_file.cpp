@@ -0,0 +1,99 @@
+#include "mapped_file.h"
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+bool MappedFileOpen(MappedFile *file, const char *path) {
+	*file = MappedFile {};
+	HANDLE file_handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_handle, &size)) {
+		CloseHandle(file_handle);
+		return false;
+	}
+	file->file_handle = file_handle;
+	file->size = static_cast<size_t>(size.QuadPart);
+	// Empty files can't be mapped
+	if (file->size == 0) {
+		return true;
+	}
+
+	HANDLE mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping_handle) {
+		MappedFileClose(file);
+		return false;
+	}
+	file->mapping_handle = mapping_handle;
+	file->data = static_cast<const char *>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+	if (!file->data) {
+		MappedFileClose(file);
+		return false;
+	}
+	return true;
+}
+
+void MappedFileClose(MappedFile *file) {
+	if (file->data) {
+		UnmapViewOfFile(file->data);
+	}
+	if (file->mapping_handle) {
+		CloseHandle(file->mapping_handle);
+	}
+	if (file->file_handle) {
+		CloseHandle(file->file_handle);
+	}
+	*file = MappedFile {};
+}
+#else
+bool MappedFileOpen(MappedFile *file, const char *path) {
+	*file = MappedFile { .data = nullptr, .size = 0, .fd = -1 };
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0) {
+		close(fd);
+		return false;
+	}
+	file->fd = fd;
+	file->size = static_cast<size_t>(file_stat.st_size);
+	// Empty files can't be mapped
+	if (file->size == 0) {
+		return true;
+	}
+
+	void *data = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		MappedFileClose(file);
+		return false;
+	}
+	// Replays walk the file front to back once
+	madvise(data, file->size, MADV_SEQUENTIAL);
+	file->data = static_cast<const char *>(data);
+	return true;
+}
+
+void MappedFileClose(MappedFile *file) {
+	if (file->data) {
+		munmap(const_cast<char *>(file->data), file->size);
+	}
+	if (file->fd >= 0) {
+		close(file->fd);
+	}
+	*file = MappedFile { .data = nullptr, .size = 0, .fd = -1 };
+}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+
+// A whole file mapped read only, so multi gigabyte recordings can be
+// walked without reading them into memory first
+struct MappedFile {
+	const char *data;
+	size_t size;
+#ifdef _WIN32
+	void *file_handle;
+	void *mapping_handle;
+#else
+	int fd;
+#endif
+};
+
+bool MappedFileOpen(MappedFile *file, const char *path);
+void MappedFileClose(MappedFile *file);
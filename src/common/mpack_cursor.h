@@ -0,0 +1,357 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+// A zero-copy msgpack cursor. Walks an encoded message in place without
+// building any nodes, strings point directly into the underlying buffer.
+// Errors are sticky in the same way mpack's expect API works: once the
+// cursor has errored every read returns a zero value, so callers only
+// need to check the error after decoding a whole structure.
+enum class MPackCursorError : uint8_t {
+	Ok,
+	// Ran out of data before the end of the current object,
+	// more bytes need to be read from the stream
+	Truncated,
+	// Unexpected type or malformed data
+	Invalid
+};
+
+struct MPackCursor {
+	const uint8_t *pos;
+	const uint8_t *end;
+	MPackCursorError error;
+};
+
+inline MPackCursor MPackCursorInit(const char *data, size_t size) {
+	return MPackCursor {
+		.pos = reinterpret_cast<const uint8_t *>(data),
+		.end = reinterpret_cast<const uint8_t *>(data) + size,
+		.error = MPackCursorError::Ok
+	};
+}
+
+inline bool MPackCursorOk(const MPackCursor *cursor) {
+	return cursor->error == MPackCursorError::Ok;
+}
+
+inline void MPackCursorFlag(MPackCursor *cursor, MPackCursorError error) {
+	if (cursor->error == MPackCursorError::Ok) {
+		cursor->error = error;
+	}
+	// Park the cursor at the end so nothing else is read
+	cursor->pos = cursor->end;
+}
+
+inline bool MPackCursorEnsure(MPackCursor *cursor, size_t count) {
+	if (static_cast<size_t>(cursor->end - cursor->pos) < count) {
+		MPackCursorFlag(cursor, MPackCursorError::Truncated);
+		return false;
+	}
+	return true;
+}
+
+inline uint8_t MPackCursorPeekTag(const MPackCursor *cursor) {
+	return cursor->pos < cursor->end ? *cursor->pos : 0xC1;
+}
+
+// Big-endian loads
+inline uint16_t MPackLoadU16(const uint8_t *p) {
+	return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+inline uint32_t MPackLoadU32(const uint8_t *p) {
+	return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+		(static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+inline uint64_t MPackLoadU64(const uint8_t *p) {
+	return (static_cast<uint64_t>(MPackLoadU32(p)) << 32) | MPackLoadU32(p + 4);
+}
+
+inline uint32_t MPackCursorArray(MPackCursor *cursor) {
+	if (!MPackCursorEnsure(cursor, 1)) return 0;
+	uint8_t tag = *cursor->pos;
+	if ((tag & 0xF0) == 0x90) {
+		cursor->pos += 1;
+		return tag & 0x0F;
+	}
+	if (tag == 0xDC && MPackCursorEnsure(cursor, 3)) {
+		uint32_t count = MPackLoadU16(cursor->pos + 1);
+		cursor->pos += 3;
+		return count;
+	}
+	if (tag == 0xDD && MPackCursorEnsure(cursor, 5)) {
+		uint32_t count = MPackLoadU32(cursor->pos + 1);
+		cursor->pos += 5;
+		return count;
+	}
+	MPackCursorFlag(cursor, MPackCursorError::Invalid);
+	return 0;
+}
+
+inline uint32_t MPackCursorMap(MPackCursor *cursor) {
+	if (!MPackCursorEnsure(cursor, 1)) return 0;
+	uint8_t tag = *cursor->pos;
+	if ((tag & 0xF0) == 0x80) {
+		cursor->pos += 1;
+		return tag & 0x0F;
+	}
+	if (tag == 0xDE && MPackCursorEnsure(cursor, 3)) {
+		uint32_t count = MPackLoadU16(cursor->pos + 1);
+		cursor->pos += 3;
+		return count;
+	}
+	if (tag == 0xDF && MPackCursorEnsure(cursor, 5)) {
+		uint32_t count = MPackLoadU32(cursor->pos + 1);
+		cursor->pos += 5;
+		return count;
+	}
+	MPackCursorFlag(cursor, MPackCursorError::Invalid);
+	return 0;
+}
+
+// Reads any integer type (signed or unsigned) as an int64_t.
+// uint64 values above INT64_MAX wrap, which matches how the
+// tree based code read `data->value.i`.
+inline int64_t MPackCursorInt(MPackCursor *cursor) {
+	if (!MPackCursorEnsure(cursor, 1)) return 0;
+	const uint8_t *p = cursor->pos;
+	uint8_t tag = *p;
+	if (tag <= 0x7F) {
+		cursor->pos += 1;
+		return tag;
+	}
+	if (tag >= 0xE0) {
+		cursor->pos += 1;
+		return static_cast<int8_t>(tag);
+	}
+
+	int64_t value;
+	size_t size;
+	switch (tag) {
+	case 0xCC: { size = 1; } break;
+	case 0xCD: { size = 2; } break;
+	case 0xCE: { size = 4; } break;
+	case 0xCF: { size = 8; } break;
+	case 0xD0: { size = 1; } break;
+	case 0xD1: { size = 2; } break;
+	case 0xD2: { size = 4; } break;
+	case 0xD3: { size = 8; } break;
+	default: {
+		MPackCursorFlag(cursor, MPackCursorError::Invalid);
+	} return 0;
+	}
+	if (!MPackCursorEnsure(cursor, 1 + size)) return 0;
+
+	switch (tag) {
+	case 0xCC: { value = p[1]; } break;
+	case 0xCD: { value = MPackLoadU16(p + 1); } break;
+	case 0xCE: { value = MPackLoadU32(p + 1); } break;
+	case 0xCF: { value = static_cast<int64_t>(MPackLoadU64(p + 1)); } break;
+	case 0xD0: { value = static_cast<int8_t>(p[1]); } break;
+	case 0xD1: { value = static_cast<int16_t>(MPackLoadU16(p + 1)); } break;
+	case 0xD2: { value = static_cast<int32_t>(MPackLoadU32(p + 1)); } break;
+	default: { value = static_cast<int64_t>(MPackLoadU64(p + 1)); } break;
+	}
+	cursor->pos += 1 + size;
+	return value;
+}
+
+inline bool MPackCursorBool(MPackCursor *cursor) {
+	if (!MPackCursorEnsure(cursor, 1)) return false;
+	uint8_t tag = *cursor->pos;
+	if (tag == 0xC2 || tag == 0xC3) {
+		cursor->pos += 1;
+		return tag == 0xC3;
+	}
+	MPackCursorFlag(cursor, MPackCursorError::Invalid);
+	return false;
+}
+
+inline bool MPackCursorIsStr(const MPackCursor *cursor) {
+	uint8_t tag = MPackCursorPeekTag(cursor);
+	return (tag & 0xE0) == 0xA0 || tag == 0xD9 || tag == 0xDA || tag == 0xDB;
+}
+
+inline bool MPackCursorIsNil(const MPackCursor *cursor) {
+	return MPackCursorPeekTag(cursor) == 0xC0;
+}
+
+// Returns a pointer into the underlying buffer, the string is not null-terminated
+inline const char *MPackCursorStr(MPackCursor *cursor, uint32_t *length) {
+	*length = 0;
+	if (!MPackCursorEnsure(cursor, 1)) return "";
+	const uint8_t *p = cursor->pos;
+	uint8_t tag = *p;
+	uint32_t header;
+	uint32_t str_length;
+	if ((tag & 0xE0) == 0xA0) {
+		header = 1;
+		str_length = tag & 0x1F;
+	}
+	else if (tag == 0xD9 && MPackCursorEnsure(cursor, 2)) {
+		header = 2;
+		str_length = p[1];
+	}
+	else if (tag == 0xDA && MPackCursorEnsure(cursor, 3)) {
+		header = 3;
+		str_length = MPackLoadU16(p + 1);
+	}
+	else if (tag == 0xDB && MPackCursorEnsure(cursor, 5)) {
+		header = 5;
+		str_length = MPackLoadU32(p + 1);
+	}
+	else {
+		MPackCursorFlag(cursor, MPackCursorError::Invalid);
+		return "";
+	}
+	if (!MPackCursorEnsure(cursor, static_cast<size_t>(header) + str_length)) return "";
+
+	cursor->pos += header + str_length;
+	*length = str_length;
+	return reinterpret_cast<const char *>(p + header);
+}
+
+// Exact (not prefix) comparison of a cursor string against a literal
+inline bool MPackStrEquals(const char *str, uint32_t length, const char *literal) {
+	return strlen(literal) == length && memcmp(str, literal, length) == 0;
+}
+
+// Consumes a single tag and its inline payload, adding the number of
+// child objects it introduces (array elements, map keys and values) to
+// *remaining. On failure the cursor is left untouched at the tag.
+inline MPackCursorError MPackCursorSkipTag(MPackCursor *cursor, uint64_t *remaining) {
+	size_t available = static_cast<size_t>(cursor->end - cursor->pos);
+	if (available < 1) return MPackCursorError::Truncated;
+	const uint8_t *p = cursor->pos;
+	uint8_t tag = *p;
+
+	// Single byte objects
+	if (tag <= 0x7F || tag >= 0xE0 || tag == 0xC0 || tag == 0xC2 || tag == 0xC3) {
+		cursor->pos += 1;
+		return MPackCursorError::Ok;
+	}
+	if ((tag & 0xF0) == 0x80) {
+		*remaining += static_cast<uint64_t>(tag & 0x0F) * 2;
+		cursor->pos += 1;
+		return MPackCursorError::Ok;
+	}
+	if ((tag & 0xF0) == 0x90) {
+		*remaining += tag & 0x0F;
+		cursor->pos += 1;
+		return MPackCursorError::Ok;
+	}
+
+	// Header size, size of the length field within the header, payload size
+	size_t header = 0;
+	size_t length_size = 0;
+	uint64_t payload = 0;
+	uint64_t children = 0;
+	if ((tag & 0xE0) == 0xA0) {
+		header = 1;
+		payload = tag & 0x1F;
+	}
+	else {
+		switch (tag) {
+		case 0xCC: case 0xD0: { header = 2; } break;
+		case 0xCD: case 0xD1: { header = 3; } break;
+		case 0xCE: case 0xD2: case 0xCA: { header = 5; } break;
+		case 0xCF: case 0xD3: case 0xCB: { header = 9; } break;
+		case 0xD4: { header = 2; payload = 1; } break;
+		case 0xD5: { header = 2; payload = 2; } break;
+		case 0xD6: { header = 2; payload = 4; } break;
+		case 0xD7: { header = 2; payload = 8; } break;
+		case 0xD8: { header = 2; payload = 16; } break;
+		case 0xC4: case 0xD9: { header = 2; length_size = 1; } break;
+		case 0xC5: case 0xDA: { header = 3; length_size = 2; } break;
+		case 0xC6: case 0xDB: { header = 5; length_size = 4; } break;
+		// ext 8/16/32 carry an extra type byte after the length
+		case 0xC7: { header = 3; length_size = 1; } break;
+		case 0xC8: { header = 4; length_size = 2; } break;
+		case 0xC9: { header = 6; length_size = 4; } break;
+		case 0xDC: case 0xDE: { header = 3; length_size = 2; } break;
+		case 0xDD: case 0xDF: { header = 5; length_size = 4; } break;
+		default: {
+		} return MPackCursorError::Invalid;
+		}
+	}
+
+	if (available < header) return MPackCursorError::Truncated;
+	if (length_size) {
+		uint64_t length = length_size == 1 ? p[1] :
+			length_size == 2 ? MPackLoadU16(p + 1) : MPackLoadU32(p + 1);
+		if (tag == 0xDC || tag == 0xDD) {
+			children = length;
+		}
+		else if (tag == 0xDE || tag == 0xDF) {
+			children = length * 2;
+		}
+		else {
+			payload = length;
+		}
+	}
+	if (available - header < payload) return MPackCursorError::Truncated;
+
+	*remaining += children;
+	cursor->pos += header + payload;
+	return MPackCursorError::Ok;
+}
+
+// Skips a single object, including all of its children, without
+// decoding it. Iterative, so deeply nested objects can't blow the stack.
+inline void MPackCursorSkip(MPackCursor *cursor) {
+	uint64_t remaining = 1;
+	while (remaining > 0 && MPackCursorOk(cursor)) {
+		--remaining;
+		MPackCursorError error = MPackCursorSkipTag(cursor, &remaining);
+		if (error != MPackCursorError::Ok) {
+			MPackCursorFlag(cursor, error);
+		}
+	}
+}
+
+inline void MPackCursorSkipN(MPackCursor *cursor, uint64_t count) {
+	for (uint64_t i = 0; i < count && MPackCursorOk(cursor); ++i) {
+		MPackCursorSkip(cursor);
+	}
+}
+
+// Finds message boundaries in a byte stream. The scan is resumable,
+// so a large message arriving in many small reads is only scanned once
+// instead of being rescanned from the start after every read.
+struct MPackFramer {
+	size_t offset;      // bytes of the pending message scanned so far
+	uint64_t remaining; // objects left to scan, 0 when no message is pending
+};
+
+// Scans the buffer holding the start of the pending message. Returns the
+// message size once it is complete, or 0 if more data is needed. The framer
+// resets itself after returning a message. Sets *invalid on malformed data.
+inline size_t MPackFramerScan(MPackFramer *framer, const char *data, size_t size, bool *invalid) {
+	*invalid = false;
+	if (framer->offset == 0 && framer->remaining == 0) {
+		framer->remaining = 1;
+	}
+
+	MPackCursor cursor = MPackCursorInit(data, size);
+	cursor.pos += framer->offset;
+	while (framer->remaining > 0) {
+		uint64_t remaining = framer->remaining - 1;
+		MPackCursorError error = MPackCursorSkipTag(&cursor, &remaining);
+		if (error == MPackCursorError::Truncated) {
+			break;
+		}
+		if (error == MPackCursorError::Invalid) {
+			*invalid = true;
+			break;
+		}
+		framer->remaining = remaining;
+	}
+
+	framer->offset = static_cast<size_t>(cursor.pos - reinterpret_cast<const uint8_t *>(data));
+	if (framer->remaining > 0 || *invalid) {
+		return 0;
+	}
+
+	size_t message_size = framer->offset;
+	framer->offset = 0;
+	return message_size;
+}
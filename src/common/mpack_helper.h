@@ -59,11 +59,6 @@ inline void MPackStartNotification(const char *notification, mpack_writer_t *wri
 	return size;
 }
 
-inline bool MPackSendData(HANDLE handle, void *buffer, size_t size) {
-	DWORD bytes_written;
-	return WriteFile(handle, buffer, static_cast<DWORD>(size), &bytes_written, nullptr) != 0;
-}
-
 inline MPackMessageResult MPackExtractMessageResult(mpack_tree_t *tree) {
 	mpack_node_t root = mpack_tree_root(tree);
 	assert(mpack_node_array_at(root, 0).data->type == mpack_type_uint);
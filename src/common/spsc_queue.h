@@ -0,0 +1,45 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "common/cache_line.h"
+
+// Lock-free bounded queue for exactly one producer thread and one
+// consumer thread. The indices only ever increase and wrap through
+// the power of two capacity, so a full queue needs no extra slot.
+template<typename T, uint32_t CAPACITY>
+struct SpscQueue {
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+	// Written by the consumer, read by the producer
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> head;
+	// Written by the producer, read by the consumer
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> tail;
+	alignas(CACHE_LINE_SIZE) T items[CAPACITY];
+
+	// Producer only, returns false when the queue is full
+	inline bool Push(const T &item) {
+		uint32_t current_tail = tail.load(std::memory_order_relaxed);
+		if (current_tail - head.load(std::memory_order_acquire) == CAPACITY) {
+			return false;
+		}
+		items[current_tail & (CAPACITY - 1)] = item;
+		tail.store(current_tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only, returns false when the queue is empty
+	inline bool Pop(T *item) {
+		uint32_t current_head = head.load(std::memory_order_relaxed);
+		if (current_head == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		*item = items[current_head & (CAPACITY - 1)];
+		head.store(current_head + 1, std::memory_order_release);
+		return true;
+	}
+
+	inline bool Empty() const {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+};
@@ -0,0 +1,447 @@
+#include "transcode.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TRANSCODE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define TRANSCODE_X86 0
+#endif
+
+// GCC and Clang only emit vector instructions for functions that ask for
+// them, MSVC takes intrinsics anywhere
+#if defined(__GNUC__) || defined(__clang__)
+#define TRANSCODE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define TRANSCODE_TARGET(isa)
+#endif
+
+constexpr uint8_t ASCII_CELL_ARRAY = 0x91;
+constexpr uint8_t ASCII_CELL_STR = 0xA1;
+
+static size_t AsciiCellsScalar(const uint8_t *data, size_t size, uint32_t *chars, size_t max_cells) {
+	size_t cell_count = 0;
+	while (cell_count < max_cells && size >= 3 &&
+		data[0] == ASCII_CELL_ARRAY && data[1] == ASCII_CELL_STR && data[2] < 0x80) {
+		chars[cell_count++] = data[2];
+		data += 3;
+		size -= 3;
+	}
+	return cell_count;
+}
+
+static void Fill32Scalar(uint32_t *data, uint32_t value, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		data[i] = value;
+	}
+}
+
+static void Fill16Scalar(uint16_t *data, uint16_t value, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		data[i] = value;
+	}
+}
+
+static size_t CellToUtf16(uint32_t cell, uint16_t *utf16) {
+	if (cell > 0xFFFF) {
+		utf16[0] = static_cast<uint16_t>(cell >> 16);
+		utf16[1] = static_cast<uint16_t>(cell & 0xFFFF);
+		return 2;
+	}
+	utf16[0] = static_cast<uint16_t>(cell);
+	return 1;
+}
+
+static size_t CellsToUtf16Scalar(const uint32_t *cells, size_t count, uint16_t *utf16) {
+	size_t length = 0;
+	for (size_t i = 0; i < count; ++i) {
+		length += CellToUtf16(cells[i], &utf16[length]);
+	}
+	return length;
+}
+
+static void ClearSpecialCells(uint64_t *special, size_t count) {
+	memset(special, 0, (count + 63) / 64 * sizeof(uint64_t));
+}
+
+// Scans cells [begin, end) of a row, the vector versions leave the first
+// cell and what is left after their last step to it
+static size_t ScanCellsScalar(const uint32_t *chars, const uint16_t *hl_ids, const uint8_t *flags,
+	size_t begin, size_t end, const TranscodeScanRules *rules, uint32_t *run_starts, size_t run_count,
+	uint64_t *special) {
+	for (size_t i = begin; i < end; ++i) {
+		if (i == 0 || hl_ids[i] != hl_ids[i - 1]) {
+			run_starts[run_count++] = static_cast<uint32_t>(i);
+		}
+		if (chars[i] - rules->plain_first >= rules->plain_count || (flags[i] & rules->special_flags)) {
+			special[i / 64] |= 1ull << (i % 64);
+		}
+	}
+	return run_count;
+}
+
+static size_t ScanRowScalar(const uint32_t *chars, const uint16_t *hl_ids, const uint8_t *flags, size_t count,
+	const TranscodeScanRules *rules, uint32_t *run_starts, uint64_t *special) {
+	ClearSpecialCells(special, count);
+	return ScanCellsScalar(chars, hl_ids, flags, 0, count, rules, run_starts, 0, special);
+}
+
+#if TRANSCODE_X86
+static int CountTrailingZeros(uint32_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(value);
+#endif
+}
+
+// Four cells take 12 bytes. Bytes 0, 3, 6 and 9 hold the array tag,
+// 1, 4, 7 and 10 the string tag, 2, 5, 8 and 11 the characters.
+constexpr uint32_t ASCII_CELL_TAG_BITS = 0x6DB;
+constexpr uint32_t ASCII_CELL_CHAR_BITS = 0x924;
+#define ASCII_CELL_PATTERN \
+	0x91, 0xA1, 0, 0x91, 0xA1, 0, 0x91, 0xA1, 0, 0x91, 0xA1, 0, 0, 0, 0, 0
+// Moves the characters into the low byte of four dwords
+#define ASCII_CELL_SHUFFLE \
+	2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1
+
+// Decodes up to four cells from 16 readable bytes. Returns the number of
+// valid cells, the dwords of all four are written regardless.
+TRANSCODE_TARGET("sse4.1")
+static size_t AsciiCellsStepSse41(const uint8_t *data, uint32_t *chars) {
+	const __m128i pattern = _mm_setr_epi8(ASCII_CELL_PATTERN);
+	const __m128i shuffle = _mm_setr_epi8(ASCII_CELL_SHUFFLE);
+
+	__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+	uint32_t matches = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, pattern)));
+	uint32_t high_bits = static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+	uint32_t invalid = (~matches & ASCII_CELL_TAG_BITS) | (high_bits & ASCII_CELL_CHAR_BITS);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(chars), _mm_shuffle_epi8(bytes, shuffle));
+	return invalid ? CountTrailingZeros(invalid) / 3 : 4;
+}
+
+TRANSCODE_TARGET("sse4.1")
+static size_t AsciiCellsSse41(const uint8_t *data, size_t size, uint32_t *chars, size_t max_cells) {
+	size_t cell_count = 0;
+	while (max_cells - cell_count >= 4 && size - cell_count * 3 >= 16) {
+		size_t valid = AsciiCellsStepSse41(data + cell_count * 3, chars + cell_count);
+		cell_count += valid;
+		if (valid < 4) {
+			return cell_count;
+		}
+	}
+	return cell_count + AsciiCellsScalar(data + cell_count * 3, size - cell_count * 3,
+		chars + cell_count, max_cells - cell_count);
+}
+
+TRANSCODE_TARGET("sse4.1")
+static void Fill32Sse41(uint32_t *data, uint32_t value, size_t count) {
+	__m128i values = _mm_set1_epi32(static_cast<int>(value));
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), values);
+	}
+	Fill32Scalar(data + i, value, count - i);
+}
+
+TRANSCODE_TARGET("sse4.1")
+static void Fill16Sse41(uint16_t *data, uint16_t value, size_t count) {
+	__m128i values = _mm_set1_epi16(static_cast<short>(value));
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), values);
+	}
+	Fill16Scalar(data + i, value, count - i);
+}
+
+// Blocks of eight cells without a surrogate pair, all of them for ASCII
+// text, narrow to eight code units with a single saturating pack
+TRANSCODE_TARGET("sse4.1")
+static size_t CellsToUtf16Sse41(const uint32_t *cells, size_t count, uint16_t *utf16) {
+	const __m128i high_halves = _mm_set1_epi32(static_cast<int>(0xFFFF0000));
+	size_t length = 0;
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cells + i));
+		__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cells + i + 4));
+		if (_mm_testz_si128(_mm_or_si128(low, high), high_halves)) {
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(utf16 + length), _mm_packus_epi32(low, high));
+			length += 8;
+		}
+		else {
+			length += CellsToUtf16Scalar(cells + i, 8, utf16 + length);
+		}
+	}
+	return length + CellsToUtf16Scalar(cells + i, count - i, utf16 + length);
+}
+
+// Bit i of changes and specials is cell base + i
+static size_t EmitScanned(size_t base, uint32_t changes, uint32_t specials, uint32_t *run_starts,
+	size_t run_count, uint64_t *special) {
+	while (changes) {
+		run_starts[run_count++] = static_cast<uint32_t>(base + CountTrailingZeros(changes));
+		changes &= changes - 1;
+	}
+	size_t shift = base % 64;
+	special[base / 64] |= static_cast<uint64_t>(specials) << shift;
+	// Past the last cell nothing is set, so the next word exists when needed
+	uint64_t spilled = shift ? static_cast<uint64_t>(specials) >> (64 - shift) : 0;
+	if (spilled) {
+		special[base / 64 + 1] |= spilled;
+	}
+	return run_count;
+}
+
+// Eight cells per step, comparing every highlight id with the one before
+// it and the characters against the plain range. There is no unsigned
+// compare, flipping the sign bits of both sides makes a signed one do.
+// Needs nothing past SSE2.
+TRANSCODE_TARGET("sse4.1")
+static size_t ScanCellsSse41(const uint32_t *chars, const uint16_t *hl_ids, const uint8_t *flags,
+	size_t begin, size_t count, const TranscodeScanRules *rules, uint32_t *run_starts, size_t run_count,
+	uint64_t *special) {
+	const __m128i sign = _mm_set1_epi32(INT32_MIN);
+	const __m128i first = _mm_set1_epi32(static_cast<int>(rules->plain_first));
+	const __m128i limit = _mm_set1_epi32(static_cast<int>(rules->plain_count ^ 0x80000000u));
+	const __m128i special_flags = _mm_set1_epi8(static_cast<char>(rules->special_flags));
+	const __m128i zero = _mm_setzero_si128();
+
+	size_t i = begin;
+	for (; i + 8 <= count; i += 8) {
+		__m128i same = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(hl_ids + i)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(hl_ids + i - 1)));
+		__m128i low = _mm_xor_si128(_mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(chars + i)), first), sign);
+		__m128i high = _mm_xor_si128(_mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(chars + i + 4)), first), sign);
+		__m128i plain = _mm_packs_epi32(_mm_cmplt_epi32(low, limit), _mm_cmplt_epi32(high, limit));
+		__m128i no_flags = _mm_cmpeq_epi8(
+			_mm_and_si128(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(flags + i)), special_flags), zero);
+		plain = _mm_and_si128(plain, _mm_unpacklo_epi8(no_flags, no_flags));
+
+		// Same ids in the low byte, plain cells in the high one
+		uint32_t bits = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(same, plain)));
+		run_count = EmitScanned(i, bits & 0xFF, (bits >> 8) & 0xFF, run_starts, run_count, special);
+	}
+	return ScanCellsScalar(chars, hl_ids, flags, i, count, rules, run_starts, run_count, special);
+}
+
+TRANSCODE_TARGET("sse4.1")
+static size_t ScanRowSse41(const uint32_t *chars, const uint16_t *hl_ids, const uint8_t *flags, size_t count,
+	const TranscodeScanRules *rules, uint32_t *run_starts, uint64_t *special) {
+	ClearSpecialCells(special, count);
+	size_t run_count = ScanCellsScalar(chars, hl_ids, flags, 0, 1, rules, run_starts, 0, special);
+	return ScanCellsSse41(chars, hl_ids, flags, 1, count, rules, run_starts, run_count, special);
+}
+
+// The AVX2 versions handle twice the cells per step and leave the rest
+// to the SSE4.1 ones, clearing the upper halves first to avoid the AVX to
+// SSE transition penalty. Byte shuffles stay within 128 bit lanes, so the
+// high lane is loaded from the fifth cell on.
+TRANSCODE_TARGET("avx2")
+static size_t AsciiCellsAvx2(const uint8_t *data, size_t size, uint32_t *chars, size_t max_cells) {
+	const __m256i pattern = _mm256_setr_epi8(ASCII_CELL_PATTERN, ASCII_CELL_PATTERN);
+	const __m256i shuffle = _mm256_setr_epi8(ASCII_CELL_SHUFFLE, ASCII_CELL_SHUFFLE);
+	constexpr uint32_t TAG_BITS = ASCII_CELL_TAG_BITS | (ASCII_CELL_TAG_BITS << 16);
+	constexpr uint32_t CHAR_BITS = ASCII_CELL_CHAR_BITS | (ASCII_CELL_CHAR_BITS << 16);
+
+	size_t cell_count = 0;
+	while (max_cells - cell_count >= 8 && size - cell_count * 3 >= 28) {
+		const uint8_t *p = data + cell_count * 3;
+		__m256i bytes = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))),
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 12)), 1);
+		uint32_t matches = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, pattern)));
+		uint32_t high_bits = static_cast<uint32_t>(_mm256_movemask_epi8(bytes));
+		uint32_t invalid = (~matches & TAG_BITS) | (high_bits & CHAR_BITS);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(chars + cell_count), _mm256_shuffle_epi8(bytes, shuffle));
+		if (invalid) {
+			int bit = CountTrailingZeros(invalid);
+			return cell_count + (bit < 16 ? bit / 3 : 4 + (bit - 16) / 3);
+		}
+		cell_count += 8;
+	}
+	_mm256_zeroupper();
+	return cell_count + AsciiCellsSse41(data + cell_count * 3, size - cell_count * 3,
+		chars + cell_count, max_cells - cell_count);
+}
+
+TRANSCODE_TARGET("avx2")
+static void Fill32Avx2(uint32_t *data, uint32_t value, size_t count) {
+	__m256i values = _mm256_set1_epi32(static_cast<int>(value));
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), values);
+	}
+	_mm256_zeroupper();
+	Fill32Sse41(data + i, value, count - i);
+}
+
+TRANSCODE_TARGET("avx2")
+static void Fill16Avx2(uint16_t *data, uint16_t value, size_t count) {
+	__m256i values = _mm256_set1_epi16(static_cast<short>(value));
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), values);
+	}
+	_mm256_zeroupper();
+	Fill16Sse41(data + i, value, count - i);
+}
+
+TRANSCODE_TARGET("avx2")
+static size_t CellsToUtf16Avx2(const uint32_t *cells, size_t count, uint16_t *utf16) {
+	const __m256i high_halves = _mm256_set1_epi32(static_cast<int>(0xFFFF0000));
+	size_t length = 0;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cells + i));
+		__m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cells + i + 8));
+		if (_mm256_testz_si256(_mm256_or_si256(low, high), high_halves)) {
+			// The pack interleaves the lanes of both inputs, put them back in order
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xD8);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(utf16 + length), packed);
+			length += 16;
+		}
+		else {
+			_mm256_zeroupper();
+			length += CellsToUtf16Sse41(cells + i, 16, utf16 + length);
+		}
+	}
+	_mm256_zeroupper();
+	return length + CellsToUtf16Sse41(cells + i, count - i, utf16 + length);
+}
+
+TRANSCODE_TARGET("avx2")
+static size_t ScanRowAvx2(const uint32_t *chars, const uint16_t *hl_ids, const uint8_t *flags, size_t count,
+	const TranscodeScanRules *rules, uint32_t *run_starts, uint64_t *special) {
+	ClearSpecialCells(special, count);
+	size_t run_count = ScanCellsScalar(chars, hl_ids, flags, 0, 1, rules, run_starts, 0, special);
+
+	const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+	const __m256i first = _mm256_set1_epi32(static_cast<int>(rules->plain_first));
+	const __m256i limit = _mm256_set1_epi32(static_cast<int>(rules->plain_count ^ 0x80000000u));
+	const __m128i special_flags = _mm_set1_epi8(static_cast<char>(rules->special_flags));
+	size_t i = 1;
+	for (; i + 16 <= count; i += 16) {
+		__m256i same = _mm256_cmpeq_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(hl_ids + i)),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i *>(hl_ids + i - 1)));
+		__m256i low = _mm256_xor_si256(_mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(chars + i)), first), sign);
+		__m256i high = _mm256_xor_si256(_mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(chars + i + 8)), first), sign);
+		__m256i plain = _mm256_permute4x64_epi64(
+			_mm256_packs_epi32(_mm256_cmpgt_epi32(limit, low), _mm256_cmpgt_epi32(limit, high)), 0xD8);
+		__m128i no_flags = _mm_cmpeq_epi8(
+			_mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(flags + i)), special_flags), _mm_setzero_si128());
+		plain = _mm256_and_si256(plain, _mm256_cvtepi8_epi16(no_flags));
+
+		// Each lane packs eight ids then eight plain cells
+		uint32_t bits = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_packs_epi16(same, plain)));
+		uint32_t changes = (bits & 0xFF) | ((bits >> 8) & 0xFF00);
+		uint32_t specials = ((bits >> 8) & 0xFF) | ((bits >> 16) & 0xFF00);
+		run_count = EmitScanned(i, changes, specials, run_starts, run_count, special);
+	}
+	_mm256_zeroupper();
+	return ScanCellsSse41(chars, hl_ids, flags, i, count, rules, run_starts, run_count, special);
+}
+#endif
+
+struct TranscodeKernels {
+	TranscodeLevel level;
+	size_t (*ascii_cells)(const uint8_t *data, size_t size, uint32_t *chars, size_t max_cells);
+	void (*fill32)(uint32_t *data, uint32_t value, size_t count);
+	void (*fill16)(uint16_t *data, uint16_t value, size_t count);
+	size_t (*cells_to_utf16)(const uint32_t *cells, size_t count, uint16_t *utf16);
+	size_t (*scan_row)(const uint32_t *chars, const uint16_t *hl_ids, const uint8_t *flags, size_t count,
+		const TranscodeScanRules *rules, uint32_t *run_starts, uint64_t *special);
+};
+
+static TranscodeKernels SelectKernels(TranscodeLevel level) {
+	switch (level) {
+#if TRANSCODE_X86
+	case TranscodeLevel::Avx2: {
+	} return TranscodeKernels { level, AsciiCellsAvx2, Fill32Avx2, Fill16Avx2, CellsToUtf16Avx2, ScanRowAvx2 };
+	case TranscodeLevel::Sse41: {
+	} return TranscodeKernels { level, AsciiCellsSse41, Fill32Sse41, Fill16Sse41, CellsToUtf16Sse41, ScanRowSse41 };
+#endif
+	default: {
+	} return TranscodeKernels { TranscodeLevel::Scalar, AsciiCellsScalar, Fill32Scalar, Fill16Scalar, CellsToUtf16Scalar, ScanRowScalar };
+	}
+}
+
+TranscodeLevel TranscodeDetectLevel() {
+#if TRANSCODE_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	// AVX state has to be enabled by the OS as well
+	bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6;
+	bool avx2 = false;
+	if (avx && max_leaf >= 7) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool sse41 = __builtin_cpu_supports("sse4.1");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (avx2) {
+		return TranscodeLevel::Avx2;
+	}
+	if (sse41) {
+		return TranscodeLevel::Sse41;
+	}
+#endif
+	return TranscodeLevel::Scalar;
+}
+
+static TranscodeKernels kernels = SelectKernels(TranscodeDetectLevel());
+
+TranscodeLevel TranscodeGetLevel() {
+	return kernels.level;
+}
+
+TranscodeLevel TranscodeSetLevel(TranscodeLevel level) {
+	TranscodeLevel detected = TranscodeDetectLevel();
+	kernels = SelectKernels(level < detected ? level : detected);
+	return kernels.level;
+}
+
+const char *TranscodeLevelName(TranscodeLevel level) {
+	switch (level) {
+	case TranscodeLevel::Scalar: return "scalar";
+	case TranscodeLevel::Sse41: return "sse4.1";
+	case TranscodeLevel::Avx2: return "avx2";
+	}
+	return "unknown";
+}
+
+size_t TranscodeAsciiCells(const uint8_t *data, size_t size, uint32_t *chars, size_t max_cells) {
+	return kernels.ascii_cells(data, size, chars, max_cells);
+}
+
+void TranscodeFill32(uint32_t *data, uint32_t value, size_t count) {
+	kernels.fill32(data, value, count);
+}
+
+void TranscodeFill16(uint16_t *data, uint16_t value, size_t count) {
+	kernels.fill16(data, value, count);
+}
+
+size_t TranscodeCellsToUtf16(const uint32_t *cells, size_t count, uint16_t *utf16) {
+	return kernels.cells_to_utf16(cells, count, utf16);
+}
+
+size_t TranscodeScanRow(const uint32_t *chars, const uint16_t *hl_ids, const uint8_t *flags, size_t count,
+	const TranscodeScanRules *rules, uint32_t *run_starts, uint64_t *special) {
+	// The kernels take at least one cell
+	if (count == 0) {
+		return 0;
+	}
+	return kernels.scan_row(chars, hl_ids, flags, count, rules, run_starts, special);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Bulk text conversions on the grid_line and row drawing hot paths, with
+// SSE4.1 and AVX2 versions picked at startup from what the CPU supports
+// and a scalar fallback everywhere else. Every level produces identical
+// output, transcode_bench checks them against each other.
+enum class TranscodeLevel : uint8_t {
+	Scalar,
+	Sse41,
+	Avx2
+};
+
+// The best level the CPU supports
+TranscodeLevel TranscodeDetectLevel();
+TranscodeLevel TranscodeGetLevel();
+// Switches the kernels in use, clamped to the detected level. Returns the
+// level now in use. Only meant for benchmarks, must not race any kernel.
+TranscodeLevel TranscodeSetLevel(TranscodeLevel level);
+const char *TranscodeLevelName(TranscodeLevel level);
+
+// Decodes a run of grid_line cells holding nothing but a single ASCII
+// character, `[c]` in msgpack (0x91 0xA1 c), which is what nvim sends for
+// most cells of a line. Stops at the first other cell or after max_cells.
+// Returns the number of cells decoded, data advances 3 bytes per cell.
+size_t TranscodeAsciiCells(const uint8_t *data, size_t size, uint32_t *chars, size_t max_cells);
+
+// Expands repeated cells
+void TranscodeFill32(uint32_t *data, uint32_t value, size_t count);
+void TranscodeFill16(uint16_t *data, uint16_t value, size_t count);
+
+// Unpacks grid cells (a UTF-16 code unit, or a surrogate pair packed as
+// (high << 16) | low) into UTF-16. utf16 needs room for 2 * count units.
+// Returns the number of units written.
+size_t TranscodeCellsToUtf16(const uint32_t *cells, size_t count, uint16_t *utf16);
+
+// Which cells of a row the renderer has to look at one by one. A cell is
+// plain when its character is in [plain_first, plain_first + plain_count)
+// and it has none of special_flags, every other cell is special.
+struct TranscodeScanRules {
+	uint32_t plain_first;
+	uint32_t plain_count;
+	uint8_t special_flags;
+};
+
+// Splits a row into runs of equal highlight ids and marks its special
+// cells. run_starts gets the first column of every run, 0 first, and needs
+// room for count entries. special gets a bit per cell, (count + 63) / 64
+// words, and is cleared first. Returns the number of runs.
+size_t TranscodeScanRow(const uint32_t *chars, const uint16_t *hl_ids, const uint8_t *flags, size_t count,
+	const TranscodeScanRules *rules, uint32_t *run_starts, uint64_t *special);
@@ -1,7 +1,14 @@
 #pragma once
 
-// WPARAM: mpack_tree_t *, LPARAM: none
+// Posted by the reader thread when messages are queued in Nvim::reader
+// WPARAM: none, LPARAM: none
 #define WM_NVIM_MESSAGE WM_USER
 
+// Posted by the render thread once a font change took effect
 // WPARAM: none, LPARAM: none
-#define WM_RENDERER_FONT_UPDATE (WM_USER + 1)
\ No newline at end of file
+#define WM_RENDERER_FONT_UPDATE (WM_USER + 1)
+
+// Posted by the render thread when the cursor moved, the IME has to be
+// told on the window's thread
+// WPARAM: cursor row, LPARAM: cursor col
+#define WM_RENDERER_IME_UPDATE (WM_USER + 2)
@@ -0,0 +1,177 @@
+#include "work_pool.h"
+#include <new>
+
+static uint64_t PackRange(uint32_t begin, uint32_t end) {
+	return static_cast<uint64_t>(end) << 32 | begin;
+}
+
+// Takes the item at the front of a thread's own share
+static bool Pop(WorkPoolShare *share, int *item) {
+	uint64_t range = share->range.load(std::memory_order_acquire);
+	for (;;) {
+		uint32_t begin = static_cast<uint32_t>(range);
+		uint32_t end = static_cast<uint32_t>(range >> 32);
+		if (begin >= end) {
+			return false;
+		}
+		if (share->range.compare_exchange_weak(range, PackRange(begin + 1, end), std::memory_order_acq_rel)) {
+			*item = static_cast<int>(begin);
+			return true;
+		}
+	}
+}
+
+// Takes the back half of another share, rounded up, and keeps its first
+// item. Only called with the thief's own share empty, which nobody else
+// writes then, so the rest can simply be stored.
+static bool Steal(WorkPool *pool, int thief, int *item) {
+	for (int i = 1; i < pool->thread_count; ++i) {
+		WorkPoolShare *victim = &pool->shares[(thief + i) % pool->thread_count];
+		uint64_t range = victim->range.load(std::memory_order_acquire);
+		for (;;) {
+			uint32_t begin = static_cast<uint32_t>(range);
+			uint32_t end = static_cast<uint32_t>(range >> 32);
+			if (begin >= end) {
+				break;
+			}
+			uint32_t middle = begin + (end - begin) / 2;
+			if (victim->range.compare_exchange_weak(range, PackRange(begin, middle), std::memory_order_acq_rel)) {
+				WorkPoolShare *own = &pool->shares[thief];
+				own->range.store(PackRange(middle + 1, end), std::memory_order_release);
+				++own->steals;
+				*item = static_cast<int>(middle);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void Work(WorkPool *pool, int worker) {
+	WorkPoolShare *own = &pool->shares[worker];
+	while (pool->remaining.load(std::memory_order_acquire) > 0) {
+		int item;
+		if (!Pop(own, &item) && !Steal(pool, worker, &item)) {
+			// The last items are running elsewhere
+			std::this_thread::yield();
+			continue;
+		}
+		pool->fn(pool->context, item, worker);
+		++own->items;
+		pool->remaining.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
+
+static void WorkerMain(WorkPool *pool, int worker) {
+	uint32_t seen = 0;
+	for (;;) {
+		pool->generation.wait(seen);
+		seen = pool->generation.load();
+		if (pool->stopping.load()) {
+			return;
+		}
+		if (!(seen & 1)) {
+			continue;
+		}
+
+		// A worker waking up after its run was closed must not touch the
+		// next one while it is set up, the run's caller waits for active
+		// workers only, see WorkPoolRun
+		pool->active.fetch_add(1);
+		if (pool->generation.load() == seen) {
+			Work(pool, worker);
+		}
+		if (pool->active.fetch_sub(1) == 1) {
+			pool->active.notify_all();
+		}
+	}
+}
+
+bool WorkPoolInitialize(WorkPool *pool, int thread_count) {
+	thread_count = thread_count < 1 ? 1 : thread_count > WORK_POOL_MAX_THREADS ? WORK_POOL_MAX_THREADS : thread_count;
+	pool->thread_count = thread_count;
+	pool->fn = nullptr;
+	pool->context = nullptr;
+	pool->generation.store(0);
+	pool->active.store(0);
+	pool->remaining.store(0);
+	pool->stopping.store(false);
+	pool->stats = WorkPoolStats {};
+
+	pool->shares = new (std::nothrow) WorkPoolShare[thread_count];
+	pool->workers = thread_count > 1 ? new (std::nothrow) std::thread[thread_count - 1] : nullptr;
+	if (!pool->shares || (thread_count > 1 && !pool->workers)) {
+		delete[] pool->shares;
+		delete[] pool->workers;
+		pool->shares = nullptr;
+		pool->workers = nullptr;
+		pool->thread_count = 0;
+		return false;
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		pool->shares[i].range.store(0);
+		pool->shares[i].items = 0;
+		pool->shares[i].steals = 0;
+	}
+	for (int i = 1; i < thread_count; ++i) {
+		pool->workers[i - 1] = std::thread(WorkerMain, pool, i);
+	}
+	return true;
+}
+
+void WorkPoolShutdown(WorkPool *pool) {
+	if (!pool->shares) {
+		return;
+	}
+	pool->stopping.store(true);
+	pool->generation.fetch_add(2);
+	pool->generation.notify_all();
+	for (int i = 1; i < pool->thread_count; ++i) {
+		pool->workers[i - 1].join();
+	}
+	delete[] pool->workers;
+	delete[] pool->shares;
+	pool->workers = nullptr;
+	pool->shares = nullptr;
+	pool->thread_count = 0;
+}
+
+void WorkPoolRun(WorkPool *pool, int count, WorkPoolFn fn, void *context) {
+	if (count <= 0) {
+		return;
+	}
+	++pool->stats.runs;
+	pool->stats.items += count;
+	if (count == 1 || pool->thread_count <= 1) {
+		++pool->stats.serial_runs;
+		for (int item = 0; item < count; ++item) {
+			fn(context, item, 0);
+		}
+		return;
+	}
+
+	int thread_count = pool->thread_count;
+	for (int i = 0; i < thread_count; ++i) {
+		uint32_t begin = static_cast<uint32_t>(static_cast<int64_t>(count) * i / thread_count);
+		uint32_t end = static_cast<uint32_t>(static_cast<int64_t>(count) * (i + 1) / thread_count);
+		pool->shares[i].range.store(PackRange(begin, end), std::memory_order_relaxed);
+		pool->shares[i].steals = 0;
+	}
+	pool->fn = fn;
+	pool->context = context;
+	pool->remaining.store(count, std::memory_order_relaxed);
+	// Opens the run, publishing the above
+	pool->generation.fetch_add(1);
+	pool->generation.notify_all();
+
+	Work(pool, 0);
+
+	// Closed before looking at the workers, so none joins after
+	pool->generation.fetch_add(1);
+	for (int active = pool->active.load(); active != 0; active = pool->active.load()) {
+		pool->active.wait(active);
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		pool->stats.steals += pool->shares[i].steals;
+	}
+}
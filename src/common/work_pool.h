@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include "common/cache_line.h"
+
+// A fixed set of threads that run a function over a range of items, the
+// calling thread taking part. Every thread starts on an even share of the
+// range and takes items from its front. A thread that runs out steals the
+// back half of another thread's remaining share, so a thread that got the
+// slow items, or woke up late, holds up the rest only for its last item.
+//
+// A share is a single word, [begin, end) packed into 64 bits, taking an
+// item or stealing is one compare and swap of it.
+constexpr int WORK_POOL_MAX_THREADS = 64;
+
+// Called for every item exactly once, from any of the pool's threads.
+// worker is the thread's index, 0 being the caller of WorkPoolRun.
+using WorkPoolFn = void (*)(void *context, int item, int worker);
+
+struct WorkPoolShare {
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> range;
+	// Written by the owning thread during a run. Items are counted over the
+	// pool's life, steals over the last run.
+	uint64_t items;
+	uint64_t steals;
+};
+
+struct WorkPoolStats {
+	uint64_t runs;
+	// Runs of a single item or on a pool of one thread, done on the caller alone
+	uint64_t serial_runs;
+	uint64_t items;
+	uint64_t steals;
+};
+
+struct WorkPool {
+	int thread_count;
+	// thread_count - 1 workers, the caller is thread 0
+	std::thread *workers;
+	WorkPoolShare *shares;
+
+	WorkPoolFn fn;
+	void *context;
+	// Odd while a run is open to workers. Workers wait on it.
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> generation;
+	// Workers inside the current run, the run returns once it drops to 0
+	std::atomic<int> active;
+	// Items not done yet
+	std::atomic<int> remaining;
+	std::atomic<bool> stopping;
+
+	WorkPoolStats stats;
+};
+
+// thread_count counts the calling thread and is clamped to
+// [1, WORK_POOL_MAX_THREADS], 1 starts no threads. Returns false when
+// out of memory.
+bool WorkPoolInitialize(WorkPool *pool, int thread_count);
+// Stops and joins the workers
+void WorkPoolShutdown(WorkPool *pool);
+
+// Calls fn for every item in [0, count) and returns once all calls have.
+// Not reentrant, only one thread may run work on a pool.
+void WorkPoolRun(WorkPool *pool, int count, WorkPoolFn fn, void *context);
@@ -6,6 +6,8 @@ struct Context {
 	bool start_fullscreen;
 	int64_t start_rows;
 	int64_t start_cols;
+	// --geometry waits for the font of the user's config, see WM_RENDERER_FONT_UPDATE
+	bool geometry_pending;
 	bool disable_fullscreen;
 	HWND hwnd;
 	Nvim *nvim;
@@ -46,26 +48,121 @@ void ToggleFullscreen(HWND hwnd, Context *context) {
 	}
 }
 
+// Answers `:echo rpcrequest(1, 'nvy_stats')` with Nvy's internal counters
+void SendStats(Context *context, int64_t msg_id) {
+	constexpr int MAX_STATS = 96;
+	constexpr int MAX_STAT_NAME_LENGTH = 64;
+	NvimStat stats[MAX_STATS];
+	char stat_names[MAX_STATS][MAX_STAT_NAME_LENGTH];
+	int stat_count = 0;
+	const auto AddStat = [&](const char *prefix, const char *name, uint64_t value) {
+		if (stat_count < MAX_STATS) {
+			snprintf(stat_names[stat_count], MAX_STAT_NAME_LENGTH, "%s_%s", prefix, name);
+			stats[stat_count] = NvimStat { stat_names[stat_count], value };
+			++stat_count;
+		}
+	};
+
+	const InputBatch *input_batch = &context->nvim->input_batch;
+	AddStat("input", "keys_queued", input_batch->inputs_queued);
+	AddStat("input", "messages_sent", input_batch->messages_sent);
+	AddStat("input", "messages_saved", input_batch->messages_saved);
+	AddStat("input", "bytes_saved", input_batch->bytes_saved);
+
+	const Transport *transport = &context->nvim->transport;
+	AddStat("transport", "writes", transport->writes);
+	AddStat("transport", "bytes_written", transport->bytes_written);
+
+	const PendingRequests *pending_requests = &context->nvim->pending_requests;
+	AddStat("requests", "outstanding", pending_requests->outstanding);
+	AddStat("requests", "evicted", pending_requests->evicted);
+	AddStat("requests", "unmatched_responses", pending_requests->unmatched_responses);
+	for (int i = 0; i < NVIM_REQUEST_COUNT; ++i) {
+		const LatencyHistogram *latency = &pending_requests->latencies[i];
+		if (latency->count == 0) {
+			continue;
+		}
+		AddStat(NVIM_REQUEST_NAMES[i], "count", latency->count);
+		AddStat(NVIM_REQUEST_NAMES[i], "mean_us", latency->total_ns / latency->count / 1000);
+		AddStat(NVIM_REQUEST_NAMES[i], "p50_us", LatencyHistogramPercentileUs(latency, 50));
+		AddStat(NVIM_REQUEST_NAMES[i], "p99_us", LatencyHistogramPercentileUs(latency, 99));
+		AddStat(NVIM_REQUEST_NAMES[i], "max_us", latency->max_ns / 1000);
+	}
+
+	const MessageReader *reader = context->nvim->reader;
+	AddStat("reader", "messages_read", reader->messages_read.load(std::memory_order_relaxed));
+	AddStat("reader", "bytes_read", reader->bytes_read.load(std::memory_order_relaxed));
+	AddStat("reader", "wakeups", reader->wakeups.load(std::memory_order_relaxed));
+	AddStat("reader", "producer_stalls", reader->producer_stalls.load(std::memory_order_relaxed));
+	AddStat("reader", "heap_messages", reader->heap_messages.load(std::memory_order_relaxed));
+
+	// The render thread's counters as of its last frame
+	RendererStats draw_stats;
+	RendererGetStats(context->renderer, &draw_stats);
+	AddStat("draw", "flushes", draw_stats.flushes);
+	AddStat("draw", "rows_drawn", draw_stats.rows_drawn);
+	AddStat("draw", "rows_direct", draw_stats.row_prep.rows_direct);
+	AddStat("draw", "scroll_blits", draw_stats.scroll_blits);
+	AddStat("draw", "hl_runs", draw_stats.row_prep.hl_runs);
+	AddStat("draw", "style_runs", draw_stats.row_prep.style_runs);
+	AddStat("draw", "parallel_preps", draw_stats.row_prep.parallel_runs);
+	AddStat("draw", "prep_steals", draw_stats.prep_pool.steals);
+	AddStat("draw", "cursor_frames", draw_stats.cursor_frames);
+	AddStat("draw", "ime_updates", draw_stats.ime_updates);
+	AddStat("draw", "bg_fills", draw_stats.background_plan.fills);
+	AddStat("draw", "bg_fills_merged", draw_stats.background_plan.fills_merged);
+	AddStat("draw", "bg_color_changes", draw_stats.background_plan.color_changes);
+	AddStat("draw", "damage_marks", draw_stats.damage.marks);
+	AddStat("draw", "redundant_draws_avoided", draw_stats.damage.marks_coalesced);
+	const SnapshotChannel *snapshots = &context->renderer->snapshots;
+	AddStat("snapshots", "published", snapshots->published.load(std::memory_order_relaxed));
+	AddStat("snapshots", "folded", snapshots->folded.load(std::memory_order_relaxed));
+	AddStat("snapshots", "rows_copied", draw_stats.model.rows_copied);
+	AddStat("snapshots", "rows_shared", draw_stats.model.rows_shared);
+	AddStat("snapshots", "rows_compared", draw_stats.mirror.rows_compared);
+	AddStat("snapshots", "rows_updated", draw_stats.mirror.rows_updated);
+	const FrameSchedulerStats *frame_stats = &draw_stats.frames;
+	AddStat("frames", "drawn", frame_stats->frames);
+	AddStat("frames", "flushes_coalesced", frame_stats->flushes_coalesced);
+	AddStat("frames", "late", frame_stats->late_frames);
+	AddStat("frames", "interval_us", draw_stats.frame_interval_ns / 1000);
+	if (frame_stats->frames) {
+		AddStat("frames", "mean_latency_us", frame_stats->total_latency_ns / frame_stats->frames / 1000);
+		AddStat("frames", "mean_draw_us", frame_stats->total_draw_ns / frame_stats->frames / 1000);
+	}
+	AddStat("frames", "max_latency_us", frame_stats->max_latency_ns / 1000);
+	AddStat("layout_cache", "hits", draw_stats.layout_cache.hits);
+	AddStat("layout_cache", "misses", draw_stats.layout_cache.misses);
+	AddStat("layout_cache", "evictions", draw_stats.layout_cache.evictions);
+	AddStat("layout_cache", "invalidations", draw_stats.layout_cache.invalidations);
+	AddStat("glyph_metrics", "lookups", draw_stats.glyph_metrics.lookups);
+	AddStat("glyph_metrics", "measured", draw_stats.glyph_metrics.measured);
+	AddStat("styles", "distinct", static_cast<uint64_t>(draw_stats.style_count));
+	AddStat("styles", "resolved", draw_stats.styles.resolved);
+	AddStat("styles", "rebuilds", draw_stats.styles.rebuilds);
+	AddStat("styles", "effects_created", draw_stats.styles.effects_created);
+
+	NvimSendStatsResponse(context->nvim, msg_id, stats, stat_count);
+}
+
 void ProcessMPackMessage(Context *context, mpack_tree_t *tree) {
 	MPackMessageResult result = MPackExtractMessageResult(tree);
 
 	switch (result.type) {
 	case MPackMessageType::Response: {
-		assert(result.response.msg_id <= context->nvim->next_msg_id);
-		switch (context->nvim->msg_id_to_method[result.response.msg_id]) {
+		NvimRequest method;
+		if (!NvimRetireRequest(context->nvim, result.response.msg_id, &method)) {
+			break;
+		}
+		switch (method) {
 		case NvimRequest::nvim_get_option_value: {
 			Vec<char> guifont_buffer;
 			NvimParseOptionValueStr(context->nvim, result.params, &guifont_buffer);
 			if (!guifont_buffer.empty()) {
+				// after user config is read, process --geometry resize for the current font.
+				// if user config also sets lines or columns, --geometry takes precedence.
+				context->geometry_pending = context->start_rows != 0 && context->start_cols != 0;
 				RendererUpdateGuiFont(context->renderer, guifont_buffer.data(), strlen(guifont_buffer.data()));
-
-				if (context->start_rows != 0 && context->start_cols != 0) {
-					// after user config is read, process --geometry resize for the current font.
-					// if user config also sets lines or columns, --geometry takes precedence.
-					PixelSize start_size = RendererGridToPixelSize(context->renderer, context->start_rows, context->start_cols);
-					SetWindowPos(context->hwnd, HWND_TOP, 0, 0, 
-						start_size.width, start_size.height, SWP_NOMOVE | SWP_NOZORDER | SWP_FRAMECHANGED);
-				}
 			}
 		} break;
 		case NvimRequest::vim_get_api_info:
@@ -75,11 +172,6 @@ void ProcessMPackMessage(Context *context, mpack_tree_t *tree) {
 		} break;
 		}
 	} break;
-	case MPackMessageType::Notification: {
-		if (MPackMatchString(result.notification.name, "redraw")) {
-			RendererRedraw(context->renderer, result.params, context->start_maximized);
-		}
-	} break;
 	case MPackMessageType::Request: {
 		if (MPackMatchString(result.request.method, "vimenter")) {
 			// nvim has read user init file, we can now request info if we want
@@ -87,14 +179,43 @@ void ProcessMPackMessage(Context *context, mpack_tree_t *tree) {
 			NvimSendResponse(context->nvim, result.request.msg_id);
 			NvimGetOptionValue(context->nvim, "guifont");
 		}
+		else if (MPackMatchString(result.request.method, "nvy_stats")) {
+			SendStats(context, result.request.msg_id);
+		}
 	} break;
 	}
 }
 
+void ProcessNvimMessage(Context *context, const ReaderMessage *message) {
+	// Redraw notifications make up nearly all of the traffic, the reader
+	// thread has already translated them into commands
+	if (message->kind == NVIM_MESSAGE_REDRAW_COMMANDS) {
+		RendererExecute(context->renderer, message->data, message->size, context->start_maximized);
+		return;
+	}
+
+	// Other notifications are ignored
+	MPackCursor cursor = MPackCursorInit(message->data, message->size);
+	if (MPackCursorArray(&cursor) == 3 &&
+		MPackCursorInt(&cursor) == static_cast<int64_t>(MPackMessageType::Notification)) {
+		return;
+	}
+
+	// Responses and requests are rare and small, use a tree for them
+	mpack_tree_t tree;
+	mpack_tree_init_data(&tree, message->data, message->size);
+	mpack_tree_parse(&tree);
+	if (mpack_tree_error(&tree) == mpack_ok) {
+		ProcessMPackMessage(context, &tree);
+	}
+	mpack_tree_destroy(&tree);
+}
+
 bool SendResizeIfNecessary(Context *context, int rows, int cols) {
-	if (!context->renderer->grid_initialized) return false;
+	// Before nvim's first grid_resize
+	if (context->renderer->nvim_rows == 0) return false;
 
-	if (rows != context->renderer->grid_rows || cols != context->renderer->grid_cols) {
+	if (rows != context->renderer->nvim_rows || cols != context->renderer->nvim_cols) {
 		NvimSendResize(context->nvim, rows, cols);
 		return true;
 	}
@@ -122,33 +243,51 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 		UINT current_dpi = HIWORD(wparam);
 		RECT* const prcNewWindow = (RECT*)lparam;
 
-		context->renderer->dpi_scale = current_dpi / 96.0f;
 		context->saved_window_width = prcNewWindow->right - prcNewWindow->left;
 		context->saved_window_height = prcNewWindow->bottom - prcNewWindow->top;
 		context->saved_dpi_scaling = current_dpi;
-		RendererUpdateFont(context->renderer, context->renderer->last_requested_font_size);
+		RendererUpdateDpi(context->renderer, current_dpi / 96.0f);
 
+		// The swap chain follows the new size in the main loop, and nvim is
+		// told the grid size on WM_RENDERER_FONT_UPDATE
 		SetWindowPos(hwnd, NULL,
 				prcNewWindow->left, prcNewWindow->top,
 				prcNewWindow->right - prcNewWindow->left, prcNewWindow->bottom - prcNewWindow->top,
 				SWP_NOZORDER | SWP_NOACTIVATE);
-
-		RendererResize(context->renderer, context->saved_window_width, context->saved_window_height);
-		auto [rows, cols] = RendererPixelsToGridSize(context->renderer, context->saved_window_width, context->saved_window_height);
-		SendResizeIfNecessary(context, rows, cols);
+	} return 0;
+	case WM_DISPLAYCHANGE:
+	case WM_EXITSIZEMOVE: {
+		// The display mode changed, or the window was moved onto another display
+		RendererUpdateRefreshRate(context->renderer);
 	} return 0;
 	case WM_DESTROY: {
 		PostQuitMessage(0);
 	} return 0;
 	case WM_NVIM_MESSAGE: {
-		mpack_tree_t *tree = reinterpret_cast<mpack_tree_t *>(wparam);
-		ProcessMPackMessage(context, tree);
+		// Drain everything queued so far, messages queued while these
+		// are processed post another wakeup
+		MessageReader *reader = context->nvim->reader;
+		MessageReaderBeginDrain(reader);
+		ReaderMessage message;
+		while (MessageReaderPop(reader, &message)) {
+			ProcessNvimMessage(context, &message);
+			MessageReaderRelease(reader, &message);
+		}
 	} return 0;
 	case WM_RENDERER_FONT_UPDATE: {
+		if (context->geometry_pending) {
+			context->geometry_pending = false;
+			PixelSize start_size = RendererGridToPixelSize(context->renderer, context->start_rows, context->start_cols);
+			SetWindowPos(context->hwnd, HWND_TOP, 0, 0,
+				start_size.width, start_size.height, SWP_NOMOVE | SWP_NOZORDER | SWP_FRAMECHANGED);
+		}
 		auto [rows, cols] = RendererPixelsToGridSize(context->renderer,
-			context->renderer->pixel_size.width, context->renderer->pixel_size.height);
+			context->saved_window_width, context->saved_window_height);
 		SendResizeIfNecessary(context, rows, cols);
 	} return 0;
+	case WM_RENDERER_IME_UPDATE: {
+		RendererUpdateImePos(context->renderer, static_cast<int>(wparam), static_cast<int>(lparam));
+	} return 0;
 	case WM_INPUTLANGCHANGE: {
 		HKL hkl = (HKL)lparam;
 		context->hkl = hkl;
@@ -326,10 +465,8 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 
 		while (abs(context->buffered_scroll_amount) >= 1.0f) {
 			if (should_resize_font) {
-				RendererUpdateFont(context->renderer, context->renderer->last_requested_font_size + (scroll_amount * 2.0f));
-				auto [rows, cols] = RendererPixelsToGridSize(context->renderer,
-					context->renderer->pixel_size.width, context->renderer->pixel_size.height);
-				SendResizeIfNecessary(context, rows, cols);
+				// Nvim is told the grid size on WM_RENDERER_FONT_UPDATE
+				RendererUpdateFontSize(context->renderer, scroll_amount * 2.0f);
 			}
 			else {
 				for (int i = 0; i < abs(scroll_amount); ++i) {
@@ -408,6 +545,13 @@ int WINAPI wWinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE prev_instance, _
 	int64_t start_pos_y = CW_USEDEFAULT;
 	bool enable_cursor_timeout = false;
 	uint32_t cursor_timeout_in_ms = 0;
+	size_t pipe_buffer_size = DEFAULT_NVIM_PIPE_BUFFER_SIZE;
+	size_t read_buffer_size = DEFAULT_READER_RING_SIZE;
+	const wchar_t *record_path = nullptr;
+	bool record_outbound = false;
+	const wchar_t *server_address = nullptr;
+	FramePolicy frame_policy = FramePolicy::LowLatency;
+	uint32_t max_fps = 0;
 
 	static constexpr const wchar_t *NVIM_CMD = L"nvim --embed";
 	size_t nvim_cmd_len = wcslen(NVIM_CMD);
@@ -465,6 +609,45 @@ int WINAPI wWinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE prev_instance, _
 			wchar_t* end_ptr;
 			cursor_timeout_in_ms = wcstol(&cmd_line_args[i][17], &end_ptr, 10);
 		}
+		else if (!wcsncmp(cmd_line_args[i], L"--pipe-buffer-size=", wcslen(L"--pipe-buffer-size="))) {
+			long kilobytes = wcstol(&cmd_line_args[i][19], nullptr, 10);
+			if (kilobytes >= 0 && kilobytes <= 1024 * 1024) {
+				pipe_buffer_size = static_cast<size_t>(kilobytes) * 1024;
+			}
+		}
+		else if (!wcsncmp(cmd_line_args[i], L"--read-buffer-size=", wcslen(L"--read-buffer-size="))) {
+			long megabytes = wcstol(&cmd_line_args[i][19], nullptr, 10);
+			if (megabytes > 0 && megabytes <= 1024) {
+				read_buffer_size = static_cast<size_t>(megabytes) * 1024 * 1024;
+			}
+		}
+		else if (!wcsncmp(cmd_line_args[i], L"--frame-policy=", wcslen(L"--frame-policy="))) {
+			const wchar_t *policy = &cmd_line_args[i][15];
+			if (!wcscmp(policy, L"low-latency")) {
+				frame_policy = FramePolicy::LowLatency;
+			}
+			else if (!wcscmp(policy, L"max-fps")) {
+				frame_policy = FramePolicy::Capped;
+			}
+			else if (!wcscmp(policy, L"power-save")) {
+				frame_policy = FramePolicy::PowerSave;
+			}
+		}
+		else if (!wcsncmp(cmd_line_args[i], L"--max-fps=", wcslen(L"--max-fps="))) {
+			long fps = wcstol(&cmd_line_args[i][10], nullptr, 10);
+			if (fps > 0 && fps <= 1000) {
+				max_fps = static_cast<uint32_t>(fps);
+			}
+		}
+		else if (!wcsncmp(cmd_line_args[i], L"--record=", wcslen(L"--record="))) {
+			record_path = &cmd_line_args[i][9];
+		}
+		else if (!wcscmp(cmd_line_args[i], L"--record-outbound")) {
+			record_outbound = true;
+		}
+		else if (!wcsncmp(cmd_line_args[i], L"--server=", wcslen(L"--server="))) {
+			server_address = &cmd_line_args[i][9];
+		}
 		// Already processed
 		else if (!wcsncmp(cmd_line_args[i], L"--neovim-bin=", wcslen(L"--neovim-bin="))) {}
 		// Otherwise assume the argument is a filename to open
@@ -547,49 +730,94 @@ int WINAPI wWinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE prev_instance, _
 	constexpr int DWMWA_USE_IMMERSIVE_DARK_MODE = 20;
 	BOOL should_use_dark_mode = ShouldUseDarkMode();
 	DwmSetWindowAttribute(hwnd, DWMWA_USE_IMMERSIVE_DARK_MODE, &should_use_dark_mode, sizeof(BOOL));
-	RendererInitialize(&renderer, hwnd, disable_ligatures, linespace_factor, context.saved_dpi_scaling);
+	RendererInitialize(&renderer, hwnd, disable_ligatures, linespace_factor, context.saved_dpi_scaling,
+		frame_policy, max_fps);
+	nvim.redraw_hook = [](void *context, const char *commands, size_t size) {
+		RendererApplyRedraw(static_cast<Renderer *>(context), commands, size);
+	};
+	nvim.redraw_context = &renderer;
 
-	NvimInitialize(&nvim, nvim_cmd, hwnd);
+	if (record_path) {
+		nvim.recorder = new StreamRecorder {};
+		if (!StreamRecorderOpen(nvim.recorder, _wfopen(record_path, L"wb"), record_outbound)) {
+			MessageBoxA(NULL, "ERROR: Could not open the --record file", "Nvy", MB_OK | MB_ICONERROR);
+			delete nvim.recorder;
+			nvim.recorder = nullptr;
+		}
+	}
+	bool started;
+	if (server_address) {
+		char address[MAX_PATH] {};
+		WideCharToMultiByte(CP_UTF8, 0, server_address, -1, address, MAX_PATH, NULL, NULL);
+		started = NvimConnect(&nvim, address, hwnd, pipe_buffer_size, read_buffer_size);
+		if (!started) {
+			MessageBoxA(NULL, "ERROR: Could not attach to the --server address", "Nvy", MB_OK | MB_ICONERROR);
+		}
+		else {
+			// There is no VimEnter to wait for, the server's options are already set
+			NvimGetOptionValue(&nvim, "guifont");
+		}
+	}
+	else {
+		started = NvimInitialize(&nvim, nvim_cmd, hwnd, pipe_buffer_size, read_buffer_size);
+	}
 	free(nvim_cmd);
 
-	// Forceably update the window to prevent any frames where the window is blank. Windows API docs
-	// specify that SetWindowPos should be called with these arguments after SetWindowLong is called.
-	UINT window_flags = SWP_NOSIZE | SWP_NOMOVE | SWP_NOZORDER | SWP_FRAMECHANGED;
-	if (start_pos_x != CW_USEDEFAULT || start_pos_y != CW_USEDEFAULT) {
-		window_flags = window_flags & ~SWP_NOMOVE;
-	}
-	SetWindowPos(hwnd, HWND_TOP, start_pos_x, start_pos_y, 0, 0, window_flags);
+	// Failing to start nvim skips straight to shutting down, the window
+	// is only shown by the first flush so it never appears
+	if (started) {
+		// Forceably update the window to prevent any frames where the window is blank. Windows API docs
+		// specify that SetWindowPos should be called with these arguments after SetWindowLong is called.
+		UINT window_flags = SWP_NOSIZE | SWP_NOMOVE | SWP_NOZORDER | SWP_FRAMECHANGED;
+		if (start_pos_x != CW_USEDEFAULT || start_pos_y != CW_USEDEFAULT) {
+			window_flags = window_flags & ~SWP_NOMOVE;
+		}
+		SetWindowPos(hwnd, HWND_TOP, start_pos_x, start_pos_y, 0, 0, window_flags);
 
-	if (start_fullscreen) {
-		ToggleFullscreen(context.hwnd, &context);
-	}
+		if (start_fullscreen) {
+			ToggleFullscreen(context.hwnd, &context);
+		}
 
-	// Attach the renderer now that the window size is determined
-	RendererAttach(context.renderer);
-	auto [rows, cols] = RendererPixelsToGridSize(context.renderer,
-		context.renderer->pixel_size.width, context.renderer->pixel_size.height);
-	NvimSendUIAttach(context.nvim, rows, cols);
+		// Attach the renderer now that the window size is determined
+		RendererAttach(context.renderer);
+		RECT client_rect;
+		GetClientRect(hwnd, &client_rect);
+		auto [rows, cols] = RendererPixelsToGridSize(context.renderer,
+			client_rect.right - client_rect.left, client_rect.bottom - client_rect.top);
+		NvimSendUIAttach(context.nvim, rows, cols);
+	}
 
 	MSG msg;
 	uint32_t previous_width = 0, previous_height = 0;
-	while (GetMessage(&msg, 0, 0, 0)) {
+	bool quit = !started;
+	while (!quit && GetMessage(&msg, 0, 0, 0)) {
 		// TranslateMessage(&msg);
 		DispatchMessage(&msg);
 
-		if (renderer.draw_active) continue;
+		// Handle everything else that is already queued before sending the
+		// keys typed meanwhile, so a burst of key repeats goes out as one write
+		while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+			if (msg.message == WM_QUIT) {
+				quit = true;
+				break;
+			}
+			DispatchMessage(&msg);
+		}
+		NvimFlushInput(&nvim);
 
+		// The render thread draws everything again at the new size
 		if (previous_width != context.saved_window_width || previous_height != context.saved_window_height) {
 			previous_width = context.saved_window_width;
 			previous_height = context.saved_window_height;
 			auto [rows, cols] = RendererPixelsToGridSize(context.renderer, context.saved_window_width, context.saved_window_height);
 			RendererResize(context.renderer, context.saved_window_width, context.saved_window_height);
-			if (!SendResizeIfNecessary(&context, rows, cols))
-				RendererFlush(context.renderer);
+			SendResizeIfNecessary(&context, rows, cols);
 		}
 	}
 
-	RendererShutdown(&renderer);
+	// The reader thread applies redraws to the renderer until it is joined
 	NvimShutdown(&nvim);
+	RendererShutdown(&renderer);
 
 	if (nvim.exit_code != EXIT_SUCCESS) {
 		// We'll generate a message from the error stdout
@@ -599,11 +827,8 @@ int WINAPI wWinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE prev_instance, _
 		while (true) {
 			// nvim outputs directly in double byte on error on windows
 			char buffer[1024 * 4];
-			DWORD read = 0;
-			if (!ReadFile(nvim.stderr_read, buffer, sizeof(buffer) - 1, &read, NULL)) {
-				break;
-			}
-			if (!read) { continue; }
+			DWORD read = static_cast<DWORD>(TransportReadError(&nvim.transport, buffer, sizeof(buffer) - 1));
+			if (!read) { break; }
 			buffer[read] = 0;
 			char *tmp = static_cast<char *>(realloc(msg, size_t(read) + len + 1));
 			if (!tmp) { break; } // no more memory... bail out
@@ -0,0 +1,73 @@
+#include "input_batch.h"
+#include <cassert>
+#include <cstring>
+#include "third_party/mpack/mpack.h"
+
+constexpr const char *INPUT_REQUEST_NAME = "nvim_input";
+
+static size_t MPackUintSize(uint64_t value) {
+	if (value <= 0x7F) return 1;
+	if (value <= 0xFF) return 2;
+	if (value <= 0xFFFF) return 3;
+	if (value <= 0xFFFFFFFF) return 5;
+	return 9;
+}
+
+static size_t MPackStrHeaderSize(size_t length) {
+	if (length <= 31) return 1;
+	if (length <= 0xFF) return 2;
+	if (length <= 0xFFFF) return 3;
+	return 5;
+}
+
+size_t InputRequestSize(int64_t msg_id, size_t keys_length) {
+	size_t name_length = strlen(INPUT_REQUEST_NAME);
+	// [0, msg_id, "nvim_input", [keys]]
+	return 1 + 1 + MPackUintSize(static_cast<uint64_t>(msg_id)) +
+		MPackStrHeaderSize(name_length) + name_length +
+		1 + MPackStrHeaderSize(keys_length) + keys_length;
+}
+
+bool InputBatchAppend(InputBatch *batch, const char *keys, size_t length, int64_t next_msg_id) {
+	if (batch->keys_length + length > MAX_INPUT_BATCH_SIZE) {
+		return false;
+	}
+
+	memcpy(batch->keys + batch->keys_length, keys, length);
+	batch->keys_length += length;
+	batch->pending_unbatched_bytes += InputRequestSize(next_msg_id + batch->pending_inputs, length);
+	++batch->pending_inputs;
+	++batch->inputs_queued;
+	return true;
+}
+
+size_t InputBatchEncode(InputBatch *batch, int64_t msg_id, char *out) {
+	if (InputBatchEmpty(batch)) {
+		return 0;
+	}
+
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, out, MAX_INPUT_BATCH_MESSAGE_SIZE);
+	mpack_start_array(&writer, 4);
+	mpack_write_i64(&writer, 0);
+	mpack_write_i64(&writer, msg_id);
+	mpack_write_cstr(&writer, INPUT_REQUEST_NAME);
+	mpack_start_array(&writer, 1);
+	mpack_write_str(&writer, batch->keys, static_cast<uint32_t>(batch->keys_length));
+	mpack_finish_array(&writer);
+	mpack_finish_array(&writer);
+	size_t size = mpack_writer_buffer_used(&writer);
+	mpack_error_t err = mpack_writer_destroy(&writer);
+	assert(err == mpack_ok);
+
+	++batch->messages_sent;
+	batch->messages_saved += batch->pending_inputs - 1;
+	if (batch->pending_unbatched_bytes > size) {
+		batch->bytes_saved += batch->pending_unbatched_bytes - size;
+	}
+
+	batch->keys_length = 0;
+	batch->pending_inputs = 0;
+	batch->pending_unbatched_bytes = 0;
+	return err == mpack_ok ? size : 0;
+}
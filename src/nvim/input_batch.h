@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Collects the key strings typed during one message loop iteration so
+// they can be sent to nvim as a single nvim_input request. nvim_input
+// takes a sequence of keys, so concatenating them is equivalent to
+// sending them one by one.
+constexpr size_t MAX_INPUT_BATCH_SIZE = 4000;
+// Room for the request header around a full batch
+constexpr size_t MAX_INPUT_BATCH_MESSAGE_SIZE = MAX_INPUT_BATCH_SIZE + 32;
+
+struct InputBatch {
+	char keys[MAX_INPUT_BATCH_SIZE];
+	size_t keys_length;
+	uint32_t pending_inputs;
+	// Encoded size the pending inputs would have had as separate requests
+	size_t pending_unbatched_bytes;
+
+	// Totals since startup
+	uint64_t inputs_queued;
+	uint64_t messages_sent;
+	uint64_t messages_saved;
+	uint64_t bytes_saved;
+};
+
+// Size of an nvim_input request carrying `keys_length` bytes of keys
+size_t InputRequestSize(int64_t msg_id, size_t keys_length);
+
+// Returns false if the keys don't fit, the batch has to be flushed first.
+// Keys larger than MAX_INPUT_BATCH_SIZE never fit and have to be sent on their own.
+bool InputBatchAppend(InputBatch *batch, const char *keys, size_t length, int64_t next_msg_id);
+
+inline bool InputBatchEmpty(const InputBatch *batch) {
+	return batch->pending_inputs == 0;
+}
+
+// Encodes the pending keys as one nvim_input request into `out`, which has
+// to hold MAX_INPUT_BATCH_MESSAGE_SIZE bytes, and resets the batch.
+// Returns the size of the request, 0 if there was nothing to send.
+size_t InputBatchEncode(InputBatch *batch, int64_t msg_id, char *out);
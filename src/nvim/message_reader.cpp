@@ -0,0 +1,231 @@
+#include "message_reader.h"
+#include <cstdlib>
+#include <cstring>
+
+bool MessageReaderInitialize(MessageReader *reader, size_t ring_size, MessageReaderReadFn read,
+	MessageReaderWakeFn wake, MessageReaderTranslateFn translate, void *context) {
+	if (ring_size < MIN_READER_RING_SIZE) {
+		ring_size = MIN_READER_RING_SIZE;
+	}
+
+	reader->ring = static_cast<char *>(malloc(ring_size));
+	if (!reader->ring) {
+		return false;
+	}
+	reader->ring_size = ring_size;
+	reader->read = read;
+	reader->wake = wake;
+	reader->translate = translate;
+	reader->context = context;
+	return true;
+}
+
+void MessageReaderShutdown(MessageReader *reader) {
+	// Only safe once the reader thread has returned
+	ReaderMessage message;
+	while (MessageReaderPop(reader, &message)) {
+		MessageReaderRelease(reader, &message);
+	}
+	free(reader->ring);
+	reader->ring = nullptr;
+}
+
+static void WakeConsumer(MessageReader *reader) {
+	if (!reader->wake_pending.exchange(true)) {
+		reader->wakeups.fetch_add(1, std::memory_order_relaxed);
+		reader->wake(reader->context);
+	}
+}
+
+// Blocks until the consumer releases another message. `seen` is the release
+// count read before the condition the caller is waiting on was checked.
+static void WaitForConsumer(MessageReader *reader, uint32_t seen) {
+	// The consumer may not know there is anything to release yet
+	WakeConsumer(reader);
+	reader->producer_stalls.fetch_add(1, std::memory_order_relaxed);
+
+	reader->stall_released_pos.store(reader->released_pos.load(std::memory_order_acquire), std::memory_order_relaxed);
+	reader->producer_waiting.store(true);
+	reader->release_count.wait(seen);
+	reader->producer_waiting.store(false);
+}
+
+// Blocks until every ring position before `end` is free to be written
+static void WaitForRoom(MessageReader *reader, uint64_t end) {
+	while (true) {
+		uint32_t seen = reader->release_count.load();
+		if (end - reader->released_pos.load(std::memory_order_acquire) <= reader->ring_size) {
+			return;
+		}
+		WaitForConsumer(reader, seen);
+	}
+}
+
+static void Publish(MessageReader *reader, ReaderMessage *message) {
+	if (reader->translate) {
+		reader->translate(reader->context, message);
+	}
+
+	while (true) {
+		uint32_t seen = reader->release_count.load();
+		if (reader->queue.Push(*message)) {
+			break;
+		}
+		WaitForConsumer(reader, seen);
+	}
+	reader->messages_read.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MessageReaderRun(MessageReader *reader) {
+	const size_t ring_size = reader->ring_size;
+	// A pending message this large could not be moved to the start of the
+	// ring without overlapping itself, so it continues on the heap instead
+	const size_t max_ring_message_size = ring_size / 2 - MIN_READER_READ_SIZE;
+
+	// Positions increase monotonically across laps of the ring, the pending
+	// (incomplete) message starts at write_pos and is `fill` bytes long
+	uint64_t write_pos = 0;
+	size_t fill = 0;
+	MPackFramer framer {};
+
+	while (true) {
+		bool invalid = false;
+		bool published = false;
+		while (fill > 0) {
+			char *message_start = reader->ring + write_pos % ring_size;
+			size_t message_size = MPackFramerScan(&framer, message_start, fill, &invalid);
+			if (message_size == 0) {
+				break;
+			}
+
+			ReaderMessage message {
+				.data = message_start,
+				.size = message_size,
+				.release_pos = write_pos + message_size,
+				.heap_data = nullptr,
+				.kind = 0
+			};
+			Publish(reader, &message);
+			published = true;
+			write_pos += message_size;
+			fill -= message_size;
+		}
+		if (published) {
+			WakeConsumer(reader);
+		}
+		if (invalid) {
+			break;
+		}
+
+		if (fill > max_ring_message_size) {
+			size_t capacity = fill * 2;
+			char *heap_data = static_cast<char *>(malloc(capacity));
+			if (!heap_data) {
+				break;
+			}
+			memcpy(heap_data, reader->ring + write_pos % ring_size, fill);
+			size_t heap_fill = fill;
+			// The ring bytes of the message are abandoned, nothing was published from them
+			fill = 0;
+
+			size_t message_size = 0;
+			while (message_size == 0 && !invalid) {
+				if (heap_fill == capacity) {
+					char *grown_data = capacity < MAX_READER_MESSAGE_SIZE ?
+						static_cast<char *>(realloc(heap_data, capacity * 2)) : nullptr;
+					if (!grown_data) {
+						break;
+					}
+					heap_data = grown_data;
+					capacity *= 2;
+				}
+
+				// Keep reads small enough that whatever follows the message fits back into the ring
+				size_t read_size = capacity - heap_fill < ring_size / 4 ? capacity - heap_fill : ring_size / 4;
+				size_t bytes = reader->read(reader->context, heap_data + heap_fill, read_size);
+				if (bytes == 0) {
+					break;
+				}
+				reader->bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+				heap_fill += bytes;
+				message_size = MPackFramerScan(&framer, heap_data, heap_fill, &invalid);
+			}
+			if (message_size == 0) {
+				free(heap_data);
+				break;
+			}
+
+			ReaderMessage message {
+				.data = heap_data,
+				.size = message_size,
+				.release_pos = write_pos,
+				.heap_data = heap_data,
+				.kind = 0
+			};
+			Publish(reader, &message);
+			reader->heap_messages.fetch_add(1, std::memory_order_relaxed);
+			WakeConsumer(reader);
+
+			// Bytes read past the end of the message go back into the ring
+			size_t excess = heap_fill - message_size;
+			if (ring_size - write_pos % ring_size < excess + MIN_READER_READ_SIZE) {
+				write_pos += ring_size - write_pos % ring_size;
+			}
+			WaitForRoom(reader, write_pos + excess);
+			memcpy(reader->ring + write_pos % ring_size, heap_data + message_size, excess);
+			fill = excess;
+			continue;
+		}
+
+		// Move a partial message at the end of the ring to the start
+		size_t offset = write_pos % ring_size;
+		if (ring_size - (offset + fill) < MIN_READER_READ_SIZE) {
+			uint64_t next_lap = write_pos - offset + ring_size;
+			WaitForRoom(reader, next_lap + fill + MIN_READER_READ_SIZE);
+			memcpy(reader->ring, reader->ring + offset, fill);
+			write_pos = next_lap;
+			offset = 0;
+		}
+
+		WaitForRoom(reader, write_pos + fill + MIN_READER_READ_SIZE);
+		size_t free_bytes = ring_size - static_cast<size_t>(write_pos + fill - reader->released_pos.load(std::memory_order_acquire));
+		size_t contiguous_bytes = ring_size - (offset + fill);
+		size_t read_size = free_bytes < contiguous_bytes ? free_bytes : contiguous_bytes;
+
+		size_t bytes = reader->read(reader->context, reader->ring + offset + fill, read_size);
+		if (bytes == 0) {
+			break;
+		}
+		reader->bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+		fill += bytes;
+	}
+
+	// Always wake the consumer, it may be waiting for the end of the stream
+	reader->finished.store(true);
+	reader->wake_pending.store(true);
+	reader->wakeups.fetch_add(1, std::memory_order_relaxed);
+	reader->wake(reader->context);
+}
+
+void MessageReaderBeginDrain(MessageReader *reader) {
+	reader->wake_pending.store(false);
+}
+
+bool MessageReaderPop(MessageReader *reader, ReaderMessage *message) {
+	return reader->queue.Pop(message);
+}
+
+void MessageReaderRelease(MessageReader *reader, const ReaderMessage *message) {
+	if (message->heap_data) {
+		free(message->heap_data);
+	}
+	reader->released_pos.store(message->release_pos, std::memory_order_release);
+	reader->release_count.fetch_add(1);
+	// Everything published is released once the queue is empty, which has
+	// to be enough for the reader to go on
+	if (reader->producer_waiting.load() &&
+		(message->release_pos - reader->stall_released_pos.load(std::memory_order_relaxed) >= reader->ring_size / 4 ||
+		reader->queue.Empty())) {
+		reader->release_count.notify_one();
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "common/mpack_cursor.h"
+#include "common/spsc_queue.h"
+
+// The reader stage between nvim's stdout and the UI thread. A dedicated
+// thread reads straight into a byte ring and frames complete msgpack
+// messages in place. Their locations go to the consumer through a
+// lock-free SPSC queue, so the reader keeps reading while the UI thread
+// parses and renders. The consumer hands each message back once it is
+// done with it, which frees its bytes in the ring.
+//
+// Messages are contiguous in the ring. When a partial message runs into
+// the end of the ring it is moved to the start, and messages too large
+// for the ring are assembled on the heap instead.
+constexpr size_t DEFAULT_READER_RING_SIZE = 16 * 1024 * 1024;
+constexpr size_t MIN_READER_RING_SIZE = 1024 * 1024;
+constexpr size_t MAX_READER_MESSAGE_SIZE = 256 * 1024 * 1024;
+// Reads are never issued for less than this, unless the consumer has caught up
+constexpr size_t MIN_READER_READ_SIZE = 64 * 1024;
+constexpr uint32_t READER_QUEUE_CAPACITY = 4096;
+
+// Reads up to `size` bytes into `buffer`, blocking until some data is
+// available. Returns the number of bytes read, 0 on end of stream or error.
+using MessageReaderReadFn = size_t (*)(void *context, char *buffer, size_t size);
+// Asks the consumer to drain the queue, e.g. by posting a window message.
+// Called on the reader thread.
+using MessageReaderWakeFn = void (*)(void *context);
+
+struct ReaderMessage {
+	const char *data;
+	size_t size;
+	// Ring position freed once the message is released
+	uint64_t release_pos;
+	// Set for messages assembled outside of the ring
+	char *heap_data;
+	// 0 for messages as read, other values are up to the translate hook
+	uint8_t kind;
+};
+
+// Optional, called on the reader thread for every message before it is
+// queued. It may point the message at a malloc'd buffer of its own, which
+// then has to replace heap_data (freeing the previous one) so it is freed
+// on release.
+using MessageReaderTranslateFn = void (*)(void *context, ReaderMessage *message);
+
+struct MessageReader {
+	char *ring;
+	size_t ring_size;
+	MessageReaderReadFn read;
+	MessageReaderWakeFn wake;
+	MessageReaderTranslateFn translate;
+	void *context;
+
+	SpscQueue<ReaderMessage, READER_QUEUE_CAPACITY> queue;
+	// Everything before this ring position has been released by the consumer
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> released_pos;
+	// Bumped on every release, the reader waits on it when the ring or queue is full
+	std::atomic<uint32_t> release_count;
+	std::atomic<bool> producer_waiting;
+	// Where released_pos was when the reader started waiting. It is only
+	// woken once a quarter of the ring is free again or the queue ran dry,
+	// rather than for every message released.
+	std::atomic<uint64_t> stall_released_pos;
+	// Set while a wakeup is outstanding, so a burst of messages wakes the consumer once
+	std::atomic<bool> wake_pending;
+	std::atomic<bool> finished;
+
+	// Reader thread statistics
+	std::atomic<uint64_t> messages_read;
+	std::atomic<uint64_t> bytes_read;
+	std::atomic<uint64_t> wakeups;
+	std::atomic<uint64_t> producer_stalls;
+	std::atomic<uint64_t> heap_messages;
+};
+
+// Returns false if the ring couldn't be allocated. ring_size is clamped
+// to at least MIN_READER_RING_SIZE, translate may be nullptr.
+bool MessageReaderInitialize(MessageReader *reader, size_t ring_size, MessageReaderReadFn read,
+	MessageReaderWakeFn wake, MessageReaderTranslateFn translate, void *context);
+void MessageReaderShutdown(MessageReader *reader);
+
+// Runs the reader loop on the calling thread until the stream ends or turns
+// out to be malformed. Wakes the consumer a final time with `finished` set.
+void MessageReaderRun(MessageReader *reader);
+
+// Consumer side. Call MessageReaderBeginDrain on every wakeup before popping,
+// messages published after it wake the consumer again. Every popped message
+// has to be released, in order, once the consumer is done with its data.
+void MessageReaderBeginDrain(MessageReader *reader);
+bool MessageReaderPop(MessageReader *reader, ReaderMessage *message);
+void MessageReaderRelease(MessageReader *reader, const ReaderMessage *message);
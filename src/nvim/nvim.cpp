@@ -1,5 +1,7 @@
 #include "nvim.h"
 #include "common/mpack_helper.h"
+#include "common/clock.h"
+#include "nvim/redraw_commands.h"
 #include "third_party/mpack/mpack.h"
 
 constexpr int Megabytes(int n) {
@@ -7,218 +9,310 @@ constexpr int Megabytes(int n) {
 }
 
 int64_t RegisterRequest(Nvim *nvim, NvimRequest request) {
-	nvim->msg_id_to_method.push_back(request);
-	return nvim->next_msg_id++;
+	int64_t msg_id = nvim->next_msg_id++;
+	PendingRequestsAdd(&nvim->pending_requests, msg_id, request, ClockNowNs());
+	return msg_id;
+}
+
+bool NvimRetireRequest(Nvim *nvim, int64_t msg_id, NvimRequest *method) {
+	uint8_t pending_method;
+	if (!PendingRequestsRetire(&nvim->pending_requests, msg_id, ClockNowNs(), &pending_method)) {
+		return false;
+	}
+	*method = static_cast<NvimRequest>(pending_method);
+	return true;
 }
 
 static size_t ReadFromNvim(mpack_tree_t *tree, char *buffer, size_t count) {
-	HANDLE nvim_stdout_read = mpack_tree_context(tree);
-	DWORD bytes_read;
-	BOOL success = ReadFile(nvim_stdout_read, buffer, static_cast<DWORD>(count), &bytes_read, nullptr);
-	if (!success) {
+	Nvim *nvim = static_cast<Nvim *>(mpack_tree_context(tree));
+	size_t bytes_read = TransportRead(&nvim->transport, buffer, count);
+	if (bytes_read == 0) {
 		mpack_tree_flag_error(tree, mpack_error_io);
 	}
+	else if (nvim->recorder) {
+		StreamRecorderWrite(nvim->recorder, StreamDirection::Inbound, buffer, bytes_read);
+	}
 	return bytes_read;
 }
 
-DWORD WINAPI NvimMessageHandler(LPVOID param) {
-	Nvim *nvim = static_cast<Nvim *>(param);
-	mpack_tree_t *tree = static_cast<mpack_tree_t *>(malloc(sizeof(mpack_tree_t)));
-	mpack_tree_init_stream(tree, ReadFromNvim, nvim->stdout_read, Megabytes(20), 1'048'576);
-
-	while (true) {
-		mpack_tree_parse(tree);
-		if (mpack_tree_error(tree) != mpack_ok) {
-			break;
+// The buffers go out in a single write
+static bool WriteToNvim(Nvim *nvim, const TransportBuffer *buffers, int buffer_count) {
+	if (nvim->recorder) {
+		for (int i = 0; i < buffer_count; ++i) {
+			StreamRecorderWrite(nvim->recorder, StreamDirection::Outbound, buffers[i].data, buffers[i].size);
 		}
+	}
+	return TransportWrite(&nvim->transport, buffers, buffer_count);
+}
+
+static bool WriteToNvim(Nvim *nvim, void *data, size_t size) {
+	TransportBuffer buffer { data, size };
+	return WriteToNvim(nvim, &buffer, 1);
+}
+
+void NvimFlushInput(Nvim *nvim) {
+	if (InputBatchEmpty(&nvim->input_batch)) {
+		return;
+	}
+
+	char data[MAX_INPUT_BATCH_MESSAGE_SIZE];
+	size_t size = InputBatchEncode(&nvim->input_batch, RegisterRequest(nvim, nvim_input), data);
+	WriteToNvim(nvim, data, size);
+}
+
+// Everything sent after NvimInitialize goes through here, so pending
+// keys are always written before whatever was sent after them
+static void SendToNvim(Nvim *nvim, void *data, size_t size) {
+	if (InputBatchEmpty(&nvim->input_batch)) {
+		WriteToNvim(nvim, data, size);
+		return;
+	}
+
+	// Pending keys and the message share a write
+	char input[MAX_INPUT_BATCH_MESSAGE_SIZE];
+	size_t input_size = InputBatchEncode(&nvim->input_batch, RegisterRequest(nvim, nvim_input), input);
+	TransportBuffer buffers[] {
+		{ input, input_size },
+		{ data, size }
+	};
+	WriteToNvim(nvim, buffers, 2);
+}
+
+// Keys are held back until the end of the message loop iteration,
+// all keys typed in between go out as a single nvim_input request
+static void QueueInput(Nvim *nvim, const char *keys) {
+	size_t length = strlen(keys);
+	if (InputBatchAppend(&nvim->input_batch, keys, length, nvim->next_msg_id)) {
+		return;
+	}
+	NvimFlushInput(nvim);
+	if (InputBatchAppend(&nvim->input_batch, keys, length, nvim->next_msg_id)) {
+		return;
+	}
+
+	// Too large to batch, send it on its own
+	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
+	size_t size = NvimEncodeInput(data, RegisterRequest(nvim, nvim_input), keys);
+	WriteToNvim(nvim, data, size);
+}
+
+static size_t ReadNvimOutput(void *context, char *buffer, size_t size) {
+	Nvim *nvim = static_cast<Nvim *>(context);
+	size_t bytes_read = TransportRead(&nvim->transport, buffer, size);
+	if (bytes_read > 0 && nvim->recorder) {
+		StreamRecorderWrite(nvim->recorder, StreamDirection::Inbound, buffer, bytes_read);
+	}
+	return bytes_read;
+}
+
+static void WakeWindowThread(void *context) {
+	Nvim *nvim = static_cast<Nvim *>(context);
+	PostMessage(nvim->hwnd, WM_NVIM_MESSAGE, 0, 0);
+}
 
-		// Blocking, dubious thread safety. Seems to work though...
-		SendMessage(nvim->hwnd, WM_NVIM_MESSAGE, reinterpret_cast<WPARAM>(tree), 0);
+// Runs on the reader thread, so the window thread only executes commands
+static void TranslateNvimMessage(void *context, ReaderMessage *message) {
+	size_t commands_size;
+	char *commands = RedrawTranslate(message->data, message->size, &commands_size);
+	if (!commands) {
+		return;
+	}
+	Nvim *nvim = static_cast<Nvim *>(context);
+	if (nvim->redraw_hook) {
+		nvim->redraw_hook(nvim->redraw_context, commands, commands_size);
 	}
 
-	mpack_tree_destroy(tree);
-	free(tree);
+	free(message->heap_data);
+	message->data = commands;
+	message->size = commands_size;
+	message->heap_data = commands;
+	message->kind = NVIM_MESSAGE_REDRAW_COMMANDS;
+}
+
+DWORD WINAPI NvimMessageHandler(LPVOID param) {
+	Nvim *nvim = static_cast<Nvim *>(param);
+
+	// Messages are framed into the reader's ring and redraws translated
+	// while the window thread handles the previous ones, it is only woken
+	// once per burst
+	MessageReaderRun(nvim->reader);
+
+	// Posted after the final wakeup, so everything read is drained first
 	PostMessage(nvim->hwnd, WM_DESTROY, 0, 0);
 	return 0;
 }
 
 DWORD WINAPI NvimProcessMonitor(LPVOID param) {
 	Nvim *nvim = static_cast<Nvim *>(param);
-	while (true) {
-		DWORD exit_code;
-		if (GetExitCodeProcess(nvim->process_info.hProcess, &exit_code) && exit_code == STILL_ACTIVE) {
-			Sleep(1);
-		}
-		else {
-			nvim->exit_code = exit_code;
-			break;
-		}
+	uint32_t exit_code;
+	if (TransportWaitForExit(&nvim->transport, &exit_code)) {
+		nvim->exit_code = exit_code;
 	}
 	PostMessage(nvim->hwnd, WM_DESTROY, 0, 0);
 	return 0;
 }
 
-void NvimInitialize(Nvim *nvim, wchar_t *command_line, HWND hwnd) {
-	nvim->hwnd = hwnd;
+// Shuts a session down that failed to start, the window closes the same
+// way nvim exiting does
+static bool AbortSession(Nvim *nvim) {
+	NvimShutdown(nvim);
+	if (nvim->exit_code == 0) {
+		nvim->exit_code = 1;
+	}
+	PostMessage(nvim->hwnd, WM_DESTROY, 0, 0);
+	return false;
+}
 
-	HANDLE job_object = CreateJobObjectW(nullptr, nullptr);
-	JOBOBJECT_EXTENDED_LIMIT_INFORMATION job_info {
-		.BasicLimitInformation = JOBOBJECT_BASIC_LIMIT_INFORMATION {
-			.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE
-		}
-	};
-	SetInformationJobObject(job_object, JobObjectExtendedLimitInformation, &job_info, sizeof(job_info));
-	
-	SECURITY_ATTRIBUTES sec_attribs {
-		.nLength = sizeof(SECURITY_ATTRIBUTES),
-		.bInheritHandle = true
-	};
-	HANDLE stdin_read, stdout_write, stderr_write;
-	CreatePipe(&stdin_read, &nvim->stdin_write, &sec_attribs, 0);
-	CreatePipe(&nvim->stdout_read, &stdout_write, &sec_attribs, 0);
-	CreatePipe(&nvim->stderr_read, &stderr_write, &sec_attribs, 0);
-
-	STARTUPINFO startup_info {
-		.cb = sizeof(STARTUPINFO),
-		.dwFlags = STARTF_USESTDHANDLES,
-		.hStdInput = stdin_read,
-		.hStdOutput = stdout_write,
-		.hStdError = stderr_write
-	};
+// Does the initial messages with nvim in sync, then hands its output
+// over to the reader thread
+static bool StartSession(Nvim *nvim, HWND hwnd, size_t read_buffer_size) {
+	nvim->hwnd = hwnd;
+	bool embedded = nvim->transport.kind == TransportKind::ChildProcess;
+	if (embedded) {
+		nvim->process_monitor_thread = CreateThread(nullptr, 0, NvimProcessMonitor, nvim, 0, nullptr);
+	}
 
-	// wchar_t command_line[] = L"nvim --embed";
-	CreateProcessW(
-		nullptr,
-		command_line,
-		nullptr,
-		nullptr,
-		true,
-		CREATE_NO_WINDOW,
-		nullptr,
-		nullptr,
-		&startup_info,
-		&nvim->process_info
-	);
-	AssignProcessToJobObject(job_object, nvim->process_info.hProcess);
-
-	// Close unneeded handles
-	CloseHandle(stdin_read);
-	CloseHandle(stdout_write);
-	CloseHandle(stderr_write);
-	CloseHandle(nvim->process_info.hThread);
-
-	// Start process monitor thread
-	DWORD _;
-	CreateThread( nullptr, 0, NvimProcessMonitor, nvim, 0, &_);
-
-	// Do the initial messages with nvim in sync
 	mpack_tree_t *tree_reader = static_cast<mpack_tree_t *>(malloc(sizeof(mpack_tree_t)));
-	mpack_tree_init_stream(tree_reader, ReadFromNvim, nvim->stdout_read, Megabytes(20), 1'048'576);
-
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
+	mpack_tree_init_stream(tree_reader, ReadFromNvim, nvim, Megabytes(20), 1'048'576);
 
 	// Query api info
-	MPackStartRequest(RegisterRequest(nvim, vim_get_api_info), NVIM_REQUEST_NAMES[vim_get_api_info], &writer);
-	mpack_start_array(&writer, 0);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	if (!MPackSendData(nvim->stdin_write, data, size)) {
-		return;
+	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
+	size_t size = NvimEncodeApiInfoRequest(data, RegisterRequest(nvim, vim_get_api_info));
+	if (!WriteToNvim(nvim, data, size)) {
+		mpack_tree_destroy(tree_reader);
+		free(tree_reader);
+		return AbortSession(nvim);
 	}
 	mpack_tree_parse(tree_reader);
 	if (mpack_tree_error(tree_reader)) {
-		return;
+		mpack_tree_destroy(tree_reader);
+		free(tree_reader);
+		return AbortSession(nvim);
 	}
 	MPackMessageResult result = MPackExtractMessageResult(tree_reader);
 	if (result.type == MPackMessageType::Response){
+		NvimRequest method;
+		NvimRetireRequest(nvim, result.response.msg_id, &method);
 		mpack_node_t top_level_map = mpack_node_array_at(result.params, 1);
 		mpack_node_t version_map = mpack_node_map_value_at(top_level_map, 0);
 		int64_t api_level = mpack_node_map_cstr(version_map, "api_level").data->value.i;
-		assert(api_level > 6);
+		assert(api_level >= MIN_NVIM_API_LEVEL);
 	}
 
 	// Set g:nvy global variable
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartNotification(NVIM_OUTBOUND_NOTIFICATION_NAMES[nvim_set_var], &writer);
-	mpack_start_array(&writer, 2);
-	mpack_write_cstr(&writer, "nvy");
-	mpack_write_int(&writer, 1);
-	mpack_finish_array(&writer);
-	size = MPackFinishMessage(&writer);
-	if (!MPackSendData(nvim->stdin_write, data, size)) {
-		return;
+	char set_var_data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
+	size_t set_var_size = NvimEncodeSetVar(set_var_data, "nvy", 1);
+
+	// An attached server has long since started, only an embedded nvim is
+	// held up until it has read the user config
+	if (!embedded) {
+		mpack_tree_destroy(tree_reader);
+		free(tree_reader);
+		if (!WriteToNvim(nvim, set_var_data, set_var_size)) {
+			return AbortSession(nvim);
+		}
+	}
+	else {
+		// Setup neovim to send a blocking request so we can finalize seting up before
+		// buffer
+		size = NvimEncodeCommand(data, RegisterRequest(nvim, nvim_command), NVIM_VIMENTER_AUTOCMD);
+		TransportBuffer buffers[] {
+			{ set_var_data, set_var_size },
+			{ data, size }
+		};
+		bool handshake_done = WriteToNvim(nvim, buffers, 2);
+		if (handshake_done) {
+			mpack_tree_parse(tree_reader);
+			handshake_done = !mpack_tree_error(tree_reader);
+		}
+		if (handshake_done) {
+			result = MPackExtractMessageResult(tree_reader); // get the result just in case...
+			if (result.type == MPackMessageType::Response) {
+				NvimRequest method;
+				NvimRetireRequest(nvim, result.response.msg_id, &method);
+			}
+		}
+		mpack_tree_destroy(tree_reader);
+		free(tree_reader);
+		if (!handshake_done) {
+			return AbortSession(nvim);
+		}
 	}
 
-	// Setup neovim to send a blocking request so we can finalize seting up before
-	// buffer
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_command), NVIM_REQUEST_NAMES[nvim_command], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, "autocmd VimEnter * call rpcrequest(1, 'vimenter')");
-	mpack_finish_array(&writer);
-	size = MPackFinishMessage(&writer);
-	if (!MPackSendData(nvim->stdin_write, data, size)) {
-		return;
+	// The reader outlives the window thread's use of it, it is only ever
+	// torn down with the process
+	nvim->reader = new MessageReader {};
+	if (!MessageReaderInitialize(nvim->reader, read_buffer_size, ReadNvimOutput, WakeWindowThread,
+		TranslateNvimMessage, nvim)) {
+		return AbortSession(nvim);
 	}
-	mpack_tree_parse(tree_reader);
-	if (mpack_tree_error(tree_reader)) {
-		return;
+	nvim->reader_thread = CreateThread(nullptr, 0, NvimMessageHandler, nvim, 0, nullptr);
+	return nvim->reader_thread || AbortSession(nvim);
+}
+
+bool NvimInitialize(Nvim *nvim, wchar_t *command_line, HWND hwnd, size_t pipe_buffer_size, size_t read_buffer_size) {
+	if (!TransportSpawn(&nvim->transport, command_line, pipe_buffer_size)) {
+		// Closes the window the same way nvim exiting does
+		nvim->exit_code = 1;
+		PostMessage(hwnd, WM_DESTROY, 0, 0);
+		return false;
 	}
-	result = MPackExtractMessageResult(tree_reader); // get the result just in case...
+	return StartSession(nvim, hwnd, read_buffer_size);
+}
 
-	mpack_tree_destroy(tree_reader);
-	free(tree_reader);
+bool NvimConnect(Nvim *nvim, const char *address, HWND hwnd, size_t receive_buffer_size, size_t read_buffer_size) {
+	if (!TransportConnect(&nvim->transport, address, receive_buffer_size)) {
+		nvim->exit_code = 1;
+		return false;
+	}
+	return StartSession(nvim, hwnd, read_buffer_size);
+}
 
-	CreateThread(nullptr, 0, NvimMessageHandler, nvim, 0, &_);
+static void JoinThread(HANDLE *thread) {
+	if (*thread) {
+		WaitForSingleObject(*thread, INFINITE);
+		CloseHandle(*thread);
+		*thread = nullptr;
+	}
 }
 
 void NvimShutdown(Nvim *nvim) {
-	DWORD exit_code;
-	GetExitCodeProcess(nvim->process_info.hProcess, &exit_code);
+	// Nothing is released under a read or wait still in progress, the
+	// stream ends first and both threads are done with it
+	TransportCancel(&nvim->transport);
+	if (nvim->reader_thread) {
+		// The reader may be waiting for room in a full ring, what is left
+		// queued is dropped until it sees the end of the stream
+		ReaderMessage message;
+		while (WaitForSingleObject(nvim->reader_thread, 1) == WAIT_TIMEOUT) {
+			while (MessageReaderPop(nvim->reader, &message)) {
+				MessageReaderRelease(nvim->reader, &message);
+			}
+		}
+		JoinThread(&nvim->reader_thread);
+	}
+	JoinThread(&nvim->process_monitor_thread);
+	if (nvim->recorder) {
+		StreamRecorderClose(nvim->recorder);
+	}
 
-	if(exit_code == STILL_ACTIVE) {
-		CloseHandle(nvim->stdin_write);
-		CloseHandle(nvim->stdout_read);
-		CloseHandle(nvim->stderr_read);
-		TerminateProcess(nvim->process_info.hProcess, 0);
-		CloseHandle(nvim->process_info.hProcess);
-		CloseHandle(nvim->process_info.hThread);
+	// An nvim that exited keeps its stderr readable for the error message
+	uint32_t exit_code;
+	if (!TransportExited(&nvim->transport, &exit_code)) {
+		TransportClose(&nvim->transport);
 	}
 }
 
 void NvimSendUIAttach(Nvim *nvim, int grid_rows, int grid_cols) {
 	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-
-	// Send UI attach notification
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartNotification(NVIM_OUTBOUND_NOTIFICATION_NAMES[nvim_ui_attach], &writer);
-	mpack_start_array(&writer, 3);
-	mpack_write_int(&writer, grid_cols);
-	mpack_write_int(&writer, grid_rows);
-	mpack_start_map(&writer, 1);
-	mpack_write_cstr(&writer, "ext_linegrid");
-	mpack_write_true(&writer);
-	mpack_finish_map(&writer);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	size_t size = NvimEncodeUIAttach(data, grid_rows, grid_cols);
+	SendToNvim(nvim, data, size);
 }
 
 void NvimSendResize(Nvim *nvim, int grid_rows, int grid_cols) {
 	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-
-	MPackStartNotification(NVIM_OUTBOUND_NOTIFICATION_NAMES[nvim_ui_try_resize], &writer);
-	mpack_start_array(&writer, 2);
-	mpack_write_int(&writer, grid_cols);
-	mpack_write_int(&writer, grid_rows);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	size_t size = NvimEncodeResize(data, grid_rows, grid_cols);
+	SendToNvim(nvim, data, size);
 }
 
 void NvimSendModifiedInput(Nvim *nvim, const char *input) {
@@ -232,15 +326,7 @@ void NvimSendModifiedInput(Nvim *nvim, const char *input) {
 	snprintf(input_string, MAX_INPUT_STRING_SIZE, "<%s%s%s%s>", ctrl_down ? "C-" : "", 
 			shift_down ? "S-" : "", alt_down ? "M-" : "", input);
 
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_input), NVIM_REQUEST_NAMES[nvim_input], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, input_string);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	QueueInput(nvim, input_string);
 }
 
 void NvimSendChar(Nvim *nvim, wchar_t input_char) {
@@ -257,15 +343,7 @@ void NvimSendChar(Nvim *nvim, wchar_t input_char) {
 	}
 	WideCharToMultiByte(CP_UTF8, 0, &input_char, 1, utf8_encoded, 64, NULL, NULL);
 
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_input), NVIM_REQUEST_NAMES[nvim_input], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, utf8_encoded);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	QueueInput(nvim, utf8_encoded);
 }
 
 void NvimSendSysChar(Nvim *nvim, wchar_t input_char) {
@@ -279,16 +357,7 @@ void NvimSendSysChar(Nvim *nvim, wchar_t input_char) {
 }
 
 void NvimSendInput(Nvim *nvim, const char *input_chars) {
-	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-
-	MPackStartRequest(RegisterRequest(nvim, nvim_input), NVIM_REQUEST_NAMES[nvim_input], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, input_chars);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	QueueInput(nvim, input_chars);
 }
 
 void NvimSendMouseInput(Nvim *nvim, MouseButton button, MouseAction action, int mouse_row, int mouse_col) {
@@ -350,7 +419,7 @@ void NvimSendMouseInput(Nvim *nvim, MouseButton button, MouseAction action, int
 	mpack_finish_array(&writer);
 
 	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	SendToNvim(nvim, data, size);
 }
 
 bool NvimProcessKeyDown(Nvim *nvim, int virtual_key) {
@@ -537,7 +606,7 @@ void NvimGetOptionValue(Nvim *nvim, const char *option) {
 	mpack_finish_map(&writer);
 	mpack_finish_array(&writer);
 	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	SendToNvim(nvim, data, size);
 }
 
 void NvimParseOptionValueStr(Nvim *nvim, mpack_node_t value_node, Vec<char> *value_out) {
@@ -553,17 +622,17 @@ void NvimParseOptionValueStr(Nvim *nvim, mpack_node_t value_node, Vec<char> *val
 
 void NvimSendCommand(Nvim *nvim, const char *command) {
 	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_command), NVIM_REQUEST_NAMES[nvim_command], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, command);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	size_t size = NvimEncodeCommand(data, RegisterRequest(nvim, nvim_command), command);
+	SendToNvim(nvim, data, size);
 }
 
 void NvimSendResponse(Nvim *nvim, int64_t req_id) {
+	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
+	size_t size = NvimEncodeResponse(data, req_id);
+	SendToNvim(nvim, data, size);
+}
+
+void NvimSendStatsResponse(Nvim *nvim, int64_t req_id, const NvimStat *stats, size_t stat_count) {
 	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
 	mpack_writer_t writer;
 	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
@@ -572,9 +641,14 @@ void NvimSendResponse(Nvim *nvim, int64_t req_id) {
 	mpack_write_i64(&writer, 1);
 	mpack_write_i64(&writer, req_id);
 	mpack_write_nil(&writer);
-	mpack_write_int(&writer, 0);
+	mpack_start_map(&writer, static_cast<uint32_t>(stat_count));
+	for (size_t i = 0; i < stat_count; ++i) {
+		mpack_write_cstr(&writer, stats[i].name);
+		mpack_write_u64(&writer, stats[i].value);
+	}
+	mpack_finish_map(&writer);
 	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	SendToNvim(nvim, data, size);
 }
 
 void NvimOpenFile(Nvim *nvim, const wchar_t *file_name, bool open_new_buffer) {
@@ -591,54 +665,38 @@ void NvimOpenFile(Nvim *nvim, const wchar_t *file_name, bool open_new_buffer) {
 	strcat_s(file_command, MAX_PATH, utf8_encoded);
 
 	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_command), NVIM_REQUEST_NAMES[nvim_command], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, file_command);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	size_t size = NvimEncodeCommand(data, RegisterRequest(nvim, nvim_command), file_command);
+	SendToNvim(nvim, data, size);
 }
 
 void NvimSetFocus(Nvim *nvim) {
 	const char *set_focus_command = "doautocmd <nomodeline> FocusGained";
 
 	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_command), NVIM_REQUEST_NAMES[nvim_command], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, set_focus_command);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	size_t size = NvimEncodeCommand(data, RegisterRequest(nvim, nvim_command), set_focus_command);
+	SendToNvim(nvim, data, size);
 }
 
 void NvimKillFocus(Nvim *nvim) {
 	const char *set_focus_command = "doautocmd <nomodeline> FocusLost";
 
 	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_command), NVIM_REQUEST_NAMES[nvim_command], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, set_focus_command);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	size_t size = NvimEncodeCommand(data, RegisterRequest(nvim, nvim_command), set_focus_command);
+	SendToNvim(nvim, data, size);
 }
 void NvimQuit(Nvim *nvim)
 {
+	// Detach from a server rather than quitting it, the end of the stream
+	// closes the window. The reader thread is still reading, the stream is
+	// released by NvimShutdown once it finished.
+	if (nvim->transport.kind != TransportKind::ChildProcess) {
+		TransportCancel(&nvim->transport);
+		return;
+	}
+
 	const char *quit_command = "qa";
 
 	char data[MAX_MPACK_OUTBOUND_MESSAGE_SIZE];
-	mpack_writer_t writer;
-	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
-	MPackStartRequest(RegisterRequest(nvim, nvim_command), NVIM_REQUEST_NAMES[nvim_command], &writer);
-	mpack_start_array(&writer, 1);
-	mpack_write_cstr(&writer, quit_command);
-	mpack_finish_array(&writer);
-	size_t size = MPackFinishMessage(&writer);
-	MPackSendData(nvim->stdin_write, data, size);
+	size_t size = NvimEncodeCommand(data, RegisterRequest(nvim, nvim_command), quit_command);
+	SendToNvim(nvim, data, size);
 }
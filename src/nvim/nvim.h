@@ -1,30 +1,12 @@
 #pragma once
 #include <pch.h>
+#include "nvim/input_batch.h"
+#include "nvim/message_reader.h"
+#include "nvim/nvim_messages.h"
+#include "nvim/pending_requests.h"
+#include "nvim/stream_recorder.h"
+#include "nvim/transport.h"
 
-enum NvimRequest : uint8_t {
-	vim_get_api_info = 0,
-	nvim_input = 1,
-	nvim_input_mouse = 2,
-	nvim_command = 3,
-	nvim_get_option_value = 4
-};
-constexpr const char *NVIM_REQUEST_NAMES[] {
-	"nvim_get_api_info",
-	"nvim_input",
-	"nvim_input_mouse",
-	"nvim_command",
-	"nvim_get_option_value"
-};
-enum NvimOutboundNotification : uint8_t {
-	nvim_ui_attach = 0,
-	nvim_ui_try_resize = 1,
-	nvim_set_var = 2
-};
-constexpr const char *NVIM_OUTBOUND_NOTIFICATION_NAMES[] {
-	"nvim_ui_attach",
-	"nvim_ui_try_resize",
-	"nvim_set_var"
-};
 enum class MouseButton {
 	Left,
 	Right,
@@ -40,22 +22,60 @@ enum class MouseAction {
 	MouseWheelLeft,
 	MouseWheelRight
 };
-constexpr int MAX_MPACK_OUTBOUND_MESSAGE_SIZE = 4096;
+
+// Asked for nvim's stdout pipe or the socket's receive buffer, 0 leaves
+// the size to the system
+constexpr size_t DEFAULT_NVIM_PIPE_BUFFER_SIZE = 1024 * 1024;
+
+// A single named counter reported through the nvy_stats request
+struct NvimStat {
+	const char *name;
+	uint64_t value;
+};
+
+// Called on the reader thread with each buffer of redraw commands, before
+// the window thread gets it
+using NvimRedrawFn = void (*)(void *context, const char *commands, size_t size);
 
 struct Nvim {
 	int64_t next_msg_id;
-	Vec<NvimRequest> msg_id_to_method;
+	// Requests awaiting a response, with their round trip latencies
+	PendingRequests pending_requests;
+
+	// Keys typed since the last NvimFlushInput
+	InputBatch input_batch;
+
+	// Frames nvim's output on its own thread, drained on WM_NVIM_MESSAGE
+	MessageReader *reader;
+	// Joined by NvimShutdown before the transport is released
+	HANDLE reader_thread;
+	HANDLE process_monitor_thread;
+
+	// Set before NvimInitialize to record the session for replaying it
+	StreamRecorder *recorder;
+	// Set before NvimInitialize to apply redraws off the window thread
+	NvimRedrawFn redraw_hook;
+	void *redraw_context;
 
 	HWND hwnd;
-	HANDLE stdin_write;
-	HANDLE stdout_read;
-	HANDLE stderr_read;
-	PROCESS_INFORMATION process_info;
+	// An embedded child process, or a connection to an `nvim --listen` server
+	Transport transport;
 	DWORD exit_code;
 };
 
-void NvimInitialize(Nvim *nvim, wchar_t *command_line, HWND hwnd);
+// Starts `command_line`, which has to include --embed. Returns false if
+// nvim couldn't be started or the handshake failed, the session is shut
+// down then.
+bool NvimInitialize(Nvim *nvim, wchar_t *command_line, HWND hwnd,
+	size_t pipe_buffer_size = DEFAULT_NVIM_PIPE_BUFFER_SIZE, size_t read_buffer_size = DEFAULT_READER_RING_SIZE);
+// Attaches to a running server instead, see TransportAddressKind for the
+// address format. The server keeps running once the window is closed.
+bool NvimConnect(Nvim *nvim, const char *address, HWND hwnd,
+	size_t receive_buffer_size = DEFAULT_NVIM_PIPE_BUFFER_SIZE, size_t read_buffer_size = DEFAULT_READER_RING_SIZE);
+// Ends the stream and waits for the threads reading it. The transport of
+// an nvim that exited is kept for its stderr. Safe to call again.
 void NvimShutdown(Nvim *nvim);
+bool NvimRetireRequest(Nvim *nvim, int64_t msg_id, NvimRequest *method);
 
 void NvimGetOptionValue(Nvim *nvim, const char *option);
 void NvimParseOptionValueStr(Nvim *nvim, mpack_node_t value_node, Vec<char> *value_out);
@@ -68,6 +88,8 @@ void NvimSendSysChar(Nvim *nvim, wchar_t sys_char);
 void NvimSendInput(Nvim *nvim, const char* input_chars);
 void NvimSendMouseInput(Nvim *nvim, MouseButton button, MouseAction action, int mouse_row, int mouse_col);
 void NvimSendResponse(Nvim *nvim, int64_t req_id);
+void NvimSendStatsResponse(Nvim *nvim, int64_t req_id, const NvimStat *stats, size_t stat_count);
+void NvimFlushInput(Nvim *nvim);
 bool NvimProcessKeyDown(Nvim *nvim, int virtual_key);
 void NvimOpenFile(Nvim *nvim, const wchar_t *file_name, bool open_new_buffer = false);
 void NvimSetFocus(Nvim *nvim);
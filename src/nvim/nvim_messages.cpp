@@ -0,0 +1,111 @@
+#include "nvim_messages.h"
+#include "common/mpack_cursor.h"
+#include "common/mpack_helper.h"
+
+size_t NvimEncodeApiInfoRequest(char *data, int64_t msg_id) {
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
+	MPackStartRequest(msg_id, NVIM_REQUEST_NAMES[vim_get_api_info], &writer);
+	mpack_start_array(&writer, 0);
+	mpack_finish_array(&writer);
+	return MPackFinishMessage(&writer);
+}
+
+static size_t EncodeStringRequest(char *data, int64_t msg_id, NvimRequest request, const char *argument) {
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
+	MPackStartRequest(msg_id, NVIM_REQUEST_NAMES[request], &writer);
+	mpack_start_array(&writer, 1);
+	mpack_write_cstr(&writer, argument);
+	mpack_finish_array(&writer);
+	return MPackFinishMessage(&writer);
+}
+
+size_t NvimEncodeCommand(char *data, int64_t msg_id, const char *command) {
+	return EncodeStringRequest(data, msg_id, nvim_command, command);
+}
+
+size_t NvimEncodeInput(char *data, int64_t msg_id, const char *keys) {
+	return EncodeStringRequest(data, msg_id, nvim_input, keys);
+}
+
+size_t NvimEncodeSetVar(char *data, const char *name, int64_t value) {
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
+	MPackStartNotification(NVIM_OUTBOUND_NOTIFICATION_NAMES[nvim_set_var], &writer);
+	mpack_start_array(&writer, 2);
+	mpack_write_cstr(&writer, name);
+	mpack_write_i64(&writer, value);
+	mpack_finish_array(&writer);
+	return MPackFinishMessage(&writer);
+}
+
+size_t NvimEncodeUIAttach(char *data, int grid_rows, int grid_cols) {
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
+	MPackStartNotification(NVIM_OUTBOUND_NOTIFICATION_NAMES[nvim_ui_attach], &writer);
+	mpack_start_array(&writer, 3);
+	mpack_write_int(&writer, grid_cols);
+	mpack_write_int(&writer, grid_rows);
+	mpack_start_map(&writer, 1);
+	mpack_write_cstr(&writer, "ext_linegrid");
+	mpack_write_true(&writer);
+	mpack_finish_map(&writer);
+	mpack_finish_array(&writer);
+	return MPackFinishMessage(&writer);
+}
+
+size_t NvimEncodeResize(char *data, int grid_rows, int grid_cols) {
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
+	MPackStartNotification(NVIM_OUTBOUND_NOTIFICATION_NAMES[nvim_ui_try_resize], &writer);
+	mpack_start_array(&writer, 2);
+	mpack_write_int(&writer, grid_cols);
+	mpack_write_int(&writer, grid_rows);
+	mpack_finish_array(&writer);
+	return MPackFinishMessage(&writer);
+}
+
+size_t NvimEncodeResponse(char *data, int64_t req_id) {
+	mpack_writer_t writer;
+	mpack_writer_init(&writer, data, MAX_MPACK_OUTBOUND_MESSAGE_SIZE);
+	mpack_start_array(&writer, 4);
+	mpack_write_i64(&writer, 1);
+	mpack_write_i64(&writer, req_id);
+	mpack_write_nil(&writer);
+	mpack_write_int(&writer, 0);
+	return MPackFinishMessage(&writer);
+}
+
+// Looks up a string key of the map at the cursor, leaving the cursor at its value
+static bool FindMapKey(MPackCursor *cursor, const char *key) {
+	uint32_t pairs = MPackCursorMap(cursor);
+	for (uint32_t i = 0; i < pairs && MPackCursorOk(cursor); ++i) {
+		if (MPackCursorIsStr(cursor)) {
+			uint32_t length;
+			const char *name = MPackCursorStr(cursor, &length);
+			if (MPackStrEquals(name, length, key)) {
+				return true;
+			}
+		}
+		else {
+			MPackCursorSkip(cursor);
+		}
+		MPackCursorSkip(cursor);
+	}
+	return false;
+}
+
+int64_t NvimParseApiLevel(const char *result, size_t size) {
+	MPackCursor cursor = MPackCursorInit(result, size);
+	if (MPackCursorArray(&cursor) < 2) {
+		return -1;
+	}
+	// channel id
+	MPackCursorSkip(&cursor);
+	if (!FindMapKey(&cursor, "version") || !FindMapKey(&cursor, "api_level")) {
+		return -1;
+	}
+	int64_t api_level = MPackCursorInt(&cursor);
+	return MPackCursorOk(&cursor) ? api_level : -1;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "nvim/pending_requests.h"
+
+// The msgpack-rpc messages Nvy sends nvim, independent of the window so
+// the headless client starts sessions exactly the way Nvy does
+enum NvimRequest : uint8_t {
+	vim_get_api_info = 0,
+	nvim_input = 1,
+	nvim_input_mouse = 2,
+	nvim_command = 3,
+	nvim_get_option_value = 4
+};
+constexpr const char *NVIM_REQUEST_NAMES[] {
+	"nvim_get_api_info",
+	"nvim_input",
+	"nvim_input_mouse",
+	"nvim_command",
+	"nvim_get_option_value"
+};
+constexpr int NVIM_REQUEST_COUNT = sizeof(NVIM_REQUEST_NAMES) / sizeof(NVIM_REQUEST_NAMES[0]);
+static_assert(NVIM_REQUEST_COUNT <= MAX_PENDING_REQUEST_METHODS);
+enum NvimOutboundNotification : uint8_t {
+	nvim_ui_attach = 0,
+	nvim_ui_try_resize = 1,
+	nvim_set_var = 2
+};
+constexpr const char *NVIM_OUTBOUND_NOTIFICATION_NAMES[] {
+	"nvim_ui_attach",
+	"nvim_ui_try_resize",
+	"nvim_set_var"
+};
+constexpr int MAX_MPACK_OUTBOUND_MESSAGE_SIZE = 4096;
+// ReaderMessage::kind of redraw notifications, which the reader thread
+// translates into a redraw command buffer (see redraw_commands.h)
+constexpr uint8_t NVIM_MESSAGE_REDRAW_COMMANDS = 1;
+
+// An embedded nvim calls back with a 'vimenter' request once it has read
+// the user config, until it is answered nvim is held up
+constexpr const char *NVIM_VIMENTER_AUTOCMD = "autocmd VimEnter * call rpcrequest(1, 'vimenter')";
+// nvim_get_api_info reports at least this level for every nvim with ext_linegrid
+constexpr int64_t MIN_NVIM_API_LEVEL = 7;
+
+// Each of these encodes one message into `data`, which has to hold
+// MAX_MPACK_OUTBOUND_MESSAGE_SIZE bytes, and returns its size
+size_t NvimEncodeApiInfoRequest(char *data, int64_t msg_id);
+size_t NvimEncodeCommand(char *data, int64_t msg_id, const char *command);
+// Keys that don't fit have to be split by the caller
+size_t NvimEncodeInput(char *data, int64_t msg_id, const char *keys);
+size_t NvimEncodeSetVar(char *data, const char *name, int64_t value);
+size_t NvimEncodeUIAttach(char *data, int grid_rows, int grid_cols);
+size_t NvimEncodeResize(char *data, int grid_rows, int grid_cols);
+// An empty (nil) result for a request nvim sent
+size_t NvimEncodeResponse(char *data, int64_t req_id);
+
+// Reads api_level from a nvim_get_api_info response's result,
+// [channel_id, {"version": {"api_level": N, ...}, ...}]. Returns -1 if it
+// isn't there.
+int64_t NvimParseApiLevel(const char *result, size_t size);
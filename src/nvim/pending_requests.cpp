@@ -0,0 +1,69 @@
+#include "pending_requests.h"
+#include <cassert>
+
+void LatencyHistogramAdd(LatencyHistogram *histogram, uint64_t latency_ns) {
+	uint64_t latency_us = latency_ns / 1000;
+	int bucket = 0;
+	while (latency_us > 1 && bucket < LATENCY_BUCKET_COUNT - 1) {
+		latency_us >>= 1;
+		++bucket;
+	}
+
+	++histogram->buckets[bucket];
+	++histogram->count;
+	histogram->total_ns += latency_ns;
+	if (latency_ns > histogram->max_ns) {
+		histogram->max_ns = latency_ns;
+	}
+}
+
+uint64_t LatencyHistogramPercentileUs(const LatencyHistogram *histogram, uint32_t percentile) {
+	if (histogram->count == 0) {
+		return 0;
+	}
+
+	// Rank of the sample the percentile falls on, rounded up
+	uint64_t rank = (histogram->count * percentile + 99) / 100;
+	if (rank == 0) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (int i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+		seen += histogram->buckets[i];
+		if (seen >= rank) {
+			return i == LATENCY_BUCKET_COUNT - 1 ? histogram->max_ns / 1000 : (uint64_t(2) << i);
+		}
+	}
+	return histogram->max_ns / 1000;
+}
+
+void PendingRequestsAdd(PendingRequests *requests, int64_t msg_id, uint8_t method, uint64_t now_ns) {
+	assert(method < MAX_PENDING_REQUEST_METHODS);
+
+	PendingRequest *slot = &requests->slots[static_cast<uint64_t>(msg_id) & (PENDING_REQUEST_SLOTS - 1)];
+	if (slot->in_use) {
+		++requests->evicted;
+		--requests->outstanding;
+	}
+	*slot = PendingRequest {
+		.msg_id = msg_id,
+		.sent_ns = now_ns,
+		.method = method,
+		.in_use = true
+	};
+	++requests->outstanding;
+}
+
+bool PendingRequestsRetire(PendingRequests *requests, int64_t msg_id, uint64_t now_ns, uint8_t *method) {
+	PendingRequest *slot = &requests->slots[static_cast<uint64_t>(msg_id) & (PENDING_REQUEST_SLOTS - 1)];
+	if (!slot->in_use || slot->msg_id != msg_id) {
+		++requests->unmatched_responses;
+		return false;
+	}
+
+	slot->in_use = false;
+	--requests->outstanding;
+	*method = slot->method;
+	LatencyHistogramAdd(&requests->latencies[slot->method], now_ns > slot->sent_ns ? now_ns - slot->sent_ns : 0);
+	return true;
+}
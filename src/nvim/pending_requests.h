@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+
+// Requests sent to nvim that haven't been answered yet. msgids are handed
+// out sequentially, so the table is a ring indexed by the low bits of the
+// msgid. A request still unanswered when its slot comes around again is
+// evicted, which keeps the memory bounded no matter how long Nvy runs.
+constexpr uint32_t PENDING_REQUEST_SLOTS = 1024;
+static_assert((PENDING_REQUEST_SLOTS & (PENDING_REQUEST_SLOTS - 1)) == 0);
+
+// Round trip latencies in power of two buckets of microseconds,
+// bucket i holds latencies in [2^i, 2^(i+1)) us and bucket 0 also
+// holds anything below 1 us. The last bucket is open ended.
+constexpr int LATENCY_BUCKET_COUNT = 24;
+struct LatencyHistogram {
+	uint64_t buckets[LATENCY_BUCKET_COUNT];
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+void LatencyHistogramAdd(LatencyHistogram *histogram, uint64_t latency_ns);
+// Upper bound of the bucket holding the given percentile (0-100), in microseconds
+uint64_t LatencyHistogramPercentileUs(const LatencyHistogram *histogram, uint32_t percentile);
+
+constexpr int MAX_PENDING_REQUEST_METHODS = 8;
+struct PendingRequest {
+	int64_t msg_id;
+	uint64_t sent_ns;
+	uint8_t method;
+	bool in_use;
+};
+struct PendingRequests {
+	PendingRequest slots[PENDING_REQUEST_SLOTS];
+	LatencyHistogram latencies[MAX_PENDING_REQUEST_METHODS];
+	uint32_t outstanding;
+	uint64_t evicted;
+	uint64_t unmatched_responses;
+};
+
+void PendingRequestsAdd(PendingRequests *requests, int64_t msg_id, uint8_t method, uint64_t now_ns);
+// Retires the request answered by a response and records its latency.
+// Returns false for responses that don't match an outstanding request.
+bool PendingRequestsRetire(PendingRequests *requests, int64_t msg_id, uint64_t now_ns, uint8_t *method);
@@ -0,0 +1,569 @@
+#include "redraw_commands.h"
+#include <cstdlib>
+#include <cstring>
+#include "common/clock.h"
+#include "common/transcode.h"
+
+static_assert(sizeof(RedrawCommandHeader) % REDRAW_COMMAND_ALIGNMENT == 0);
+static_assert(sizeof(RedrawCommand) == 8);
+
+constexpr size_t AlignCommandSize(size_t size) {
+	return (size + REDRAW_COMMAND_ALIGNMENT - 1) & ~(REDRAW_COMMAND_ALIGNMENT - 1);
+}
+
+uint32_t RedrawEncodeCellText(const char *text, uint32_t length) {
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(text);
+	if (length == 1 && bytes[0] < 0x80) {
+		return bytes[0];
+	}
+	if (length == 0) {
+		return REDRAW_CELL_RIGHT_HALF;
+	}
+
+	// Decode the first codepoint, invalid sequences become U+FFFD
+	uint32_t codepoint = 0xFFFD;
+	uint32_t sequence_length = 1;
+	if (bytes[0] < 0x80) {
+		codepoint = bytes[0];
+	}
+	else if (bytes[0] >= 0xC2 && bytes[0] < 0xF5) {
+		uint32_t expected_length = bytes[0] < 0xE0 ? 2 : bytes[0] < 0xF0 ? 3 : 4;
+		uint32_t decoded = bytes[0] & (0x7F >> expected_length);
+		bool valid = expected_length <= length;
+		for (uint32_t i = 1; valid && i < expected_length; ++i) {
+			valid = (bytes[i] & 0xC0) == 0x80;
+			decoded = (decoded << 6) | (bytes[i] & 0x3F);
+		}
+		constexpr uint32_t MIN_CODEPOINT[] = { 0, 0, 0x80, 0x800, 0x10000 };
+		if (valid && decoded >= MIN_CODEPOINT[expected_length] && decoded <= 0x10FFFF &&
+			(decoded < 0xD800 || decoded > 0xDFFF)) {
+			codepoint = decoded;
+			sequence_length = expected_length;
+		}
+	}
+
+	// A cell only has room for a single codepoint
+	if (sequence_length != length) {
+		return REDRAW_CELL_REPLACEMENT;
+	}
+	if (codepoint < 0x10000) {
+		return codepoint;
+	}
+	uint32_t high = 0xD800 + ((codepoint - 0x10000) >> 10);
+	uint32_t low = 0xDC00 + ((codepoint - 0x10000) & 0x3FF);
+	return (high << 16) | low;
+}
+
+static bool FitsInt32(int64_t value) {
+	return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Receives the decoded redraw events from RedrawDispatch and appends
+// the matching commands to a growing malloc'd buffer
+struct CommandWriter {
+	char *data;
+	size_t size;
+	size_t capacity;
+	uint32_t command_count;
+	bool failed;
+
+	// Scratch space for the highlight ids of the grid_line being written
+	uint16_t *hl_ids;
+	uint32_t hl_ids_capacity;
+
+	bool Reserve(size_t bytes) {
+		if (failed) {
+			return false;
+		}
+		if (size + bytes <= capacity) {
+			return true;
+		}
+
+		size_t new_capacity = capacity * 2;
+		while (new_capacity < size + bytes) {
+			new_capacity *= 2;
+		}
+		char *new_data = static_cast<char *>(realloc(data, new_capacity));
+		if (!new_data) {
+			failed = true;
+			return false;
+		}
+		data = new_data;
+		capacity = new_capacity;
+		return true;
+	}
+
+	// Starts a command with `size` bytes of struct and trailing data, returns
+	// nullptr if out of memory. The command is zeroed apart from its header.
+	template<typename T>
+	T *Begin(RedrawEvent event, size_t trailing_size = 0) {
+		size_t command_size = AlignCommandSize(sizeof(T) + trailing_size);
+		if (!Reserve(command_size)) {
+			return nullptr;
+		}
+		T *command = reinterpret_cast<T *>(data + size);
+		memset(command, 0, command_size);
+		command->command.event = event;
+		command->command.size = static_cast<uint32_t>(command_size);
+		size += command_size;
+		++command_count;
+		return command;
+	}
+
+	void Bare(RedrawEvent event) {
+		if (!Reserve(sizeof(RedrawCommand))) {
+			return;
+		}
+		RedrawCommand *command = reinterpret_cast<RedrawCommand *>(data + size);
+		*command = RedrawCommand { .event = event, .reserved = {}, .size = sizeof(RedrawCommand) };
+		size += sizeof(RedrawCommand);
+		++command_count;
+	}
+
+	void OptionSet(const RedrawOptionSet *option_set) {
+		size_t value_str_length = option_set->value_is_str ? option_set->value_str_length : 0;
+		RedrawCommandOptionSet *command = Begin<RedrawCommandOptionSet>(RedrawEvent::option_set,
+			option_set->name_length + value_str_length);
+		if (!command) {
+			return;
+		}
+		command->name_length = option_set->name_length;
+		command->value_str_length = static_cast<uint32_t>(value_str_length);
+		command->value_int = option_set->value_int;
+		command->value_is_str = option_set->value_is_str;
+		char *strings = reinterpret_cast<char *>(command + 1);
+		memcpy(strings, option_set->name, option_set->name_length);
+		memcpy(strings + option_set->name_length, option_set->value_str, value_str_length);
+	}
+	void GridResize(const RedrawGridResize *grid_resize) {
+		if (!FitsInt32(grid_resize->grid) || grid_resize->width <= 0 || grid_resize->height <= 0 ||
+			grid_resize->width > INT32_MAX || grid_resize->height > INT32_MAX) {
+			return;
+		}
+		RedrawCommandGridResize *command = Begin<RedrawCommandGridResize>(RedrawEvent::grid_resize);
+		if (command) {
+			command->grid = static_cast<int32_t>(grid_resize->grid);
+			command->width = static_cast<int32_t>(grid_resize->width);
+			command->height = static_cast<int32_t>(grid_resize->height);
+		}
+	}
+	void GridClear(const RedrawGridClear *grid_clear) {
+		RedrawCommandGridClear *command = Begin<RedrawCommandGridClear>(RedrawEvent::grid_clear);
+		if (command) {
+			command->grid = FitsInt32(grid_clear->grid) ? static_cast<int32_t>(grid_clear->grid) : 0;
+		}
+	}
+	void DefaultColorsSet(const RedrawDefaultColorsSet *default_colors) {
+		RedrawCommandDefaultColorsSet *command = Begin<RedrawCommandDefaultColorsSet>(RedrawEvent::default_colors_set);
+		if (command) {
+			command->rgb_fg = default_colors->rgb_fg;
+			command->rgb_bg = default_colors->rgb_bg;
+			command->rgb_sp = default_colors->rgb_sp;
+		}
+	}
+	void HlAttrDefine(const RedrawHlAttrDefine *hl_attr_define) {
+		if (!FitsInt32(hl_attr_define->id)) {
+			return;
+		}
+		RedrawCommandHlAttrDefine *command = Begin<RedrawCommandHlAttrDefine>(RedrawEvent::hl_attr_define);
+		if (command) {
+			command->id = static_cast<int32_t>(hl_attr_define->id);
+			command->flags_mask = hl_attr_define->flags_mask;
+			command->attributes = hl_attr_define->attributes;
+		}
+	}
+	void GridLine(RedrawGridLine *grid_line) {
+		if (!FitsInt32(grid_line->grid) || grid_line->row < 0 || grid_line->row > INT32_MAX ||
+			grid_line->col_start < 0 || grid_line->col_start > INT32_MAX) {
+			return;
+		}
+
+		// The cell count is only known once repeats are expanded, so the
+		// chars are written in place and the highlight ids appended after
+		size_t command_offset = size;
+		uint32_t command_count_before = command_count;
+		if (!Begin<RedrawCommandGridLine>(RedrawEvent::grid_line)) {
+			return;
+		}
+		size = command_offset + sizeof(RedrawCommandGridLine);
+
+		uint32_t cell_count = 0;
+		RedrawCell cell;
+		for (;;) {
+			// Most cells are a lone ASCII character, runs of them are decoded in bulk
+			uint32_t run_limit = RedrawAsciiCellLimit(&grid_line->cells);
+			if (run_limit > MAX_REDRAW_LINE_CELLS - cell_count) {
+				run_limit = MAX_REDRAW_LINE_CELLS - cell_count;
+			}
+			if (run_limit > 0) {
+				if (!Reserve(run_limit * sizeof(uint32_t)) || !ReserveHlIds(cell_count + run_limit)) {
+					break;
+				}
+				uint32_t *chars = reinterpret_cast<uint32_t *>(data + size);
+				uint32_t run_length = RedrawNextAsciiCells(&grid_line->cells, chars, run_limit);
+				TranscodeFill16(hl_ids + cell_count, static_cast<uint16_t>(grid_line->cells.hl_id), run_length);
+				size += run_length * sizeof(uint32_t);
+				cell_count += run_length;
+			}
+
+			if (!RedrawNextCell(&grid_line->cells, &cell)) {
+				break;
+			}
+			if (cell.repeat < 0) {
+				break;
+			}
+			uint32_t repeat = cell.text_length == 0 ? 1 :
+				static_cast<uint32_t>(cell.repeat < MAX_REDRAW_LINE_CELLS ? cell.repeat : MAX_REDRAW_LINE_CELLS);
+			if (repeat > MAX_REDRAW_LINE_CELLS - cell_count) {
+				repeat = MAX_REDRAW_LINE_CELLS - cell_count;
+			}
+			if (!Reserve(repeat * sizeof(uint32_t)) || !ReserveHlIds(cell_count + repeat)) {
+				break;
+			}
+
+			uint32_t cell_char = RedrawEncodeCellText(cell.text, cell.text_length);
+			uint16_t hl_id = static_cast<uint16_t>(cell.hl_id);
+			uint32_t *chars = reinterpret_cast<uint32_t *>(data + size);
+			if (repeat == 1) {
+				chars[0] = cell_char;
+				hl_ids[cell_count] = hl_id;
+			}
+			else {
+				TranscodeFill32(chars, cell_char, repeat);
+				TranscodeFill16(hl_ids + cell_count, hl_id, repeat);
+			}
+			size += repeat * sizeof(uint32_t);
+			cell_count += repeat;
+		}
+
+		size_t trailing_size = static_cast<size_t>(cell_count) * (sizeof(uint32_t) + sizeof(uint16_t));
+		size_t command_size = AlignCommandSize(sizeof(RedrawCommandGridLine) + trailing_size);
+		if (!MPackCursorOk(grid_line->cells.cursor) || !Reserve(command_size - (size - command_offset))) {
+			// Drop the line, nothing after a malformed cell is drawn
+			size = command_offset;
+			command_count = command_count_before;
+			return;
+		}
+		if (cell_count > 0) {
+			memcpy(data + size, hl_ids, cell_count * sizeof(uint16_t));
+		}
+		memset(data + size + cell_count * sizeof(uint16_t), 0,
+			command_offset + command_size - size - cell_count * sizeof(uint16_t));
+		size = command_offset + command_size;
+
+		RedrawCommandGridLine *command = reinterpret_cast<RedrawCommandGridLine *>(data + command_offset);
+		command->command.size = static_cast<uint32_t>(command_size);
+		command->grid = static_cast<int32_t>(grid_line->grid);
+		command->row = static_cast<int32_t>(grid_line->row);
+		command->col_start = static_cast<int32_t>(grid_line->col_start);
+		command->cell_count = cell_count;
+	}
+	bool ReserveHlIds(uint32_t count) {
+		if (count <= hl_ids_capacity) {
+			return true;
+		}
+		uint32_t new_capacity = hl_ids_capacity ? hl_ids_capacity : 512;
+		while (new_capacity < count) {
+			new_capacity *= 2;
+		}
+		uint16_t *new_hl_ids = static_cast<uint16_t *>(realloc(hl_ids, new_capacity * sizeof(uint16_t)));
+		if (!new_hl_ids) {
+			failed = true;
+			return false;
+		}
+		hl_ids = new_hl_ids;
+		hl_ids_capacity = new_capacity;
+		return true;
+	}
+	void GridCursorGoto(const RedrawGridCursorGoto *cursor_goto) {
+		if (!FitsInt32(cursor_goto->grid) || !FitsInt32(cursor_goto->row) || !FitsInt32(cursor_goto->col)) {
+			return;
+		}
+		RedrawCommandGridCursorGoto *command = Begin<RedrawCommandGridCursorGoto>(RedrawEvent::grid_cursor_goto);
+		if (command) {
+			command->grid = static_cast<int32_t>(cursor_goto->grid);
+			command->row = static_cast<int32_t>(cursor_goto->row);
+			command->col = static_cast<int32_t>(cursor_goto->col);
+		}
+	}
+	void ModeInfoSet(RedrawModeInfoSet *mode_info_set) {
+		size_t command_offset = size;
+		uint32_t command_count_before = command_count;
+		// Each mode info takes at least one byte of msgpack, which bounds the count
+		const MPackCursor *cursor = mode_info_set->mode_infos.cursor;
+		if (mode_info_set->mode_info_count > static_cast<size_t>(cursor->end - cursor->pos)) {
+			return;
+		}
+		size_t trailing_size = static_cast<size_t>(mode_info_set->mode_info_count) * sizeof(RedrawCommandModeInfo);
+		RedrawCommandModeInfoSet *command = Begin<RedrawCommandModeInfoSet>(RedrawEvent::mode_info_set, trailing_size);
+		if (!command) {
+			return;
+		}
+		command->cursor_style_enabled = mode_info_set->cursor_style_enabled;
+		command->mode_info_count = mode_info_set->mode_info_count;
+
+		RedrawCommandModeInfo *mode_infos = reinterpret_cast<RedrawCommandModeInfo *>(command + 1);
+		RedrawModeInfo mode_info;
+		uint32_t count = 0;
+		while (RedrawNextModeInfo(&mode_info_set->mode_infos, &mode_info)) {
+			RedrawCommandModeInfo *out = &mode_infos[count++];
+			out->shape = CursorShape::None;
+			if (MPackStrEquals(mode_info.cursor_shape, mode_info.cursor_shape_length, "block")) {
+				out->shape = CursorShape::Block;
+			}
+			else if (MPackStrEquals(mode_info.cursor_shape, mode_info.cursor_shape_length, "vertical")) {
+				out->shape = CursorShape::Vertical;
+			}
+			else if (MPackStrEquals(mode_info.cursor_shape, mode_info.cursor_shape_length, "horizontal")) {
+				out->shape = CursorShape::Horizontal;
+			}
+			out->has_attr_id = mode_info.has_attr_id;
+			out->attr_id = static_cast<uint16_t>(mode_info.attr_id);
+			out->cell_percentage = static_cast<int32_t>(mode_info.cell_percentage);
+			out->blinkwait = static_cast<int32_t>(mode_info.blinkwait);
+			out->blinkon = static_cast<int32_t>(mode_info.blinkon);
+			out->blinkoff = static_cast<int32_t>(mode_info.blinkoff);
+		}
+		if (!MPackCursorOk(mode_info_set->mode_infos.cursor) || count != mode_info_set->mode_info_count) {
+			size = command_offset;
+			command_count = command_count_before;
+		}
+	}
+	void ModeChange(const RedrawModeChange *mode_change) {
+		RedrawCommandModeChange *command = Begin<RedrawCommandModeChange>(RedrawEvent::mode_change);
+		if (command) {
+			command->mode_index = FitsInt32(mode_change->mode_index) ? static_cast<int32_t>(mode_change->mode_index) : -1;
+		}
+	}
+	void SetTitle(const RedrawSetTitle *set_title) {
+		RedrawCommandSetTitle *command = Begin<RedrawCommandSetTitle>(RedrawEvent::set_title, set_title->title_length);
+		if (command) {
+			command->title_length = set_title->title_length;
+			memcpy(command + 1, set_title->title, set_title->title_length);
+		}
+	}
+	void BusyStart() {
+		Bare(RedrawEvent::busy_start);
+	}
+	void BusyStop() {
+		Bare(RedrawEvent::busy_stop);
+	}
+	void GridScroll(const RedrawGridScroll *grid_scroll) {
+		if (!FitsInt32(grid_scroll->grid) || !FitsInt32(grid_scroll->top) || !FitsInt32(grid_scroll->bottom) ||
+			!FitsInt32(grid_scroll->left) || !FitsInt32(grid_scroll->right) ||
+			!FitsInt32(grid_scroll->rows) || !FitsInt32(grid_scroll->cols)) {
+			return;
+		}
+		RedrawCommandGridScroll *command = Begin<RedrawCommandGridScroll>(RedrawEvent::grid_scroll);
+		if (command) {
+			command->grid = static_cast<int32_t>(grid_scroll->grid);
+			command->top = static_cast<int32_t>(grid_scroll->top);
+			command->bottom = static_cast<int32_t>(grid_scroll->bottom);
+			command->left = static_cast<int32_t>(grid_scroll->left);
+			command->right = static_cast<int32_t>(grid_scroll->right);
+			command->rows = static_cast<int32_t>(grid_scroll->rows);
+			command->cols = static_cast<int32_t>(grid_scroll->cols);
+		}
+	}
+	void Flush() {
+		Bare(RedrawEvent::flush);
+	}
+};
+
+// Times every event on its way through a CommandWriter. The time of an
+// event covers decoding it and writing its command, skipped events count
+// towards the event after them.
+struct ProfilingWriter {
+	CommandWriter *writer;
+	RedrawTranslateProfile *profile;
+	uint64_t last_ns;
+
+	void Tick(RedrawEvent event) {
+		uint64_t now = ClockNowNs();
+		profile->ns[static_cast<uint32_t>(event)] += now - last_ns;
+		++profile->count[static_cast<uint32_t>(event)];
+		last_ns = now;
+	}
+
+	void OptionSet(const RedrawOptionSet *option_set) {
+		writer->OptionSet(option_set);
+		Tick(RedrawEvent::option_set);
+	}
+	void GridResize(const RedrawGridResize *grid_resize) {
+		writer->GridResize(grid_resize);
+		Tick(RedrawEvent::grid_resize);
+	}
+	void GridClear(const RedrawGridClear *grid_clear) {
+		writer->GridClear(grid_clear);
+		Tick(RedrawEvent::grid_clear);
+	}
+	void DefaultColorsSet(const RedrawDefaultColorsSet *default_colors) {
+		writer->DefaultColorsSet(default_colors);
+		Tick(RedrawEvent::default_colors_set);
+	}
+	void HlAttrDefine(const RedrawHlAttrDefine *hl_attr_define) {
+		writer->HlAttrDefine(hl_attr_define);
+		Tick(RedrawEvent::hl_attr_define);
+	}
+	void GridLine(RedrawGridLine *grid_line) {
+		writer->GridLine(grid_line);
+		Tick(RedrawEvent::grid_line);
+	}
+	void GridCursorGoto(const RedrawGridCursorGoto *cursor_goto) {
+		writer->GridCursorGoto(cursor_goto);
+		Tick(RedrawEvent::grid_cursor_goto);
+	}
+	void ModeInfoSet(RedrawModeInfoSet *mode_info_set) {
+		writer->ModeInfoSet(mode_info_set);
+		Tick(RedrawEvent::mode_info_set);
+	}
+	void ModeChange(const RedrawModeChange *mode_change) {
+		writer->ModeChange(mode_change);
+		Tick(RedrawEvent::mode_change);
+	}
+	void SetTitle(const RedrawSetTitle *set_title) {
+		writer->SetTitle(set_title);
+		Tick(RedrawEvent::set_title);
+	}
+	void BusyStart() {
+		writer->BusyStart();
+		Tick(RedrawEvent::busy_start);
+	}
+	void BusyStop() {
+		writer->BusyStop();
+		Tick(RedrawEvent::busy_stop);
+	}
+	void GridScroll(const RedrawGridScroll *grid_scroll) {
+		writer->GridScroll(grid_scroll);
+		Tick(RedrawEvent::grid_scroll);
+	}
+	void Flush() {
+		writer->Flush();
+		Tick(RedrawEvent::flush);
+	}
+};
+
+char *RedrawTranslate(const char *data, size_t size, size_t *commands_size, RedrawTranslateProfile *profile) {
+	MPackCursor cursor = MPackCursorInit(data, size);
+	if (MPackCursorArray(&cursor) != 3 || MPackCursorInt(&cursor) != 2) {
+		return nullptr;
+	}
+	uint32_t name_length;
+	const char *name = MPackCursorStr(&cursor, &name_length);
+	if (!MPackCursorOk(&cursor) || !MPackStrEquals(name, name_length, "redraw")) {
+		return nullptr;
+	}
+
+	// Expanded cells take about twice the space of their msgpack
+	CommandWriter writer {};
+	writer.capacity = AlignCommandSize(sizeof(RedrawCommandHeader) + size * 2);
+	writer.data = static_cast<char *>(malloc(writer.capacity));
+	if (!writer.data) {
+		return nullptr;
+	}
+	writer.size = sizeof(RedrawCommandHeader);
+
+	if (profile) {
+		ProfilingWriter profiling_writer { &writer, profile, ClockNowNs() };
+		RedrawDispatch(&cursor, &profiling_writer);
+	}
+	else {
+		RedrawDispatch(&cursor, &writer);
+	}
+	free(writer.hl_ids);
+	if (writer.failed || writer.size > UINT32_MAX) {
+		free(writer.data);
+		return nullptr;
+	}
+
+	*reinterpret_cast<RedrawCommandHeader *>(writer.data) = RedrawCommandHeader {
+		.magic = REDRAW_COMMAND_MAGIC,
+		.version = REDRAW_COMMAND_VERSION,
+		.reserved = 0,
+		.size = static_cast<uint32_t>(writer.size),
+		.command_count = writer.command_count
+	};
+	*commands_size = writer.size;
+	return writer.data;
+}
+
+bool RedrawCommandsBegin(RedrawCommandReader *reader, const char *data, size_t size) {
+	if (size < sizeof(RedrawCommandHeader)) {
+		return false;
+	}
+	RedrawCommandHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != REDRAW_COMMAND_MAGIC || header.version != REDRAW_COMMAND_VERSION ||
+		header.size < sizeof(RedrawCommandHeader) || header.size > size) {
+		return false;
+	}
+
+	reader->data = data;
+	reader->size = header.size;
+	reader->offset = sizeof(RedrawCommandHeader);
+	return true;
+}
+
+static size_t MinCommandSize(RedrawEvent event) {
+	switch (event) {
+	case RedrawEvent::option_set: return sizeof(RedrawCommandOptionSet);
+	case RedrawEvent::grid_resize: return sizeof(RedrawCommandGridResize);
+	case RedrawEvent::grid_clear: return sizeof(RedrawCommandGridClear);
+	case RedrawEvent::default_colors_set: return sizeof(RedrawCommandDefaultColorsSet);
+	case RedrawEvent::hl_attr_define: return sizeof(RedrawCommandHlAttrDefine);
+	case RedrawEvent::grid_line: return sizeof(RedrawCommandGridLine);
+	case RedrawEvent::grid_cursor_goto: return sizeof(RedrawCommandGridCursorGoto);
+	case RedrawEvent::mode_info_set: return sizeof(RedrawCommandModeInfoSet);
+	case RedrawEvent::mode_change: return sizeof(RedrawCommandModeChange);
+	case RedrawEvent::set_title: return sizeof(RedrawCommandSetTitle);
+	case RedrawEvent::busy_start:
+	case RedrawEvent::busy_stop:
+	case RedrawEvent::flush: return sizeof(RedrawCommand);
+	case RedrawEvent::grid_scroll: return sizeof(RedrawCommandGridScroll);
+	case RedrawEvent::unknown: break;
+	}
+	return 0;
+}
+
+// Size of the data following the command struct
+static uint64_t TrailingSize(const RedrawCommand *command) {
+	switch (command->event) {
+	case RedrawEvent::option_set: {
+		const RedrawCommandOptionSet *option_set = reinterpret_cast<const RedrawCommandOptionSet *>(command);
+		return static_cast<uint64_t>(option_set->name_length) + option_set->value_str_length;
+	}
+	case RedrawEvent::grid_line: {
+		const RedrawCommandGridLine *grid_line = reinterpret_cast<const RedrawCommandGridLine *>(command);
+		return static_cast<uint64_t>(grid_line->cell_count) * (sizeof(uint32_t) + sizeof(uint16_t));
+	}
+	case RedrawEvent::mode_info_set: {
+		const RedrawCommandModeInfoSet *mode_info_set = reinterpret_cast<const RedrawCommandModeInfoSet *>(command);
+		return static_cast<uint64_t>(mode_info_set->mode_info_count) * sizeof(RedrawCommandModeInfo);
+	}
+	case RedrawEvent::set_title: {
+		const RedrawCommandSetTitle *set_title = reinterpret_cast<const RedrawCommandSetTitle *>(command);
+		return set_title->title_length;
+	}
+	default: {
+	} break;
+	}
+	return 0;
+}
+
+const RedrawCommand *RedrawNextCommand(RedrawCommandReader *reader) {
+	size_t remaining = reader->size - reader->offset;
+	if (remaining < sizeof(RedrawCommand)) {
+		return nullptr;
+	}
+
+	const RedrawCommand *command = reinterpret_cast<const RedrawCommand *>(reader->data + reader->offset);
+	size_t min_size = MinCommandSize(command->event);
+	if (min_size == 0 || command->size < min_size || command->size > remaining ||
+		command->size % REDRAW_COMMAND_ALIGNMENT != 0 ||
+		min_size + TrailingSize(command) > command->size) {
+		return nullptr;
+	}
+
+	reader->offset += command->size;
+	return command;
+}
@@ -0,0 +1,189 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "nvim/redraw_events.h"
+#include "renderer/cursor.h"
+#include "renderer/highlight.h"
+
+// Redraw notifications translated into a flat binary command buffer. The
+// reader thread does the translation and applies the commands to its
+// snapshot model, the window and render threads never touch msgpack or
+// UTF-8.
+//
+// Buffer layout, in native byte order:
+//
+//   RedrawCommandHeader    magic "NVRC", format version, size of the whole
+//                          buffer in bytes and the number of commands
+//   commands               back to back, each starting with a RedrawCommand
+//                          that holds its RedrawEvent and its size in bytes.
+//                          Sizes are multiples of REDRAW_COMMAND_ALIGNMENT.
+//
+// Every command is one of the RedrawCommand* structs below. Variable length
+// data directly follows the struct:
+//
+//   option_set       name, then value_str (not null-terminated)
+//   grid_line        uint32_t chars[cell_count], uint16_t hl_ids[cell_count]
+//   mode_info_set    RedrawCommandModeInfo mode_infos[mode_info_count]
+//   set_title        title (not null-terminated)
+//
+// busy_start, busy_stop and flush are a bare RedrawCommand. Cells hold the
+// text as drawn: a UTF-16 code unit, a surrogate pair packed as
+// (high << 16) | low, or REDRAW_CELL_RIGHT_HALF for the empty cell nvim
+// sends after a wide character. Repeated cells are expanded.
+//
+// Recorded buffers carry the version, bump it whenever a struct, the
+// RedrawEvent values or the cell encoding change.
+constexpr uint32_t REDRAW_COMMAND_MAGIC = 0x4352564E; // "NVRC"
+constexpr uint16_t REDRAW_COMMAND_VERSION = 1;
+constexpr size_t REDRAW_COMMAND_ALIGNMENT = 8;
+constexpr uint32_t REDRAW_CELL_RIGHT_HALF = 0xFFFFFFFF;
+// Drawn for text that doesn't fit a single cell, e.g. combining characters
+constexpr uint32_t REDRAW_CELL_REPLACEMENT = 0x25A1;
+// Cells past this in a single grid_line are dropped
+constexpr uint32_t MAX_REDRAW_LINE_CELLS = 1 << 16;
+
+struct RedrawCommandHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t size;
+	uint32_t command_count;
+};
+
+struct RedrawCommand {
+	RedrawEvent event;
+	uint8_t reserved[3];
+	uint32_t size;
+};
+
+struct RedrawCommandOptionSet {
+	RedrawCommand command;
+	uint32_t name_length;
+	uint32_t value_str_length;
+	int64_t value_int;
+	bool value_is_str;
+};
+
+struct RedrawCommandGridResize {
+	RedrawCommand command;
+	int32_t grid;
+	int32_t width;
+	int32_t height;
+};
+
+struct RedrawCommandGridClear {
+	RedrawCommand command;
+	int32_t grid;
+};
+
+struct RedrawCommandDefaultColorsSet {
+	RedrawCommand command;
+	uint32_t rgb_fg;
+	uint32_t rgb_bg;
+	uint32_t rgb_sp;
+};
+
+struct RedrawCommandHlAttrDefine {
+	RedrawCommand command;
+	int32_t id;
+	uint16_t flags_mask;
+	HighlightAttributes attributes;
+};
+
+struct RedrawCommandGridLine {
+	RedrawCommand command;
+	int32_t grid;
+	int32_t row;
+	int32_t col_start;
+	uint32_t cell_count;
+};
+
+struct RedrawCommandGridCursorGoto {
+	RedrawCommand command;
+	int32_t grid;
+	int32_t row;
+	int32_t col;
+};
+
+struct RedrawCommandModeInfo {
+	CursorShape shape;
+	bool has_attr_id;
+	uint16_t attr_id;
+	int32_t cell_percentage;
+	int32_t blinkwait;
+	int32_t blinkon;
+	int32_t blinkoff;
+};
+struct RedrawCommandModeInfoSet {
+	RedrawCommand command;
+	bool cursor_style_enabled;
+	uint32_t mode_info_count;
+};
+
+struct RedrawCommandModeChange {
+	RedrawCommand command;
+	int32_t mode_index;
+};
+
+struct RedrawCommandSetTitle {
+	RedrawCommand command;
+	uint32_t title_length;
+};
+
+struct RedrawCommandGridScroll {
+	RedrawCommand command;
+	int32_t grid;
+	int32_t top;
+	int32_t bottom;
+	int32_t left;
+	int32_t right;
+	int32_t rows;
+	int32_t cols;
+};
+
+inline const char *RedrawOptionSetName(const RedrawCommandOptionSet *option_set) {
+	return reinterpret_cast<const char *>(option_set + 1);
+}
+inline const char *RedrawOptionSetValueStr(const RedrawCommandOptionSet *option_set) {
+	return RedrawOptionSetName(option_set) + option_set->name_length;
+}
+inline const uint32_t *RedrawGridLineChars(const RedrawCommandGridLine *grid_line) {
+	return reinterpret_cast<const uint32_t *>(grid_line + 1);
+}
+inline const uint16_t *RedrawGridLineHlIds(const RedrawCommandGridLine *grid_line) {
+	return reinterpret_cast<const uint16_t *>(RedrawGridLineChars(grid_line) + grid_line->cell_count);
+}
+inline const RedrawCommandModeInfo *RedrawModeInfos(const RedrawCommandModeInfoSet *mode_info_set) {
+	return reinterpret_cast<const RedrawCommandModeInfo *>(mode_info_set + 1);
+}
+inline const char *RedrawSetTitleText(const RedrawCommandSetTitle *set_title) {
+	return reinterpret_cast<const char *>(set_title + 1);
+}
+
+// Converts the UTF-8 text of a cell to its REDRAW_CELL encoding
+uint32_t RedrawEncodeCellText(const char *text, uint32_t length);
+
+// Time spent translating each kind of event, accumulated over calls
+struct RedrawTranslateProfile {
+	uint64_t ns[REDRAW_EVENT_COUNT];
+	uint64_t count[REDRAW_EVENT_COUNT];
+};
+
+// Translates a whole msgpack message. Returns a command buffer allocated
+// with malloc if the message is a redraw notification, nullptr otherwise.
+// Events up to the first malformed one are kept. Passing a profile times
+// every event, which is meant for replays rather than live sessions.
+char *RedrawTranslate(const char *data, size_t size, size_t *commands_size,
+	RedrawTranslateProfile *profile = nullptr);
+
+// Walks a command buffer. Every command returned has been checked to hold
+// its struct and trailing data, so recorded buffers can be replayed safely.
+struct RedrawCommandReader {
+	const char *data;
+	size_t size;
+	size_t offset;
+};
+// Returns false if the buffer is truncated or of another format version
+bool RedrawCommandsBegin(RedrawCommandReader *reader, const char *data, size_t size);
+// Returns nullptr at the end of the buffer or on the first malformed command
+const RedrawCommand *RedrawNextCommand(RedrawCommandReader *reader);
@@ -0,0 +1,117 @@
+#include "redraw_events.h"
+
+void RedrawDecodeOptionSet(MPackCursor *cursor, RedrawOptionSet *option_set) {
+	option_set->name = MPackCursorStr(cursor, &option_set->name_length);
+	option_set->value_is_str = MPackCursorIsStr(cursor);
+	option_set->value_str = "";
+	option_set->value_str_length = 0;
+	option_set->value_int = 0;
+
+	uint8_t tag = MPackCursorPeekTag(cursor);
+	if (option_set->value_is_str) {
+		option_set->value_str = MPackCursorStr(cursor, &option_set->value_str_length);
+	}
+	else if (tag == 0xC2 || tag == 0xC3) {
+		option_set->value_int = MPackCursorBool(cursor) ? 1 : 0;
+	}
+	else if (tag <= 0x7F || tag >= 0xE0 || (tag >= 0xCC && tag <= 0xD3)) {
+		option_set->value_int = MPackCursorInt(cursor);
+	}
+	else {
+		MPackCursorSkip(cursor);
+	}
+}
+
+void RedrawDecodeHlAttrDefine(MPackCursor *cursor, RedrawHlAttrDefine *hl_attr_define) {
+	hl_attr_define->id = MPackCursorInt(cursor);
+	hl_attr_define->attributes = HighlightAttributes {
+		.foreground = DEFAULT_COLOR,
+		.background = DEFAULT_COLOR,
+		.special = DEFAULT_COLOR,
+		.flags = 0
+	};
+	hl_attr_define->flags_mask = 0;
+
+	HighlightAttributes *attributes = &hl_attr_define->attributes;
+	uint32_t attrib_map_length = MPackCursorMap(cursor);
+	for (uint32_t i = 0; i < attrib_map_length; ++i) {
+		uint32_t key_length;
+		const char *key = MPackCursorStr(cursor, &key_length);
+
+		const auto SetFlag = [&](HighlightAttributeFlags flag) {
+			hl_attr_define->flags_mask |= flag;
+			if (MPackCursorBool(cursor)) {
+				attributes->flags |= flag;
+			}
+		};
+		if (MPackStrEquals(key, key_length, "foreground")) {
+			attributes->foreground = static_cast<uint32_t>(MPackCursorInt(cursor));
+		}
+		else if (MPackStrEquals(key, key_length, "background")) {
+			attributes->background = static_cast<uint32_t>(MPackCursorInt(cursor));
+		}
+		else if (MPackStrEquals(key, key_length, "special")) {
+			attributes->special = static_cast<uint32_t>(MPackCursorInt(cursor));
+		}
+		else if (MPackStrEquals(key, key_length, "reverse")) {
+			SetFlag(HL_ATTRIB_REVERSE);
+		}
+		else if (MPackStrEquals(key, key_length, "italic")) {
+			SetFlag(HL_ATTRIB_ITALIC);
+		}
+		else if (MPackStrEquals(key, key_length, "bold")) {
+			SetFlag(HL_ATTRIB_BOLD);
+		}
+		else if (MPackStrEquals(key, key_length, "strikethrough")) {
+			SetFlag(HL_ATTRIB_STRIKETHROUGH);
+		}
+		else if (MPackStrEquals(key, key_length, "underline")) {
+			SetFlag(HL_ATTRIB_UNDERLINE);
+		}
+		else if (MPackStrEquals(key, key_length, "undercurl")) {
+			SetFlag(HL_ATTRIB_UNDERCURL);
+		}
+		else {
+			MPackCursorSkip(cursor);
+		}
+	}
+}
+
+bool RedrawNextModeInfo(RedrawModeInfoReader *reader, RedrawModeInfo *mode_info) {
+	if (reader->remaining == 0 || !MPackCursorOk(reader->cursor)) {
+		return false;
+	}
+	--reader->remaining;
+
+	*mode_info = RedrawModeInfo {};
+	mode_info->cursor_shape = "";
+	MPackCursor *cursor = reader->cursor;
+	uint32_t mode_info_map_length = MPackCursorMap(cursor);
+	for (uint32_t i = 0; i < mode_info_map_length; ++i) {
+		uint32_t key_length;
+		const char *key = MPackCursorStr(cursor, &key_length);
+		if (MPackStrEquals(key, key_length, "cursor_shape")) {
+			mode_info->cursor_shape = MPackCursorStr(cursor, &mode_info->cursor_shape_length);
+		}
+		else if (MPackStrEquals(key, key_length, "attr_id")) {
+			mode_info->has_attr_id = true;
+			mode_info->attr_id = MPackCursorInt(cursor);
+		}
+		else if (MPackStrEquals(key, key_length, "cell_percentage")) {
+			mode_info->cell_percentage = MPackCursorInt(cursor);
+		}
+		else if (MPackStrEquals(key, key_length, "blinkwait")) {
+			mode_info->blinkwait = MPackCursorInt(cursor);
+		}
+		else if (MPackStrEquals(key, key_length, "blinkon")) {
+			mode_info->blinkon = MPackCursorInt(cursor);
+		}
+		else if (MPackStrEquals(key, key_length, "blinkoff")) {
+			mode_info->blinkoff = MPackCursorInt(cursor);
+		}
+		else {
+			MPackCursorSkip(cursor);
+		}
+	}
+	return MPackCursorOk(cursor);
+}
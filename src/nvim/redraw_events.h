@@ -0,0 +1,444 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include "common/mpack_cursor.h"
+#include "common/transcode.h"
+#include "renderer/highlight.h"
+
+// The redraw events Nvy handles. Event names are resolved through a
+// perfect hash built at compile time, so dispatching an event costs one
+// table lookup and a single exact compare instead of a chain of compares.
+enum class RedrawEvent : uint8_t {
+	option_set,
+	grid_resize,
+	grid_clear,
+	default_colors_set,
+	hl_attr_define,
+	grid_line,
+	grid_cursor_goto,
+	mode_info_set,
+	mode_change,
+	set_title,
+	busy_start,
+	busy_stop,
+	grid_scroll,
+	flush,
+	unknown
+};
+constexpr const char *REDRAW_EVENT_NAMES[] {
+	"option_set",
+	"grid_resize",
+	"grid_clear",
+	"default_colors_set",
+	"hl_attr_define",
+	"grid_line",
+	"grid_cursor_goto",
+	"mode_info_set",
+	"mode_change",
+	"set_title",
+	"busy_start",
+	"busy_stop",
+	"grid_scroll",
+	"flush"
+};
+constexpr uint32_t REDRAW_EVENT_COUNT = static_cast<uint32_t>(RedrawEvent::unknown);
+static_assert(sizeof(REDRAW_EVENT_NAMES) / sizeof(REDRAW_EVENT_NAMES[0]) == REDRAW_EVENT_COUNT);
+
+constexpr uint32_t RedrawEventNameLength(const char *name) {
+	uint32_t length = 0;
+	while (name[length]) {
+		++length;
+	}
+	return length;
+}
+
+// Mixes the length with the first and second to last bytes. When adding
+// an event, change the multiplier if the static_assert below fires.
+constexpr uint32_t REDRAW_EVENT_HASH_SIZE = 32;
+constexpr uint32_t RedrawEventHash(const char *name, uint32_t length) {
+	return (length + static_cast<uint8_t>(name[0]) + static_cast<uint8_t>(name[length - 2]) * 10) &
+		(REDRAW_EVENT_HASH_SIZE - 1);
+}
+
+struct RedrawEventTable {
+	RedrawEvent slots[REDRAW_EVENT_HASH_SIZE];
+	uint32_t name_lengths[REDRAW_EVENT_COUNT];
+	bool has_collision;
+};
+constexpr RedrawEventTable RedrawBuildEventTable() {
+	RedrawEventTable table {};
+	for (uint32_t i = 0; i < REDRAW_EVENT_HASH_SIZE; ++i) {
+		table.slots[i] = RedrawEvent::unknown;
+	}
+	for (uint32_t i = 0; i < REDRAW_EVENT_COUNT; ++i) {
+		uint32_t length = RedrawEventNameLength(REDRAW_EVENT_NAMES[i]);
+		uint32_t slot = RedrawEventHash(REDRAW_EVENT_NAMES[i], length);
+		if (table.slots[slot] != RedrawEvent::unknown) {
+			table.has_collision = true;
+		}
+		table.slots[slot] = static_cast<RedrawEvent>(i);
+		table.name_lengths[i] = length;
+	}
+	return table;
+}
+constexpr RedrawEventTable REDRAW_EVENT_TABLE = RedrawBuildEventTable();
+static_assert(!REDRAW_EVENT_TABLE.has_collision, "Redraw event names collide, adjust RedrawEventHash");
+
+// Exact match, names that only share a prefix with an event are unknown
+inline RedrawEvent RedrawEventFromName(const char *name, uint32_t length) {
+	if (length < 2) {
+		return RedrawEvent::unknown;
+	}
+	RedrawEvent event = REDRAW_EVENT_TABLE.slots[RedrawEventHash(name, length)];
+	if (event == RedrawEvent::unknown) {
+		return RedrawEvent::unknown;
+	}
+	uint32_t index = static_cast<uint32_t>(event);
+	if (REDRAW_EVENT_TABLE.name_lengths[index] != length || memcmp(name, REDRAW_EVENT_NAMES[index], length) != 0) {
+		return RedrawEvent::unknown;
+	}
+	return event;
+}
+
+// Decoded parameter tuples, one per batched call of an event. Strings
+// point into the message being decoded and are not null-terminated.
+struct RedrawOptionSet {
+	const char *name;
+	uint32_t name_length;
+	// Options are strings, integers or booleans
+	bool value_is_str;
+	const char *value_str;
+	uint32_t value_str_length;
+	int64_t value_int;
+};
+
+struct RedrawGridResize {
+	int64_t grid;
+	int64_t width;
+	int64_t height;
+};
+
+struct RedrawGridClear {
+	int64_t grid;
+};
+
+struct RedrawDefaultColorsSet {
+	uint32_t rgb_fg;
+	uint32_t rgb_bg;
+	uint32_t rgb_sp;
+};
+
+struct RedrawHlAttrDefine {
+	int64_t id;
+	// Colors missing from the map are DEFAULT_COLOR
+	HighlightAttributes attributes;
+	// The HighlightAttributeFlags present in the map, flags
+	// outside of this mask were not sent
+	uint16_t flags_mask;
+};
+
+// Walks the cells of a grid_line one at a time. The highlight id of
+// a cell carries over to following cells that don't specify one.
+struct RedrawCellReader {
+	MPackCursor *cursor;
+	uint32_t remaining;
+	int64_t hl_id;
+};
+struct RedrawCell {
+	const char *text;
+	uint32_t text_length;
+	int64_t hl_id;
+	int64_t repeat;
+};
+
+struct RedrawGridLine {
+	int64_t grid;
+	int64_t row;
+	int64_t col_start;
+	RedrawCellReader cells;
+};
+
+struct RedrawGridCursorGoto {
+	int64_t grid;
+	int64_t row;
+	int64_t col;
+};
+
+// Mode infos are maps of optional keys, fields missing
+// from the map are left zero and their has_ flag unset
+struct RedrawModeInfo {
+	const char *cursor_shape;
+	uint32_t cursor_shape_length;
+	bool has_attr_id;
+	int64_t attr_id;
+	int64_t cell_percentage;
+	int64_t blinkwait;
+	int64_t blinkon;
+	int64_t blinkoff;
+};
+struct RedrawModeInfoReader {
+	MPackCursor *cursor;
+	uint32_t remaining;
+};
+
+struct RedrawModeInfoSet {
+	bool cursor_style_enabled;
+	uint32_t mode_info_count;
+	RedrawModeInfoReader mode_infos;
+};
+
+struct RedrawModeChange {
+	const char *mode;
+	uint32_t mode_length;
+	int64_t mode_index;
+};
+
+struct RedrawSetTitle {
+	const char *title;
+	uint32_t title_length;
+};
+
+struct RedrawGridScroll {
+	int64_t grid;
+	int64_t top;
+	int64_t bottom;
+	int64_t left;
+	int64_t right;
+	int64_t rows;
+	int64_t cols;
+};
+
+inline bool RedrawNextCell(RedrawCellReader *reader, RedrawCell *cell) {
+	if (reader->remaining == 0 || !MPackCursorOk(reader->cursor)) {
+		return false;
+	}
+	--reader->remaining;
+
+	uint32_t cell_length = MPackCursorArray(reader->cursor);
+	cell->text = MPackCursorStr(reader->cursor, &cell->text_length);
+	if (cell_length > 1) {
+		reader->hl_id = MPackCursorInt(reader->cursor);
+	}
+	cell->hl_id = reader->hl_id;
+	cell->repeat = cell_length > 2 ? MPackCursorInt(reader->cursor) : 1;
+	MPackCursorSkipN(reader->cursor, cell_length > 3 ? cell_length - 3 : 0);
+	return MPackCursorOk(reader->cursor);
+}
+
+// Upper bound on the cells RedrawNextAsciiCells can decode, 0 unless the
+// next cell starts like a single character cell
+inline uint32_t RedrawAsciiCellLimit(const RedrawCellReader *reader) {
+	if (reader->remaining == 0 || MPackCursorPeekTag(reader->cursor) != 0x91) {
+		return 0;
+	}
+	size_t available = static_cast<size_t>(reader->cursor->end - reader->cursor->pos) / 3;
+	return available < reader->remaining ? static_cast<uint32_t>(available) : reader->remaining;
+}
+
+// Decodes the run of single ASCII character cells, `[c]`, at the reader,
+// up to max_cells. They carry the highlight id of the cell before them.
+// Returns the number of cells written to chars.
+inline uint32_t RedrawNextAsciiCells(RedrawCellReader *reader, uint32_t *chars, uint32_t max_cells) {
+	MPackCursor *cursor = reader->cursor;
+	if (max_cells > reader->remaining) {
+		max_cells = reader->remaining;
+	}
+	uint32_t cell_count = static_cast<uint32_t>(TranscodeAsciiCells(cursor->pos,
+		static_cast<size_t>(cursor->end - cursor->pos), chars, max_cells));
+	cursor->pos += cell_count * 3;
+	reader->remaining -= cell_count;
+	return cell_count;
+}
+
+bool RedrawNextModeInfo(RedrawModeInfoReader *reader, RedrawModeInfo *mode_info);
+
+// Reads the header of a parameter tuple, returning the number of trailing
+// fields beyond the ones Nvy decodes. Tuples with fewer fields than expected
+// are malformed and stop decoding.
+inline uint32_t RedrawBeginTuple(MPackCursor *cursor, uint32_t field_count) {
+	uint32_t param_count = MPackCursorArray(cursor);
+	if (param_count < field_count) {
+		MPackCursorFlag(cursor, MPackCursorError::Invalid);
+		return 0;
+	}
+	return param_count - field_count;
+}
+
+void RedrawDecodeOptionSet(MPackCursor *cursor, RedrawOptionSet *option_set);
+void RedrawDecodeHlAttrDefine(MPackCursor *cursor, RedrawHlAttrDefine *hl_attr_define);
+
+// Decodes the params of a redraw notification and calls the handler method
+// matching each parameter tuple, e.g. handler->GridLine(&grid_line). The
+// handler is only called for tuples that decoded cleanly, and anything it
+// leaves unread (cells, mode infos) is skipped afterwards. Unknown events
+// are skipped without being decoded. Returns false on malformed input.
+template<typename Handler>
+bool RedrawDispatch(MPackCursor *params, Handler *handler) {
+	uint32_t event_count = MPackCursorArray(params);
+	for (uint32_t i = 0; i < event_count && MPackCursorOk(params); ++i) {
+		// Each event is an array of its name followed by one parameter tuple per batched call
+		uint32_t event_length = MPackCursorArray(params);
+		uint32_t name_length;
+		const char *name = MPackCursorStr(params, &name_length);
+		uint32_t tuple_count = event_length > 0 ? event_length - 1 : 0;
+
+		RedrawEvent event = RedrawEventFromName(name, name_length);
+		if (event == RedrawEvent::unknown) {
+			// Events Nvy doesn't handle (win_viewport, hl_group_set, ...)
+			MPackCursorSkipN(params, tuple_count);
+			continue;
+		}
+
+		for (uint32_t j = 0; j < tuple_count && MPackCursorOk(params); ++j) {
+			switch (event) {
+			case RedrawEvent::option_set: {
+				uint32_t extra = RedrawBeginTuple(params, 2);
+				RedrawOptionSet option_set;
+				RedrawDecodeOptionSet(params, &option_set);
+				MPackCursorSkipN(params, extra);
+				if (MPackCursorOk(params)) {
+					handler->OptionSet(&option_set);
+				}
+			} break;
+			case RedrawEvent::grid_resize: {
+				uint32_t extra = RedrawBeginTuple(params, 3);
+				RedrawGridResize grid_resize;
+				grid_resize.grid = MPackCursorInt(params);
+				grid_resize.width = MPackCursorInt(params);
+				grid_resize.height = MPackCursorInt(params);
+				MPackCursorSkipN(params, extra);
+				if (MPackCursorOk(params)) {
+					handler->GridResize(&grid_resize);
+				}
+			} break;
+			case RedrawEvent::grid_clear: {
+				uint32_t extra = RedrawBeginTuple(params, 1);
+				RedrawGridClear grid_clear;
+				grid_clear.grid = MPackCursorInt(params);
+				MPackCursorSkipN(params, extra);
+				if (MPackCursorOk(params)) {
+					handler->GridClear(&grid_clear);
+				}
+			} break;
+			case RedrawEvent::default_colors_set: {
+				// The cterm colors that follow are unused
+				uint32_t extra = RedrawBeginTuple(params, 3);
+				RedrawDefaultColorsSet default_colors;
+				default_colors.rgb_fg = static_cast<uint32_t>(MPackCursorInt(params));
+				default_colors.rgb_bg = static_cast<uint32_t>(MPackCursorInt(params));
+				default_colors.rgb_sp = static_cast<uint32_t>(MPackCursorInt(params));
+				MPackCursorSkipN(params, extra);
+				if (MPackCursorOk(params)) {
+					handler->DefaultColorsSet(&default_colors);
+				}
+			} break;
+			case RedrawEvent::hl_attr_define: {
+				// Skips the cterm attributes and highlight info
+				uint32_t extra = RedrawBeginTuple(params, 2);
+				RedrawHlAttrDefine hl_attr_define;
+				RedrawDecodeHlAttrDefine(params, &hl_attr_define);
+				MPackCursorSkipN(params, extra);
+				if (MPackCursorOk(params)) {
+					handler->HlAttrDefine(&hl_attr_define);
+				}
+			} break;
+			case RedrawEvent::grid_line: {
+				// Skips the wrap flag sent by newer versions of nvim
+				uint32_t extra = RedrawBeginTuple(params, 4);
+				RedrawGridLine grid_line;
+				grid_line.grid = MPackCursorInt(params);
+				grid_line.row = MPackCursorInt(params);
+				grid_line.col_start = MPackCursorInt(params);
+				grid_line.cells = RedrawCellReader { params, MPackCursorArray(params), 0 };
+				if (MPackCursorOk(params)) {
+					handler->GridLine(&grid_line);
+				}
+				RedrawCell cell;
+				while (RedrawNextCell(&grid_line.cells, &cell)) {
+				}
+				MPackCursorSkipN(params, extra);
+			} break;
+			case RedrawEvent::grid_cursor_goto: {
+				uint32_t extra = RedrawBeginTuple(params, 3);
+				RedrawGridCursorGoto cursor_goto;
+				cursor_goto.grid = MPackCursorInt(params);
+				cursor_goto.row = MPackCursorInt(params);
+				cursor_goto.col = MPackCursorInt(params);
+				MPackCursorSkipN(params, extra);
+				if (MPackCursorOk(params)) {
+					handler->GridCursorGoto(&cursor_goto);
+				}
+			} break;
+			case RedrawEvent::mode_info_set: {
+				uint32_t extra = RedrawBeginTuple(params, 2);
+				RedrawModeInfoSet mode_info_set;
+				mode_info_set.cursor_style_enabled = MPackCursorBool(params);
+				mode_info_set.mode_info_count = MPackCursorArray(params);
+				mode_info_set.mode_infos = RedrawModeInfoReader { params, mode_info_set.mode_info_count };
+				if (MPackCursorOk(params)) {
+					handler->ModeInfoSet(&mode_info_set);
+				}
+				RedrawModeInfo mode_info;
+				while (RedrawNextModeInfo(&mode_info_set.mode_infos, &mode_info)) {
+				}
+				MPackCursorSkipN(params, extra);
+			} break;
+			case RedrawEvent::mode_change: {
+				uint32_t extra = RedrawBeginTuple(params, 2);
+				RedrawModeChange mode_change;
+				mode_change.mode = MPackCursorStr(params, &mode_change.mode_length);
+				mode_change.mode_index = MPackCursorInt(params);
+				MPackCursorSkipN(params, extra);
+				if (MPackCursorOk(params)) {
+					handler->ModeChange(&mode_change);
+				}
+			} break;
+			case RedrawEvent::set_title: {
+				uint32_t extra = RedrawBeginTuple(params, 1);
+				RedrawSetTitle set_title;
+				set_title.title = MPackCursorStr(params, &set_title.title_length);
+				MPackCursorSkipN(params, extra);
+				if (MPackCursorOk(params)) {
+					handler->SetTitle(&set_title);
+				}
+			} break;
+			case RedrawEvent::busy_start: {
+				MPackCursorSkip(params);
+				if (MPackCursorOk(params)) {
+					handler->BusyStart();
+				}
+			} break;
+			case RedrawEvent::busy_stop: {
+				MPackCursorSkip(params);
+				if (MPackCursorOk(params)) {
+					handler->BusyStop();
+				}
+			} break;
+			case RedrawEvent::grid_scroll: {
+				uint32_t extra = RedrawBeginTuple(params, 7);
+				RedrawGridScroll grid_scroll;
+				grid_scroll.grid = MPackCursorInt(params);
+				grid_scroll.top = MPackCursorInt(params);
+				grid_scroll.bottom = MPackCursorInt(params);
+				grid_scroll.left = MPackCursorInt(params);
+				grid_scroll.right = MPackCursorInt(params);
+				grid_scroll.rows = MPackCursorInt(params);
+				grid_scroll.cols = MPackCursorInt(params);
+				MPackCursorSkipN(params, extra);
+				if (MPackCursorOk(params)) {
+					handler->GridScroll(&grid_scroll);
+				}
+			} break;
+			case RedrawEvent::flush: {
+				MPackCursorSkip(params);
+				if (MPackCursorOk(params)) {
+					handler->Flush();
+				}
+			} break;
+			case RedrawEvent::unknown: {
+			} break;
+			}
+		}
+	}
+	return MPackCursorOk(params);
+}
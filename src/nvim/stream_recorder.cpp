@@ -0,0 +1,153 @@
+#include "stream_recorder.h"
+#include <cstring>
+#include "common/clock.h"
+
+constexpr size_t MAX_VARINT_SIZE = 10;
+
+static size_t EncodeVarint(uint64_t value, uint8_t *out) {
+	size_t size = 0;
+	while (value >= 0x80) {
+		out[size++] = static_cast<uint8_t>(value | 0x80);
+		value >>= 7;
+	}
+	out[size++] = static_cast<uint8_t>(value);
+	return size;
+}
+
+static bool DecodeVarint(const char *data, size_t size, size_t *offset, uint64_t *value) {
+	uint64_t result = 0;
+	for (uint32_t shift = 0; shift < 64 && *offset < size; shift += 7) {
+		uint8_t byte = static_cast<uint8_t>(data[(*offset)++]);
+		result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			*value = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void WriteLittleEndian32(uint8_t *out, uint32_t value) {
+	for (int i = 0; i < 4; ++i) {
+		out[i] = static_cast<uint8_t>(value >> (i * 8));
+	}
+}
+
+static uint32_t ReadLittleEndian32(const char *data) {
+	uint32_t value = 0;
+	for (int i = 0; i < 4; ++i) {
+		value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (i * 8);
+	}
+	return value;
+}
+
+bool StreamRecorderOpen(StreamRecorder *recorder, FILE *file, bool record_outbound) {
+	if (!file) {
+		return false;
+	}
+	// Reads from nvim are large, full buffering keeps recording to one
+	// write per buffer instead of one per record
+	setvbuf(file, nullptr, _IOFBF, STREAM_RECORDER_BUFFER_SIZE);
+
+	uint8_t header[sizeof(StreamRecordingHeader)];
+	WriteLittleEndian32(header, STREAM_RECORDING_MAGIC);
+	WriteLittleEndian32(header + 4, STREAM_RECORDING_VERSION);
+	if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+		fclose(file);
+		return false;
+	}
+
+	recorder->file = file;
+	recorder->record_outbound = record_outbound;
+	recorder->start_time_ns = ClockNowNs();
+	recorder->last_time_ns = recorder->start_time_ns;
+	return true;
+}
+
+// Expects the recorder's mutex to be held
+static void WriteRecord(StreamRecorder *recorder, StreamDirection direction, uint64_t time_ns,
+	const void *data, size_t size) {
+	if (!recorder->file || recorder->failed) {
+		return;
+	}
+	uint64_t delta = time_ns > recorder->last_time_ns ? time_ns - recorder->last_time_ns : 0;
+	recorder->last_time_ns += delta;
+
+	uint8_t prefix[MAX_VARINT_SIZE * 2];
+	size_t prefix_size = EncodeVarint((delta << 1) | static_cast<uint64_t>(direction), prefix);
+	prefix_size += EncodeVarint(size, prefix + prefix_size);
+	if (fwrite(prefix, 1, prefix_size, recorder->file) != prefix_size ||
+		fwrite(data, 1, size, recorder->file) != size) {
+		// Keep the recording readable up to the last complete record
+		recorder->failed = true;
+		return;
+	}
+	++recorder->records_written;
+	recorder->bytes_recorded += size;
+}
+
+void StreamRecorderWrite(StreamRecorder *recorder, StreamDirection direction, const void *data, size_t size) {
+	if (direction == StreamDirection::Outbound && !recorder->record_outbound) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(recorder->mutex);
+	// Taken under the lock, so deltas never go backwards between threads
+	WriteRecord(recorder, direction, ClockNowNs(), data, size);
+}
+
+void StreamRecorderWriteAt(StreamRecorder *recorder, StreamDirection direction, uint64_t time_ns,
+	const void *data, size_t size) {
+	std::lock_guard<std::mutex> lock(recorder->mutex);
+	WriteRecord(recorder, direction, recorder->start_time_ns + time_ns, data, size);
+}
+
+void StreamRecorderFlush(StreamRecorder *recorder) {
+	std::lock_guard<std::mutex> lock(recorder->mutex);
+	if (recorder->file) {
+		fflush(recorder->file);
+	}
+}
+
+void StreamRecorderClose(StreamRecorder *recorder) {
+	std::lock_guard<std::mutex> lock(recorder->mutex);
+	if (recorder->file) {
+		fclose(recorder->file);
+		recorder->file = nullptr;
+	}
+}
+
+bool StreamRecordingBegin(StreamRecordingReader *reader, const char *data, size_t size) {
+	if (size < sizeof(StreamRecordingHeader) || ReadLittleEndian32(data) != STREAM_RECORDING_MAGIC ||
+		ReadLittleEndian32(data + 4) != STREAM_RECORDING_VERSION) {
+		return false;
+	}
+	*reader = StreamRecordingReader {
+		.data = data,
+		.size = size,
+		.offset = sizeof(StreamRecordingHeader),
+		.time_ns = 0
+	};
+	return true;
+}
+
+bool StreamRecordingNext(StreamRecordingReader *reader, StreamRecord *record) {
+	size_t offset = reader->offset;
+	uint64_t tagged_delta;
+	uint64_t size;
+	if (!DecodeVarint(reader->data, reader->size, &offset, &tagged_delta) ||
+		!DecodeVarint(reader->data, reader->size, &offset, &size) ||
+		size > reader->size - offset) {
+		return false;
+	}
+
+	reader->time_ns += tagged_delta >> 1;
+	*record = StreamRecord {
+		.time_ns = reader->time_ns,
+		.direction = static_cast<StreamDirection>(tagged_delta & 1),
+		.data = reader->data + offset,
+		.size = static_cast<size_t>(size)
+	};
+	reader->offset = offset + static_cast<size_t>(size);
+	return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+// Records the raw msgpack bytes exchanged with nvim, so a session can be
+// replayed through the decode and grid update path later on.
+//
+// File layout, integers little endian:
+//
+//   StreamRecordingHeader   magic "NVYR" and format version
+//   records                 back to back, each one
+//                             varint  (time delta << 1) | direction
+//                             varint  size
+//                             bytes   exactly as read from or written to nvim
+//
+// Varints are LEB128. Time deltas are in nanoseconds since the previous
+// record, the first one is relative to when recording started. Records
+// hold whatever a single read returned, so messages span records freely.
+constexpr uint32_t STREAM_RECORDING_MAGIC = 0x5259564E; // "NVYR"
+constexpr uint32_t STREAM_RECORDING_VERSION = 1;
+constexpr size_t STREAM_RECORDER_BUFFER_SIZE = 256 * 1024;
+
+struct StreamRecordingHeader {
+	uint32_t magic;
+	uint32_t version;
+};
+
+enum class StreamDirection : uint8_t {
+	Inbound = 0,
+	Outbound = 1
+};
+
+// Inbound bytes are recorded from the reader thread, outbound ones from
+// the window thread, so writes are serialized
+struct StreamRecorder {
+	std::mutex mutex;
+	FILE *file;
+	bool record_outbound;
+	uint64_t start_time_ns;
+	uint64_t last_time_ns;
+	uint64_t records_written;
+	uint64_t bytes_recorded;
+	bool failed;
+};
+
+// Takes ownership of `file`, which has to be opened for binary writing
+bool StreamRecorderOpen(StreamRecorder *recorder, FILE *file, bool record_outbound);
+void StreamRecorderWrite(StreamRecorder *recorder, StreamDirection direction, const void *data, size_t size);
+// Records with a given time since recording started, for tools that write
+// synthetic recordings. Times earlier than the previous record are clamped.
+void StreamRecorderWriteAt(StreamRecorder *recorder, StreamDirection direction, uint64_t time_ns,
+	const void *data, size_t size);
+void StreamRecorderFlush(StreamRecorder *recorder);
+void StreamRecorderClose(StreamRecorder *recorder);
+
+struct StreamRecord {
+	// Since recording started
+	uint64_t time_ns;
+	StreamDirection direction;
+	const char *data;
+	size_t size;
+};
+
+// Walks a recording held in memory, e.g. a mapped file
+struct StreamRecordingReader {
+	const char *data;
+	size_t size;
+	size_t offset;
+	uint64_t time_ns;
+};
+// Returns false if the data isn't a recording of this format version
+bool StreamRecordingBegin(StreamRecordingReader *reader, const char *data, size_t size);
+// Returns false at the end of the recording, or at a truncated record
+bool StreamRecordingNext(StreamRecordingReader *reader, StreamRecord *record);
@@ -0,0 +1,722 @@
+#include "transport.h"
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+constexpr size_t MAX_TRANSPORT_HOST_LENGTH = 256;
+
+TransportKind TransportAddressKind(const char *address) {
+	const char *port = strrchr(address, ':');
+	if (!port || port == address || !port[1]) {
+		return TransportKind::LocalSocket;
+	}
+	for (const char *c = port + 1; *c; ++c) {
+		if (*c < '0' || *c > '9') {
+			return TransportKind::LocalSocket;
+		}
+	}
+	// Paths that happen to end in :<digits>
+	if (strchr(address, '/') || strchr(address, '\\')) {
+		return TransportKind::LocalSocket;
+	}
+	return TransportKind::Tcp;
+}
+
+// Splits host:port, removing the brackets around IPv6 hosts
+static bool SplitHostPort(const char *address, char *host, const char **port) {
+	const char *separator = strrchr(address, ':');
+	const char *host_start = address;
+	const char *host_end = separator;
+	if (host_start[0] == '[' && host_end[-1] == ']') {
+		++host_start;
+		--host_end;
+	}
+	size_t host_length = static_cast<size_t>(host_end - host_start);
+	if (host_length == 0 || host_length >= MAX_TRANSPORT_HOST_LENGTH) {
+		return false;
+	}
+	memcpy(host, host_start, host_length);
+	host[host_length] = '\0';
+	*port = separator + 1;
+	return true;
+}
+
+#ifdef _WIN32
+static void InitializeTransport(Transport *transport, TransportKind kind) {
+	*transport = Transport {};
+	transport->kind = kind;
+	transport->socket = INVALID_SOCKET;
+}
+
+bool TransportSpawn(Transport *transport, wchar_t *command_line, size_t pipe_buffer_size) {
+	InitializeTransport(transport, TransportKind::ChildProcess);
+
+	HANDLE job_object = CreateJobObjectW(nullptr, nullptr);
+	JOBOBJECT_EXTENDED_LIMIT_INFORMATION job_info {
+		.BasicLimitInformation = JOBOBJECT_BASIC_LIMIT_INFORMATION {
+			.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE
+		}
+	};
+	SetInformationJobObject(job_object, JobObjectExtendedLimitInformation, &job_info, sizeof(job_info));
+
+	SECURITY_ATTRIBUTES sec_attribs {
+		.nLength = sizeof(SECURITY_ATTRIBUTES),
+		.bInheritHandle = true
+	};
+	HANDLE stdin_read, stdin_write, stdout_read, stdout_write, stderr_read, stderr_write;
+	CreatePipe(&stdin_read, &stdin_write, &sec_attribs, 0);
+	// A large stdout pipe lets nvim write a whole redraw batch without
+	// waiting for the reader thread to catch up
+	CreatePipe(&stdout_read, &stdout_write, &sec_attribs, static_cast<DWORD>(pipe_buffer_size));
+	CreatePipe(&stderr_read, &stderr_write, &sec_attribs, 0);
+	// Only the child's ends are inherited
+	SetHandleInformation(stdin_write, HANDLE_FLAG_INHERIT, 0);
+	SetHandleInformation(stdout_read, HANDLE_FLAG_INHERIT, 0);
+	SetHandleInformation(stderr_read, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFO startup_info {
+		.cb = sizeof(STARTUPINFO),
+		.dwFlags = STARTF_USESTDHANDLES,
+		.hStdInput = stdin_read,
+		.hStdOutput = stdout_write,
+		.hStdError = stderr_write
+	};
+
+	PROCESS_INFORMATION process_info {};
+	BOOL created = CreateProcessW(
+		nullptr,
+		command_line,
+		nullptr,
+		nullptr,
+		true,
+		CREATE_NO_WINDOW,
+		nullptr,
+		nullptr,
+		&startup_info,
+		&process_info
+	);
+
+	// Close unneeded handles
+	CloseHandle(stdin_read);
+	CloseHandle(stdout_write);
+	CloseHandle(stderr_write);
+	if (!created) {
+		CloseHandle(stdin_write);
+		CloseHandle(stdout_read);
+		CloseHandle(stderr_read);
+		CloseHandle(job_object);
+		return false;
+	}
+	AssignProcessToJobObject(job_object, process_info.hProcess);
+	CloseHandle(process_info.hThread);
+
+	transport->read_handle = stdout_read;
+	transport->write_handle = stdin_write;
+	transport->error_handle = stderr_read;
+	transport->process_handle = process_info.hProcess;
+	transport->job_handle = job_object;
+	return true;
+}
+
+static bool ConnectPipe(Transport *transport, const char *address) {
+	// Bare names are looked up in the local pipe namespace
+	char path[MAX_PATH];
+	const char *prefix = address[0] == '\\' ? "" : "\\\\.\\pipe\\";
+	if (snprintf(path, sizeof(path), "%s%s", prefix, address) >= static_cast<int>(sizeof(path))) {
+		return false;
+	}
+
+	HANDLE pipe = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+	if (pipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipeA(path, 5000)) {
+		pipe = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+	}
+	if (pipe == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	transport->read_handle = pipe;
+	transport->write_handle = pipe;
+	transport->read_event = CreateEventW(nullptr, true, false, nullptr);
+	transport->write_event = CreateEventW(nullptr, true, false, nullptr);
+	transport->cancel_event = CreateEventW(nullptr, true, false, nullptr);
+	return transport->read_event && transport->write_event && transport->cancel_event;
+}
+
+static bool ConnectTcp(Transport *transport, const char *address, size_t receive_buffer_size) {
+	char host[MAX_TRANSPORT_HOST_LENGTH];
+	const char *port;
+	if (!SplitHostPort(address, host, &port)) {
+		return false;
+	}
+
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		return false;
+	}
+
+	addrinfo hints {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP
+	};
+	addrinfo *addresses;
+	if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+		WSACleanup();
+		return false;
+	}
+	SOCKET connection = INVALID_SOCKET;
+	for (addrinfo *candidate = addresses; candidate; candidate = candidate->ai_next) {
+		connection = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+		if (connection == INVALID_SOCKET) {
+			continue;
+		}
+		if (receive_buffer_size) {
+			// Before connecting, so the window scale is negotiated for it
+			int size = receive_buffer_size < INT_MAX ? static_cast<int>(receive_buffer_size) : INT_MAX;
+			setsockopt(connection, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char *>(&size), sizeof(size));
+		}
+		if (connect(connection, candidate->ai_addr, static_cast<int>(candidate->ai_addrlen)) == 0) {
+			break;
+		}
+		closesocket(connection);
+		connection = INVALID_SOCKET;
+	}
+	freeaddrinfo(addresses);
+	if (connection == INVALID_SOCKET) {
+		WSACleanup();
+		return false;
+	}
+
+	// Keys go out as soon as they are typed
+	BOOL no_delay = true;
+	setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&no_delay), sizeof(no_delay));
+	transport->socket = connection;
+	return true;
+}
+
+bool TransportConnect(Transport *transport, const char *address, size_t receive_buffer_size) {
+	InitializeTransport(transport, TransportAddressKind(address));
+	bool connected = transport->kind == TransportKind::Tcp ?
+		ConnectTcp(transport, address, receive_buffer_size) : ConnectPipe(transport, address);
+	if (!connected) {
+		TransportClose(transport);
+	}
+	return connected;
+}
+
+static bool OverlappedTransfer(Transport *transport, HANDLE event, bool write, char *buffer, DWORD size,
+	DWORD *transferred) {
+	HANDLE handle = write ? transport->write_handle : transport->read_handle;
+	if (WaitForSingleObject(transport->cancel_event, 0) == WAIT_OBJECT_0) {
+		return false;
+	}
+	OVERLAPPED overlapped {};
+	overlapped.hEvent = event;
+	BOOL success = write ?
+		WriteFile(handle, buffer, size, nullptr, &overlapped) :
+		ReadFile(handle, buffer, size, nullptr, &overlapped);
+	if (!success && GetLastError() != ERROR_IO_PENDING) {
+		return false;
+	}
+	// The transfer has to finish, even cancelled, before the OVERLAPPED
+	// on the stack goes away
+	HANDLE events[] { event, transport->cancel_event };
+	if (WaitForMultipleObjects(2, events, false, INFINITE) != WAIT_OBJECT_0) {
+		CancelIoEx(handle, &overlapped);
+	}
+	return GetOverlappedResult(handle, &overlapped, transferred, true);
+}
+
+size_t TransportRead(Transport *transport, char *buffer, size_t size) {
+	DWORD read_size = size < MAXDWORD ? static_cast<DWORD>(size) : MAXDWORD;
+	DWORD bytes_read = 0;
+	switch (transport->kind) {
+	case TransportKind::ChildProcess: {
+		if (!ReadFile(transport->read_handle, buffer, read_size, &bytes_read, nullptr)) {
+			return 0;
+		}
+	} break;
+	case TransportKind::LocalSocket: {
+		if (!OverlappedTransfer(transport, transport->read_event, false, buffer, read_size, &bytes_read)) {
+			return 0;
+		}
+	} break;
+	case TransportKind::Tcp: {
+		int received = recv(transport->socket, buffer, read_size < INT_MAX ? static_cast<int>(read_size) : INT_MAX, 0);
+		return received > 0 ? static_cast<size_t>(received) : 0;
+	} break;
+	}
+	return bytes_read;
+}
+
+static bool WriteAll(Transport *transport, const char *data, size_t size) {
+	while (size > 0) {
+		DWORD write_size = size < MAXDWORD ? static_cast<DWORD>(size) : MAXDWORD;
+		DWORD bytes_written;
+		bool success = transport->kind == TransportKind::LocalSocket ?
+			OverlappedTransfer(transport, transport->write_event, true,
+				const_cast<char *>(data), write_size, &bytes_written) :
+			WriteFile(transport->write_handle, data, write_size, &bytes_written, nullptr);
+		if (!success) {
+			return false;
+		}
+		data += bytes_written;
+		size -= bytes_written;
+	}
+	return true;
+}
+
+bool TransportWrite(Transport *transport, const TransportBuffer *buffers, int buffer_count) {
+	if (buffer_count > MAX_TRANSPORT_BUFFERS) {
+		return false;
+	}
+	size_t total_size = 0;
+	for (int i = 0; i < buffer_count; ++i) {
+		total_size += buffers[i].size;
+	}
+
+	if (transport->kind == TransportKind::Tcp) {
+		// A blocking WSASend sends everything
+		WSABUF wsa_buffers[MAX_TRANSPORT_BUFFERS];
+		for (int i = 0; i < buffer_count; ++i) {
+			wsa_buffers[i].buf = static_cast<char *>(const_cast<void *>(buffers[i].data));
+			wsa_buffers[i].len = static_cast<ULONG>(buffers[i].size);
+		}
+		DWORD sent;
+		if (WSASend(transport->socket, wsa_buffers, buffer_count, &sent, 0, nullptr, nullptr) != 0) {
+			return false;
+		}
+	}
+	else {
+		// Pipes have no gathering write, small batches are copied together instead
+		constexpr size_t GATHER_BUFFER_SIZE = 16 * 1024;
+		if (buffer_count > 1 && total_size <= GATHER_BUFFER_SIZE) {
+			char gathered[GATHER_BUFFER_SIZE];
+			size_t offset = 0;
+			for (int i = 0; i < buffer_count; ++i) {
+				memcpy(gathered + offset, buffers[i].data, buffers[i].size);
+				offset += buffers[i].size;
+			}
+			if (!WriteAll(transport, gathered, total_size)) {
+				return false;
+			}
+		}
+		else {
+			for (int i = 0; i < buffer_count; ++i) {
+				if (!WriteAll(transport, static_cast<const char *>(buffers[i].data), buffers[i].size)) {
+					return false;
+				}
+			}
+		}
+	}
+	++transport->writes;
+	transport->bytes_written += total_size;
+	return true;
+}
+
+size_t TransportReadError(Transport *transport, char *buffer, size_t size) {
+	DWORD bytes_read;
+	if (!transport->error_handle || !ReadFile(transport->error_handle, buffer, static_cast<DWORD>(size), &bytes_read, nullptr)) {
+		return 0;
+	}
+	return bytes_read;
+}
+
+bool TransportWaitForExit(Transport *transport, uint32_t *exit_code) {
+	if (!transport->process_handle) {
+		return false;
+	}
+	WaitForSingleObject(transport->process_handle, INFINITE);
+	DWORD process_exit_code;
+	GetExitCodeProcess(transport->process_handle, &process_exit_code);
+	*exit_code = process_exit_code;
+	return true;
+}
+
+bool TransportExited(Transport *transport, uint32_t *exit_code) {
+	if (!transport->process_handle || WaitForSingleObject(transport->process_handle, 0) != WAIT_OBJECT_0) {
+		return false;
+	}
+	DWORD process_exit_code;
+	GetExitCodeProcess(transport->process_handle, &process_exit_code);
+	*exit_code = process_exit_code;
+	return true;
+}
+
+static void CloseHandleIfSet(void **handle) {
+	if (*handle) {
+		CloseHandle(*handle);
+		*handle = nullptr;
+	}
+}
+
+void TransportCancel(Transport *transport) {
+	switch (transport->kind) {
+	case TransportKind::ChildProcess: {
+		if (transport->process_handle) {
+			TerminateProcess(transport->process_handle, 0);
+		}
+		// In case something nvim started still holds its output open
+		if (transport->read_handle) {
+			CancelIoEx(transport->read_handle, nullptr);
+		}
+	} break;
+	case TransportKind::LocalSocket: {
+		if (transport->cancel_event) {
+			SetEvent(transport->cancel_event);
+		}
+	} break;
+	case TransportKind::Tcp: {
+		if (transport->socket != INVALID_SOCKET) {
+			shutdown(transport->socket, SD_BOTH);
+		}
+	} break;
+	}
+}
+
+void TransportClose(Transport *transport) {
+	TransportCancel(transport);
+	switch (transport->kind) {
+	case TransportKind::ChildProcess: {
+		CloseHandleIfSet(&transport->write_handle);
+		CloseHandleIfSet(&transport->read_handle);
+		CloseHandleIfSet(&transport->error_handle);
+		CloseHandleIfSet(&transport->process_handle);
+		CloseHandleIfSet(&transport->job_handle);
+	} break;
+	case TransportKind::LocalSocket: {
+		CloseHandleIfSet(&transport->read_handle);
+		transport->write_handle = nullptr;
+		CloseHandleIfSet(&transport->read_event);
+		CloseHandleIfSet(&transport->write_event);
+		CloseHandleIfSet(&transport->cancel_event);
+	} break;
+	case TransportKind::Tcp: {
+		if (transport->socket != INVALID_SOCKET) {
+			closesocket(transport->socket);
+			transport->socket = INVALID_SOCKET;
+			WSACleanup();
+		}
+	} break;
+	}
+}
+#else
+static void InitializeTransport(Transport *transport, TransportKind kind) {
+	*transport = Transport {};
+	transport->kind = kind;
+	transport->read_fd = -1;
+	transport->write_fd = -1;
+	transport->error_fd = -1;
+	transport->pid = -1;
+}
+
+static void CloseDescriptor(int *fd) {
+	if (*fd >= 0) {
+		close(*fd);
+		*fd = -1;
+	}
+}
+
+// Neither end is inherited by the child unless it is dup'ed onto its stdio
+static bool CreateCloseOnExecPipe(int fds[2]) {
+	if (pipe(fds) != 0) {
+		fds[0] = fds[1] = -1;
+		return false;
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return true;
+}
+
+bool TransportSpawn(Transport *transport, char *const *argv, size_t pipe_buffer_size) {
+	InitializeTransport(transport, TransportKind::ChildProcess);
+
+	int stdin_pipe[2], stdout_pipe[2], stderr_pipe[2];
+	bool created = CreateCloseOnExecPipe(stdin_pipe);
+	created = CreateCloseOnExecPipe(stdout_pipe) && created;
+	created = CreateCloseOnExecPipe(stderr_pipe) && created;
+#ifdef F_SETPIPE_SZ
+	// A large stdout pipe lets nvim write a whole redraw batch without
+	// waiting for the reader thread to catch up. Sizes above
+	// /proc/sys/fs/pipe-max-size fail, which keeps the default.
+	if (created && pipe_buffer_size) {
+		fcntl(stdout_pipe[1], F_SETPIPE_SZ, pipe_buffer_size < INT_MAX ? static_cast<int>(pipe_buffer_size) : INT_MAX);
+	}
+#else
+	(void)pipe_buffer_size;
+#endif
+
+	pid_t pid = -1;
+	if (created) {
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_adddup2(&actions, stdin_pipe[0], STDIN_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, stdout_pipe[1], STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, stderr_pipe[1], STDERR_FILENO);
+		created = posix_spawnp(&pid, argv[0], &actions, nullptr, argv, environ) == 0;
+		posix_spawn_file_actions_destroy(&actions);
+	}
+
+	// Close the child's ends
+	CloseDescriptor(&stdin_pipe[0]);
+	CloseDescriptor(&stdout_pipe[1]);
+	CloseDescriptor(&stderr_pipe[1]);
+	if (!created) {
+		CloseDescriptor(&stdin_pipe[1]);
+		CloseDescriptor(&stdout_pipe[0]);
+		CloseDescriptor(&stderr_pipe[0]);
+		return false;
+	}
+
+	transport->read_fd = stdout_pipe[0];
+	transport->write_fd = stdin_pipe[1];
+	transport->error_fd = stderr_pipe[0];
+	transport->pid = pid;
+	return true;
+}
+
+static void SetReceiveBufferSize(int fd, size_t receive_buffer_size) {
+	if (receive_buffer_size) {
+		int size = receive_buffer_size < INT_MAX ? static_cast<int>(receive_buffer_size) : INT_MAX;
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+#ifdef SO_NOSIGPIPE
+	// Writing to a closed connection fails instead of raising SIGPIPE
+	int no_sigpipe = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof(no_sigpipe));
+#endif
+}
+
+static int ConnectUnixSocket(const char *path, size_t receive_buffer_size) {
+	sockaddr_un socket_address {};
+	socket_address.sun_family = AF_UNIX;
+	size_t path_length = strlen(path);
+	if (path_length >= sizeof(socket_address.sun_path)) {
+		return -1;
+	}
+	memcpy(socket_address.sun_path, path, path_length + 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	SetReceiveBufferSize(fd, receive_buffer_size);
+	if (connect(fd, reinterpret_cast<const sockaddr *>(&socket_address), sizeof(socket_address)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int ConnectTcp(const char *address, size_t receive_buffer_size) {
+	char host[MAX_TRANSPORT_HOST_LENGTH];
+	const char *port;
+	if (!SplitHostPort(address, host, &port)) {
+		return -1;
+	}
+
+	addrinfo hints {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	addrinfo *addresses;
+	if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+		return -1;
+	}
+	int fd = -1;
+	for (addrinfo *candidate = addresses; candidate; candidate = candidate->ai_next) {
+		fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		// Before connecting, so the window scale is negotiated for it
+		SetReceiveBufferSize(fd, receive_buffer_size);
+		if (connect(fd, candidate->ai_addr, candidate->ai_addrlen) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(addresses);
+	if (fd < 0) {
+		return -1;
+	}
+
+	// Keys go out as soon as they are typed
+	int no_delay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+	return fd;
+}
+
+bool TransportConnect(Transport *transport, const char *address, size_t receive_buffer_size) {
+	InitializeTransport(transport, TransportAddressKind(address));
+	int fd = transport->kind == TransportKind::Tcp ?
+		ConnectTcp(address, receive_buffer_size) : ConnectUnixSocket(address, receive_buffer_size);
+	if (fd < 0) {
+		return false;
+	}
+	transport->read_fd = fd;
+	transport->write_fd = fd;
+	return true;
+}
+
+size_t TransportRead(Transport *transport, char *buffer, size_t size) {
+	while (true) {
+		ssize_t bytes_read = read(transport->read_fd, buffer, size);
+		if (bytes_read >= 0) {
+			return static_cast<size_t>(bytes_read);
+		}
+		if (errno != EINTR) {
+			return 0;
+		}
+	}
+}
+
+bool TransportWrite(Transport *transport, const TransportBuffer *buffers, int buffer_count) {
+	if (buffer_count > MAX_TRANSPORT_BUFFERS) {
+		return false;
+	}
+	iovec vectors[MAX_TRANSPORT_BUFFERS];
+	int vector_count = 0;
+	size_t total_size = 0;
+	for (int i = 0; i < buffer_count; ++i) {
+		if (buffers[i].size > 0) {
+			vectors[vector_count++] = iovec { const_cast<void *>(buffers[i].data), buffers[i].size };
+			total_size += buffers[i].size;
+		}
+	}
+
+	iovec *next = vectors;
+	while (vector_count > 0) {
+		ssize_t written;
+		if (transport->kind == TransportKind::ChildProcess) {
+			written = writev(transport->write_fd, next, vector_count);
+		}
+		else {
+			msghdr message {};
+			message.msg_iov = next;
+			message.msg_iovlen = vector_count;
+#ifdef MSG_NOSIGNAL
+			written = sendmsg(transport->write_fd, &message, MSG_NOSIGNAL);
+#else
+			written = sendmsg(transport->write_fd, &message, 0);
+#endif
+		}
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		// A short write continues in the middle of a buffer
+		size_t remaining = static_cast<size_t>(written);
+		while (vector_count > 0 && remaining >= next->iov_len) {
+			remaining -= next->iov_len;
+			++next;
+			--vector_count;
+		}
+		if (vector_count > 0) {
+			next->iov_base = static_cast<char *>(next->iov_base) + remaining;
+			next->iov_len -= remaining;
+		}
+	}
+	++transport->writes;
+	transport->bytes_written += total_size;
+	return true;
+}
+
+size_t TransportReadError(Transport *transport, char *buffer, size_t size) {
+	if (transport->error_fd < 0) {
+		return 0;
+	}
+	while (true) {
+		ssize_t bytes_read = read(transport->error_fd, buffer, size);
+		if (bytes_read >= 0) {
+			return static_cast<size_t>(bytes_read);
+		}
+		if (errno != EINTR) {
+			return 0;
+		}
+	}
+}
+
+// The child is only reaped by TransportClose, so waiting on it from one
+// thread and polling it from another doesn't race
+static bool WaitForChild(Transport *transport, int options, uint32_t *exit_code) {
+	if (transport->pid <= 0) {
+		return false;
+	}
+	siginfo_t info {};
+	while (waitid(P_PID, static_cast<id_t>(transport->pid), &info, WEXITED | WNOWAIT | options) != 0) {
+		if (errno != EINTR) {
+			return false;
+		}
+	}
+	if (info.si_pid == 0) {
+		return false;
+	}
+	// Shells report signals the same way
+	*exit_code = info.si_code == CLD_EXITED ? static_cast<uint32_t>(info.si_status) : 128 + static_cast<uint32_t>(info.si_status);
+	return true;
+}
+
+bool TransportWaitForExit(Transport *transport, uint32_t *exit_code) {
+	return WaitForChild(transport, 0, exit_code);
+}
+
+bool TransportExited(Transport *transport, uint32_t *exit_code) {
+	return WaitForChild(transport, WNOHANG, exit_code);
+}
+
+void TransportCancel(Transport *transport) {
+	if (transport->kind != TransportKind::ChildProcess && transport->read_fd >= 0) {
+		// Wakes up a read blocked on the reader thread
+		shutdown(transport->read_fd, SHUT_RDWR);
+	}
+	uint32_t exit_code;
+	if (transport->pid > 0 && !TransportExited(transport, &exit_code)) {
+		kill(transport->pid, SIGTERM);
+	}
+}
+
+void TransportClose(Transport *transport) {
+	TransportCancel(transport);
+	if (transport->write_fd != transport->read_fd) {
+		CloseDescriptor(&transport->write_fd);
+	}
+	transport->write_fd = -1;
+	CloseDescriptor(&transport->read_fd);
+	CloseDescriptor(&transport->error_fd);
+
+	if (transport->pid > 0) {
+		while (waitpid(transport->pid, nullptr, 0) < 0 && errno == EINTR) {}
+		transport->pid = -1;
+	}
+}
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// The byte stream between Nvy and nvim. Either the stdio pipes of a child
+// process started with `--embed`, or a connection to an nvim server started
+// with `nvim --listen <address>`: a Unix domain socket (a named pipe on
+// Windows) or TCP.
+//
+// Reads happen on the reader thread, writes on the window thread, so a
+// transport is safe to read and write concurrently but not to write from
+// several threads at once.
+enum class TransportKind : uint8_t {
+	ChildProcess,
+	LocalSocket,
+	Tcp
+};
+
+// Gathered into a single write, nvim sees either all of them or none
+struct TransportBuffer {
+	const void *data;
+	size_t size;
+};
+constexpr int MAX_TRANSPORT_BUFFERS = 16;
+
+struct Transport {
+	TransportKind kind;
+#ifdef _WIN32
+	// The same handle for named pipes, unused for TCP
+	void *read_handle;
+	void *write_handle;
+	void *error_handle;
+	void *process_handle;
+	void *job_handle;
+	// Named pipes are opened for overlapped I/O, otherwise a blocking read
+	// would hold up every write until nvim sends something
+	void *read_event;
+	void *write_event;
+	// Set by TransportCancel, ends the transfers waiting on named pipes
+	void *cancel_event;
+	uintptr_t socket;
+#else
+	// The same descriptor for sockets
+	int read_fd;
+	int write_fd;
+	int error_fd;
+	int pid;
+#endif
+
+	// Window thread statistics
+	uint64_t writes;
+	uint64_t bytes_written;
+};
+
+// Parses an nvim server address the way `nvim --server` does. host:port is
+// TCP (IPv6 hosts in brackets), anything else is a socket or pipe path.
+TransportKind TransportAddressKind(const char *address);
+
+// Starts nvim with its stdio redirected to pipes. pipe_buffer_size is asked
+// for nvim's stdout, 0 leaves it to the system.
+#ifdef _WIN32
+bool TransportSpawn(Transport *transport, wchar_t *command_line, size_t pipe_buffer_size);
+#else
+// argv is null terminated, argv[0] is looked up in PATH
+bool TransportSpawn(Transport *transport, char *const *argv, size_t pipe_buffer_size);
+#endif
+// Connects to a running `nvim --listen` server, Nagle's algorithm is turned
+// off for TCP. receive_buffer_size works like pipe_buffer_size.
+bool TransportConnect(Transport *transport, const char *address, size_t receive_buffer_size);
+
+// Blocks until some data is available. Returns the number of bytes read,
+// 0 once the stream ended or failed.
+size_t TransportRead(Transport *transport, char *buffer, size_t size);
+// Writes all buffers in order with as few system calls as possible
+bool TransportWrite(Transport *transport, const TransportBuffer *buffers, int buffer_count);
+// Reads the child's stderr, 0 at its end and for connections
+size_t TransportReadError(Transport *transport, char *buffer, size_t size);
+
+// Blocks until the child exits. Returns false for connections, which have
+// no process to wait for.
+bool TransportWaitForExit(Transport *transport, uint32_t *exit_code);
+// True once the child exited, always false for connections
+bool TransportExited(Transport *transport, uint32_t *exit_code);
+// Ends the stream without releasing anything, and terminates the child if
+// it still runs. A read blocked on another thread returns 0, as do the
+// reads after it.
+void TransportCancel(Transport *transport);
+// Cancels the stream and releases it. Not safe while another thread may
+// still read, cancel and wait for the reader to finish first.
+void TransportClose(Transport *transport);
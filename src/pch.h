@@ -16,6 +16,7 @@
 #include "third_party/mpack/mpack.h"
 #include "common/dx_helper.h"
 #include "common/mpack_helper.h"
+#include "common/mpack_cursor.h"
 #include "common/vec.h"
 #include "common/window_messages.h"
 using Microsoft::WRL::ComPtr;
\ No newline at end of file
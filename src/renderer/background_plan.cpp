@@ -0,0 +1,165 @@
+#include "background_plan.h"
+#include <algorithm>
+#include <cstdlib>
+
+// Nothing merges into the first row of a plan
+constexpr int NO_ROW = -2;
+
+void BackgroundPlanInitialize(BackgroundPlan *plan) {
+	*plan = BackgroundPlan {};
+	plan->last_row = NO_ROW;
+	plan->open_default_fill = -1;
+}
+
+void BackgroundPlanShutdown(BackgroundPlan *plan) {
+	free(plan->fills);
+	free(plan->open_fills);
+	free(plan->next_open_fills);
+	plan->fills = nullptr;
+	plan->open_fills = nullptr;
+	plan->next_open_fills = nullptr;
+	plan->fill_capacity = 0;
+	plan->open_capacity = 0;
+	BackgroundPlanBegin(plan, plan->default_color);
+}
+
+bool BackgroundPlanReserve(BackgroundPlan *plan, int rows, int cols) {
+	// Every cell a run of its own, and the default fill below
+	int64_t fill_capacity = static_cast<int64_t>(rows) * (cols + 1);
+	if (fill_capacity <= plan->fill_capacity && cols + 1 <= plan->open_capacity) {
+		return true;
+	}
+
+	BackgroundPlanShutdown(plan);
+	if (fill_capacity > INT32_MAX) {
+		return false;
+	}
+	plan->fills = static_cast<BackgroundFill *>(malloc(fill_capacity * sizeof(BackgroundFill)));
+	plan->open_fills = static_cast<int *>(malloc((cols + 1) * sizeof(int)));
+	plan->next_open_fills = static_cast<int *>(malloc((cols + 1) * sizeof(int)));
+	if (!plan->fills || !plan->open_fills || !plan->next_open_fills) {
+		BackgroundPlanShutdown(plan);
+		return false;
+	}
+	plan->fill_capacity = static_cast<int>(fill_capacity);
+	plan->open_capacity = cols + 1;
+	return true;
+}
+
+void BackgroundPlanBegin(BackgroundPlan *plan, uint32_t default_color) {
+	plan->default_color = default_color;
+	plan->fill_count = 0;
+	plan->last_row = NO_ROW;
+	plan->open_default_fill = -1;
+	plan->open_count = 0;
+}
+
+static int AddFill(BackgroundPlan *plan, int row, int col_begin, int col_end, uint32_t color) {
+	plan->fills[plan->fill_count] = BackgroundFill { row, row + 1, col_begin, col_end, color };
+	return plan->fill_count++;
+}
+
+static bool GrowFill(BackgroundPlan *plan, int fill, int row, int col_begin, int col_end, uint32_t color) {
+	BackgroundFill *above = &plan->fills[fill];
+	if (above->col_begin != col_begin || above->col_end != col_end || above->color != color) {
+		return false;
+	}
+	above->row_end = row + 1;
+	++plan->stats.fills_merged;
+	return true;
+}
+
+bool BackgroundPlanAddRow(BackgroundPlan *plan, int row, int cols,
+	const uint32_t *run_starts, const uint32_t *run_colors, size_t run_count) {
+	if (run_count == 0 || cols + 1 > plan->open_capacity || plan->fill_count + cols + 1 > plan->fill_capacity) {
+		return false;
+	}
+
+	bool has_default = false;
+	for (size_t i = 0; i < run_count; ++i) {
+		if (!plan->run_brush_set || run_colors[i] != plan->run_brush_color) {
+			plan->run_brush_set = true;
+			plan->run_brush_color = run_colors[i];
+			++plan->stats.run_color_changes;
+		}
+		has_default |= run_colors[i] == plan->default_color;
+	}
+	plan->stats.runs += run_count;
+
+	// Only fills reaching down to the row above can grow
+	bool below_last = row == plan->last_row + 1;
+	int open_default_fill = below_last ? plan->open_default_fill : -1;
+	int open_count = below_last ? plan->open_count : 0;
+
+	plan->open_default_fill = -1;
+	if (has_default) {
+		if (open_default_fill >= 0 && GrowFill(plan, open_default_fill, row, 0, cols, plan->default_color)) {
+			plan->open_default_fill = open_default_fill;
+		}
+		else {
+			plan->open_default_fill = AddFill(plan, row, 0, cols, plan->default_color);
+		}
+	}
+
+	// The open fills and the runs are both in column order
+	int open = 0;
+	int next_open_count = 0;
+	for (size_t i = 0; i < run_count;) {
+		uint32_t color = run_colors[i];
+		int col_begin = static_cast<int>(run_starts[i]);
+		size_t end = i + 1;
+		while (end < run_count && run_colors[end] == color) {
+			++end;
+		}
+		int col_end = end < run_count ? static_cast<int>(run_starts[end]) : cols;
+
+		if (color == plan->default_color) {
+			plan->stats.runs_skipped += end - i;
+		}
+		else {
+			while (open < open_count && plan->fills[plan->open_fills[open]].col_begin < col_begin) {
+				++open;
+			}
+			int fill;
+			if (open < open_count && GrowFill(plan, plan->open_fills[open], row, col_begin, col_end, color)) {
+				fill = plan->open_fills[open++];
+			}
+			else {
+				fill = AddFill(plan, row, col_begin, col_end, color);
+			}
+			plan->next_open_fills[next_open_count++] = fill;
+		}
+		i = end;
+	}
+
+	int *open_fills = plan->open_fills;
+	plan->open_fills = plan->next_open_fills;
+	plan->next_open_fills = open_fills;
+	plan->open_count = next_open_count;
+	plan->last_row = row;
+	return true;
+}
+
+void BackgroundPlanFinish(BackgroundPlan *plan) {
+	// The default color sorts first, under the rest
+	const auto Key = [plan](const BackgroundFill &fill) {
+		return static_cast<uint64_t>(fill.color != plan->default_color) << 32 | fill.color;
+	};
+	std::sort(plan->fills, plan->fills + plan->fill_count, [&Key](const BackgroundFill &a, const BackgroundFill &b) {
+		return Key(a) < Key(b);
+	});
+
+	for (int i = 0; i < plan->fill_count; ++i) {
+		if (!plan->fill_brush_set || plan->fills[i].color != plan->fill_brush_color) {
+			plan->fill_brush_set = true;
+			plan->fill_brush_color = plan->fills[i].color;
+			++plan->stats.color_changes;
+		}
+	}
+	plan->stats.fills += plan->fill_count;
+
+	// The fill indices are gone
+	plan->last_row = NO_ROW;
+	plan->open_default_fill = -1;
+	plan->open_count = 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// A rectangle of cells filled with one color
+struct BackgroundFill {
+	int row_begin;
+	int row_end;
+	int col_begin;
+	int col_end;
+	// 0xRRGGBB, as nvim sends colors
+	uint32_t color;
+};
+
+struct BackgroundPlanStats {
+	// Runs handed in, each used to be filled on its own
+	uint64_t runs;
+	// Brush color changes filling every run in row order would take
+	uint64_t run_color_changes;
+	// Runs of the default color, left to the fill of their row
+	uint64_t runs_skipped;
+	// Fills that grew a row instead of starting a new one
+	uint64_t fills_merged;
+	uint64_t fills;
+	uint64_t color_changes;
+};
+
+// Plans the backgrounds of the rows drawn in a flush as few fills as
+// possible. A row with any default color in it gets one fill of the
+// default across, drawn first, and only the runs of other colors on top.
+// Neighbouring runs of one color become one fill, as do fills of the same
+// columns and color in consecutive rows. The fills come out ordered by
+// color, the default first, so each color sets the brush once. Fills of
+// different colors never overlap, apart from the default ones under the
+// rest.
+struct BackgroundPlan {
+	uint32_t default_color;
+	BackgroundFill *fills;
+	int fill_count;
+	int fill_capacity;
+
+	// Fills that reach down to the last row added, the default one and the
+	// rest in column order, -1 for none. The next row grows them where it
+	// matches.
+	int last_row;
+	int open_default_fill;
+	int *open_fills;
+	int open_count;
+	int *next_open_fills;
+	int open_capacity;
+
+	// The colors the brush was left with filling runs one by one and
+	// filling the plans, both carry over from one plan to the next
+	bool run_brush_set;
+	uint32_t run_brush_color;
+	bool fill_brush_set;
+	uint32_t fill_brush_color;
+	BackgroundPlanStats stats;
+};
+
+void BackgroundPlanInitialize(BackgroundPlan *plan);
+void BackgroundPlanShutdown(BackgroundPlan *plan);
+// Makes room for the fills of every row of a grid, adding rows never
+// allocates. Returns false when out of memory, the plan is empty then.
+bool BackgroundPlanReserve(BackgroundPlan *plan, int rows, int cols);
+
+// Drops the fills of the last plan and starts over
+void BackgroundPlanBegin(BackgroundPlan *plan, uint32_t default_color);
+// Adds a row split into runs, run i covers columns [run_starts[i],
+// run_starts[i + 1]) and the last one goes up to cols. The first run
+// starts at 0. Rows come in increasing order. Returns false and leaves the
+// row out if it doesn't fit the reserved size.
+bool BackgroundPlanAddRow(BackgroundPlan *plan, int row, int cols,
+	const uint32_t *run_starts, const uint32_t *run_colors, size_t run_count);
+// Orders the fills by color, rows can't be added after
+void BackgroundPlanFinish(BackgroundPlan *plan);
@@ -0,0 +1,53 @@
+#include "cursor.h"
+#include <cmath>
+
+void CursorBlinkReset(CursorBlink *blink, const CursorModeInfo *mode_info, uint64_t now_ms) {
+	blink->visible = true;
+	if (!mode_info || mode_info->blinkwait <= 0 || mode_info->blinkon <= 0 || mode_info->blinkoff <= 0) {
+		blink->on = 0;
+		blink->off = 0;
+		blink->next_ms = CURSOR_BLINK_NEVER;
+		return;
+	}
+	blink->on = mode_info->blinkon;
+	blink->off = mode_info->blinkoff;
+	blink->next_ms = now_ms + static_cast<uint64_t>(mode_info->blinkwait);
+}
+
+bool CursorBlinkAdvance(CursorBlink *blink, uint64_t now_ms) {
+	if (blink->next_ms == CURSOR_BLINK_NEVER || now_ms < blink->next_ms) {
+		return false;
+	}
+
+	// Skips whole periods, a suspended machine wakes up at any time
+	bool was_visible = blink->visible;
+	uint64_t period = static_cast<uint64_t>(blink->on) + static_cast<uint64_t>(blink->off);
+	blink->next_ms += (now_ms - blink->next_ms) / period * period;
+	while (blink->next_ms <= now_ms) {
+		blink->visible = !blink->visible;
+		blink->next_ms += static_cast<uint64_t>(blink->visible ? blink->on : blink->off);
+	}
+	if (blink->visible == was_visible) {
+		return false;
+	}
+	++blink->toggles;
+	return true;
+}
+
+bool CursorCoverPixels(float left, float top, float right, float bottom, uint32_t width, uint32_t height,
+	CursorPixels *pixels) {
+	float clamped_left = fmaxf(floorf(left), 0.0f);
+	float clamped_top = fmaxf(floorf(top), 0.0f);
+	float clamped_right = fminf(ceilf(right), static_cast<float>(width));
+	float clamped_bottom = fminf(ceilf(bottom), static_cast<float>(height));
+	if (!(clamped_left < clamped_right && clamped_top < clamped_bottom)) {
+		return false;
+	}
+	*pixels = CursorPixels {
+		static_cast<uint32_t>(clamped_left),
+		static_cast<uint32_t>(clamped_top),
+		static_cast<uint32_t>(clamped_right),
+		static_cast<uint32_t>(clamped_bottom)
+	};
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+
+// Cursor state as set by nvim's mode_info_set, mode_change and
+// grid_cursor_goto, shared between the redraw decoder and the renderer.
+enum class CursorShape : uint8_t {
+	None,
+	Block,
+	Vertical,
+	Horizontal
+};
+
+struct CursorModeInfo {
+	CursorShape shape;
+	uint16_t hl_attrib_id;
+	// In milliseconds, the mode doesn't blink if any of them is 0
+	int32_t blinkwait;
+	int32_t blinkon;
+	int32_t blinkoff;
+};
+struct Cursor {
+	CursorModeInfo *mode_info;
+	int row;
+	int col;
+};
+
+// Blinking as nvim describes it: once the cursor moves or changes mode it
+// shows for blinkwait, then is off for blinkoff and on for blinkon, over
+// and over. Times are in milliseconds, from any monotonic clock.
+constexpr uint64_t CURSOR_BLINK_NEVER = UINT64_MAX;
+
+struct CursorBlink {
+	int32_t on;
+	int32_t off;
+	bool visible;
+	// When visible flips next, CURSOR_BLINK_NEVER when the mode doesn't blink
+	uint64_t next_ms;
+	uint64_t toggles;
+};
+
+// Shows the cursor and starts the mode's blinking over, mode_info may be
+// nullptr
+void CursorBlinkReset(CursorBlink *blink, const CursorModeInfo *mode_info, uint64_t now_ms);
+// Catches up with the clock. Returns true if visible changed, phases that
+// passed entirely while nobody looked don't count.
+bool CursorBlinkAdvance(CursorBlink *blink, uint64_t now_ms);
+
+// The whole pixels a cursor rect touches, clamped to a surface of width
+// by height pixels. Returns false if none of them is on the surface.
+struct CursorPixels {
+	uint32_t left;
+	uint32_t top;
+	uint32_t right;
+	uint32_t bottom;
+};
+bool CursorCoverPixels(float left, float top, float right, float bottom, uint32_t width, uint32_t height,
+	CursorPixels *pixels);
@@ -0,0 +1,92 @@
+#include "frame_scheduler.h"
+
+static void UpdateInterval(FrameScheduler *scheduler) {
+	uint64_t cap_ns = scheduler->max_fps ? 1000000000ull / scheduler->max_fps : 0;
+	switch (scheduler->policy) {
+	case FramePolicy::LowLatency: {
+		scheduler->interval_ns = scheduler->refresh_ns;
+	} break;
+	case FramePolicy::Capped: {
+		scheduler->interval_ns = cap_ns ? cap_ns : scheduler->refresh_ns;
+	} break;
+	case FramePolicy::PowerSave: {
+		uint64_t half_rate_ns = 2 * scheduler->refresh_ns;
+		scheduler->interval_ns = cap_ns > half_rate_ns ? cap_ns : half_rate_ns;
+	} break;
+	}
+}
+
+void FrameSchedulerInitialize(FrameScheduler *scheduler, FramePolicy policy, uint32_t max_fps) {
+	*scheduler = FrameScheduler {};
+	scheduler->policy = policy;
+	scheduler->max_fps = max_fps;
+	scheduler->due_ns = FRAME_NOT_DUE;
+	FrameSchedulerSetRefreshRate(scheduler, 0);
+}
+
+void FrameSchedulerSetRefreshRate(FrameScheduler *scheduler, uint32_t refresh_hz) {
+	// Windows reports 0 or 1 for the hardware default
+	scheduler->refresh_ns = 1000000000ull / (refresh_hz > 1 ? refresh_hz : FRAME_DEFAULT_REFRESH_HZ);
+	UpdateInterval(scheduler);
+}
+
+// The first time at or after now a frame may start
+static uint64_t NextFrameNs(const FrameScheduler *scheduler, uint64_t now_ns) {
+	if (!scheduler->has_drawn) {
+		return now_ns;
+	}
+	uint64_t interval = scheduler->interval_ns;
+	uint64_t earliest = scheduler->last_frame_ns + interval;
+	if (scheduler->policy != FramePolicy::PowerSave) {
+		return earliest > now_ns ? earliest : now_ns;
+	}
+	// The next tick, counting from the last frame
+	if (earliest >= now_ns) {
+		return earliest;
+	}
+	return earliest + (now_ns - earliest + interval - 1) / interval * interval;
+}
+
+bool FrameSchedulerFlush(FrameScheduler *scheduler, uint64_t now_ns) {
+	++scheduler->stats.flushes;
+	if (scheduler->pending_flushes == 0) {
+		scheduler->pending_since_ns = now_ns;
+		scheduler->due_ns = NextFrameNs(scheduler, now_ns);
+	}
+	else {
+		++scheduler->stats.flushes_coalesced;
+	}
+	++scheduler->pending_flushes;
+	return now_ns >= scheduler->due_ns;
+}
+
+bool FrameSchedulerTick(FrameScheduler *scheduler, uint64_t now_ns) {
+	return scheduler->pending_flushes && now_ns >= scheduler->due_ns;
+}
+
+void FrameSchedulerFrameDrawn(FrameScheduler *scheduler, uint64_t start_ns, uint64_t end_ns) {
+	FrameRecord *record = &scheduler->history[scheduler->history_next];
+	scheduler->history_next = (scheduler->history_next + 1) % FRAME_HISTORY;
+	record->start_ns = start_ns;
+	record->draw_ns = end_ns - start_ns;
+	record->flushes = scheduler->pending_flushes;
+	record->latency_ns = 0;
+	if (scheduler->pending_flushes) {
+		record->latency_ns = start_ns - scheduler->pending_since_ns;
+		if (start_ns > scheduler->due_ns + scheduler->interval_ns) {
+			++scheduler->stats.late_frames;
+		}
+	}
+
+	FrameSchedulerStats *stats = &scheduler->stats;
+	++stats->frames;
+	stats->total_latency_ns += record->latency_ns;
+	stats->max_latency_ns = record->latency_ns > stats->max_latency_ns ? record->latency_ns : stats->max_latency_ns;
+	stats->total_draw_ns += record->draw_ns;
+
+	// Missed ticks are dropped, the next frame counts from this one
+	scheduler->has_drawn = true;
+	scheduler->last_frame_ns = start_ns;
+	scheduler->pending_flushes = 0;
+	scheduler->due_ns = FRAME_NOT_DUE;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+
+// How flushes are turned into frames, see FrameScheduler
+enum class FramePolicy : uint8_t {
+	// A flush is drawn at once when a refresh interval has passed since
+	// the last frame, otherwise as soon as it has
+	LowLatency,
+	// The same, with the interval of a frame rate cap instead
+	Capped,
+	// Frames are only drawn on ticks of a longer interval, half the
+	// refresh rate or the cap, so even a single flush waits for one
+	PowerSave
+};
+
+constexpr uint64_t FRAME_NOT_DUE = UINT64_MAX;
+constexpr uint32_t FRAME_DEFAULT_REFRESH_HZ = 60;
+constexpr int FRAME_HISTORY = 64;
+
+// A frame drawn, flushes is 0 for one drawn without any, e.g. on resize
+struct FrameRecord {
+	uint64_t start_ns;
+	// From the first flush it draws to the start
+	uint64_t latency_ns;
+	uint64_t draw_ns;
+	uint32_t flushes;
+};
+
+struct FrameSchedulerStats {
+	uint64_t flushes;
+	uint64_t frames;
+	// Flushes drawn in a frame together with an earlier one
+	uint64_t flushes_coalesced;
+	// Frames that started more than an interval after they were due, the
+	// ticks missed meanwhile are dropped rather than caught up on
+	uint64_t late_frames;
+	uint64_t total_latency_ns;
+	uint64_t max_latency_ns;
+	uint64_t total_draw_ns;
+};
+
+// Paces drawing to the display. Every flush is applied to the grid as it
+// arrives, but a frame is drawn at most once per interval and draws the
+// latest state, so the flushes of a :terminal flood or a fast scroll that
+// arrive within one interval end up in one frame. Times are in
+// nanoseconds, from any monotonic clock.
+//
+// The render thread calls FrameSchedulerFlush for each flush and draws if
+// it returns true, otherwise it waits until due_ns and draws once
+// FrameSchedulerTick says so. Every frame drawn, for whatever reason, is
+// reported with FrameSchedulerFrameDrawn.
+struct FrameScheduler {
+	FramePolicy policy;
+	uint32_t max_fps;
+	uint64_t refresh_ns;
+	uint64_t interval_ns;
+
+	bool has_drawn;
+	uint64_t last_frame_ns;
+	// Flushes waiting for a frame, since the first of them
+	uint32_t pending_flushes;
+	uint64_t pending_since_ns;
+	// When the pending flushes are drawn, FRAME_NOT_DUE when none are
+	uint64_t due_ns;
+
+	// The last FRAME_HISTORY frames, history_next is where the next goes
+	FrameRecord history[FRAME_HISTORY];
+	uint32_t history_next;
+	FrameSchedulerStats stats;
+};
+
+// max_fps is the cap of FramePolicy::Capped and PowerSave, 0 for none
+void FrameSchedulerInitialize(FrameScheduler *scheduler, FramePolicy policy, uint32_t max_fps);
+// The display's refresh rate, 0 if unknown
+void FrameSchedulerSetRefreshRate(FrameScheduler *scheduler, uint32_t refresh_hz);
+
+// Returns true if the flush is to be drawn now
+bool FrameSchedulerFlush(FrameScheduler *scheduler, uint64_t now_ns);
+// Returns true if the pending flushes are due
+bool FrameSchedulerTick(FrameScheduler *scheduler, uint64_t now_ns);
+void FrameSchedulerFrameDrawn(FrameScheduler *scheduler, uint64_t start_ns, uint64_t end_ns);
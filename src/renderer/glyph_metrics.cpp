@@ -0,0 +1,119 @@
+#include "glyph_metrics.h"
+#include <cstdlib>
+#include <cstring>
+
+// Cells are never 0 past the BMP, so 0 marks an empty slot
+constexpr uint32_t EMPTY_ASTRAL_CELL = 0;
+constexpr uint32_t INITIAL_ASTRAL_CAPACITY = 64;
+
+void GlyphMetricsInitialize(GlyphMetrics *metrics, GlyphMetricsSource source) {
+	*metrics = GlyphMetrics {};
+	metrics->source = source;
+}
+
+void GlyphMetricsShutdown(GlyphMetrics *metrics) {
+	for (int i = 0; i < GLYPH_METRICS_PAGE_COUNT; ++i) {
+		free(metrics->pages[i]);
+		metrics->pages[i] = nullptr;
+	}
+	free(metrics->astral);
+	metrics->astral = nullptr;
+	metrics->astral_capacity = 0;
+	metrics->astral_count = 0;
+}
+
+void GlyphMetricsInvalidate(GlyphMetrics *metrics) {
+	// Keep the memory, the new font will mostly see the same cells
+	for (int i = 0; i < GLYPH_METRICS_PAGE_COUNT; ++i) {
+		if (metrics->pages[i]) {
+			memset(metrics->pages[i], 0, GLYPH_METRICS_PAGE_SIZE * sizeof(GlyphMetric));
+		}
+	}
+	if (metrics->astral) {
+		memset(metrics->astral, 0, metrics->astral_capacity * sizeof(GlyphAstralMetric));
+	}
+	metrics->astral_count = 0;
+}
+
+static uint32_t AstralSlot(uint32_t cell, uint32_t capacity) {
+	return (cell * 0x9E3779B1u) >> 7 & (capacity - 1);
+}
+
+static bool GrowAstral(GlyphMetrics *metrics) {
+	uint32_t capacity = metrics->astral_capacity ? metrics->astral_capacity * 2 : INITIAL_ASTRAL_CAPACITY;
+	GlyphAstralMetric *astral = static_cast<GlyphAstralMetric *>(calloc(capacity, sizeof(GlyphAstralMetric)));
+	if (!astral) {
+		return false;
+	}
+	for (uint32_t i = 0; i < metrics->astral_capacity; ++i) {
+		const GlyphAstralMetric *entry = &metrics->astral[i];
+		if (entry->cell == EMPTY_ASTRAL_CELL) {
+			continue;
+		}
+		uint32_t slot = AstralSlot(entry->cell, capacity);
+		while (astral[slot].cell != EMPTY_ASTRAL_CELL) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		astral[slot] = *entry;
+	}
+	free(metrics->astral);
+	metrics->astral = astral;
+	metrics->astral_capacity = capacity;
+	return true;
+}
+
+// The entry of a cell, nullptr if there is no memory for it, in which
+// case the source is asked every time
+static GlyphMetric *FindMetric(GlyphMetrics *metrics, uint32_t cell) {
+	++metrics->stats.lookups;
+	if (cell < 0x10000) {
+		GlyphMetric **page = &metrics->pages[cell / GLYPH_METRICS_PAGE_SIZE];
+		if (!*page) {
+			*page = static_cast<GlyphMetric *>(calloc(GLYPH_METRICS_PAGE_SIZE, sizeof(GlyphMetric)));
+			if (!*page) {
+				return nullptr;
+			}
+		}
+		return &(*page)[cell % GLYPH_METRICS_PAGE_SIZE];
+	}
+
+	if ((metrics->astral_count + 1) * 2 > metrics->astral_capacity && !GrowAstral(metrics)) {
+		return nullptr;
+	}
+	uint32_t slot = AstralSlot(cell, metrics->astral_capacity);
+	while (metrics->astral[slot].cell != cell) {
+		if (metrics->astral[slot].cell == EMPTY_ASTRAL_CELL) {
+			metrics->astral[slot].cell = cell;
+			++metrics->astral_count;
+			break;
+		}
+		slot = (slot + 1) & (metrics->astral_capacity - 1);
+	}
+	return &metrics->astral[slot].metric;
+}
+
+float GlyphMetricsAdvance(GlyphMetrics *metrics, uint32_t cell) {
+	GlyphMetric *metric = FindMetric(metrics, cell);
+	if (!metric) {
+		return metrics->source.measure_advance(metrics->source.context, cell);
+	}
+	if (!(metric->flags & GLYPH_METRIC_HAS_ADVANCE)) {
+		metric->advance = metrics->source.measure_advance(metrics->source.context, cell);
+		metric->flags |= GLYPH_METRIC_HAS_ADVANCE;
+		++metrics->stats.measured;
+	}
+	return metric->advance;
+}
+
+uint16_t GlyphMetricsGlyphIndex(GlyphMetrics *metrics, uint32_t cell) {
+	GlyphMetric *metric = FindMetric(metrics, cell);
+	if (!metric) {
+		return metrics->source.glyph_index(metrics->source.context, cell);
+	}
+	if (!(metric->flags & GLYPH_METRIC_HAS_GLYPH_INDEX)) {
+		metric->glyph_index = metrics->source.glyph_index(metrics->source.context, cell);
+		metric->flags |= GLYPH_METRIC_HAS_GLYPH_INDEX;
+		++metrics->stats.measured;
+	}
+	return metric->glyph_index;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Asks the font about a grid cell (a UTF-16 code unit, or a surrogate
+// pair packed as (high << 16) | low). Implemented by the renderer with
+// DirectWrite, which is slow enough that GlyphMetrics asks once per cell.
+struct GlyphMetricsSource {
+	void *context;
+	// Advance of the cell's text, laid out with font fallback
+	float (*measure_advance)(void *context, uint32_t cell);
+	// Glyph of the cell in the primary font, 0 if the font lacks it
+	uint16_t (*glyph_index)(void *context, uint32_t cell);
+};
+
+// Entry flags
+constexpr uint8_t GLYPH_METRIC_HAS_ADVANCE = 1 << 0;
+constexpr uint8_t GLYPH_METRIC_HAS_GLYPH_INDEX = 1 << 1;
+
+struct GlyphMetric {
+	float advance;
+	uint16_t glyph_index;
+	uint8_t flags;
+};
+
+// Pages of the BMP are allocated as cells from them show up
+constexpr int GLYPH_METRICS_PAGE_SIZE = 256;
+constexpr int GLYPH_METRICS_PAGE_COUNT = 0x10000 / GLYPH_METRICS_PAGE_SIZE;
+
+struct GlyphAstralMetric {
+	uint32_t cell;
+	GlyphMetric metric;
+};
+
+struct GlyphMetricsStats {
+	uint64_t lookups;
+	uint64_t measured;
+};
+
+// Metrics of the cells the grid was drawn with, valid for a single font
+// at a single size. BMP cells are looked up in a table, surrogate pairs
+// in an open addressed hash table keyed by the packed cell.
+struct GlyphMetrics {
+	GlyphMetricsSource source;
+	GlyphMetric *pages[GLYPH_METRICS_PAGE_COUNT];
+
+	// Capacity is a power of two, kept at most half full
+	GlyphAstralMetric *astral;
+	uint32_t astral_capacity;
+	uint32_t astral_count;
+
+	GlyphMetricsStats stats;
+};
+
+void GlyphMetricsInitialize(GlyphMetrics *metrics, GlyphMetricsSource source);
+void GlyphMetricsShutdown(GlyphMetrics *metrics);
+// Forgets every cell, for when the font or its size changes
+void GlyphMetricsInvalidate(GlyphMetrics *metrics);
+
+float GlyphMetricsAdvance(GlyphMetrics *metrics, uint32_t cell);
+uint16_t GlyphMetricsGlyphIndex(GlyphMetrics *metrics, uint32_t cell);
+// Whether the primary font has a glyph for the cell, instead of a fallback
+inline bool GlyphMetricsInPrimaryFont(GlyphMetrics *metrics, uint32_t cell) {
+	return GlyphMetricsGlyphIndex(metrics, cell) != 0;
+}
@@ -39,10 +39,10 @@ HRESULT GlyphRenderer::DrawGlyphRun(void *client_drawing_context, float baseline
 	{
 		ComPtr<GlyphDrawingEffect> drawing_effect;
 		client_drawing_effect->QueryInterface(__uuidof(GlyphDrawingEffect), reinterpret_cast<void **>(drawing_effect.GetAddressOf()));
-		drawing_effect_brush->SetColor(D2D1::ColorF(drawing_effect->text_color));
+		drawing_effect_brush->SetColor(drawing_effect->text_color);
 	}
 	else {
-		drawing_effect_brush->SetColor(D2D1::ColorF(renderer->hl_attribs[0].foreground));
+		drawing_effect_brush->SetColor(StyleColorF(StyleTableGet(&renderer->ui.styles, 0)->foreground));
 	}
 
 	DWRITE_GLYPH_IMAGE_FORMATS supported_formats =
@@ -166,12 +166,11 @@ HRESULT GlyphRenderer::DrawLine(void *client_drawing_context, float baseline_ori
 	{
 		ComPtr<GlyphDrawingEffect> drawing_effect;
 		client_drawing_effect->QueryInterface(__uuidof(GlyphDrawingEffect), reinterpret_cast<void **>(drawing_effect.GetAddressOf()));
-		uint32_t line_color = use_special_color ? drawing_effect->special_color : drawing_effect->text_color;
-		temp_brush->SetColor(D2D1::ColorF(line_color));
+		temp_brush->SetColor(use_special_color ? drawing_effect->special_color : drawing_effect->text_color);
 	}
 	else {
-		uint32_t line_color = use_special_color ? renderer->hl_attribs[0].special : renderer->hl_attribs[0].foreground;
-		temp_brush->SetColor(D2D1::ColorF(line_color));
+		const HighlightStyle *style = StyleTableGet(&renderer->ui.styles, 0);
+		temp_brush->SetColor(StyleColorF(use_special_color ? style->special : style->foreground));
 	} 
 
 	D2D1_RECT_F rect;
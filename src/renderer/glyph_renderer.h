@@ -2,7 +2,7 @@
 #include <pch.h>
 
 struct DECLSPEC_UUID("8d4d2884-e4d9-11ea-87d0-0242ac130003") GlyphDrawingEffect : public IUnknown {
-	GlyphDrawingEffect(uint32_t text_color, uint32_t special_color) : 
+	GlyphDrawingEffect(D2D1_COLOR_F text_color, D2D1_COLOR_F special_color) : 
         ref_count(0), 
         text_color(text_color), 
         special_color(special_color) {}
@@ -23,8 +23,8 @@ struct DECLSPEC_UUID("8d4d2884-e4d9-11ea-87d0-0242ac130003") GlyphDrawingEffect
 	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppv_object) noexcept override;
 
 	ULONG ref_count;
-    uint32_t text_color;
-    uint32_t special_color;
+    D2D1_COLOR_F text_color;
+    D2D1_COLOR_F special_color;
 };
 
 struct Renderer;
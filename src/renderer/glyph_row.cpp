@@ -0,0 +1,138 @@
+#include "glyph_row.h"
+#include <cstdlib>
+#include <cstring>
+
+void GlyphRowInitialize(GlyphRow *row) {
+	*row = GlyphRow {};
+}
+
+void GlyphRowShutdown(GlyphRow *row) {
+	free(row->advances);
+	row->advances = nullptr;
+	row->capacity = 0;
+}
+
+static void FillAdvances(GlyphRow *row) {
+	for (int i = 0; i < row->capacity; ++i) {
+		row->advances[i] = row->advance;
+	}
+}
+
+bool GlyphRowReserve(GlyphRow *row, int cols) {
+	if (cols <= row->capacity) {
+		return true;
+	}
+	GlyphRowShutdown(row);
+	row->advances = static_cast<float *>(malloc(cols * sizeof(float)));
+	if (!row->advances) {
+		return false;
+	}
+	row->capacity = cols;
+	FillAdvances(row);
+	return true;
+}
+
+void GlyphRowSetFont(GlyphRow *row, GlyphMetrics *metrics, float advance, bool enabled) {
+	row->advance = advance;
+	FillAdvances(row);
+	memset(row->ascii_glyphs, 0, sizeof(row->ascii_glyphs));
+	row->enabled = enabled;
+	for (uint32_t c = 0x20; c < 0x7F; ++c) {
+		row->ascii_glyphs[c] = GlyphMetricsGlyphIndex(metrics, c);
+		// Cells missing from the font are special anyway, see the renderer's
+		// scan rules, which leaves nothing to draw directly
+		row->enabled &= row->ascii_glyphs[c] != 0;
+	}
+}
+
+static uint16_t ReadU16(const uint8_t *data) {
+	return static_cast<uint16_t>(data[0] << 8 | data[1]);
+}
+
+bool GlyphRowFontSubstitutes(const uint8_t *gsub, size_t size, bool standard_ligatures) {
+	// Major and minor version, then the offsets of the script, feature and
+	// lookup lists
+	if (size < 10 || ReadU16(gsub) != 1) {
+		return true;
+	}
+	size_t feature_list = ReadU16(gsub + 6);
+	if (feature_list == 0) {
+		return false;
+	}
+	if (feature_list + 2 > size) {
+		return true;
+	}
+	size_t feature_count = ReadU16(gsub + feature_list);
+	if (feature_list + 2 + feature_count * 6 > size) {
+		return true;
+	}
+
+	// Contextual alternates and the ligatures on by default. Glyph
+	// composition and localized forms are left alone, printable ASCII in
+	// English has none.
+	const char *substituting[] { "calt", "clig", "rlig", "rclt", "liga" };
+	size_t substituting_count = standard_ligatures ? 5 : 4;
+	for (size_t i = 0; i < feature_count; ++i) {
+		const uint8_t *tag = gsub + feature_list + 2 + i * 6;
+		for (size_t j = 0; j < substituting_count; ++j) {
+			if (!memcmp(tag, substituting[j], 4)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static bool DrawnPlain(const HighlightStyle *style) {
+	return style->font_weight == STYLE_FONT_WEIGHT_NORMAL && style->font_style == STYLE_FONT_STYLE_NORMAL &&
+		style->decorations == 0;
+}
+
+bool GlyphRowBuild(const GlyphRow *row, StyleTable *styles, const uint32_t *chars, const uint16_t *hl_ids,
+	const uint64_t *special, const uint32_t *run_starts, size_t run_count, int cols,
+	uint16_t *glyph_indices, GlyphRowRun *runs, int *glyph_run_count) {
+	*glyph_run_count = 0;
+	bool direct = row->enabled && cols <= row->capacity;
+	for (int i = 0; direct && i < (cols + 63) / 64; ++i) {
+		direct = special[i] == 0;
+	}
+	if (!direct) {
+		return false;
+	}
+
+	// Highlight id runs drawn alike are one glyph run
+	int count = 0;
+	for (size_t run = 0; run < run_count;) {
+		uint16_t style_id = StyleTableStyleId(styles, hl_ids[run_starts[run]]);
+		if (!DrawnPlain(StyleTableStyle(styles, style_id))) {
+			return false;
+		}
+		size_t end = run + 1;
+		while (end < run_count && StyleTableStyleId(styles, hl_ids[run_starts[end]]) == style_id) {
+			++end;
+		}
+
+		int col_begin = static_cast<int>(run_starts[run]);
+		int col_end = end < run_count ? static_cast<int>(run_starts[end]) : cols;
+		uint32_t blank = 1;
+		for (int col = col_begin; col < col_end; ++col) {
+			// Cells are printable ASCII, the mask only keeps a bad scan in bounds
+			glyph_indices[col] = row->ascii_glyphs[chars[col] & 0x7F];
+			blank &= chars[col] == ' ';
+		}
+		if (!blank) {
+			runs[count++] = GlyphRowRun { col_begin, col_end, style_id };
+		}
+		run = end;
+	}
+	*glyph_run_count = count;
+	return true;
+}
+
+bool GlyphRowCellGlyph(const GlyphRow *row, const HighlightStyle *style, uint32_t cell, uint16_t *glyph) {
+	if (!row->enabled || cell < 0x20 || cell >= 0x7F || !DrawnPlain(style)) {
+		return false;
+	}
+	*glyph = row->ascii_glyphs[cell];
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "renderer/glyph_metrics.h"
+#include "renderer/style_table.h"
+
+// Rows of plain text in a monospaced font that substitutes no glyphs need
+// no shaping: every cell is one glyph of the primary font, one cell wide.
+// Those are drawn as a glyph run per style straight from a table of glyph
+// indices, without a text layout. Rows with anything else in them, a wide
+// or non-ASCII cell, one missing from the font, or a bold, italic or
+// decorated style, are laid out as before.
+struct GlyphRowRun {
+	int col_begin;
+	int col_end;
+	uint16_t style_id;
+};
+
+struct GlyphRow {
+	// Off when the font needs shaping, every row is laid out then
+	bool enabled;
+	float advance;
+	// Of printable ASCII in the primary font, the rest is never looked at
+	uint16_t ascii_glyphs[128];
+	// The advance of every column, the same in all rows
+	int capacity;
+	float *advances;
+};
+
+void GlyphRowInitialize(GlyphRow *row);
+void GlyphRowShutdown(GlyphRow *row);
+// Makes room for the advances of rows of up to cols cells. Returns false when out of
+// memory, every row is laid out then.
+bool GlyphRowReserve(GlyphRow *row, int cols);
+// Takes the glyphs of the new primary font from its metrics, advance is
+// the cell width. enabled says whether the font is monospaced and doesn't
+// substitute glyphs, see GlyphRowFontSubstitutes.
+void GlyphRowSetFont(GlyphRow *row, GlyphMetrics *metrics, float advance, bool enabled);
+
+// Whether a font's GSUB table, as stored in the font, has any of the
+// substitutions DirectWrite applies by default that join or swap glyphs of
+// ASCII text. Standard ligatures only count when they aren't turned off.
+// A table that doesn't parse counts as substituting.
+bool GlyphRowFontSubstitutes(const uint8_t *gsub, size_t size, bool standard_ligatures);
+
+// Builds the glyph runs of a row from its scan, see TranscodeScanRow,
+// whose special cells have to include every cell outside printable ASCII.
+// glyph_indices gets a glyph per column and runs up to one per highlight
+// id run. Returns false if the row has to be laid out. Only reads the
+// glyph row and the styles, so rows can be built on several threads.
+bool GlyphRowBuild(const GlyphRow *row, StyleTable *styles, const uint32_t *chars, const uint16_t *hl_ids,
+	const uint64_t *special, const uint32_t *run_starts, size_t run_count, int cols,
+	uint16_t *glyph_indices, GlyphRowRun *runs, int *glyph_run_count);
+
+// The glyph a single cell in a style is drawn with without a layout, e.g.
+// the cursor's. Returns false if it has to be laid out.
+bool GlyphRowCellGlyph(const GlyphRow *row, const HighlightStyle *style, uint32_t cell, uint16_t *glyph);
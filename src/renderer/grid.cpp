@@ -0,0 +1,359 @@
+#include "grid.h"
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include "common/cache_line.h"
+#include "common/transcode.h"
+
+// Far beyond any screen, guards the size computations against overflow
+constexpr int64_t MAX_GRID_CELLS = int64_t(1) << 28;
+
+static bool IsSurrogatePair(uint32_t left, uint32_t right) {
+	return (0xD800 <= left && left <= 0xDBFF) && (0xDC00 <= right && right <= 0xDFFF);
+}
+
+static size_t AlignToCacheLine(size_t size) {
+	return (size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+}
+
+static int DirtyWordCount(const Grid *grid) {
+	return (grid->rows + 63) / 64;
+}
+
+static bool IsRowDirty(const Grid *grid, int64_t row) {
+	return (grid->dirty_rows[row / 64] >> (row % 64)) & 1;
+}
+
+// Moves the dirty mark of a row along with its cells, unlike
+// GridMarkDirty this also clears it and isn't counted as damage
+static void MoveRowDirty(Grid *grid, int64_t from, int64_t to) {
+	uint64_t bit = uint64_t(1) << (to % 64);
+	if (IsRowDirty(grid, from)) {
+		grid->dirty_rows[to / 64] |= bit;
+		grid->dirty_spans[to] = grid->dirty_spans[from];
+	}
+	else {
+		grid->dirty_rows[to / 64] &= ~bit;
+	}
+}
+
+static void MarkRegionDirty(Grid *grid, const GridPendingScroll *region) {
+	for (int row = region->top; row < region->bottom; ++row) {
+		GridMarkDirty(grid, row, region->left, region->right);
+	}
+}
+
+bool GridResize(Grid *grid, int rows, int cols) {
+	if (rows <= 0 || cols <= 0 || static_cast<int64_t>(rows) * cols > MAX_GRID_CELLS) {
+		return false;
+	}
+	if (grid->memory && grid->rows == rows && grid->cols == cols) {
+		return false;
+	}
+
+	size_t cell_count = static_cast<size_t>(rows) * cols;
+	size_t chars_size = AlignToCacheLine(cell_count * sizeof(uint32_t));
+	size_t hl_ids_size = AlignToCacheLine(cell_count * sizeof(uint16_t));
+	size_t flags_size = AlignToCacheLine(cell_count * sizeof(uint8_t));
+	size_t row_map_size = AlignToCacheLine(rows * sizeof(int32_t));
+	size_t dirty_rows_size = AlignToCacheLine((rows + 63) / 64 * sizeof(uint64_t));
+	size_t dirty_spans_size = rows * sizeof(GridSpan);
+	void *memory = malloc(chars_size + hl_ids_size + flags_size + row_map_size + dirty_rows_size + dirty_spans_size + CACHE_LINE_SIZE - 1);
+	if (!memory) {
+		return false;
+	}
+
+	GridDamageStats damage = grid->damage;
+	GridFree(grid);
+	grid->damage = damage;
+	uintptr_t base = (reinterpret_cast<uintptr_t>(memory) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+	char *arrays = reinterpret_cast<char *>(base);
+	grid->rows = rows;
+	grid->cols = cols;
+	grid->chars = reinterpret_cast<uint32_t *>(arrays);
+	grid->hl_ids = reinterpret_cast<uint16_t *>(arrays + chars_size);
+	grid->flags = reinterpret_cast<uint8_t *>(arrays + chars_size + hl_ids_size);
+	arrays += chars_size + hl_ids_size + flags_size;
+	grid->row_map = reinterpret_cast<int32_t *>(arrays);
+	grid->dirty_rows = reinterpret_cast<uint64_t *>(arrays + row_map_size);
+	grid->dirty_spans = reinterpret_cast<GridSpan *>(arrays + row_map_size + dirty_rows_size);
+	grid->memory = memory;
+	GridClear(grid);
+	return true;
+}
+
+void GridClear(Grid *grid) {
+	if (!grid->memory) {
+		return;
+	}
+	// An empty grid cell is equivalent to a space in a text layout
+	size_t cell_count = static_cast<size_t>(grid->rows) * grid->cols;
+	TranscodeFill32(grid->chars, ' ', cell_count);
+	memset(grid->hl_ids, 0, cell_count * sizeof(uint16_t));
+	memset(grid->flags, 0, cell_count * sizeof(uint8_t));
+	for (int row = 0; row < grid->rows; ++row) {
+		grid->row_map[row] = row;
+	}
+	GridMarkAllDirty(grid);
+}
+
+void GridFree(Grid *grid) {
+	free(grid->memory);
+	*grid = Grid {};
+}
+
+bool GridUpdateLine(Grid *grid, const RedrawCommandGridLine *grid_line) {
+	int64_t grid_size = static_cast<int64_t>(grid->cols) * grid->rows;
+	int64_t offset = static_cast<int64_t>(grid_line->row) * grid->cols + grid_line->col_start;
+	// Guard against writing outside the grid on malformed input
+	if (grid_line->row < 0 || grid_line->row >= grid->rows || offset < 0 || offset >= grid_size) {
+		return false;
+	}
+	int64_t cell_count = grid_line->cell_count;
+	if (offset + cell_count > grid_size) {
+		cell_count = grid_size - offset;
+	}
+
+	const uint32_t *chars = RedrawGridLineChars(grid_line);
+	const uint16_t *hl_ids = RedrawGridLineHlIds(grid_line);
+	uint32_t *grid_chars = grid->chars;
+	uint16_t *grid_hl_ids = grid->hl_ids;
+	uint8_t *flags = grid->flags;
+
+	// offset counts cells of the grid in order, for the dirty marks, cell
+	// and previous_cell are where the current and previous cell are
+	// stored, which is only contiguous within a row
+	int row = grid_line->row;
+	int col = grid_line->col_start;
+	int64_t cell = GridRowOffset(grid, row) + col;
+	int64_t previous_cell = col > 0 ? cell - 1 : row > 0 ? GridRowOffset(grid, row - 1) + grid->cols - 1 : -1;
+	int64_t first_offset = offset;
+	int64_t first_previous_cell = previous_cell;
+	uint8_t flags_before = previous_cell >= 0 ? flags[previous_cell] : 0;
+	for (int64_t i = 0; i < cell_count; ++i, ++offset) {
+		if (chars[i] == REDRAW_CELL_RIGHT_HALF) {
+			// This is the right part of the wide char. Sadly grid_line
+			// event can be splitted at the middle of wide character.
+
+			// Be careful not to overwrite right half of surrogate pair.
+			// It never happens that there is no previous cell, since it
+			// is the right half of wide char, but add check for safety.
+			if (previous_cell < 0 || !IsSurrogatePair(grid_chars[previous_cell], grid_chars[cell])) {
+				grid_chars[cell] = 0;
+			}
+
+			// This cell itself is not a wide character.
+			flags[cell] &= ~GRID_CELL_WIDE;
+
+			// Adjust properties. Again it never happens that there is no
+			// previous cell, since it is the right half of wide char, but
+			// adding check for safety.
+			if (previous_cell >= 0) {
+				// Set the wide flag for the left cell.
+				flags[previous_cell] |= GRID_CELL_WIDE;
+
+				// Inherit the highlight id from left half.
+				grid_hl_ids[cell] = grid_hl_ids[previous_cell];
+			}
+		} else {
+			// This is single width character or left half cell of wide
+			// character.
+
+			// Left cell should not be a wide character, so reset the
+			// flag. This time checking for the previous cell is mandatory.
+			if (previous_cell >= 0) {
+				flags[previous_cell] &= ~GRID_CELL_WIDE;
+			}
+
+			// The text was already converted by the reader thread,
+			// surrogate pairs are packed into a single grid cell
+			grid_chars[cell] = chars[i];
+			grid_hl_ids[cell] = hl_ids[i];
+
+			// Here we clear the wide flag unconditionally. This is
+			// because if it is actually a wide character, then the
+			// right half of the char, empty string, should be appear
+			// soon, and the flag will be set there (first branch of
+			// this `if`).
+			flags[cell] &= ~GRID_CELL_WIDE;
+		}
+
+		previous_cell = cell++;
+		if (++col == grid->cols && i + 1 < cell_count) {
+			col = 0;
+			cell = GridRowOffset(grid, ++row);
+		}
+	}
+
+	// The cell before the line may have lost or gained its wide flag, and
+	// overlong lines carry on into the following rows
+	bool previous_changed = first_previous_cell >= 0 && flags[first_previous_cell] != flags_before;
+	int64_t first_dirty = previous_changed ? first_offset - 1 : first_offset;
+	for (int64_t row_start = first_dirty - first_dirty % grid->cols; row_start < offset; row_start += grid->cols) {
+		int64_t begin = first_dirty > row_start ? first_dirty - row_start : 0;
+		int64_t end = offset - row_start;
+		GridMarkDirty(grid, static_cast<int>(row_start / grid->cols), static_cast<int>(begin),
+			static_cast<int>(end < grid->cols ? end : grid->cols));
+	}
+	return true;
+}
+
+bool GridScroll(Grid *grid, const RedrawCommandGridScroll *grid_scroll) {
+	int64_t top = grid_scroll->top;
+	int64_t bottom = grid_scroll->bottom;
+	int64_t left = grid_scroll->left;
+	int64_t right = grid_scroll->right;
+	int64_t rows = grid_scroll->rows;
+	if (top < 0 || bottom > grid->rows || left < 0 || right > grid->cols || top >= bottom || left >= right) {
+		return false;
+	}
+	if (rows == 0) {
+		return true;
+	}
+
+	// Currently nvim does not support horizontal scrolling,
+	// grid_scroll->cols is reserved for later use
+
+	GridPendingScroll region {
+		static_cast<int32_t>(top),
+		static_cast<int32_t>(bottom),
+		static_cast<int32_t>(left),
+		static_cast<int32_t>(right),
+		static_cast<int32_t>(rows)
+	};
+	if (rows >= bottom - top || -rows >= bottom - top) {
+		// Nothing stays in view
+		MarkRegionDirty(grid, &region);
+		return true;
+	}
+
+	// This part is slightly cryptic, basically we're just
+	// iterating from top to bottom or vice versa depending on scroll direction.
+	bool scrolling_down = rows > 0;
+	int64_t start_row = scrolling_down ? top : bottom - 1;
+	int64_t end_row = scrolling_down ? bottom - 1 : top;
+	int64_t increment = scrolling_down ? 1 : -1;
+
+	bool full_width = left == 0 && right == grid->cols;
+	for (int64_t j = start_row; scrolling_down ? j <= end_row : j >= end_row; j += increment) {
+		// Clip anything outside the scroll region
+		int64_t target_row = j - rows;
+		if (target_row < top || target_row >= bottom) {
+			continue;
+		}
+
+		if (full_width) {
+			// The row map is rotated below, only the marks move here
+			MoveRowDirty(grid, j, target_row);
+			continue;
+		}
+
+		size_t target = GridRowOffset(grid, static_cast<int>(target_row)) + left;
+		size_t source = GridRowOffset(grid, static_cast<int>(j)) + left;
+		memcpy(&grid->chars[target], &grid->chars[source], (right - left) * sizeof(uint32_t));
+		memcpy(&grid->hl_ids[target], &grid->hl_ids[source], (right - left) * sizeof(uint16_t));
+		memcpy(&grid->flags[target], &grid->flags[source], (right - left) * sizeof(uint8_t));
+		// The columns outside the region stay, so keep the mark the
+		// target row had as well
+		if (IsRowDirty(grid, j)) {
+			GridSpan span = grid->dirty_spans[j];
+			GridMarkDirty(grid, static_cast<int>(target_row), span.begin, span.end);
+		}
+	}
+
+	if (full_width) {
+		// The rows scrolled out of view come back in at the other end
+		int32_t *row_map = grid->row_map;
+		std::rotate(row_map + top, scrolling_down ? row_map + top + rows : row_map + bottom + rows, row_map + bottom);
+	}
+
+	int64_t first_uncovered = scrolling_down ? bottom - rows : top;
+	int64_t last_uncovered = scrolling_down ? bottom : top - rows;
+	for (int64_t row = first_uncovered; row < last_uncovered; ++row) {
+		GridMarkDirty(grid, static_cast<int>(row), static_cast<int>(left), static_cast<int>(right));
+	}
+
+	if (grid->pending_scroll_count < GRID_MAX_PENDING_SCROLLS) {
+		grid->pending_scrolls[grid->pending_scroll_count++] = region;
+	}
+	else {
+		MarkRegionDirty(grid, &region);
+	}
+	return true;
+}
+
+void GridMarkDirty(Grid *grid, int row, int begin, int end) {
+	if (!grid->memory || row < 0 || row >= grid->rows) {
+		return;
+	}
+	begin = begin > 0 ? begin : 0;
+	end = end < grid->cols ? end : grid->cols;
+	if (begin >= end) {
+		return;
+	}
+
+	uint64_t bit = uint64_t(1) << (row % 64);
+	uint64_t *word = &grid->dirty_rows[row / 64];
+	GridSpan *span = &grid->dirty_spans[row];
+	++grid->damage.marks;
+	if (*word & bit) {
+		++grid->damage.marks_coalesced;
+		span->begin = begin < span->begin ? begin : span->begin;
+		span->end = end > span->end ? end : span->end;
+	}
+	else {
+		*word |= bit;
+		*span = GridSpan { begin, end };
+	}
+}
+
+void GridMarkAllDirty(Grid *grid) {
+	if (!grid->memory) {
+		return;
+	}
+	int word_count = DirtyWordCount(grid);
+	memset(grid->dirty_rows, 0xFF, word_count * sizeof(uint64_t));
+	// Keep the bits past the last row clear so scans end there
+	if (grid->rows % 64) {
+		grid->dirty_rows[word_count - 1] = (uint64_t(1) << (grid->rows % 64)) - 1;
+	}
+	for (int row = 0; row < grid->rows; ++row) {
+		grid->dirty_spans[row] = GridSpan { 0, grid->cols };
+	}
+	grid->pending_scroll_count = 0;
+}
+
+void GridMarkScrollsDirty(Grid *grid) {
+	// Scrolls only move rows within their region, so whatever the order
+	// they came in, every row that changed lies in one of them
+	for (int i = 0; i < grid->pending_scroll_count; ++i) {
+		MarkRegionDirty(grid, &grid->pending_scrolls[i]);
+	}
+	grid->pending_scroll_count = 0;
+}
+
+void GridClearDirty(Grid *grid) {
+	if (grid->memory) {
+		memset(grid->dirty_rows, 0, DirtyWordCount(grid) * sizeof(uint64_t));
+	}
+	grid->pending_scroll_count = 0;
+}
+
+int GridNextDirtyRow(const Grid *grid, int row) {
+	if (!grid->memory || row >= grid->rows) {
+		return -1;
+	}
+	row = row > 0 ? row : 0;
+	int word = row / 64;
+	uint64_t bits = grid->dirty_rows[word] & (~uint64_t(0) << (row % 64));
+	for (;;) {
+		if (bits) {
+			return word * 64 + std::countr_zero(bits);
+		}
+		if (++word >= DirtyWordCount(grid)) {
+			return -1;
+		}
+		bits = grid->dirty_rows[word];
+	}
+}
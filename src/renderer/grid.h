@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "nvim/redraw_commands.h"
+
+// Cell flags
+constexpr uint8_t GRID_CELL_WIDE = 1 << 0; // Left half of a wide character
+
+// Columns [begin, end) of a row that changed
+struct GridSpan {
+	int32_t begin;
+	int32_t end;
+};
+
+// A grid_scroll the drawn rows haven't followed yet, see Grid
+struct GridPendingScroll {
+	int32_t top;
+	int32_t bottom;
+	int32_t left;
+	int32_t right;
+	int32_t rows;
+};
+constexpr int GRID_MAX_PENDING_SCROLLS = 16;
+
+// Kept across resizes. Drawing rows as commands arrived laid out a row
+// once per mark, marks_coalesced counts the layouts that saves.
+struct GridDamageStats {
+	uint64_t marks;
+	uint64_t marks_coalesced;
+};
+
+// The cell state of nvim's grid, kept apart from the renderer so redraw
+// commands can be applied (and replayed) without drawing anything.
+//
+// Cells are stored as parallel arrays of rows * cols entries, each one
+// starting on a cache line: the REDRAW_CELL encoding of their text (a
+// space when empty), the highlight id and GRID_CELL_* flags. Rows are
+// reached through row_map, scrolling the full width of the grid only
+// rotates its entries instead of copying cells, so index the arrays
+// with GridRowOffset.
+//
+// Updates mark the rows they touch dirty, along with the columns that
+// changed, so whoever draws the grid only has to visit those rows and
+// clears the marks once it has. Rows moved by a scroll aren't marked,
+// the scroll is queued in pending_scrolls instead so the drawn rows can
+// be moved along with a blit, or marked with GridMarkScrollsDirty when
+// they can't be. Dirty marks move with the rows they belong to.
+struct Grid {
+	int rows;
+	int cols;
+	uint32_t *chars;
+	uint16_t *hl_ids;
+	uint8_t *flags;
+	// The physical row each row of the grid is stored in
+	int32_t *row_map;
+
+	// A bit per row, and the span that changed for each dirty row
+	uint64_t *dirty_rows;
+	GridSpan *dirty_spans;
+	GridDamageStats damage;
+
+	GridPendingScroll pending_scrolls[GRID_MAX_PENDING_SCROLLS];
+	int pending_scroll_count;
+
+	// Single allocation behind all of the above
+	void *memory;
+};
+
+// Returns true if the grid was reallocated, which also clears it
+bool GridResize(Grid *grid, int rows, int cols);
+void GridClear(Grid *grid);
+void GridFree(Grid *grid);
+
+// Index of the first cell of a row in chars, hl_ids and flags
+inline size_t GridRowOffset(const Grid *grid, int row) {
+	return static_cast<size_t>(grid->row_map[row]) * grid->cols;
+}
+
+// Returns false if the row lies outside the grid, cells past the end of
+// the grid are dropped
+bool GridUpdateLine(Grid *grid, const RedrawCommandGridLine *grid_line);
+
+// Returns false if the region lies outside the grid. Rows of the region
+// that were moved are [top, bottom - rows) when scrolling down and
+// [top - rows, bottom) when scrolling up. The rows scrolled into view
+// are marked dirty and hold stale cells until nvim redraws them.
+bool GridScroll(Grid *grid, const RedrawCommandGridScroll *grid_scroll);
+
+// Columns are clamped to the grid, rows outside of it are ignored
+void GridMarkDirty(Grid *grid, int row, int begin, int end);
+// Also drops the pending scrolls, every row gets drawn anyway
+void GridMarkAllDirty(Grid *grid);
+// Marks the regions of the pending scrolls dirty and drops them, for
+// when the drawn rows can't be moved
+void GridMarkScrollsDirty(Grid *grid);
+// Clears the dirty marks and pending scrolls
+void GridClearDirty(Grid *grid);
+// The first dirty row at or after row, -1 if there is none
+int GridNextDirtyRow(const Grid *grid, int row);
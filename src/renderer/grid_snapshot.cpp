@@ -0,0 +1,479 @@
+#include "grid_snapshot.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+static SnapshotRow *CreateRow(const Grid *grid, int row) {
+	size_t cols = static_cast<size_t>(grid->cols);
+	void *memory = malloc(sizeof(SnapshotRow) + cols * (sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t)));
+	if (!memory) {
+		return nullptr;
+	}
+	SnapshotRow *snapshot_row = new (memory) SnapshotRow {};
+	snapshot_row->refs.store(1, std::memory_order_relaxed);
+	snapshot_row->cols = grid->cols;
+	snapshot_row->chars = reinterpret_cast<uint32_t *>(snapshot_row + 1);
+	snapshot_row->hl_ids = reinterpret_cast<uint16_t *>(snapshot_row->chars + cols);
+	snapshot_row->flags = reinterpret_cast<uint8_t *>(snapshot_row->hl_ids + cols);
+
+	size_t offset = GridRowOffset(grid, row);
+	memcpy(snapshot_row->chars, &grid->chars[offset], cols * sizeof(uint32_t));
+	memcpy(snapshot_row->hl_ids, &grid->hl_ids[offset], cols * sizeof(uint16_t));
+	memcpy(snapshot_row->flags, &grid->flags[offset], cols * sizeof(uint8_t));
+	return snapshot_row;
+}
+
+static void AcquireRow(SnapshotRow *row) {
+	row->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void ReleaseRow(SnapshotRow *row) {
+	if (row && row->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		row->~SnapshotRow();
+		free(row);
+	}
+}
+
+void GridSnapshotFree(GridSnapshot *snapshot) {
+	if (!snapshot) {
+		return;
+	}
+	for (int i = 0; snapshot->row_data && i < snapshot->rows; ++i) {
+		ReleaseRow(snapshot->row_data[i]);
+	}
+	free(snapshot->row_data);
+	free(snapshot->highlights);
+	free(snapshot);
+}
+
+// Folds an untaken snapshot into the one replacing it, so the result
+// describes everything that changed since the one before older
+static void FoldSnapshot(GridSnapshot *older, GridSnapshot *snapshot) {
+	snapshot->flushes += older->flushes;
+
+	// Scrolls of a grid since resized are no use to follow
+	bool resized = older->rows != snapshot->rows || older->cols != snapshot->cols;
+	if (resized || older->scrolls_dropped || older->scroll_count + snapshot->scroll_count > GRID_MAX_PENDING_SCROLLS) {
+		snapshot->scrolls_dropped = true;
+		snapshot->scroll_count = 0;
+	}
+	else if (!snapshot->scrolls_dropped) {
+		memmove(&snapshot->scrolls[older->scroll_count], snapshot->scrolls,
+			snapshot->scroll_count * sizeof(GridPendingScroll));
+		memcpy(snapshot->scrolls, older->scrolls, older->scroll_count * sizeof(GridPendingScroll));
+		snapshot->scroll_count += older->scroll_count;
+	}
+
+	if (older->highlight_count) {
+		size_t count = static_cast<size_t>(older->highlight_count) + snapshot->highlight_count;
+		SnapshotHighlight *highlights = static_cast<SnapshotHighlight *>(malloc(count * sizeof(SnapshotHighlight)));
+		if (highlights) {
+			memcpy(highlights, older->highlights, older->highlight_count * sizeof(SnapshotHighlight));
+			if (snapshot->highlight_count) {
+				memcpy(&highlights[older->highlight_count], snapshot->highlights,
+					snapshot->highlight_count * sizeof(SnapshotHighlight));
+			}
+			free(snapshot->highlights);
+			snapshot->highlights = highlights;
+			snapshot->highlight_count = static_cast<int>(count);
+		}
+	}
+	// Colors and the cursor are always the latest
+	snapshot->default_colors_changed |= older->default_colors_changed;
+	snapshot->cursor_changed |= older->cursor_changed;
+}
+
+void SnapshotChannelInitialize(SnapshotChannel *channel) {
+	channel->latest.store(nullptr);
+	channel->woken = false;
+	channel->published.store(0);
+	channel->folded.store(0);
+	channel->taken.store(0);
+}
+
+void SnapshotChannelShutdown(SnapshotChannel *channel) {
+	GridSnapshotFree(channel->latest.exchange(nullptr));
+}
+
+void SnapshotChannelPublish(SnapshotChannel *channel, GridSnapshot *snapshot) {
+	// Only the publishing thread stores, so the slot stays empty until the
+	// folded snapshot goes in
+	GridSnapshot *older = channel->latest.exchange(nullptr, std::memory_order_acquire);
+	if (older) {
+		FoldSnapshot(older, snapshot);
+		GridSnapshotFree(older);
+		channel->folded.fetch_add(1, std::memory_order_relaxed);
+	}
+	channel->latest.store(snapshot, std::memory_order_release);
+	channel->published.fetch_add(1, std::memory_order_relaxed);
+	SnapshotChannelWake(channel);
+}
+
+GridSnapshot *SnapshotChannelTake(SnapshotChannel *channel) {
+	GridSnapshot *snapshot = channel->latest.exchange(nullptr, std::memory_order_acquire);
+	if (snapshot) {
+		channel->taken.fetch_add(1, std::memory_order_relaxed);
+	}
+	return snapshot;
+}
+
+void SnapshotChannelWait(SnapshotChannel *channel, uint64_t timeout_ns) {
+	std::unique_lock<std::mutex> lock(channel->mutex);
+	if (timeout_ns == UINT64_MAX) {
+		channel->wakeup.wait(lock, [channel]() { return channel->woken; });
+	}
+	else {
+		channel->wakeup.wait_for(lock, std::chrono::nanoseconds(timeout_ns), [channel]() { return channel->woken; });
+	}
+	channel->woken = false;
+}
+
+void SnapshotChannelWake(SnapshotChannel *channel) {
+	{
+		std::lock_guard<std::mutex> lock(channel->mutex);
+		channel->woken = true;
+	}
+	channel->wakeup.notify_one();
+}
+
+bool SnapshotModelInitialize(SnapshotModel *model) {
+	model->defined_ids = static_cast<int32_t *>(malloc((static_cast<size_t>(MAX_HIGHLIGHT_ATTRIBS) + 1) * sizeof(int32_t)));
+	return model->defined_ids != nullptr && UiStateInitialize(&model->ui, false);
+}
+
+static void ReleasePublished(SnapshotModel *model) {
+	for (int i = 0; model->published && i < model->published_rows; ++i) {
+		ReleaseRow(model->published[i]);
+	}
+	free(model->published);
+	model->published = nullptr;
+	model->published_rows = 0;
+	model->published_cols = 0;
+}
+
+void SnapshotModelShutdown(SnapshotModel *model) {
+	ReleasePublished(model);
+	free(model->defined_ids);
+	model->defined_ids = nullptr;
+	UiStateShutdown(&model->ui);
+}
+
+static void TrackCommand(SnapshotModel *model, const RedrawCommand *command) {
+	switch (command->event) {
+	case RedrawEvent::hl_attr_define: {
+		int32_t id = reinterpret_cast<const RedrawCommandHlAttrDefine *>(command)->id;
+		if (id < 0 || id > MAX_HIGHLIGHT_ATTRIBS) {
+			break;
+		}
+		uint64_t bit = uint64_t(1) << (id % 64);
+		if (!(model->defined_bits[id / 64] & bit)) {
+			model->defined_bits[id / 64] |= bit;
+			model->defined_ids[model->defined_count++] = id;
+		}
+	} break;
+	case RedrawEvent::default_colors_set: {
+		model->default_colors_changed = true;
+	} break;
+	case RedrawEvent::grid_cursor_goto:
+	case RedrawEvent::mode_change: {
+		model->cursor_changed = true;
+	} break;
+	default: {
+	} break;
+	}
+}
+
+int SnapshotModelApply(SnapshotModel *model, const char *commands, size_t size, SnapshotChannel *channel) {
+	RedrawCommandReader reader;
+	if (!RedrawCommandsBegin(&reader, commands, size)) {
+		return 0;
+	}
+	int published = 0;
+	while (const RedrawCommand *command = RedrawNextCommand(&reader)) {
+		UiStateApply(&model->ui, command);
+		TrackCommand(model, command);
+		if (command->event == RedrawEvent::flush) {
+			// Out of memory the changes stay pending for the next flush
+			if (GridSnapshot *snapshot = SnapshotModelBuild(model)) {
+				SnapshotChannelPublish(channel, snapshot);
+				++published;
+			}
+		}
+	}
+	return published;
+}
+
+static bool IsRowDirty(const Grid *grid, int row) {
+	return (grid->dirty_rows[row / 64] >> (row % 64)) & 1;
+}
+
+// Rows a grid_scroll of part of the width copied cells into. Later full
+// width scrolls may have moved them since, but only within their own
+// regions, so every such row lies within the span of all the regions.
+static void PartialScrollSpan(const Grid *grid, int *top, int *bottom) {
+	*top = grid->rows;
+	*bottom = 0;
+	bool partial = false;
+	for (int i = 0; i < grid->pending_scroll_count; ++i) {
+		const GridPendingScroll *scroll = &grid->pending_scrolls[i];
+		partial |= scroll->left != 0 || scroll->right != grid->cols;
+		*top = scroll->top < *top ? scroll->top : *top;
+		*bottom = scroll->bottom > *bottom ? scroll->bottom : *bottom;
+	}
+	if (!partial) {
+		*top = 0;
+		*bottom = 0;
+	}
+}
+
+static bool BuildRows(SnapshotModel *model, GridSnapshot *snapshot) {
+	Grid *grid = &model->ui.grid;
+	if (!grid->memory) {
+		return true;
+	}
+	if (model->published_rows != grid->rows || model->published_cols != grid->cols) {
+		ReleasePublished(model);
+		model->published = static_cast<SnapshotRow **>(calloc(grid->rows, sizeof(SnapshotRow *)));
+		if (!model->published) {
+			return false;
+		}
+		model->published_rows = grid->rows;
+		model->published_cols = grid->cols;
+	}
+	snapshot->row_data = static_cast<SnapshotRow **>(calloc(grid->rows, sizeof(SnapshotRow *)));
+	if (!snapshot->row_data) {
+		return false;
+	}
+	snapshot->rows = grid->rows;
+	snapshot->cols = grid->cols;
+
+	int partial_top, partial_bottom;
+	PartialScrollSpan(grid, &partial_top, &partial_bottom);
+	for (int row = 0; row < grid->rows; ++row) {
+		SnapshotRow **published = &model->published[grid->row_map[row]];
+		if (!*published || IsRowDirty(grid, row) || (row >= partial_top && row < partial_bottom)) {
+			SnapshotRow *copy = CreateRow(grid, row);
+			if (!copy) {
+				return false;
+			}
+			ReleaseRow(*published);
+			*published = copy;
+			++model->stats.rows_copied;
+		}
+		else {
+			++model->stats.rows_shared;
+		}
+		AcquireRow(*published);
+		snapshot->row_data[row] = *published;
+	}
+
+	snapshot->scroll_count = grid->pending_scroll_count;
+	memcpy(snapshot->scrolls, grid->pending_scrolls, grid->pending_scroll_count * sizeof(GridPendingScroll));
+	return true;
+}
+
+GridSnapshot *SnapshotModelBuild(SnapshotModel *model) {
+	GridSnapshot *snapshot = static_cast<GridSnapshot *>(calloc(1, sizeof(GridSnapshot)));
+	if (!snapshot) {
+		return nullptr;
+	}
+	if (model->defined_count) {
+		snapshot->highlights = static_cast<SnapshotHighlight *>(
+			malloc(model->defined_count * sizeof(SnapshotHighlight)));
+	}
+	if (!BuildRows(model, snapshot) || (model->defined_count && !snapshot->highlights)) {
+		// Rows already rebuilt stay published, they match the grid
+		GridSnapshotFree(snapshot);
+		return nullptr;
+	}
+
+	UiState *ui = &model->ui;
+	for (int i = 0; i < model->defined_count; ++i) {
+		int32_t id = model->defined_ids[i];
+		snapshot->highlights[i] = SnapshotHighlight { id, ui->hl_attribs[id] };
+		model->defined_bits[id / 64] = 0;
+	}
+	snapshot->highlight_count = model->defined_count;
+	snapshot->default_colors_changed = model->default_colors_changed;
+	snapshot->default_colors = ui->hl_attribs[0];
+
+	memcpy(snapshot->cursor_mode_infos, ui->cursor_mode_infos, sizeof(snapshot->cursor_mode_infos));
+	snapshot->cursor_mode = ui->cursor.mode_info ? static_cast<int>(ui->cursor.mode_info - ui->cursor_mode_infos) : -1;
+	snapshot->cursor_row = ui->cursor.row;
+	snapshot->cursor_col = ui->cursor.col;
+	snapshot->cursor_changed = model->cursor_changed;
+	snapshot->busy = ui->busy;
+
+	snapshot->sequence = ++model->sequence;
+	snapshot->flushes = 1;
+	++model->stats.snapshots;
+	snapshot->model_stats = model->stats;
+	snapshot->damage = ui->grid.damage;
+
+	model->defined_count = 0;
+	model->default_colors_changed = false;
+	model->cursor_changed = false;
+	if (ui->grid.memory) {
+		GridClearDirty(&ui->grid);
+	}
+	return snapshot;
+}
+
+// Copies the columns of a row that differ from the snapshot, returns
+// false if none do
+static bool UpdateRow(Grid *grid, int row, const SnapshotRow *snapshot_row) {
+	size_t offset = GridRowOffset(grid, row);
+	uint32_t *chars = &grid->chars[offset];
+	uint16_t *hl_ids = &grid->hl_ids[offset];
+	uint8_t *flags = &grid->flags[offset];
+	int cols = grid->cols;
+	int begin = 0;
+	while (begin < cols && chars[begin] == snapshot_row->chars[begin] &&
+		hl_ids[begin] == snapshot_row->hl_ids[begin] && flags[begin] == snapshot_row->flags[begin]) {
+		++begin;
+	}
+	if (begin == cols) {
+		return false;
+	}
+	int end = cols;
+	while (chars[end - 1] == snapshot_row->chars[end - 1] && hl_ids[end - 1] == snapshot_row->hl_ids[end - 1] &&
+		flags[end - 1] == snapshot_row->flags[end - 1]) {
+		--end;
+	}
+	size_t count = static_cast<size_t>(end - begin);
+	memcpy(&chars[begin], &snapshot_row->chars[begin], count * sizeof(uint32_t));
+	memcpy(&hl_ids[begin], &snapshot_row->hl_ids[begin], count * sizeof(uint16_t));
+	memcpy(&flags[begin], &snapshot_row->flags[begin], count * sizeof(uint8_t));
+	GridMarkDirty(grid, row, begin, end);
+	return true;
+}
+
+void SnapshotMirrorShutdown(SnapshotMirror *mirror) {
+	for (int i = 0; mirror->rows && i < mirror->row_count; ++i) {
+		ReleaseRow(mirror->rows[i]);
+	}
+	free(mirror->rows);
+	mirror->rows = nullptr;
+	mirror->row_count = 0;
+}
+
+static void ForgetRows(SnapshotMirror *mirror, int begin, int end) {
+	for (int row = begin; row < end; ++row) {
+		ReleaseRow(mirror->rows[row]);
+		mirror->rows[row] = nullptr;
+	}
+}
+
+// Follows a scroll the way GridScroll moves the cells
+static void ScrollMirror(SnapshotMirror *mirror, const GridPendingScroll *scroll, int cols) {
+	int top = scroll->top;
+	int bottom = scroll->bottom;
+	int rows = scroll->rows;
+	if (rows >= bottom - top || -rows >= bottom - top) {
+		return;
+	}
+	if (scroll->left != 0 || scroll->right != cols) {
+		// Cells were copied into the rows, but not the columns outside
+		ForgetRows(mirror, top, bottom);
+		return;
+	}
+	// The rows scrolled into view keep the cells that were scrolled out
+	SnapshotRow **row_data = mirror->rows;
+	std::rotate(row_data + top, rows > 0 ? row_data + top + rows : row_data + bottom + rows, row_data + bottom);
+}
+
+static void ApplyRows(Grid *grid, SnapshotMirror *mirror, const GridSnapshot *snapshot) {
+	if (!snapshot->row_data) {
+		return;
+	}
+	bool resized = grid->rows != snapshot->rows || grid->cols != snapshot->cols;
+	if (resized || mirror->row_count != snapshot->rows) {
+		// A new grid is cleared and all dirty, the rows only need copying
+		if (resized && !GridResize(grid, snapshot->rows, snapshot->cols)) {
+			return;
+		}
+		SnapshotMirrorShutdown(mirror);
+		mirror->rows = static_cast<SnapshotRow **>(calloc(snapshot->rows, sizeof(SnapshotRow *)));
+		if (!mirror->rows) {
+			return;
+		}
+		mirror->row_count = snapshot->rows;
+	}
+	if (snapshot->scrolls_dropped) {
+		// Scrolled cells aren't moved, the rows that differ are drawn again
+		ForgetRows(mirror, 0, mirror->row_count);
+	}
+	for (int i = 0; !resized && i < snapshot->scroll_count; ++i) {
+		const GridPendingScroll *scroll = &snapshot->scrolls[i];
+		RedrawCommandGridScroll grid_scroll {};
+		grid_scroll.top = scroll->top;
+		grid_scroll.bottom = scroll->bottom;
+		grid_scroll.left = scroll->left;
+		grid_scroll.right = scroll->right;
+		grid_scroll.rows = scroll->rows;
+		if (GridScroll(grid, &grid_scroll)) {
+			ScrollMirror(mirror, scroll, grid->cols);
+		}
+	}
+
+	for (int row = 0; row < grid->rows; ++row) {
+		SnapshotRow *snapshot_row = snapshot->row_data[row];
+		if (mirror->rows[row] == snapshot_row) {
+			continue;
+		}
+		++mirror->stats.rows_compared;
+		mirror->stats.rows_updated += UpdateRow(grid, row, snapshot_row);
+		AcquireRow(snapshot_row);
+		ReleaseRow(mirror->rows[row]);
+		mirror->rows[row] = snapshot_row;
+	}
+}
+
+// Marks the rows showing a highlight the snapshot redefines. Their cells
+// may not have changed, but they're drawn in the old colors.
+static void MarkRedefinedRows(Grid *grid, const GridSnapshot *snapshot) {
+	if (!grid->memory) {
+		return;
+	}
+	uint64_t redefined[STYLE_TABLE_HIGHLIGHTS / 64] {};
+	for (int i = 0; i < snapshot->highlight_count; ++i) {
+		uint32_t id = static_cast<uint32_t>(snapshot->highlights[i].id);
+		redefined[id / 64] |= uint64_t(1) << (id % 64);
+	}
+	for (int row = 0; row < grid->rows; ++row) {
+		const uint16_t *hl_ids = &grid->hl_ids[GridRowOffset(grid, row)];
+		for (int col = 0; col < grid->cols; ++col) {
+			if (redefined[hl_ids[col] / 64] & (uint64_t(1) << (hl_ids[col] % 64))) {
+				GridMarkDirty(grid, row, 0, grid->cols);
+				break;
+			}
+		}
+	}
+}
+
+void GridSnapshotApply(UiState *ui, SnapshotMirror *mirror, const GridSnapshot *snapshot) {
+	ApplyRows(&ui->grid, mirror, snapshot);
+
+	for (int i = 0; i < snapshot->highlight_count; ++i) {
+		const SnapshotHighlight *highlight = &snapshot->highlights[i];
+		ui->hl_attribs[highlight->id] = highlight->attribs;
+		StyleTableDefine(&ui->styles, highlight->id);
+	}
+	if (snapshot->default_colors_changed) {
+		ui->hl_attribs[0] = snapshot->default_colors;
+		StyleTableResolveAll(&ui->styles);
+		// Every highlight falls back to the defaults for what it leaves out
+		GridMarkAllDirty(&ui->grid);
+	}
+	else if (snapshot->highlight_count) {
+		MarkRedefinedRows(&ui->grid, snapshot);
+	}
+
+	memcpy(ui->cursor_mode_infos, snapshot->cursor_mode_infos, sizeof(ui->cursor_mode_infos));
+	ui->cursor.mode_info = snapshot->cursor_mode >= 0 ? &ui->cursor_mode_infos[snapshot->cursor_mode] : nullptr;
+	ui->cursor.row = snapshot->cursor_row;
+	ui->cursor.col = snapshot->cursor_col;
+	ui->busy = snapshot->busy;
+}
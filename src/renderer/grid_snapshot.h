@@ -0,0 +1,162 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "renderer/ui_state.h"
+
+// The cells of a row as of a flush. Rows never change once built, a row
+// nvim didn't touch is shared by every snapshot since the one it was
+// built for, and freed along with the last of them.
+struct SnapshotRow {
+	std::atomic<uint32_t> refs;
+	int cols;
+	uint32_t *chars;
+	uint16_t *hl_ids;
+	uint8_t *flags;
+};
+
+struct SnapshotHighlight {
+	int32_t id;
+	HighlightAttributes attribs;
+};
+
+struct SnapshotModelStats {
+	uint64_t snapshots;
+	uint64_t rows_copied;
+	uint64_t rows_shared;
+};
+
+// The state of the UI at a flush, built by a SnapshotModel and handed to
+// the thread that draws it through a SnapshotChannel. A snapshot belongs
+// to whoever holds it, only its rows are shared.
+//
+// Next to the rows it carries what changed since the snapshot before it,
+// so the drawing side can keep a mirror of its own: the grid_scrolls to
+// follow with a blit, and the highlights defined. Snapshots the drawing
+// side never took are folded into the next one.
+struct GridSnapshot {
+	uint64_t sequence;
+	// Flushes folded into this one, 1 for one that wasn't
+	uint32_t flushes;
+
+	int rows;
+	int cols;
+	// The rows in order, nullptr before the first grid_resize
+	SnapshotRow **row_data;
+
+	GridPendingScroll scrolls[GRID_MAX_PENDING_SCROLLS];
+	int scroll_count;
+	// More scrolls than fit were folded together, none are left to follow
+	bool scrolls_dropped;
+
+	// In the order they were defined, ids may repeat
+	SnapshotHighlight *highlights;
+	int highlight_count;
+	bool default_colors_changed;
+	HighlightAttributes default_colors;
+
+	CursorModeInfo cursor_mode_infos[MAX_CURSOR_MODE_INFOS];
+	// -1 before the first mode_change
+	int cursor_mode;
+	int cursor_row;
+	int cursor_col;
+	// The cursor moved or changed mode, which restarts blinking
+	bool cursor_changed;
+	bool busy;
+
+	// The model's counters, as of this snapshot
+	SnapshotModelStats model_stats;
+	GridDamageStats damage;
+};
+
+void GridSnapshotFree(GridSnapshot *snapshot);
+
+// Hands the latest snapshot from the thread applying nvim's redraw events
+// to the thread drawing them. There is a single slot: publishing while
+// the last snapshot is still there folds that one into the new one, so
+// the drawing side always takes the latest state at once and the
+// applying side never waits for it.
+struct SnapshotChannel {
+	std::atomic<GridSnapshot *> latest;
+
+	// Wakes the drawing side, for a snapshot or anything else it waits on
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool woken;
+
+	std::atomic<uint64_t> published;
+	std::atomic<uint64_t> folded;
+	std::atomic<uint64_t> taken;
+};
+
+void SnapshotChannelInitialize(SnapshotChannel *channel);
+// Frees a snapshot that was never taken
+void SnapshotChannelShutdown(SnapshotChannel *channel);
+
+// Takes ownership of the snapshot and wakes the drawing side
+void SnapshotChannelPublish(SnapshotChannel *channel, GridSnapshot *snapshot);
+// The latest snapshot, nullptr if there is none since the last take
+GridSnapshot *SnapshotChannelTake(SnapshotChannel *channel);
+// Waits up to timeout_ns, UINT64_MAX for no limit, unless woken since
+// the last wait
+void SnapshotChannelWait(SnapshotChannel *channel, uint64_t timeout_ns);
+void SnapshotChannelWake(SnapshotChannel *channel);
+
+// The applying side. It keeps a UiState of its own, without styles since
+// the drawing side resolves highlights, and the row last built for each
+// physical row of its grid, which stays valid until the row is marked
+// dirty or a grid_scroll of part of the width copies cells into it.
+struct SnapshotModel {
+	UiState ui;
+
+	SnapshotRow **published;
+	int published_rows;
+	int published_cols;
+
+	// Highlight ids defined since the last snapshot
+	uint64_t defined_bits[(MAX_HIGHLIGHT_ATTRIBS + 64) / 64];
+	int32_t *defined_ids;
+	int defined_count;
+	bool default_colors_changed;
+	bool cursor_changed;
+
+	uint64_t sequence;
+	SnapshotModelStats stats;
+};
+
+bool SnapshotModelInitialize(SnapshotModel *model);
+void SnapshotModelShutdown(SnapshotModel *model);
+
+// Applies a buffer of redraw commands and publishes a snapshot at every
+// flush. Returns the number published.
+int SnapshotModelApply(SnapshotModel *model, const char *commands, size_t size, SnapshotChannel *channel);
+// A snapshot of the current state, nullptr if out of memory. Resets what
+// changed since the last one.
+GridSnapshot *SnapshotModelBuild(SnapshotModel *model);
+
+struct SnapshotMirrorStats {
+	uint64_t rows_compared;
+	uint64_t rows_updated;
+};
+
+// The drawing side's record of the snapshot row each row of its grid was
+// last brought up to, moved along with the rows as the grid scrolls. It
+// holds a reference to each, so a row it names can't be freed and its
+// address taken by a new one.
+struct SnapshotMirror {
+	SnapshotRow **rows;
+	int row_count;
+	SnapshotMirrorStats stats;
+};
+
+void SnapshotMirrorShutdown(SnapshotMirror *mirror);
+
+// Brings the drawing side's UiState up to a snapshot. Scrolls are applied
+// to the grid as GridScroll does, queued for a blit, then every row that
+// isn't the one the mirror names for it is compared with the snapshot
+// and marked dirty for the columns that differ. Rows showing a highlight
+// the snapshot redefines are marked dirty whole, as is every row when the
+// default colors change.
+void GridSnapshotApply(UiState *ui, SnapshotMirror *mirror, const GridSnapshot *snapshot);
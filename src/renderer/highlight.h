@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+
+// Highlight attributes as defined by nvim's hl_attr_define, shared between
+// the redraw decoder and the renderer.
+constexpr uint32_t DEFAULT_COLOR = 0x46464646;
+enum HighlightAttributeFlags : uint16_t {
+	HL_ATTRIB_REVERSE			= 1 << 0,
+	HL_ATTRIB_ITALIC			= 1 << 1,
+	HL_ATTRIB_BOLD				= 1 << 2,
+	HL_ATTRIB_STRIKETHROUGH		= 1 << 3,
+	HL_ATTRIB_UNDERLINE			= 1 << 4,
+	HL_ATTRIB_UNDERCURL			= 1 << 5
+};
+struct HighlightAttributes {
+	uint32_t foreground;
+	uint32_t background;
+	uint32_t special;
+	uint16_t flags;
+};
@@ -0,0 +1,194 @@
+#include "layout_cache.h"
+#include <cstdlib>
+#include <cstring>
+
+static void ResetEntries(LayoutCache *cache) {
+	for (int i = 0; i < cache->count; ++i) {
+		cache->release(cache->entries[i].layout);
+	}
+	cache->count = 0;
+	cache->newest = -1;
+	cache->oldest = -1;
+	memset(cache->buckets, 0xFF, sizeof(cache->buckets));
+}
+
+void LayoutCacheInitialize(LayoutCache *cache, void (*release)(void *layout)) {
+	*cache = LayoutCache {};
+	cache->release = release;
+	ResetEntries(cache);
+}
+
+void LayoutCacheShutdown(LayoutCache *cache) {
+	ResetEntries(cache);
+	free(cache->key_memory);
+	cache->key_memory = nullptr;
+	cache->key_cols = 0;
+}
+
+void LayoutCacheInvalidate(LayoutCache *cache) {
+	ResetEntries(cache);
+	++cache->generation;
+	++cache->stats.invalidations;
+}
+
+static uint64_t Mix(uint64_t hash, uint64_t value) {
+	hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+	return hash ^ (hash >> 32);
+}
+
+// Four independent lanes over 8 byte words, a single one waits on a
+// multiply per word
+struct HashLanes {
+	uint64_t lanes[4];
+};
+
+static void HashBytes(HashLanes *hash, const void *data, size_t size) {
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	uint64_t lane0 = hash->lanes[0];
+	uint64_t lane1 = hash->lanes[1];
+	uint64_t lane2 = hash->lanes[2];
+	uint64_t lane3 = hash->lanes[3];
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		uint64_t words[4];
+		memcpy(words, &bytes[i], sizeof(words));
+		lane0 = Mix(lane0, words[0]);
+		lane1 = Mix(lane1, words[1]);
+		lane2 = Mix(lane2, words[2]);
+		lane3 = Mix(lane3, words[3]);
+	}
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, &bytes[i], sizeof(word));
+		lane0 = Mix(lane0, word);
+	}
+	if (i < size) {
+		uint64_t word = 0;
+		memcpy(&word, &bytes[i], size - i);
+		lane0 = Mix(lane0, word);
+	}
+	*hash = HashLanes { lane0, lane1, lane2, lane3 };
+}
+
+uint64_t LayoutCacheHash(const LayoutCache *cache, const LayoutCacheRow *row) {
+	uint64_t seed = Mix(cache->generation, static_cast<uint64_t>(row->cols));
+	HashLanes lanes { seed, seed + 1, seed + 2, seed + 3 };
+	HashBytes(&lanes, row->chars, row->cols * sizeof(uint32_t));
+	HashBytes(&lanes, row->hl_ids, row->cols * sizeof(uint16_t));
+	HashBytes(&lanes, row->flags, row->cols * sizeof(uint8_t));
+	uint64_t hash = Mix(Mix(Mix(lanes.lanes[0], lanes.lanes[1]), lanes.lanes[2]), lanes.lanes[3]);
+
+	// The bucket comes from the low bits, which the multiplies mix least
+	hash ^= hash >> 29;
+	hash *= 0xBF58476D1CE4E5B9ull;
+	return hash ^ (hash >> 32);
+}
+
+static bool KeyEquals(const LayoutCache *cache, int32_t index, const LayoutCacheRow *row) {
+	size_t offset = static_cast<size_t>(index) * cache->key_cols;
+	return !memcmp(&cache->key_chars[offset], row->chars, row->cols * sizeof(uint32_t)) &&
+		!memcmp(&cache->key_hl_ids[offset], row->hl_ids, row->cols * sizeof(uint16_t)) &&
+		!memcmp(&cache->key_flags[offset], row->flags, row->cols * sizeof(uint8_t));
+}
+
+static void Unlink(LayoutCache *cache, int32_t index) {
+	LayoutCacheEntry *entry = &cache->entries[index];
+	if (entry->newer >= 0) {
+		cache->entries[entry->newer].older = entry->older;
+	}
+	else {
+		cache->newest = entry->older;
+	}
+	if (entry->older >= 0) {
+		cache->entries[entry->older].newer = entry->newer;
+	}
+	else {
+		cache->oldest = entry->newer;
+	}
+}
+
+static void LinkNewest(LayoutCache *cache, int32_t index) {
+	LayoutCacheEntry *entry = &cache->entries[index];
+	entry->newer = -1;
+	entry->older = cache->newest;
+	if (cache->newest >= 0) {
+		cache->entries[cache->newest].newer = index;
+	}
+	else {
+		cache->oldest = index;
+	}
+	cache->newest = index;
+}
+
+void *LayoutCacheFind(LayoutCache *cache, uint64_t hash, const LayoutCacheRow *row) {
+	if (row->cols == cache->key_cols) {
+		int32_t index = cache->buckets[hash & (LAYOUT_CACHE_BUCKETS - 1)];
+		for (; index >= 0; index = cache->entries[index].next_in_bucket) {
+			if (cache->entries[index].hash == hash && KeyEquals(cache, index, row)) {
+				if (cache->newest != index) {
+					Unlink(cache, index);
+					LinkNewest(cache, index);
+				}
+				++cache->stats.hits;
+				return cache->entries[index].layout;
+			}
+		}
+	}
+	++cache->stats.misses;
+	return nullptr;
+}
+
+static bool ResizeKeys(LayoutCache *cache, int cols) {
+	size_t cells = static_cast<size_t>(LAYOUT_CACHE_ENTRIES) * cols;
+	void *memory = malloc(cells * (sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t)));
+	if (!memory) {
+		return false;
+	}
+
+	ResetEntries(cache);
+	free(cache->key_memory);
+	cache->key_memory = memory;
+	cache->key_cols = cols;
+	cache->key_chars = static_cast<uint32_t *>(memory);
+	cache->key_hl_ids = reinterpret_cast<uint16_t *>(cache->key_chars + cells);
+	cache->key_flags = reinterpret_cast<uint8_t *>(cache->key_hl_ids + cells);
+	return true;
+}
+
+bool LayoutCacheInsert(LayoutCache *cache, uint64_t hash, const LayoutCacheRow *row, void *layout) {
+	if (row->cols <= 0 || (row->cols != cache->key_cols && !ResizeKeys(cache, row->cols))) {
+		return false;
+	}
+
+	int32_t index;
+	if (cache->count < LAYOUT_CACHE_ENTRIES) {
+		index = cache->count++;
+	}
+	else {
+		// Evict the least recently used entry and take its place
+		index = cache->oldest;
+		LayoutCacheEntry *evicted = &cache->entries[index];
+		int32_t *link = &cache->buckets[evicted->hash & (LAYOUT_CACHE_BUCKETS - 1)];
+		while (*link != index) {
+			link = &cache->entries[*link].next_in_bucket;
+		}
+		*link = evicted->next_in_bucket;
+		Unlink(cache, index);
+		cache->release(evicted->layout);
+		++cache->stats.evictions;
+	}
+
+	LayoutCacheEntry *entry = &cache->entries[index];
+	int32_t *bucket = &cache->buckets[hash & (LAYOUT_CACHE_BUCKETS - 1)];
+	entry->hash = hash;
+	entry->layout = layout;
+	entry->next_in_bucket = *bucket;
+	*bucket = index;
+	LinkNewest(cache, index);
+
+	size_t offset = static_cast<size_t>(index) * cache->key_cols;
+	memcpy(&cache->key_chars[offset], row->chars, row->cols * sizeof(uint32_t));
+	memcpy(&cache->key_hl_ids[offset], row->hl_ids, row->cols * sizeof(uint16_t));
+	memcpy(&cache->key_flags[offset], row->flags, row->cols * sizeof(uint8_t));
+	return true;
+}
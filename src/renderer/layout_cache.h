@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Text layouts of grid rows the renderer made recently, so a row drawn
+// again unchanged (the row the cursor left, a statusline nvim sent again)
+// doesn't have its text laid out again. Rows are found by a hash of their
+// cells and compared in full, so a collision can't draw the wrong text.
+// Layouts are opaque here, the least recently used one is handed to the
+// release function when the cache is full.
+constexpr int LAYOUT_CACHE_ENTRIES = 256;
+constexpr int LAYOUT_CACHE_BUCKETS = 512;
+static_assert((LAYOUT_CACHE_BUCKETS & (LAYOUT_CACHE_BUCKETS - 1)) == 0);
+
+// The cells of a grid row, as the key of its layout
+struct LayoutCacheRow {
+	const uint32_t *chars;
+	const uint16_t *hl_ids;
+	const uint8_t *flags;
+	int cols;
+};
+
+struct LayoutCacheEntry {
+	uint64_t hash;
+	void *layout;
+	int32_t next_in_bucket;
+	// Recency list, -1 at either end
+	int32_t newer;
+	int32_t older;
+};
+
+struct LayoutCacheStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t invalidations;
+};
+
+struct LayoutCache {
+	LayoutCacheEntry entries[LAYOUT_CACHE_ENTRIES];
+	int32_t buckets[LAYOUT_CACHE_BUCKETS];
+	int count;
+	int32_t newest;
+	int32_t oldest;
+	// Seeds every hash, bumped on invalidation
+	uint32_t generation;
+
+	// The row of every entry, key_cols cells each. All rows of a grid
+	// are the same length, the cache starts over when that changes.
+	int key_cols;
+	uint32_t *key_chars;
+	uint16_t *key_hl_ids;
+	uint8_t *key_flags;
+	void *key_memory;
+
+	void (*release)(void *layout);
+	LayoutCacheStats stats;
+};
+
+void LayoutCacheInitialize(LayoutCache *cache, void (*release)(void *layout));
+void LayoutCacheShutdown(LayoutCache *cache);
+// Releases every layout, for when something they were made with (the
+// font, the DPI, colors or highlights) changes
+void LayoutCacheInvalidate(LayoutCache *cache);
+
+uint64_t LayoutCacheHash(const LayoutCache *cache, const LayoutCacheRow *row);
+// Returns the layout of an identical row, or nullptr
+void *LayoutCacheFind(LayoutCache *cache, uint64_t hash, const LayoutCacheRow *row);
+// Adds the layout of a row that isn't in the cache and takes it over.
+// Returns false if the keys couldn't be allocated, the caller keeps the
+// layout then.
+bool LayoutCacheInsert(LayoutCache *cache, uint64_t hash, const LayoutCacheRow *row, void *layout);
@@ -1,5 +1,9 @@
 #include "renderer.h"
+#include <bit>
+#include "common/clock.h"
+#include "common/transcode.h"
 #include "renderer/glyph_renderer.h"
+#include "nvim/redraw_commands.h"
 
 void InitializeD2D(Renderer *renderer) {
 	D2D1_FACTORY_OPTIONS options {};
@@ -43,6 +47,7 @@ void InitializeD3D(Renderer *renderer) {
 	WIN_CHECK(renderer->d2d_context->CreateSolidColorBrush(
 		D2D1::ColorF(D2D1::ColorF::Black),
 		renderer->d2d_background_rect_brush.GetAddressOf()));
+	renderer->background_rect_color = StyleColor { 0.0f, 0.0f, 0.0f, 1.0f };
 }
 
 void InitializeDWrite(Renderer *renderer) {
@@ -67,6 +72,8 @@ void InitializeWindowDependentResources(Renderer *renderer, uint32_t width, uint
 
 	renderer->pixel_size.width = width;
 	renderer->pixel_size.height = height;
+	// The pixels under the cursor went with the old buffers
+	renderer->cursor_saved = false;
 
 	ID3D11RenderTargetView *null_views[] = { nullptr };
 	renderer->d3d_context->OMSetRenderTargets(ARRAYSIZE(null_views), null_views, nullptr);
@@ -133,12 +140,28 @@ void InitializeWindowDependentResources(Renderer *renderer, uint32_t width, uint
 		renderer->d2d_target_bitmap.GetAddressOf()
 	));
 	renderer->d2d_context->SetAntialiasMode(D2D1_ANTIALIAS_MODE_ALIASED);
+
+	renderer->scroll_texture.Reset();
+	if (width > 0 && height > 0) {
+		D3D11_TEXTURE2D_DESC scroll_texture_desc {};
+		scroll_texture_desc.Width = width;
+		scroll_texture_desc.Height = height;
+		scroll_texture_desc.MipLevels = 1;
+		scroll_texture_desc.ArraySize = 1;
+		scroll_texture_desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		scroll_texture_desc.SampleDesc.Count = 1;
+		scroll_texture_desc.Usage = D3D11_USAGE_DEFAULT;
+		WIN_CHECK(renderer->d3d_device->CreateTexture2D(&scroll_texture_desc, nullptr,
+			renderer->scroll_texture.GetAddressOf()));
+	}
 }
 
 void HandleDeviceLost(Renderer *renderer) {
 	renderer->d3d_device.Reset();
 	renderer->d3d_context.Reset();
 	renderer->dxgi_swapchain.Reset();
+	renderer->scroll_texture.Reset();
+	renderer->cursor_texture.Reset();
 	renderer->d2d_factory.Reset();
 	renderer->d2d_device.Reset();
 	renderer->d2d_context.Reset();
@@ -148,6 +171,8 @@ void HandleDeviceLost(Renderer *renderer) {
 	renderer->dwrite_text_format.Reset();
 	renderer->dwrite_typography.Reset();
 	renderer->glyph_renderer.reset();
+	LayoutCacheInvalidate(&renderer->layout_cache);
+	GlyphMetricsInvalidate(&renderer->glyph_metrics);
 
 	InitializeD2D(renderer);
 	InitializeD3D(renderer);
@@ -161,13 +186,56 @@ void HandleDeviceLost(Renderer *renderer) {
 	);
 }
 
-void RendererInitialize(Renderer *renderer, HWND hwnd, bool disable_ligatures, float linespace_factor, float monitor_dpi) {
+// GlyphMetricsSource
+float MeasureCellAdvance(void *context, uint32_t cell) {
+	// Only the cluster at the start is measured, so a wide char measures
+	// the same without its right half
+	return GetTextWidth(static_cast<Renderer *>(context), &cell, 1);
+}
+
+uint16_t PrimaryGlyphIndex(void *context, uint32_t cell) {
+	Renderer *renderer = static_cast<Renderer *>(context);
+	uint32_t codepoint = cell;
+	if (ContainsSurrogatePair(cell)) {
+		codepoint = 0x10000 + (((cell >> 16) - 0xD800) << 10) + ((cell & 0xFFFF) - 0xDC00);
+	}
+	uint16_t glyph_index;
+	WIN_CHECK(renderer->font_face->GetGlyphIndicesW(&codepoint, 1, &glyph_index));
+	return glyph_index;
+}
+
+void ReleaseTextLayout(void *layout) {
+	static_cast<IDWriteTextLayout1 *>(layout)->Release();
+}
+
+void *CreateDrawingEffect(void *context, const HighlightStyle *style) {
+	GlyphDrawingEffect *drawing_effect = new GlyphDrawingEffect(StyleColorF(style->foreground), StyleColorF(style->special));
+	drawing_effect->AddRef();
+	return drawing_effect;
+}
+
+void ReleaseDrawingEffect(void *context, void *drawing_effect) {
+	static_cast<GlyphDrawingEffect *>(drawing_effect)->Release();
+}
+
+void UpdateRefreshRate(Renderer *renderer);
+bool RendererUpdateFont(Renderer *renderer, float font_size, const char *font_string = "", int strlen = 0);
+void RendererInitialize(Renderer *renderer, HWND hwnd, bool disable_ligatures, float linespace_factor, float monitor_dpi,
+	FramePolicy frame_policy, uint32_t max_fps) {
 	renderer->hwnd = hwnd;
 	renderer->disable_ligatures = disable_ligatures;
 	renderer->linespace_factor = linespace_factor;
 
 	renderer->dpi_scale = monitor_dpi / 96.0f;
-	renderer->hl_attribs.resize(MAX_HIGHLIGHT_ATTRIBS);
+	renderer->ime_row = -1;
+	renderer->ime_col = -1;
+	CursorBlinkReset(&renderer->cursor_blink, nullptr, 0);
+	FrameSchedulerInitialize(&renderer->frame_scheduler, frame_policy, max_fps);
+	UpdateRefreshRate(renderer);
+	UiStateInitialize(&renderer->ui);
+	SnapshotModelInitialize(&renderer->model);
+	SnapshotChannelInitialize(&renderer->snapshots);
+	StyleTableSetEffectSource(&renderer->ui.styles, StyleEffectSource { renderer, CreateDrawingEffect, ReleaseDrawingEffect });
 
 	wcscpy_s(renderer->fallback_font, MAX_FONT_LENGTH, L"Consolas");
 
@@ -175,9 +243,17 @@ void RendererInitialize(Renderer *renderer, HWND hwnd, bool disable_ligatures, f
 	InitializeD3D(renderer);
 	InitializeDWrite(renderer);
 	renderer->glyph_renderer = std::make_unique<GlyphRenderer>(renderer);
+	LayoutCacheInitialize(&renderer->layout_cache, ReleaseTextLayout);
+	GlyphMetricsInitialize(&renderer->glyph_metrics, GlyphMetricsSource { renderer, MeasureCellAdvance, PrimaryGlyphIndex });
+	BackgroundPlanInitialize(&renderer->background_plan);
+	GlyphRowInitialize(&renderer->glyph_row);
+	// Rows are few, past a handful of threads more of them mostly wait
+	int prep_threads = static_cast<int>(std::thread::hardware_concurrency());
+	RowPrepInitialize(&renderer->row_prep, prep_threads > 8 ? 8 : prep_threads);
 	RendererUpdateFont(renderer, DEFAULT_FONT_SIZE, DEFAULT_FONT, static_cast<int>(strlen(DEFAULT_FONT)));
 }
 
+void RenderThread(Renderer *renderer);
 void RendererAttach(Renderer *renderer) {
 	RECT client_rect;
 	GetClientRect(renderer->hwnd, &client_rect);
@@ -186,12 +262,23 @@ void RendererAttach(Renderer *renderer) {
 		static_cast<uint32_t>(client_rect.right - client_rect.left),
 		static_cast<uint32_t>(client_rect.bottom - client_rect.top)
 	);
+
+	// From here on only the render thread draws
+	renderer->render_thread = std::thread(RenderThread, renderer);
 }
 
 void RendererShutdown(Renderer *renderer) {
+	if (renderer->render_thread.joinable()) {
+		renderer->render_stopping.store(true, std::memory_order_release);
+		SnapshotChannelWake(&renderer->snapshots);
+		renderer->render_thread.join();
+	}
+
 	renderer->d3d_device.Reset();
 	renderer->d3d_context.Reset();
 	renderer->dxgi_swapchain.Reset();
+	renderer->scroll_texture.Reset();
+	renderer->cursor_texture.Reset();
 	renderer->d2d_factory.Reset();
 	renderer->d2d_device.Reset();
 	renderer->d2d_context.Reset();
@@ -201,13 +288,17 @@ void RendererShutdown(Renderer *renderer) {
 	renderer->dwrite_text_format.Reset();
 	renderer->dwrite_typography.Reset();
 	renderer->glyph_renderer.reset();
-	renderer->grid_chars.reset();
+	LayoutCacheShutdown(&renderer->layout_cache);
+	GlyphMetricsShutdown(&renderer->glyph_metrics);
+	BackgroundPlanShutdown(&renderer->background_plan);
+	GlyphRowShutdown(&renderer->glyph_row);
+	RowPrepShutdown(&renderer->row_prep);
+	// The reader thread was stopped by NvimShutdown, nothing publishes anymore
+	SnapshotChannelShutdown(&renderer->snapshots);
+	SnapshotModelShutdown(&renderer->model);
+	SnapshotMirrorShutdown(&renderer->mirror);
+	UiStateShutdown(&renderer->ui);
 	renderer->wchar_buffer.reset();
-	renderer->grid_cell_properties.reset();
-}
-
-void RendererResize(Renderer *renderer, uint32_t width, uint32_t height) {
-	InitializeWindowDependentResources(renderer, width, height);
 }
 
 bool ContainsSurrogatePair(uint32_t cell) {
@@ -215,21 +306,10 @@ bool ContainsSurrogatePair(uint32_t cell) {
 }
 
 void ConvertToWide(Renderer *renderer, uint32_t *text, uint32_t length) {
-	size_t wchar_i = 0;
-	for (size_t i = 0; i < length; i++) {
-		// Unpack surrogate pairs into two sequential wchars.
-		if (ContainsSurrogatePair(text[i])) {
-			renderer->wchar_buffer[wchar_i] = static_cast<wchar_t>(text[i] >> 16);
-			renderer->wchar_buffer[wchar_i + 1] = static_cast<wchar_t>(text[i] & 0xFFFF);
-			wchar_i += 2;
-			continue;
-		}
-
-		renderer->wchar_buffer[wchar_i] = static_cast<wchar_t>(text[i]);
-		wchar_i += 1;
-	}
-
-	renderer->wchar_buffer_length = wchar_i;
+	// Unpacks surrogate pairs into two sequential wchars
+	static_assert(sizeof(wchar_t) == sizeof(uint16_t));
+	renderer->wchar_buffer_length = TranscodeCellsToUtf16(text, length,
+		reinterpret_cast<uint16_t *>(renderer->wchar_buffer.get()));
 }
 
 float GetTextWidth(Renderer *renderer, uint32_t *text, uint32_t length) {
@@ -358,130 +438,95 @@ bool UpdateFontMetrics(Renderer *renderer, float font_size, const char* font_str
 	return guifont_exists;
 }
 
-bool RendererUpdateFont(Renderer *renderer, float font_size, const char *font_string, int strlen) {
-	renderer->dwrite_text_format.Reset();
-
-	renderer->draws_invalidated = true;
-	return UpdateFontMetrics(renderer, font_size, font_string, strlen);
-}
-
-void UpdateDefaultColors(Renderer *renderer, mpack_node_t default_colors) {
-	size_t default_colors_arr_length = mpack_node_array_length(default_colors);
-
-	for (size_t i = 1; i < default_colors_arr_length; ++i) {
-		mpack_node_t color_arr = mpack_node_array_at(default_colors, i);
-
-		// Default colors occupy the first index of the highlight attribs array
-		renderer->hl_attribs[0].foreground = static_cast<uint32_t>(mpack_node_array_at(color_arr, 0).data->value.u);
-		renderer->hl_attribs[0].background = static_cast<uint32_t>(mpack_node_array_at(color_arr, 1).data->value.u);
-		renderer->hl_attribs[0].special = static_cast<uint32_t>(mpack_node_array_at(color_arr, 2).data->value.u);
-		renderer->hl_attribs[0].flags = 0;
+// Whether text in the primary font gets glyphs joined or swapped by shaping
+bool FontSubstitutesGlyphs(Renderer *renderer) {
+	const void *table;
+	UINT32 size;
+	void *table_context;
+	BOOL exists;
+	if (FAILED(renderer->font_face->TryGetFontTable(DWRITE_MAKE_OPENTYPE_TAG('G', 'S', 'U', 'B'),
+		&table, &size, &table_context, &exists))) {
+		return true;
 	}
-}
-
-void UpdateHighlightAttributes(Renderer *renderer, mpack_node_t highlight_attribs) {
-	uint64_t attrib_count = mpack_node_array_length(highlight_attribs);
-	for (uint64_t i = 1; i < attrib_count; ++i) {
-		int64_t attrib_index = mpack_node_array_at(mpack_node_array_at(highlight_attribs, i), 0).data->value.i;
-		assert(attrib_index <= MAX_HIGHLIGHT_ATTRIBS);
-
-		mpack_node_t attrib_map = mpack_node_array_at(mpack_node_array_at(highlight_attribs, i), 1);
-
-		const auto SetColor = [&](const char *name, uint32_t *color) {
-			mpack_node_t color_node = mpack_node_map_cstr_optional(attrib_map, name);
-			if (!mpack_node_is_missing(color_node)) {
-				*color = static_cast<uint32_t>(color_node.data->value.u);
-			}
-			else {
-				*color = DEFAULT_COLOR;
-			}
-		};
-		SetColor("foreground", &renderer->hl_attribs[attrib_index].foreground);
-		SetColor("background", &renderer->hl_attribs[attrib_index].background);
-		SetColor("special", &renderer->hl_attribs[attrib_index].special);
-
-		const auto SetFlag = [&](const char *flag_name, HighlightAttributeFlags flag) {
-			mpack_node_t flag_node = mpack_node_map_cstr_optional(attrib_map, flag_name);
-			if (!mpack_node_is_missing(flag_node)) {
-				if (flag_node.data->value.b) {
-					renderer->hl_attribs[attrib_index].flags |= flag;
-				}
-				else {
-					renderer->hl_attribs[attrib_index].flags &= ~flag;
-				}
-			}
-		};
-		SetFlag("reverse", HL_ATTRIB_REVERSE);
-		SetFlag("italic", HL_ATTRIB_ITALIC);
-		SetFlag("bold", HL_ATTRIB_BOLD);
-		SetFlag("strikethrough", HL_ATTRIB_STRIKETHROUGH);
-		SetFlag("underline", HL_ATTRIB_UNDERLINE);
-		SetFlag("undercurl", HL_ATTRIB_UNDERCURL);
+	if (!exists) {
+		return false;
 	}
+	bool substitutes = GlyphRowFontSubstitutes(static_cast<const uint8_t *>(table), size, !renderer->disable_ligatures);
+	renderer->font_face->ReleaseFontTable(table_context);
+	return substitutes;
 }
 
-uint32_t CreateForegroundColor(Renderer *renderer, HighlightAttributes *hl_attribs) {
-	if (hl_attribs->flags & HL_ATTRIB_REVERSE) {
-		return hl_attribs->background == DEFAULT_COLOR ? renderer->hl_attribs[0].background : hl_attribs->background;
-	}
-	else {
-		return hl_attribs->foreground == DEFAULT_COLOR ? renderer->hl_attribs[0].foreground : hl_attribs->foreground;
-	}
-}
+bool RendererUpdateFont(Renderer *renderer, float font_size, const char *font_string, int strlen) {
+	renderer->dwrite_text_format.Reset();
 
-uint32_t CreateBackgroundColor(Renderer *renderer, HighlightAttributes *hl_attribs) {
-	if (hl_attribs->flags & HL_ATTRIB_REVERSE) {
-		return hl_attribs->foreground == DEFAULT_COLOR ? renderer->hl_attribs[0].foreground : hl_attribs->foreground;
-	}
-	else {
-		return hl_attribs->background == DEFAULT_COLOR ? renderer->hl_attribs[0].background : hl_attribs->background;
+	// Also covers DPI changes, which update the font size
+	LayoutCacheInvalidate(&renderer->layout_cache);
+	GlyphMetricsInvalidate(&renderer->glyph_metrics);
+	renderer->draws_invalidated = true;
+	// The composition window takes the font's height
+	renderer->ime_row = -1;
+	bool guifont_exists = UpdateFontMetrics(renderer, font_size, font_string, strlen);
+
+	// Printable ASCII needs no spacing when the font has all of it, rows
+	// only visit their other cells then
+	renderer->scan_rules = TranscodeScanRules { 0x20, 0x5F, GRID_CELL_WIDE };
+	for (uint32_t cell = 0x20; cell < 0x7F; ++cell) {
+		if (!GlyphMetricsInPrimaryFont(&renderer->glyph_metrics, cell)) {
+			renderer->scan_rules.plain_count = 0;
+			break;
+		}
 	}
-}
+	GlyphRowSetFont(&renderer->glyph_row, &renderer->glyph_metrics, renderer->font_width,
+		renderer->font_face->IsMonospacedFont() && !FontSubstitutesGlyphs(renderer));
 
-uint32_t CreateSpecialColor(Renderer *renderer, HighlightAttributes *hl_attribs) {
-	return hl_attribs->special == DEFAULT_COLOR ? renderer->hl_attribs[0].special : hl_attribs->special;
+	std::lock_guard<std::mutex> lock(renderer->shared_lock);
+	renderer->metrics.font_width = renderer->font_width;
+	renderer->metrics.font_height = renderer->font_height;
+	wcscpy_s(renderer->metrics.font, MAX_FONT_LENGTH, renderer->font);
+	return guifont_exists;
 }
 
-void ApplyHighlightAttributes(Renderer *renderer, HighlightAttributes *hl_attribs,
-	IDWriteTextLayout *text_layout, int start, int end) {
-	GlyphDrawingEffect *drawing_effect = new GlyphDrawingEffect(
-			CreateForegroundColor(renderer, hl_attribs),
-			CreateSpecialColor(renderer, hl_attribs)
-	);
+static_assert(STYLE_FONT_WEIGHT_NORMAL == DWRITE_FONT_WEIGHT_NORMAL && STYLE_FONT_WEIGHT_BOLD == DWRITE_FONT_WEIGHT_BOLD);
+static_assert(STYLE_FONT_STYLE_NORMAL == DWRITE_FONT_STYLE_NORMAL && STYLE_FONT_STYLE_ITALIC == DWRITE_FONT_STYLE_ITALIC);
+
+// Styles are resolved as highlights are defined, see StyleTable, and share
+// one drawing effect between every run drawn with them
+void ApplyStyle(Renderer *renderer, HighlightStyle *style, IDWriteTextLayout *text_layout, int start, int end) {
 	DWRITE_TEXT_RANGE range {
 		static_cast<uint32_t>(start),
 		static_cast<uint32_t>(end - start)
 	};
-	if (hl_attribs->flags & HL_ATTRIB_ITALIC) {
-		text_layout->SetFontStyle(DWRITE_FONT_STYLE_ITALIC, range);
+	if (style->font_style != STYLE_FONT_STYLE_NORMAL) {
+		text_layout->SetFontStyle(static_cast<DWRITE_FONT_STYLE>(style->font_style), range);
 	}
-	if (hl_attribs->flags & HL_ATTRIB_BOLD) {
-		text_layout->SetFontWeight(DWRITE_FONT_WEIGHT_BOLD, range);
+	if (style->font_weight != STYLE_FONT_WEIGHT_NORMAL) {
+		text_layout->SetFontWeight(static_cast<DWRITE_FONT_WEIGHT>(style->font_weight), range);
 		if(renderer->font_size != renderer->font_size_scale_bold)
 			text_layout->SetFontSize(renderer->font_size_scale_bold, range);
 	}
-	if (hl_attribs->flags & HL_ATTRIB_STRIKETHROUGH) {
+	if (style->decorations & HL_ATTRIB_STRIKETHROUGH) {
 		text_layout->SetStrikethrough(true, range);
 	}
-	if (hl_attribs->flags & HL_ATTRIB_UNDERLINE) {
-		text_layout->SetUnderline(true, range);
-	}
-	if (hl_attribs->flags & HL_ATTRIB_UNDERCURL) {
+	if (style->decorations & (HL_ATTRIB_UNDERLINE | HL_ATTRIB_UNDERCURL)) {
 		text_layout->SetUnderline(true, range);
 	}
-	text_layout->SetDrawingEffect(drawing_effect, range);
+	text_layout->SetDrawingEffect(
+		static_cast<GlyphDrawingEffect *>(StyleTableDrawingEffect(&renderer->ui.styles, style)), range);
 }
 
-void DrawBackgroundRect(Renderer *renderer, D2D1_RECT_F rect, HighlightAttributes *hl_attribs) {
-	uint32_t color = CreateBackgroundColor(renderer, hl_attribs);
-	renderer->d2d_background_rect_brush->SetColor(D2D1::ColorF(color));
+void DrawBackgroundRect(Renderer *renderer, D2D1_RECT_F rect, StyleColor color) {
+	StyleColor *last = &renderer->background_rect_color;
+	if (color.r != last->r || color.g != last->g || color.b != last->b || color.a != last->a) {
+		renderer->d2d_background_rect_brush->SetColor(StyleColorF(color));
+		*last = color;
+	}
 
 	renderer->d2d_context->FillRectangle(rect, renderer->d2d_background_rect_brush.Get());
 }
 
 D2D1_RECT_F GetCursorForegroundRect(Renderer *renderer, D2D1_RECT_F cursor_bg_rect) {
-	if (renderer->cursor.mode_info) {
-		switch (renderer->cursor.mode_info->shape) {
+	if (renderer->ui.cursor.mode_info) {
+		switch (renderer->ui.cursor.mode_info->shape) {
 		case CursorShape::None: {
 		} return cursor_bg_rect;
 		case CursorShape::Block: {
@@ -497,7 +542,7 @@ D2D1_RECT_F GetCursorForegroundRect(Renderer *renderer, D2D1_RECT_F cursor_bg_re
 	return cursor_bg_rect;
 }
 
-void DrawHighlightedText(Renderer *renderer, D2D1_RECT_F rect, uint32_t *text, uint32_t length, HighlightAttributes *hl_attribs) {
+void DrawHighlightedText(Renderer *renderer, D2D1_RECT_F rect, uint32_t *text, uint32_t length, HighlightStyle *style) {
 	ConvertToWide(renderer, text, length);
 
 	ComPtr<IDWriteTextLayout> text_layout;
@@ -509,46 +554,111 @@ void DrawHighlightedText(Renderer *renderer, D2D1_RECT_F rect, uint32_t *text, u
 		rect.bottom - rect.top,
 		text_layout.GetAddressOf()
 	));
-	ApplyHighlightAttributes(renderer, hl_attribs, text_layout.Get(), 0, 1);
+	ApplyStyle(renderer, style, text_layout.Get(), 0, 1);
 
 	renderer->d2d_context->PushAxisAlignedClip(rect, D2D1_ANTIALIAS_MODE_ALIASED);
 	text_layout->Draw(renderer, renderer->glyph_renderer.get(), rect.left, rect.top);
 	renderer->d2d_context->PopAxisAlignedClip();
 }
 
-void DrawGridLine(Renderer *renderer, int row) {
-	int base = row * renderer->grid_cols;
+// The style runs of a row were split off its highlight id runs by RowPrep
+void PlanGridLineBackground(Renderer *renderer, const RowPacket *packet) {
+	if (!BackgroundPlanAddRow(&renderer->background_plan, packet->row, renderer->ui.grid.cols,
+		packet->style_starts, packet->style_colors, packet->style_run_count)) {
+		// Only when the plan wasn't sized for the grid, fill the runs one by one
+		for (size_t run = 0; run < packet->style_run_count; ++run) {
+			uint32_t col_end = run + 1 < packet->style_run_count ? packet->style_starts[run + 1] : renderer->ui.grid.cols;
+			D2D1_RECT_F bg_rect {
+				packet->style_starts[run] * renderer->font_width,
+				packet->row * renderer->font_height,
+				col_end * renderer->font_width,
+				(packet->row * renderer->font_height) + renderer->font_height
+			};
+			DrawBackgroundRect(renderer, bg_rect, StyleColorFromRgb(packet->style_colors[run]));
+		}
+	}
+}
 
-	D2D1_RECT_F rect {
-		0.0f,
-		row * renderer->font_height,
-		renderer->grid_cols * renderer->font_width,
-		(row * renderer->font_height) + renderer->font_height
-	};
+void DrawBackgroundFills(Renderer *renderer) {
+	const BackgroundPlan *plan = &renderer->background_plan;
+	for (int i = 0; i < plan->fill_count; ++i) {
+		const BackgroundFill *fill = &plan->fills[i];
+		D2D1_RECT_F rect {
+			fill->col_begin * renderer->font_width,
+			fill->row_begin * renderer->font_height,
+			fill->col_end * renderer->font_width,
+			fill->row_end * renderer->font_height
+		};
+		DrawBackgroundRect(renderer, rect, StyleColorFromRgb(fill->color));
+	}
+}
 
+// Lays out the text of a row with its highlights applied, the layout
+// doesn't depend on where the row is drawn
+ComPtr<IDWriteTextLayout1> CreateGridLineLayout(Renderer *renderer, const RowPacket *packet) {
 	ComPtr<IDWriteTextLayout> temp_text_layout;
-	ConvertToWide(renderer, &renderer->grid_chars[base], renderer->grid_cols);
 	WIN_CHECK(renderer->dwrite_factory->CreateTextLayout(
-		renderer->wchar_buffer.get(),
-		renderer->wchar_buffer_length,
+		reinterpret_cast<const wchar_t *>(packet->text),
+		static_cast<uint32_t>(packet->text_length),
 		renderer->dwrite_text_format.Get(),
-		rect.right - rect.left,
-		rect.bottom - rect.top,
+		renderer->ui.grid.cols * renderer->font_width,
+		renderer->font_height,
 		temp_text_layout.GetAddressOf()
 	));
-    size_t grid_chars_length = renderer->wchar_buffer_length;
+    size_t grid_chars_length = packet->text_length;
 	ComPtr<IDWriteTextLayout1> text_layout;
 	WIN_CHECK(temp_text_layout.As(&text_layout));
 
-	uint16_t hl_attrib_id = renderer->grid_cell_properties[base].hl_attrib_id;
-	int col_offset = 0;
+	// Only run starts and special cells are visited, in column order, a run
+	// start before a special cell in the same column. Surrogate pairs are
+	// always special, which keeps count of the wchars before each visit.
+	StyleTable *styles = &renderer->ui.styles;
+	size_t base = GridRowOffset(&renderer->ui.grid, packet->row);
+	const uint32_t *chars = &renderer->ui.grid.chars[base];
+	const uint16_t *hl_ids = &renderer->ui.grid.hl_ids[base];
+	const uint8_t *flags = &renderer->ui.grid.flags[base];
+	int cols = renderer->ui.grid.cols;
+	int special_words = (cols + 63) / 64;
+	uint16_t style_id = StyleTableStyleId(styles, hl_ids[0]);
 	int col_offset_wchars = 0;
-	for (int i = 0, i_wchars = 0; i < renderer->grid_cols;
-		i_wchars += ContainsSurrogatePair(renderer->grid_chars[base + i]) ? 2 : 1, ++i) {
+	int surrogate_pairs = 0;
+	size_t run = 1;
+	int special_word = 0;
+	uint64_t special_bits = packet->special_cells[0];
+	for (;;) {
+		while (!special_bits && ++special_word < special_words) {
+			special_bits = packet->special_cells[special_word];
+		}
+		int special_col = special_bits ? special_word * 64 + std::countr_zero(special_bits) : cols;
+		int run_col = run < packet->run_count ? static_cast<int>(packet->run_starts[run]) : cols;
+		if (special_col == cols && run_col == cols) {
+			break;
+		}
+
+		// Check if the style changes, 
+		// if so apply it until this point and continue with the new style
+		if (run_col <= special_col) {
+			int i_wchars = run_col + surrogate_pairs;
+			if (StyleTableStyleId(styles, hl_ids[run_col]) != style_id) {
+				ApplyStyle(renderer, StyleTableStyle(styles, style_id), text_layout.Get(), col_offset_wchars, i_wchars);
+
+				style_id = StyleTableStyleId(styles, hl_ids[run_col]);
+				col_offset_wchars = i_wchars;
+			}
+			++run;
+			continue;
+		}
+
+		int i = special_col;
+		int i_wchars = i + surrogate_pairs;
+		special_bits &= special_bits - 1;
+		// Metrics are looked up once per cell and font, see GlyphMetrics
+		uint32_t cell = chars[i];
+		surrogate_pairs += ContainsSurrogatePair(cell);
 
 		// Add spacing for wide chars
-		if (renderer->grid_cell_properties[base + i].is_wide_char) {
-			float char_width = GetTextWidth(renderer, &renderer->grid_chars[base + i], 2);
+		if (flags[i] & GRID_CELL_WIDE) {
+			float char_width = GlyphMetricsAdvance(&renderer->glyph_metrics, cell);
 			DWRITE_TEXT_RANGE range { static_cast<uint32_t>(i_wchars), 1 };
 			text_layout->SetCharacterSpacing(0, (renderer->font_width * 2) - char_width, 0, range);
 		}
@@ -556,8 +666,8 @@ void DrawGridLine(Renderer *renderer, int row) {
 		// Add spacing for unicode chars. These characters are still single char width, 
 		// but some of them by default will take up a bit more or less, leading to issues. 
 		// So we realign them here.	
-		else if(renderer->grid_chars[base + i] > 0xFF) {
-			float char_width = GetTextWidth(renderer, &renderer->grid_chars[base + i], 1);
+		else if(cell > 0xFF) {
+			float char_width = GlyphMetricsAdvance(&renderer->glyph_metrics, cell);
 			if(abs(char_width - renderer->font_width) > 0.01f) {
 				DWRITE_TEXT_RANGE range { static_cast<uint32_t>(i_wchars), 1 };
 				text_layout->SetCharacterSpacing(0, renderer->font_width - char_width, 0, range);
@@ -565,12 +675,9 @@ void DrawGridLine(Renderer *renderer, int row) {
 		}
 		else {
 			// Add spacing for character not existing in this font
-			uint16_t glyph_index;
-			uint32_t code = static_cast<uint32_t>(renderer->grid_chars[base + i]);
-			WIN_CHECK(renderer->font_face->GetGlyphIndicesW(&code, 1, &glyph_index));
-			if (glyph_index == 0)
+			if (!GlyphMetricsInPrimaryFont(&renderer->glyph_metrics, cell))
 			{
-				float char_width = GetTextWidth(renderer, &renderer->grid_chars[base + i], 1);
+				float char_width = GlyphMetricsAdvance(&renderer->glyph_metrics, cell);
 				float d_width = renderer->font_width - char_width;
 				if (d_width > 0)
 				{
@@ -579,254 +686,339 @@ void DrawGridLine(Renderer *renderer, int row) {
 				}
 			}
 		}
-
-		// Check if the attributes change, 
-		// if so draw until this point and continue with the new attributes
-		if (renderer->grid_cell_properties[base + i].hl_attrib_id != hl_attrib_id) {
-			D2D1_RECT_F bg_rect {
-				col_offset * renderer->font_width,
-				row * renderer->font_height,
-				col_offset * renderer->font_width + renderer->font_width * (i - col_offset),
-				(row * renderer->font_height) + renderer->font_height
-			};
-			DrawBackgroundRect(renderer, bg_rect, &renderer->hl_attribs[hl_attrib_id]);
-			ApplyHighlightAttributes(renderer, &renderer->hl_attribs[hl_attrib_id], text_layout.Get(), col_offset_wchars, i_wchars);
-
-			hl_attrib_id = renderer->grid_cell_properties[base + i].hl_attrib_id;
-			col_offset = i;
-			col_offset_wchars = i_wchars;
-		}
 	}
-	
-	// Draw the remaining columns, there is always atleast the last column to draw,
-	// but potentially more in case the last X columns share the same hl_attrib
-	D2D1_RECT_F last_rect = rect;
-	last_rect.left = col_offset * renderer->font_width;
-	DrawBackgroundRect(renderer, last_rect, &renderer->hl_attribs[hl_attrib_id]);
-	ApplyHighlightAttributes(renderer, &renderer->hl_attribs[hl_attrib_id], text_layout.Get(), col_offset_wchars, grid_chars_length);
+	ApplyStyle(renderer, StyleTableStyle(styles, style_id), text_layout.Get(), col_offset_wchars, grid_chars_length);
 
-	renderer->d2d_context->PushAxisAlignedClip(rect, D2D1_ANTIALIAS_MODE_ALIASED);
 	if(renderer->disable_ligatures) {
 		DWRITE_TEXT_RANGE range { 0u, static_cast<uint32_t>(grid_chars_length) };
 		text_layout->SetTypography(renderer->dwrite_typography.Get(), range);
 	}
-	text_layout->Draw(renderer, renderer->glyph_renderer.get(), 0.0f, rect.top);
-	renderer->d2d_context->PopAxisAlignedClip();
+	return text_layout;
 }
 
-void DrawAllGridLines(Renderer *renderer) {
-	for (size_t i = 0; i < renderer->grid_rows; ++i) {
-		DrawGridLine(renderer, i);
+// Draws the glyph runs GlyphRowBuild made of a row, placed and colored as
+// the row's text layout would have them
+void DrawGlyphRow(Renderer *renderer, const RowPacket *packet, D2D1_RECT_F rect) {
+	const GlyphRow *glyph_row = &renderer->glyph_row;
+	float baseline = rect.top + renderer->font_ascent * renderer->linespace_factor;
+	renderer->d2d_context->PushAxisAlignedClip(rect, D2D1_ANTIALIAS_MODE_ALIASED);
+	for (int i = 0; i < packet->glyph_run_count; ++i) {
+		const GlyphRowRun *run = &packet->glyph_runs[i];
+		DWRITE_GLYPH_RUN glyph_run {};
+		glyph_run.fontFace = renderer->font_face.Get();
+		glyph_run.fontEmSize = renderer->font_size;
+		glyph_run.glyphCount = static_cast<uint32_t>(run->col_end - run->col_begin);
+		glyph_run.glyphIndices = &packet->glyph_indices[run->col_begin];
+		glyph_run.glyphAdvances = &glyph_row->advances[run->col_begin];
+
+		HighlightStyle *style = StyleTableStyle(&renderer->ui.styles, run->style_id);
+		renderer->glyph_renderer->DrawGlyphRun(renderer, run->col_begin * renderer->font_width, baseline,
+			DWRITE_MEASURING_MODE_NATURAL, &glyph_run, nullptr,
+			static_cast<GlyphDrawingEffect *>(StyleTableDrawingEffect(&renderer->ui.styles, style)));
 	}
+	renderer->d2d_context->PopAxisAlignedClip();
 }
 
-bool IsSurrogatePair(wchar_t left, wchar_t right) {
-	return (0xD800 <= left && left <= 0xDBFF) && (0xDC00 <= right && right <= 0xDFFF);
-}
-
-void DrawGridLines(Renderer *renderer, mpack_node_t grid_lines) {
-	assert(renderer->grid_chars != nullptr);
-	assert(renderer->grid_cell_properties != nullptr);
-	
-	int grid_size = renderer->grid_cols * renderer->grid_rows;
-	size_t line_count = mpack_node_array_length(grid_lines);
-	for (size_t i = 1; i < line_count; ++i) {
-		mpack_node_t grid_line = mpack_node_array_at(grid_lines, i);
+void DrawGridLine(Renderer *renderer, const RowPacket *packet) {
+	size_t base = GridRowOffset(&renderer->ui.grid, packet->row);
 
-		int row = MPackIntFromArray(grid_line, 1);
-		int col_start = MPackIntFromArray(grid_line, 2);
+	D2D1_RECT_F rect {
+		0.0f,
+		packet->row * renderer->font_height,
+		renderer->ui.grid.cols * renderer->font_width,
+		(packet->row * renderer->font_height) + renderer->font_height
+	};
+	// Plain text needs neither a layout nor the cache. The background was
+	// planned and filled before, see DrawDirtyGridLines.
+	if (packet->direct) {
+		DrawGlyphRow(renderer, packet, rect);
+		return;
+	}
 
-		mpack_node_t cell_array = mpack_node_array_at(grid_line, 3);
-		size_t cell_array_length = mpack_node_array_length(cell_array);
+	// Rows are often drawn again unchanged, e.g. the one the cursor left
+	LayoutCacheRow key {
+		&renderer->ui.grid.chars[base],
+		&renderer->ui.grid.hl_ids[base],
+		&renderer->ui.grid.flags[base],
+		renderer->ui.grid.cols
+	};
+	uint64_t hash = packet->layout_hash;
+	ComPtr<IDWriteTextLayout1> text_layout = static_cast<IDWriteTextLayout1 *>(
+		LayoutCacheFind(&renderer->layout_cache, hash, &key));
+	if (!text_layout) {
+		text_layout = CreateGridLineLayout(renderer, packet);
+		if (LayoutCacheInsert(&renderer->layout_cache, hash, &key, text_layout.Get())) {
+			// The cache's reference
+			text_layout->AddRef();
+		}
+	}
 
-		int hl_attrib_id = 0;
-		int offset = row * renderer->grid_cols + col_start;
-		for (size_t j = 0; j < cell_array_length; ++j) {
-			mpack_node_t cell = mpack_node_array_at(cell_array, j);
-			size_t cell_length = mpack_node_array_length(cell);
+	renderer->d2d_context->PushAxisAlignedClip(rect, D2D1_ANTIALIAS_MODE_ALIASED);
+	text_layout->Draw(renderer, renderer->glyph_renderer.get(), 0.0f, rect.top);
+	renderer->d2d_context->PopAxisAlignedClip();
+}
 
-			mpack_node_t text = mpack_node_array_at(cell, 0);
-			const char *str = mpack_node_str(text);
+// The back buffer still holds the previous frame (see CopyFrontToBack),
+// so the rows nvim scrolled since are already drawn, only in the wrong
+// place. Moves them instead of laying them out again, which leaves the
+// rows scrolled into view to draw. Rows only line up with pixels when the
+// line height is whole, otherwise they are drawn again.
+void MoveScrolledRows(Renderer *renderer) {
+	Grid *grid = &renderer->ui.grid;
+	if (grid->pending_scroll_count == 0) {
+		return;
+	}
+	if (!renderer->scroll_texture || renderer->font_height != floorf(renderer->font_height)) {
+		GridMarkScrollsDirty(grid);
+		return;
+	}
 
-			if (cell_length > 1) {
-				hl_attrib_id = MPackIntFromArray(cell, 1);
+	ComPtr<ID3D11Texture2D> back;
+	WIN_CHECK(renderer->dxgi_swapchain->GetBuffer(0, IID_PPV_ARGS(back.GetAddressOf())));
+	// Copies have to follow anything drawn so far
+	WIN_CHECK(renderer->d2d_context->Flush());
+
+	uint32_t row_height = static_cast<uint32_t>(renderer->font_height);
+	uint32_t col_width = static_cast<uint32_t>(renderer->font_width);
+	for (int i = 0; i < grid->pending_scroll_count; ++i) {
+		const GridPendingScroll *scroll = &grid->pending_scrolls[i];
+		uint32_t moved_rows = static_cast<uint32_t>(scroll->bottom - scroll->top - abs(scroll->rows));
+		uint32_t source_row = static_cast<uint32_t>(scroll->rows > 0 ? scroll->top + scroll->rows : scroll->top);
+		uint32_t target_row = static_cast<uint32_t>(scroll->rows > 0 ? scroll->top : scroll->top - scroll->rows);
+
+		// A region past the edge of the window (while it is being resized)
+		// has no pixels to move
+		D3D11_BOX box {
+			scroll->left * col_width,
+			source_row * row_height,
+			0,
+			scroll->right * col_width,
+			(source_row + moved_rows) * row_height,
+			1
+		};
+		if (scroll->bottom * row_height > renderer->pixel_size.height || box.right > renderer->pixel_size.width) {
+			for (int row = scroll->top; row < scroll->bottom; ++row) {
+				GridMarkDirty(grid, row, scroll->left, scroll->right);
 			}
+			continue;
+		}
 
-			int repeat = 1;
-			if (cell_length > 2) {
-				repeat = MPackIntFromArray(cell, 2);
-			}
+		// Copying a texture onto itself can't overlap, so go through the
+		// scratch texture
+		renderer->d3d_context->CopySubresourceRegion(renderer->scroll_texture.Get(), 0, box.left, box.top, 0,
+			back.Get(), 0, &box);
+		renderer->d3d_context->CopySubresourceRegion(back.Get(), 0, box.left, target_row * row_height, 0,
+			renderer->scroll_texture.Get(), 0, &box);
+		++renderer->scroll_blits;
+	}
+	grid->pending_scroll_count = 0;
+}
 
-			int strlen = static_cast<int>(mpack_node_strlen(text));
-			if (strlen == 0) {
-				// This is the right part of the wide char. Sadly grid_line
-				// event can be splitted at the middle of wide character.
+// The dirty rows are prepared first, all at once, see RowPrep. Then the
+// backgrounds of all of them go, as one plan, then the text. Text is
+// clipped to its row, so no row's text is under another's fill.
+void DrawDirtyGridLines(Renderer *renderer) {
+	Grid *grid = &renderer->ui.grid;
+	RowPrep *prep = &renderer->row_prep;
+	if (!RowPrepRun(prep, grid, &renderer->ui.styles, &renderer->glyph_row, &renderer->layout_cache,
+		&renderer->scan_rules)) {
+		// Out of memory on the last resize, the rows stay dirty
+		return;
+	}
 
-				// Be careful not to overwrite right half of surrogate pair.
-				// It never happens that offset == 0, since it is the right
-				// half of wide char, but add check for safety.
-				if (offset == 0 || !IsSurrogatePair(renderer->grid_chars[offset - 1], renderer->grid_chars[offset])) {
-					renderer->grid_chars[offset] = L'\0';
-				}
+	BackgroundPlanBegin(&renderer->background_plan, StyleTableGet(&renderer->ui.styles, 0)->background_rgb);
+	for (int i = 0; i < prep->packet_count; ++i) {
+		PlanGridLineBackground(renderer, &prep->packets[i]);
+	}
+	BackgroundPlanFinish(&renderer->background_plan);
+	DrawBackgroundFills(renderer);
 
-				// This cell itself is not a wide character.
-				renderer->grid_cell_properties[offset].is_wide_char = false;
+	for (int i = 0; i < prep->packet_count; ++i) {
+		DrawGridLine(renderer, &prep->packets[i]);
+		++renderer->rows_drawn;
+	}
+	GridClearDirty(grid);
+}
 
-				// Adjust properties. Again it never happens that offset == 0,
-				// since it is the right half of wide char, but adding check
-				// for safety.
-				if (offset > 0) {
-					// Set is_wide_char flag for the left cell to true.
-					renderer->grid_cell_properties[offset - 1].is_wide_char = true;
+// The cursor is an overlay on the frame the rows drew. The pixels it
+// covers are copied aside before it is drawn and put back to erase it, so
+// moving it, changing its shape or blinking lays out no row.
+void EraseCursor(Renderer *renderer) {
+	if (!renderer->cursor_saved) {
+		return;
+	}
+	renderer->cursor_saved = false;
 
-					// Inherit hl_attrib_id from left half.
-					renderer->grid_cell_properties[offset].hl_attrib_id = renderer->grid_cell_properties[offset - 1].hl_attrib_id;
-				}
+	ComPtr<ID3D11Texture2D> back;
+	WIN_CHECK(renderer->dxgi_swapchain->GetBuffer(0, IID_PPV_ARGS(back.GetAddressOf())));
+	// Copies have to follow anything drawn so far
+	WIN_CHECK(renderer->d2d_context->Flush());
+	const CursorPixels *pixels = &renderer->cursor_pixels;
+	D3D11_BOX box { 0, 0, 0, pixels->right - pixels->left, pixels->bottom - pixels->top, 1 };
+	renderer->d3d_context->CopySubresourceRegion(back.Get(), 0, pixels->left, pixels->top, 0,
+		renderer->cursor_texture.Get(), 0, &box);
+}
 
-				++offset;
-			} else {
-				// This is single width character or left half cell of wide
-				// character.
+// Returns false if the rect is off the window, there is nothing to draw then
+bool SaveUnderCursor(Renderer *renderer, D2D1_RECT_F rect) {
+	CursorPixels pixels;
+	if (!CursorCoverPixels(rect.left, rect.top, rect.right, rect.bottom,
+		renderer->pixel_size.width, renderer->pixel_size.height, &pixels)) {
+		return false;
+	}
 
-				// Left cell should not be a wide character, so reset the
-				// flag. This time checking offset > 0 is mandatory.
-				if (offset > 0) {
-					renderer->grid_cell_properties[offset - 1].is_wide_char = false;
-				}
+	// Grows with the font, a wide cell at most
+	uint32_t width = pixels.right - pixels.left;
+	uint32_t height = pixels.bottom - pixels.top;
+	if (!renderer->cursor_texture || width > renderer->cursor_texture_width || height > renderer->cursor_texture_height) {
+		renderer->cursor_texture.Reset();
+		D3D11_TEXTURE2D_DESC cursor_texture_desc {};
+		cursor_texture_desc.Width = width > renderer->cursor_texture_width ? width : renderer->cursor_texture_width;
+		cursor_texture_desc.Height = height > renderer->cursor_texture_height ? height : renderer->cursor_texture_height;
+		cursor_texture_desc.MipLevels = 1;
+		cursor_texture_desc.ArraySize = 1;
+		cursor_texture_desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		cursor_texture_desc.SampleDesc.Count = 1;
+		cursor_texture_desc.Usage = D3D11_USAGE_DEFAULT;
+		WIN_CHECK(renderer->d3d_device->CreateTexture2D(&cursor_texture_desc, nullptr,
+			renderer->cursor_texture.GetAddressOf()));
+		renderer->cursor_texture_width = cursor_texture_desc.Width;
+		renderer->cursor_texture_height = cursor_texture_desc.Height;
+	}
 
-				// Wide character will never be repeated, so we don't have to
-				// handle wide character specially.
-				for (int k = 0; k < repeat; ++k) {
-					wchar_t buffer[2];
-					int wstrlen = MultiByteToWideChar(CP_UTF8, 0, str, strlen, buffer, 2);
-					if (wstrlen == 2) {
-						// If the str takes two wchars, it must be a surrogate pair.
-						bool is_surrogate_pair = IsSurrogatePair(buffer[0], buffer[1]);
-						if (is_surrogate_pair) {
-							// Pack the surrogate pair into a single grid cell.
-							renderer->grid_chars[offset] = (buffer[0] << 16) | buffer[1];
-						} else {
-							// This is an unsupported character (ie: a diacritic), draw a box here instead.
-							renderer->grid_chars[offset] = 0x25a1;
-						}
-					} else {
-						renderer->grid_chars[offset] = buffer[0];
-					}
-
-					renderer->grid_cell_properties[offset].hl_attrib_id = hl_attrib_id;
-
-					// Here we set is_wide_char to be always false. This is
-					// because if it is actually a wide character, then the
-					// right half of the char, empty string, should be appear
-					// soon, and the flag will be set there (first branch of
-					// this `if`).
-					renderer->grid_cell_properties[offset].is_wide_char = false;
-
-					++offset;
-				}
-			}
-		}
+	ComPtr<ID3D11Texture2D> back;
+	WIN_CHECK(renderer->dxgi_swapchain->GetBuffer(0, IID_PPV_ARGS(back.GetAddressOf())));
+	WIN_CHECK(renderer->d2d_context->Flush());
+	D3D11_BOX box { pixels.left, pixels.top, 0, pixels.right, pixels.bottom, 1 };
+	renderer->d3d_context->CopySubresourceRegion(renderer->cursor_texture.Get(), 0, 0, 0, 0, back.Get(), 0, &box);
+	renderer->cursor_pixels = pixels;
+	renderer->cursor_saved = true;
+	return true;
+}
 
-		DrawGridLine(renderer, row);
-	}
+// A single glyph of the primary font, as a row drawn directly has it
+void DrawCursorGlyph(Renderer *renderer, D2D1_RECT_F rect, uint16_t glyph, HighlightStyle *style) {
+	float advance = renderer->font_width;
+	DWRITE_GLYPH_RUN glyph_run {};
+	glyph_run.fontFace = renderer->font_face.Get();
+	glyph_run.fontEmSize = renderer->font_size;
+	glyph_run.glyphCount = 1;
+	glyph_run.glyphIndices = &glyph;
+	glyph_run.glyphAdvances = &advance;
+
+	renderer->d2d_context->PushAxisAlignedClip(rect, D2D1_ANTIALIAS_MODE_ALIASED);
+	renderer->glyph_renderer->DrawGlyphRun(renderer, rect.left,
+		rect.top + renderer->font_ascent * renderer->linespace_factor, DWRITE_MEASURING_MODE_NATURAL,
+		&glyph_run, nullptr, static_cast<GlyphDrawingEffect *>(StyleTableDrawingEffect(&renderer->ui.styles, style)));
+	renderer->d2d_context->PopAxisAlignedClip();
 }
 
 void DrawCursor(Renderer *renderer) {
-	if (!renderer->cursor.mode_info) return;
-	int cursor_grid_offset = renderer->cursor.row * renderer->grid_cols + renderer->cursor.col;
+	if (!renderer->ui.cursor.mode_info) return;
+	if (renderer->ui.cursor.row < 0 || renderer->ui.cursor.row >= renderer->ui.grid.rows ||
+		renderer->ui.cursor.col < 0 || renderer->ui.cursor.col >= renderer->ui.grid.cols) {
+		return;
+	}
+	size_t cursor_grid_offset = GridRowOffset(&renderer->ui.grid, renderer->ui.cursor.row) + renderer->ui.cursor.col;
 
 	int double_width_char_factor = 1;
-	if (cursor_grid_offset < (renderer->grid_rows * renderer->grid_cols) &&
-		renderer->grid_cell_properties[cursor_grid_offset].is_wide_char) {
+	if (renderer->ui.grid.flags[cursor_grid_offset] & GRID_CELL_WIDE) {
 		double_width_char_factor += 1;
 	}
 
-	HighlightAttributes cursor_hl_attribs = renderer->hl_attribs[renderer->cursor.mode_info->hl_attrib_id];
+	HighlightAttributes cursor_hl_attribs = renderer->ui.hl_attribs[renderer->ui.cursor.mode_info->hl_attrib_id];
 
 	// Inherit GUI options for char under cursor (like italic)
-	int hl_attrib_id_under_cursor = renderer->grid_cell_properties[cursor_grid_offset].hl_attrib_id;
-	HighlightAttributes under_cursor_hl_attribs = renderer->hl_attribs[hl_attrib_id_under_cursor];
+	int hl_attrib_id_under_cursor = renderer->ui.grid.hl_ids[cursor_grid_offset];
+	HighlightAttributes under_cursor_hl_attribs = renderer->ui.hl_attribs[hl_attrib_id_under_cursor];
 	cursor_hl_attribs.flags = under_cursor_hl_attribs.flags;
 
-	if (renderer->cursor.mode_info->hl_attrib_id == 0) {
+	if (renderer->ui.cursor.mode_info->hl_attrib_id == 0) {
 		cursor_hl_attribs.flags |= HL_ATTRIB_REVERSE;
 	}
+	// Shares its style, and drawing effect, with highlights drawn alike
+	uint16_t cursor_style_id = StyleTableIntern(&renderer->ui.styles, &cursor_hl_attribs);
+	HighlightStyle *cursor_style = StyleTableStyle(&renderer->ui.styles, cursor_style_id);
 
 	D2D1_RECT_F cursor_rect {
-		renderer->cursor.col * renderer->font_width,
-		renderer->cursor.row * renderer->font_height,
-		renderer->cursor.col * renderer->font_width + renderer->font_width * double_width_char_factor,
-		(renderer->cursor.row * renderer->font_height) + renderer->font_height
+		renderer->ui.cursor.col * renderer->font_width,
+		renderer->ui.cursor.row * renderer->font_height,
+		renderer->ui.cursor.col * renderer->font_width + renderer->font_width * double_width_char_factor,
+		(renderer->ui.cursor.row * renderer->font_height) + renderer->font_height
 	};
 	D2D1_RECT_F cursor_fg_rect = GetCursorForegroundRect(renderer, cursor_rect);
-	DrawBackgroundRect(renderer, cursor_fg_rect, &cursor_hl_attribs);
-
-	if (renderer->cursor.mode_info->shape == CursorShape::Block) {
-		DrawHighlightedText(renderer, cursor_fg_rect, &renderer->grid_chars[cursor_grid_offset],
-			double_width_char_factor, &cursor_hl_attribs);
-	}
-}
-
-bool UpdateGridSize(Renderer *renderer, mpack_node_t grid_resize) {
-	mpack_node_t grid_resize_params = mpack_node_array_at(grid_resize, 1);
-	int grid_cols = MPackIntFromArray(grid_resize_params, 1);
-	int grid_rows = MPackIntFromArray(grid_resize_params, 2);
-
-	if (!renderer->grid_chars ||
-		!renderer->wchar_buffer ||
-		!renderer->grid_cell_properties ||
-		renderer->grid_cols != grid_cols ||
-		renderer->grid_rows != grid_rows) {
-		
-		renderer->grid_cols = grid_cols;
-		renderer->grid_rows = grid_rows;
-
-		size_t grid_cell_count = static_cast<size_t>(grid_cols) * grid_rows;
-		renderer->grid_chars = std::unique_ptr<uint32_t[]>(new uint32_t[grid_cell_count]);
-		// Initialize all grid character to a space. An empty
-		// grid cell is equivalent to a space in a text layout
-		for (size_t i = 0; i < grid_cell_count; ++i) {
-			renderer->grid_chars[i] = L' ';
-		}
-		renderer->grid_cell_properties = std::unique_ptr<CellProperty[]>(new CellProperty[grid_cell_count]());
-		renderer->wchar_buffer = std::unique_ptr<wchar_t[]>(new wchar_t[static_cast<size_t>(grid_cols) * 2]);
-
-		renderer->grid_initialized = true;
-		return true;
+	if (!SaveUnderCursor(renderer, cursor_fg_rect)) {
+		return;
 	}
+	DrawBackgroundRect(renderer, cursor_fg_rect, cursor_style->background);
 
-	return false;
+	if (renderer->ui.cursor.mode_info->shape == CursorShape::Block) {
+		uint16_t glyph;
+		if (double_width_char_factor == 1 && GlyphRowCellGlyph(&renderer->glyph_row, cursor_style,
+			renderer->ui.grid.chars[cursor_grid_offset], &glyph)) {
+			DrawCursorGlyph(renderer, cursor_fg_rect, glyph, cursor_style);
+		}
+		else {
+			DrawHighlightedText(renderer, cursor_fg_rect, &renderer->ui.grid.chars[cursor_grid_offset],
+				double_width_char_factor, cursor_style);
+		}
+	}
 }
 
-void UpdateCursorPos(Renderer *renderer, mpack_node_t cursor_goto) {
-	mpack_node_t cursor_goto_params = mpack_node_array_at(cursor_goto, 1);
-	renderer->cursor.row = MPackIntFromArray(cursor_goto_params, 1);
-	renderer->cursor.col = MPackIntFromArray(cursor_goto_params, 2);
+// The grid was resized by GridSnapshotApply, the buffers sized by it follow
+bool UpdateGridSize(Renderer *renderer) {
+	int rows = renderer->ui.grid.rows;
+	int cols = renderer->ui.grid.cols;
+	renderer->wchar_buffer = std::unique_ptr<wchar_t[]>(new wchar_t[static_cast<size_t>(cols) * 2]);
+	if (!RowPrepReserve(&renderer->row_prep, rows, cols)) {
+		return false;
+	}
+	// Without the memory rows fill their runs one by one, or are all laid out
+	BackgroundPlanReserve(&renderer->background_plan, rows, cols);
+	GlyphRowReserve(&renderer->glyph_row, cols);
+	renderer->grid_initialized = true;
+	return true;
 }
 
+// Only on flush, and when the cursor moved since. The IME belongs to the
+// window's thread, see RendererUpdateImePos.
 void UpdateImePos(Renderer* renderer) {
+	if (renderer->ui.cursor.row == renderer->ime_row && renderer->ui.cursor.col == renderer->ime_col) {
+		return;
+	}
+	renderer->ime_row = renderer->ui.cursor.row;
+	renderer->ime_col = renderer->ui.cursor.col;
+	++renderer->ime_updates;
+	PostMessage(renderer->hwnd, WM_RENDERER_IME_UPDATE, static_cast<WPARAM>(renderer->ime_row), static_cast<LPARAM>(renderer->ime_col));
+}
+
+void RendererUpdateImePos(Renderer *renderer, int row, int col) {
+	RendererMetrics metrics;
+	{
+		std::lock_guard<std::mutex> lock(renderer->shared_lock);
+		metrics = renderer->metrics;
+	}
+
 	HIMC input_context = ImmGetContext(renderer->hwnd);
 	COMPOSITIONFORM composition_form {};
 	composition_form.dwStyle = CFS_POINT;
-	composition_form.ptCurrentPos.x = static_cast<LONG>(renderer->cursor.col * renderer->font_width);
-	composition_form.ptCurrentPos.y = static_cast<LONG>(renderer->cursor.row * renderer->font_height);
+	composition_form.ptCurrentPos.x = static_cast<LONG>(col * metrics.font_width);
+	composition_form.ptCurrentPos.y = static_cast<LONG>(row * metrics.font_height);
 
 	if (ImmSetCompositionWindow(input_context, &composition_form)) {
 		LOGFONTW font_attribs {};
-		font_attribs.lfHeight = static_cast<LONG>(renderer->font_height);
-		wcscpy_s(font_attribs.lfFaceName, LF_FACESIZE, renderer->font);
+		font_attribs.lfHeight = static_cast<LONG>(metrics.font_height);
+		wcscpy_s(font_attribs.lfFaceName, LF_FACESIZE, metrics.font);
 		ImmSetCompositionFontW(input_context, &font_attribs);
 	}
 
 	ImmReleaseContext(renderer->hwnd, input_context);
 }
 
-void UpdateWindowTitle(Renderer *renderer, mpack_node_t set_title) {
+void UpdateWindowTitle(Renderer *renderer, const RedrawCommandSetTitle *set_title) {
 	// Get new title
-	mpack_node_t params = mpack_node_array_at(set_title, 1);
-	mpack_node_t value = mpack_node_array_at(params, 0);
-	const char *new_title = mpack_node_str(value);
-	int len = mpack_node_strlen(value);
+	const char *new_title = RedrawSetTitleText(set_title);
+	int len = static_cast<int>(set_title->title_length);
 
 	// Append " - Nvy" to the title. If title is empty, do not add " - ".
 	const char *append = len == 0 ? "Nvy" : " - Nvy";
@@ -849,107 +1041,9 @@ void UpdateWindowTitle(Renderer *renderer, mpack_node_t set_title) {
 	free(wbuf);
 }
 
-void UpdateCursorMode(Renderer *renderer, mpack_node_t mode_change) {
-	mpack_node_t mode_change_params = mpack_node_array_at(mode_change, 1);
-	renderer->cursor.mode_info = &renderer->cursor_mode_infos[mpack_node_array_at(mode_change_params, 1).data->value.u];
-}
-
-void UpdateCursorModeInfos(Renderer *renderer, mpack_node_t mode_info_set_params) {
-	mpack_node_t mode_info_params = mpack_node_array_at(mode_info_set_params, 1);
-	mpack_node_t mode_infos = mpack_node_array_at(mode_info_params, 1);
-	size_t mode_infos_length = mpack_node_array_length(mode_infos);
-	assert(mode_infos_length <= MAX_CURSOR_MODE_INFOS);
-
-	for (size_t i = 0; i < mode_infos_length; ++i) {
-		mpack_node_t mode_info_map = mpack_node_array_at(mode_infos, i);
-
-		renderer->cursor_mode_infos[i].shape = CursorShape::None;
-		mpack_node_t cursor_shape = mpack_node_map_cstr_optional(mode_info_map, "cursor_shape");
-		if (!mpack_node_is_missing(cursor_shape)) {
-			const char *cursor_shape_str = mpack_node_str(cursor_shape);
-			size_t strlen = mpack_node_strlen(cursor_shape);
-			if (!strncmp(cursor_shape_str, "block", strlen)) {
-				renderer->cursor_mode_infos[i].shape = CursorShape::Block;
-			}
-			else if (!strncmp(cursor_shape_str, "vertical", strlen)) {
-				renderer->cursor_mode_infos[i].shape = CursorShape::Vertical;
-			}
-			else if (!strncmp(cursor_shape_str, "horizontal", strlen)) {
-				renderer->cursor_mode_infos[i].shape = CursorShape::Horizontal;
-			}
-		}
-
-		renderer->cursor_mode_infos[i].hl_attrib_id = 0;
-		mpack_node_t hl_attrib_index = mpack_node_map_cstr_optional(mode_info_map, "attr_id");
-		if (!mpack_node_is_missing(hl_attrib_index)) {
-			renderer->cursor_mode_infos[i].hl_attrib_id = static_cast<int>(hl_attrib_index.data->value.i);
-		}
-	}
-}
-
-void ScrollRegion(Renderer *renderer, mpack_node_t scroll_region) {
-	size_t scroll_count = mpack_node_array_length(scroll_region);
-
-	for (size_t i = 1; i < scroll_count; ++i) {
-		mpack_node_t scroll_region_params = mpack_node_array_at(scroll_region, i);
-
-		int64_t top = mpack_node_array_at(scroll_region_params, 1).data->value.i;
-		int64_t bottom = mpack_node_array_at(scroll_region_params, 2).data->value.i;
-		int64_t left = mpack_node_array_at(scroll_region_params, 3).data->value.i;
-		int64_t right = mpack_node_array_at(scroll_region_params, 4).data->value.i;
-		int64_t rows = mpack_node_array_at(scroll_region_params, 5).data->value.i;
-		int64_t cols = mpack_node_array_at(scroll_region_params, 6).data->value.i;
-
-		// Currently nvim does not support horizontal scrolling, 
-		// the parameter is reserved for later use
-		assert(cols == 0);
-
-		// This part is slightly cryptic, basically we're just
-		// iterating from top to bottom or vice versa depending on scroll direction.
-		bool scrolling_down = rows > 0;
-		int64_t start_row = scrolling_down ? top : bottom - 1;
-		int64_t end_row = scrolling_down ? bottom - 1 : top;
-		int64_t increment = scrolling_down ? 1 : -1;
-
-		for (int64_t j = start_row; scrolling_down ? j <= end_row : j >= end_row; j += increment) {
-			// Clip anything outside the scroll region
-			int64_t target_row = j - rows;
-			if (target_row < top || target_row >= bottom) {
-				continue;
-			}
-
-			memcpy(
-				&renderer->grid_chars[target_row * renderer->grid_cols + left],
-				&renderer->grid_chars[j * renderer->grid_cols + left],
-				(right - left) * sizeof(uint32_t)
-			);
-
-			memcpy(
-				&renderer->grid_cell_properties[target_row * renderer->grid_cols + left],
-				&renderer->grid_cell_properties[j * renderer->grid_cols + left],
-				(right - left) * sizeof(CellProperty)
-			);
-
-			// Sadly I have given up on making use of IDXGISwapChain1::Present1
-			// scroll_rects or bitmap copies. The former seems insufficient for
-			// nvim since it can require multiple scrolls per frame, the latter
-			// I can't seem to make work with the FLIP_SEQUENTIAL swapchain model.
-			// Thus we fall back to drawing the appropriate scrolled grid lines
-			DrawGridLine(renderer, target_row);
-		}
-
-		// Redraw the line which the cursor has moved to, as it is no
-		// longer guaranteed that the cursor is still there
-		int cursor_row = renderer->cursor.row - rows;
-		if(cursor_row >= 0 && cursor_row < renderer->grid_rows) {
-			DrawGridLine(renderer, cursor_row);
-		}
-	}
-}
-
 void DrawBorderRectangles(Renderer *renderer) {
-	float left_border = renderer->font_width * renderer->grid_cols;
-	float top_border = renderer->font_height * renderer->grid_rows;
+	float left_border = renderer->font_width * renderer->ui.grid.cols;
+	float top_border = renderer->font_height * renderer->ui.grid.rows;
 
 	if(left_border != static_cast<float>(renderer->pixel_size.width)) {
 		D2D1_RECT_F vertical_rect {
@@ -958,7 +1052,7 @@ void DrawBorderRectangles(Renderer *renderer) {
 			static_cast<float>(renderer->pixel_size.width),
 			static_cast<float>(renderer->pixel_size.height)
 		};
-		DrawBackgroundRect(renderer, vertical_rect, &renderer->hl_attribs[0]);
+		DrawBackgroundRect(renderer, vertical_rect, StyleTableGet(&renderer->ui.styles, 0)->background);
 	}
 
 	if(top_border != static_cast<float>(renderer->pixel_size.height)) {
@@ -968,11 +1062,11 @@ void DrawBorderRectangles(Renderer *renderer) {
 			static_cast<float>(renderer->pixel_size.width),
 			static_cast<float>(renderer->pixel_size.height)
 		};
-		DrawBackgroundRect(renderer, horizontal_rect, &renderer->hl_attribs[0]);
+		DrawBackgroundRect(renderer, horizontal_rect, StyleTableGet(&renderer->ui.styles, 0)->background);
 	}
 }
 
-bool RendererUpdateGuiFont(Renderer *renderer, const char *guifont, size_t strlen) {
+bool UpdateGuiFont(Renderer *renderer, const char *guifont, size_t strlen) {
 	if (strlen == 0) {
 		return false;
 	}
@@ -1012,51 +1106,23 @@ bool RendererUpdateGuiFont(Renderer *renderer, const char *guifont, size_t strle
 	return RendererUpdateFont(renderer, font_size, guifont, static_cast<int>(font_str_len));
 }
 
-void SetGuiOptions(Renderer *renderer, mpack_node_t option_set) {
-	uint64_t option_set_length = mpack_node_array_length(option_set);
-
-	for (uint64_t i = 1; i < option_set_length; ++i) {
-		mpack_node_t name = mpack_node_array_at(mpack_node_array_at(option_set, i), 0);
-		mpack_node_t value = mpack_node_array_at(mpack_node_array_at(option_set, i), 1);
-		if (MPackMatchString(name, "guifont")) {
-			const char *font_str = mpack_node_str(value);
-			size_t strlen = mpack_node_strlen(value);
-			RendererUpdateGuiFont(renderer, font_str, strlen);
-
-			// Send message to window in order to update nvim row/col count
-			PostMessage(renderer->hwnd, WM_RENDERER_FONT_UPDATE, 0, 0);
-		}
-	}
-}
-
-void ClearGrid(Renderer *renderer) {
-	// Initialize all grid character to a space.
-	for (int i = 0; i < renderer->grid_cols * renderer->grid_rows; ++i) {
-		renderer->grid_chars[i] = L' ';
+void SetGuiOptions(Renderer *renderer, const RedrawCommandOptionSet *option_set) {
+	if (MPackStrEquals(RedrawOptionSetName(option_set), option_set->name_length, "guifont") && option_set->value_is_str) {
+		// The window is told to update nvim's row/col count once it's done
+		RendererUpdateGuiFont(renderer, RedrawOptionSetValueStr(option_set), option_set->value_str_length);
 	}
-	memset(renderer->grid_cell_properties.get(), 0, static_cast<size_t>(renderer->grid_cols) * renderer->grid_rows * sizeof(CellProperty));
-	D2D1_RECT_F rect {
-		0.0f,
-		0.0f,
-		renderer->grid_cols * renderer->font_width,
-		renderer->grid_rows * renderer->font_height
-	};
-	DrawBackgroundRect(renderer, rect, &renderer->hl_attribs[0]);
 }
 
 void StartDraw(Renderer *renderer) {
-	if (!renderer->draw_active) {
-		WaitForSingleObjectEx(
-			renderer->swapchain_wait_handle,
-			1000,
-			true
-		);
+	WaitForSingleObjectEx(
+		renderer->swapchain_wait_handle,
+		1000,
+		true
+	);
 
-		renderer->d2d_context->SetTarget(renderer->d2d_target_bitmap.Get());
-		renderer->d2d_context->BeginDraw();
-		renderer->d2d_context->SetTransform(D2D1::IdentityMatrix());
-		renderer->draw_active = true;
-	}
+	renderer->d2d_context->SetTarget(renderer->d2d_target_bitmap.Get());
+	renderer->d2d_context->BeginDraw();
+	renderer->d2d_context->SetTransform(D2D1::IdentityMatrix());
 }
 
 void CopyFrontToBack(Renderer *renderer) {
@@ -1071,7 +1137,6 @@ void FinishDraw(Renderer *renderer) {
 	renderer->d2d_context->EndDraw();
 
 	HRESULT hr = renderer->dxgi_swapchain->Present(0, DXGI_PRESENT_ALLOW_TEARING);
-	renderer->draw_active = false;
 
 	CopyFrontToBack(renderer);
 
@@ -1081,98 +1146,308 @@ void FinishDraw(Renderer *renderer) {
 }
 
 void RendererFlush(Renderer* renderer) {
+	uint64_t start_ns = ClockNowNs();
 	StartDraw(renderer);
+	++renderer->flushes;
 	if (renderer->draws_invalidated) {
 		renderer->draws_invalidated = false;
-		DrawAllGridLines(renderer);
+		GridMarkAllDirty(&renderer->ui.grid);
 	}
-
-	if (!renderer->ui_busy) {
+	// Before anything moves or draws over the pixels it saved
+	EraseCursor(renderer);
+	MoveScrolledRows(renderer);
+	DrawDirtyGridLines(renderer);
+
+	uint64_t now_ms = ClockNowNs() / 1000000;
+	if (renderer->cursor_blink_reset) {
+		renderer->cursor_blink_reset = false;
+		CursorBlinkReset(&renderer->cursor_blink, renderer->ui.cursor.mode_info, now_ms);
+	}
+	else {
+		CursorBlinkAdvance(&renderer->cursor_blink, now_ms);
+	}
+	if (!renderer->ui.busy && renderer->cursor_blink.visible) {
 		DrawCursor(renderer);
 	}
 	DrawBorderRectangles(renderer);
 	FinishDraw(renderer);
-}
+	UpdateImePos(renderer);
+	renderer->has_drawn = true;
 
-void RendererRedraw(Renderer *renderer, mpack_node_t params, bool start_maximized) {
-	StartDraw(renderer);
+	// Whatever flushes were waiting are drawn now
+	FrameSchedulerFrameDrawn(&renderer->frame_scheduler, start_ns, ClockNowNs());
+}
 
-	uint64_t redraw_commands_length = mpack_node_array_length(params);
-	for (uint64_t i = 0; i < redraw_commands_length; ++i) {
-		mpack_node_t redraw_command_arr = mpack_node_array_at(params, i);
-		mpack_node_t redraw_command_name = mpack_node_array_at(redraw_command_arr, 0);
+void UpdateRefreshRate(Renderer *renderer) {
+	MONITORINFOEXW monitor_info {};
+	monitor_info.cbSize = sizeof(monitor_info);
+	DEVMODEW display_mode {};
+	display_mode.dmSize = sizeof(display_mode);
+	HMONITOR monitor = MonitorFromWindow(renderer->hwnd, MONITOR_DEFAULTTONEAREST);
+	uint32_t refresh_hz = 0;
+	if (GetMonitorInfoW(monitor, &monitor_info) &&
+		EnumDisplaySettingsW(monitor_info.szDevice, ENUM_CURRENT_SETTINGS, &display_mode)) {
+		refresh_hz = display_mode.dmDisplayFrequency;
+	}
+	FrameSchedulerSetRefreshRate(&renderer->frame_scheduler, refresh_hz);
+}
 
-		if (MPackMatchString(redraw_command_name, "option_set")) {
-			SetGuiOptions(renderer, redraw_command_arr);
-		}
-		if (MPackMatchString(redraw_command_name, "grid_resize")) {
-			if (UpdateGridSize(renderer, redraw_command_arr))
-			{
-				PixelSize size = RendererGridToPixelSize(renderer, renderer->grid_rows, renderer->grid_cols);
-				SetWindowPos(renderer->hwnd, HWND_TOP, 0, 0, size.width, size.height, SWP_NOMOVE | SWP_NOZORDER | SWP_FRAMECHANGED);
-			}
-		}
-		if (MPackMatchString(redraw_command_name, "grid_clear")) {
-			ClearGrid(renderer);
-		}
-		else if (MPackMatchString(redraw_command_name, "default_colors_set")) {
-			UpdateDefaultColors(renderer, redraw_command_arr);
-			renderer->draws_invalidated = true;
-		}
-		else if (MPackMatchString(redraw_command_name, "hl_attr_define")) {
-			UpdateHighlightAttributes(renderer, redraw_command_arr);
-		}
-		else if (MPackMatchString(redraw_command_name, "grid_line")) {
-			DrawGridLines(renderer, redraw_command_arr);
-		}
-		else if (MPackMatchString(redraw_command_name, "grid_cursor_goto")) {
-			// If the old cursor position is still within the row bounds,
-			// redraw the line to get rid of the cursor
-			if(renderer->cursor.row < renderer->grid_rows) {
-				DrawGridLine(renderer, renderer->cursor.row);
-			}
-			UpdateCursorPos(renderer, redraw_command_arr);
-			UpdateImePos(renderer);
+// Draws nothing but the cursor, when it's time for it to blink
+void BlinkCursor(Renderer *renderer) {
+	// Nothing was drawn yet, or a flush waits for its frame and draws the
+	// cursor along with it
+	if (!renderer->has_drawn || renderer->frame_scheduler.pending_flushes) {
+		return;
+	}
+	if (CursorBlinkAdvance(&renderer->cursor_blink, ClockNowNs() / 1000000)) {
+		StartDraw(renderer);
+		EraseCursor(renderer);
+		if (!renderer->ui.busy && renderer->cursor_blink.visible) {
+			DrawCursor(renderer);
 		}
-		else if (MPackMatchString(redraw_command_name, "mode_info_set")) {
-			UpdateCursorModeInfos(renderer, redraw_command_arr);
+		FinishDraw(renderer);
+		++renderer->cursor_frames;
+	}
+}
+
+// When the render thread wakes up unless woken before: for the frame the
+// pending flushes wait for, or the next blink of the cursor. Blinking
+// restarts whenever the cursor moves or changes mode, and stops while nvim
+// is busy.
+uint64_t NextWakeNs(Renderer *renderer) {
+	uint64_t wake_ns = renderer->frame_scheduler.pending_flushes ? renderer->frame_scheduler.due_ns : UINT64_MAX;
+	uint64_t blink_ms = renderer->cursor_blink.next_ms;
+	if (blink_ms != CURSOR_BLINK_NEVER && !renderer->ui.busy) {
+		uint64_t blink_ns = blink_ms * 1000000;
+		wake_ns = blink_ns < wake_ns ? blink_ns : wake_ns;
+	}
+	return wake_ns;
+}
+
+// Does what the window thread asked for. Returns true if everything has
+// to be drawn again.
+bool HandleRequests(Renderer *renderer) {
+	RendererRequests requests;
+	{
+		std::lock_guard<std::mutex> lock(renderer->shared_lock);
+		requests = renderer->requests;
+		renderer->requests = RendererRequests {};
+	}
+
+	bool font_changed = requests.guifont_changed || requests.dpi_changed || requests.font_size_delta != 0.0f;
+	if (requests.dpi_changed) {
+		renderer->dpi_scale = requests.dpi_scale;
+	}
+	if (requests.guifont_changed) {
+		UpdateGuiFont(renderer, requests.guifont, requests.guifont_length);
+	}
+	else if (font_changed) {
+		// Also covers DPI changes, which update the font size
+		RendererUpdateFont(renderer, renderer->last_requested_font_size + requests.font_size_delta);
+	}
+	if (requests.refresh_rate_changed) {
+		UpdateRefreshRate(renderer);
+	}
+	if (requests.resize) {
+		InitializeWindowDependentResources(renderer, requests.width, requests.height);
+	}
+
+	if (font_changed) {
+		// Send message to window in order to update nvim row/col count
+		PostMessage(renderer->hwnd, WM_RENDERER_FONT_UPDATE, 0, 0);
+	}
+	return font_changed || requests.resize;
+}
+
+// Brings the renderer up to the latest snapshot of the model
+void ApplySnapshot(Renderer *renderer, const GridSnapshot *snapshot) {
+	int rows = renderer->ui.grid.rows;
+	int cols = renderer->ui.grid.cols;
+	// Sadly I have given up on making use of IDXGISwapChain1::Present1
+	// scroll_rects, they seem insufficient for nvim since it can require
+	// multiple scrolls per frame. Instead the scrolls are queued on the
+	// grid and the next flush moves the drawn rows, see MoveScrolledRows
+	GridSnapshotApply(&renderer->ui, &renderer->mirror, snapshot);
+	if (renderer->ui.grid.rows != rows || renderer->ui.grid.cols != cols) {
+		UpdateGridSize(renderer);
+	}
+
+	if (snapshot->highlight_count || snapshot->default_colors_changed) {
+		// Cached layouts have the colors of the ids nvim redefines baked in.
+		// GridSnapshotApply has marked the rows showing them.
+		LayoutCacheInvalidate(&renderer->layout_cache);
+	}
+	if (snapshot->cursor_changed) {
+		// The cursor is erased and drawn again on flush, see EraseCursor
+		renderer->cursor_blink_reset = true;
+	}
+	renderer->model_stats = snapshot->model_stats;
+	renderer->model_damage = snapshot->damage;
+}
+
+void PublishStats(Renderer *renderer) {
+	RendererStats stats {
+		.flushes = renderer->flushes,
+		.rows_drawn = renderer->rows_drawn,
+		.scroll_blits = renderer->scroll_blits,
+		.cursor_frames = renderer->cursor_frames,
+		.ime_updates = renderer->ime_updates,
+		.row_prep = renderer->row_prep.stats,
+		.prep_pool = renderer->row_prep.pool.stats,
+		.background_plan = renderer->background_plan.stats,
+		.frames = renderer->frame_scheduler.stats,
+		.frame_interval_ns = renderer->frame_scheduler.interval_ns,
+		.layout_cache = renderer->layout_cache.stats,
+		.glyph_metrics = renderer->glyph_metrics.stats,
+		.style_count = renderer->ui.styles.style_count,
+		.styles = renderer->ui.styles.stats,
+		.model = renderer->model_stats,
+		.damage = renderer->model_damage,
+		.mirror = renderer->mirror.stats
+	};
+	std::lock_guard<std::mutex> lock(renderer->shared_lock);
+	renderer->stats = stats;
+}
+
+void RenderThread(Renderer *renderer) {
+	while (true) {
+		uint64_t now_ns = ClockNowNs();
+		uint64_t wake_ns = NextWakeNs(renderer);
+		uint64_t timeout_ns = wake_ns == UINT64_MAX ? UINT64_MAX : (wake_ns > now_ns ? wake_ns - now_ns : 0);
+		SnapshotChannelWait(&renderer->snapshots, timeout_ns);
+		if (renderer->render_stopping.load(std::memory_order_acquire)) {
+			break;
 		}
-		else if (MPackMatchString(redraw_command_name, "mode_change")) {
-			// Redraw cursor if its inside the bounds
-			if(renderer->cursor.row < renderer->grid_rows) {
-				DrawGridLine(renderer, renderer->cursor.row);
+
+		bool redraw = HandleRequests(renderer);
+		bool draw = false;
+		now_ns = ClockNowNs();
+		if (GridSnapshot *snapshot = SnapshotChannelTake(&renderer->snapshots)) {
+			ApplySnapshot(renderer, snapshot);
+			// The flushes are applied to the grid already, drawing them can
+			// wait for the next frame along with the flushes that follow
+			for (uint32_t i = 0; i < snapshot->flushes; ++i) {
+				draw = FrameSchedulerFlush(&renderer->frame_scheduler, now_ns);
 			}
-			UpdateCursorMode(renderer, redraw_command_arr);
-		}
-		else if (MPackMatchString(redraw_command_name, "set_title")) {
-			UpdateWindowTitle(renderer, redraw_command_arr);
+			GridSnapshotFree(snapshot);
 		}
-		else if (MPackMatchString(redraw_command_name, "busy_start")) {
-			renderer->ui_busy = true;
-			// Hide cursor while UI is busy
-			if(renderer->cursor.row < renderer->grid_rows) {
-				DrawGridLine(renderer, renderer->cursor.row);
-			}
+		else {
+			draw = FrameSchedulerTick(&renderer->frame_scheduler, now_ns);
 		}
-		else if (MPackMatchString(redraw_command_name, "busy_stop")) {
-			renderer->ui_busy = false;
+
+		if (draw || (redraw && renderer->grid_initialized)) {
+			RendererFlush(renderer);
 		}
-		else if (MPackMatchString(redraw_command_name, "grid_scroll")) {
-			ScrollRegion(renderer, redraw_command_arr);
+		else {
+			BlinkCursor(renderer);
 		}
-		else if (MPackMatchString(redraw_command_name, "flush")) {
-			if (!renderer->has_drawn) {
-				renderer->has_drawn = true;
-				ShowWindow(renderer->hwnd, start_maximized ? SW_MAXIMIZE : SW_SHOWDEFAULT);			}
+		PublishStats(renderer);
+	}
+}
 
-			RendererFlush(renderer);
+void RendererApplyRedraw(Renderer *renderer, const char *commands, size_t size) {
+	SnapshotModelApply(&renderer->model, commands, size, &renderer->snapshots);
+}
+
+// Asks the render thread for something, see RendererRequests
+template <typename Fn>
+void Request(Renderer *renderer, Fn &&fn) {
+	{
+		std::lock_guard<std::mutex> lock(renderer->shared_lock);
+		fn(&renderer->requests);
+	}
+	SnapshotChannelWake(&renderer->snapshots);
+}
+
+void RendererResize(Renderer *renderer, uint32_t width, uint32_t height) {
+	Request(renderer, [&](RendererRequests *requests) {
+		requests->resize = true;
+		requests->width = width;
+		requests->height = height;
+	});
+}
+
+void RendererUpdateGuiFont(Renderer *renderer, const char *guifont, size_t strlen) {
+	if (strlen >= MAX_GUIFONT_LENGTH) {
+		return;
+	}
+	Request(renderer, [&](RendererRequests *requests) {
+		requests->guifont_changed = true;
+		memcpy(requests->guifont, guifont, strlen);
+		requests->guifont[strlen] = '\0';
+		requests->guifont_length = strlen;
+	});
+}
+
+void RendererUpdateFontSize(Renderer *renderer, float font_size_delta) {
+	Request(renderer, [&](RendererRequests *requests) {
+		requests->font_size_delta += font_size_delta;
+	});
+}
+
+void RendererUpdateDpi(Renderer *renderer, float dpi_scale) {
+	Request(renderer, [&](RendererRequests *requests) {
+		requests->dpi_changed = true;
+		requests->dpi_scale = dpi_scale;
+	});
+}
+
+void RendererUpdateRefreshRate(Renderer *renderer) {
+	Request(renderer, [&](RendererRequests *requests) {
+		requests->refresh_rate_changed = true;
+	});
+}
+
+void RendererGetStats(Renderer *renderer, RendererStats *stats) {
+	std::lock_guard<std::mutex> lock(renderer->shared_lock);
+	*stats = renderer->stats;
+}
+
+// The window thread's part of a redraw command buffer, the reader thread
+// applied it to the model already
+void RendererExecute(Renderer *renderer, const char *commands, size_t size, bool start_maximized) {
+	RedrawCommandReader reader;
+	if (!RedrawCommandsBegin(&reader, commands, size)) {
+		return;
+	}
+
+	while (const RedrawCommand *command = RedrawNextCommand(&reader)) {
+		switch (command->event) {
+		case RedrawEvent::option_set: {
+			SetGuiOptions(renderer, reinterpret_cast<const RedrawCommandOptionSet *>(command));
+		} break;
+		case RedrawEvent::grid_resize: {
+			const RedrawCommandGridResize *grid_resize = reinterpret_cast<const RedrawCommandGridResize *>(command);
+			renderer->nvim_rows = grid_resize->height;
+			renderer->nvim_cols = grid_resize->width;
+			PixelSize size = RendererGridToPixelSize(renderer, renderer->nvim_rows, renderer->nvim_cols);
+			SetWindowPos(renderer->hwnd, HWND_TOP, 0, 0, size.width, size.height, SWP_NOMOVE | SWP_NOZORDER | SWP_FRAMECHANGED);
+		} break;
+		case RedrawEvent::set_title: {
+			UpdateWindowTitle(renderer, reinterpret_cast<const RedrawCommandSetTitle *>(command));
+		} break;
+		case RedrawEvent::flush: {
+			if (!renderer->window_shown) {
+				renderer->window_shown = true;
+				ShowWindow(renderer->hwnd, start_maximized ? SW_MAXIMIZE : SW_SHOWDEFAULT);
+			}
+		} break;
+		default: {
+		} break;
 		}
 	}
 }
 
+// The font's cell size, for the window thread
+D2D1_SIZE_F CellSize(Renderer *renderer) {
+	std::lock_guard<std::mutex> lock(renderer->shared_lock);
+	return D2D1_SIZE_F { renderer->metrics.font_width, renderer->metrics.font_height };
+}
+
 PixelSize RendererGridToPixelSize(Renderer *renderer, int rows, int cols) {
-	int requested_width = static_cast<int>(ceilf(renderer->font_width) * cols);
-	int requested_height = static_cast<int>(ceilf(renderer->font_height) * rows);
+	D2D1_SIZE_F cell = CellSize(renderer);
+	int requested_width = static_cast<int>(ceilf(cell.width) * cols);
+	int requested_height = static_cast<int>(ceilf(cell.height) * rows);
 
 	// Adjust size to include title bar
 	RECT adjusted_rect = { 0, 0, requested_width, requested_height };
@@ -1184,15 +1459,17 @@ PixelSize RendererGridToPixelSize(Renderer *renderer, int rows, int cols) {
 }
 
 GridSize RendererPixelsToGridSize(Renderer *renderer, int width, int height) {
+	D2D1_SIZE_F cell = CellSize(renderer);
 	return GridSize {
-		static_cast<int>(height / renderer->font_height),
-		static_cast<int>(width / renderer->font_width)
+		static_cast<int>(height / cell.height),
+		static_cast<int>(width / cell.width)
 	};
 }
 
 GridPoint RendererCursorToGridPoint(Renderer *renderer, int x, int y) {
+	D2D1_SIZE_F cell = CellSize(renderer);
 	return GridPoint {
-		static_cast<int>(y / renderer->font_height),
-		static_cast<int>(x / renderer->font_width)
+		static_cast<int>(y / cell.height),
+		static_cast<int>(x / cell.width)
 	};
 }
@@ -1,33 +1,19 @@
 #pragma once
 #include <pch.h>
+#include "common/transcode.h"
+#include "renderer/background_plan.h"
+#include "renderer/frame_scheduler.h"
+#include "renderer/glyph_metrics.h"
 #include "renderer/glyph_renderer.h"
+#include "renderer/glyph_row.h"
+#include "renderer/grid_snapshot.h"
+#include "renderer/layout_cache.h"
+#include "renderer/row_prep.h"
+#include "renderer/ui_state.h"
 
 constexpr const char *DEFAULT_FONT = "Consolas";
 constexpr float DEFAULT_FONT_SIZE = 14.0f;
 
-constexpr uint32_t DEFAULT_COLOR = 0x46464646;
-enum HighlightAttributeFlags : uint16_t {
-	HL_ATTRIB_REVERSE			= 1 << 0,
-	HL_ATTRIB_ITALIC			= 1 << 1,
-	HL_ATTRIB_BOLD				= 1 << 2,
-	HL_ATTRIB_STRIKETHROUGH		= 1 << 3,
-	HL_ATTRIB_UNDERLINE			= 1 << 4,
-	HL_ATTRIB_UNDERCURL			= 1 << 5
-};
-struct HighlightAttributes {
-	uint32_t foreground;
-	uint32_t background;
-	uint32_t special;
-	uint16_t flags;
-};
-
-enum class CursorShape {
-	None,
-	Block,
-	Vertical,
-	Horizontal
-};
-
 struct GridPoint {
 	int row;
 	int col;
@@ -41,46 +27,123 @@ struct PixelSize {
 	int height;
 };
 
-struct CursorModeInfo {
-	CursorShape shape;
-	uint16_t hl_attrib_id;
-};
-struct Cursor {
-	CursorModeInfo *mode_info;
-	int row;
-	int col;
-};
-
-struct CellProperty {
-	uint16_t hl_attrib_id;
-	bool is_wide_char;
-};
-
-constexpr int MAX_HIGHLIGHT_ATTRIBS = 0xFFFF;
-constexpr int MAX_CURSOR_MODE_INFOS = 64;
 constexpr int MAX_FONT_LENGTH = 128;
+constexpr int MAX_GUIFONT_LENGTH = 256;
 constexpr float DEFAULT_DPI = 96.0f;
 constexpr float POINTS_PER_INCH = 72.0f;
 struct GlyphDrawingEffect;
 struct GlyphRenderer;
 using Microsoft::WRL::ComPtr;
+
+static_assert(sizeof(StyleColor) == sizeof(D2D1_COLOR_F));
+inline D2D1_COLOR_F StyleColorF(StyleColor color) {
+	return D2D1_COLOR_F { color.r, color.g, color.b, color.a };
+}
+
+// What the window thread asks of the render thread, done before its next frame
+struct RendererRequests {
+	bool resize;
+	uint32_t width;
+	uint32_t height;
+	bool dpi_changed;
+	float dpi_scale;
+	// From ctrl+wheel, added up until the render thread gets to them
+	float font_size_delta;
+	bool guifont_changed;
+	char guifont[MAX_GUIFONT_LENGTH];
+	size_t guifont_length;
+	bool refresh_rate_changed;
+};
+
+// What the window thread needs of the font, to map between cells and pixels
+struct RendererMetrics {
+	float font_width;
+	float font_height;
+	wchar_t font[MAX_FONT_LENGTH];
+};
+
+// The render thread's counters as of its last frame, for nvy_stats
+struct RendererStats {
+	uint64_t flushes;
+	uint64_t rows_drawn;
+	uint64_t scroll_blits;
+	uint64_t cursor_frames;
+	uint64_t ime_updates;
+	RowPrepStats row_prep;
+	WorkPoolStats prep_pool;
+	BackgroundPlanStats background_plan;
+	FrameSchedulerStats frames;
+	uint64_t frame_interval_ns;
+	LayoutCacheStats layout_cache;
+	GlyphMetricsStats glyph_metrics;
+	int style_count;
+	StyleTableStats styles;
+	// The applying side's, as of the last snapshot taken
+	SnapshotModelStats model;
+	GridDamageStats damage;
+	SnapshotMirrorStats mirror;
+};
+
+// Nvim's redraw events are applied to a SnapshotModel on the reader thread,
+// see RendererApplyRedraw, and drawn on a thread of the renderer's own. The
+// window thread only handles input, and what has to be done on it: the
+// title, the window size and the IME.
 struct Renderer {
-	CursorModeInfo cursor_mode_infos[MAX_CURSOR_MODE_INFOS];
-	Vec<HighlightAttributes> hl_attribs;
-	Cursor cursor;
+	// The grid, highlights and cursor as of the last snapshot taken
+	UiState ui;
+	// Nvim's state, only ever touched by the reader thread
+	SnapshotModel model;
+	SnapshotChannel snapshots;
+	SnapshotMirror mirror;
+	// The model's counters, as of the last snapshot taken
+	SnapshotModelStats model_stats;
+	GridDamageStats model_damage;
+
+	std::thread render_thread;
+	std::atomic<bool> render_stopping;
+
+	// Shared between the render thread and the window thread
+	std::mutex shared_lock;
+	RendererRequests requests;
+	RendererMetrics metrics;
+	RendererStats stats;
+
+	// The window thread's, the grid size nvim last set and whether the
+	// window was shown
+	int nvim_rows;
+	int nvim_cols;
+	bool window_shown;
 
 	std::unique_ptr<GlyphRenderer> glyph_renderer;
+	LayoutCache layout_cache;
+	GlyphMetrics glyph_metrics;
+	// Backgrounds of the rows drawn in a flush, see BackgroundPlan
+	BackgroundPlan background_plan;
+	// Rows drawn without a text layout, see GlyphRow
+	GlyphRow glyph_row;
+	// The dirty rows of a flush, prepared on a pool of threads
+	RowPrep row_prep;
 
 	D3D_FEATURE_LEVEL d3d_feature_level;
 	ComPtr<ID3D11Device2> d3d_device;
 	ComPtr<ID3D11DeviceContext2> d3d_context;
 	ComPtr<IDXGISwapChain2> dxgi_swapchain;
 	HANDLE swapchain_wait_handle;
+	// Scratch copy of scrolled rows, the back buffer can't be copied onto itself
+	ComPtr<ID3D11Texture2D> scroll_texture;
+	// The pixels under the cursor from before it was drawn, see DrawCursor
+	ComPtr<ID3D11Texture2D> cursor_texture;
+	uint32_t cursor_texture_width;
+	uint32_t cursor_texture_height;
+	CursorPixels cursor_pixels;
+	bool cursor_saved;
 	ComPtr<ID2D1Factory5> d2d_factory;
 	ComPtr<ID2D1Device4> d2d_device;
 	ComPtr<ID2D1DeviceContext4> d2d_context;
 	ComPtr<ID2D1Bitmap1> d2d_target_bitmap;
 	ComPtr<ID2D1SolidColorBrush> d2d_background_rect_brush;
+	// Last color of the brush, rects of the same color don't set it again
+	StyleColor background_rect_color;
 
     ComPtr<IDWriteFontFace1> font_face;
 
@@ -106,29 +169,58 @@ struct Renderer {
 
 	D2D1_SIZE_U pixel_size;
 	bool grid_initialized;
-	int grid_rows;
-	int grid_cols;
-	std::unique_ptr<uint32_t[]> grid_chars;
 	std::unique_ptr<wchar_t[]> wchar_buffer;
 	size_t wchar_buffer_length;
-	std::unique_ptr<CellProperty[]> grid_cell_properties;
+	// Which cells of a row need a closer look, see TranscodeScanRow
+	TranscodeScanRules scan_rules;
+
+	CursorBlink cursor_blink;
+	// Set when the cursor moved or changed mode, which restarts blinking
+	bool cursor_blink_reset;
+	// Where the IME composition window was put last, -1 to put it again
+	int ime_row;
+	int ime_col;
+
+	// Flushes are drawn at most once per frame interval
+	FrameScheduler frame_scheduler;
 
 	HWND hwnd;
-	bool draw_active;
-	bool ui_busy;
 	bool has_drawn;
 	bool draws_invalidated;
+
+	// Statistics
+	uint64_t flushes;
+	uint64_t rows_drawn;
+	uint64_t scroll_blits;
+	// Frames that only erased or drew the cursor, when it blinks
+	uint64_t cursor_frames;
+	uint64_t ime_updates;
 };
 
-void RendererInitialize(Renderer *renderer, HWND hwnd, bool disable_ligatures, float linespace_factor, float monitor_dpi);
+void RendererInitialize(Renderer *renderer, HWND hwnd, bool disable_ligatures, float linespace_factor, float monitor_dpi,
+	FramePolicy frame_policy, uint32_t max_fps);
+// Creates the swap chain for the window's size and starts the render thread
 void RendererAttach(Renderer *renderer);
+// Stops the render thread and releases the model and the snapshots, call
+// NvimShutdown first so the reader thread no longer applies redraws.
 void RendererShutdown(Renderer *renderer);
 
+// Called on nvim's reader thread with each buffer of redraw commands
+void RendererApplyRedraw(Renderer *renderer, const char *commands, size_t size);
+
+// Called on the window thread, these ask the render thread, which posts
+// WM_RENDERER_FONT_UPDATE once the font changed
 void RendererResize(Renderer *renderer, uint32_t width, uint32_t height);
-bool RendererUpdateGuiFont(Renderer *renderer, const char *guifont, size_t strlen);
-bool RendererUpdateFont(Renderer *renderer, float font_size, const char *font_string = "", int strlen = 0);
-void RendererRedraw(Renderer *renderer, mpack_node_t params, bool start_maximized);
-void RendererFlush(Renderer* renderer);
+void RendererUpdateGuiFont(Renderer *renderer, const char *guifont, size_t strlen);
+void RendererUpdateFontSize(Renderer *renderer, float font_size_delta);
+void RendererUpdateDpi(Renderer *renderer, float dpi_scale);
+// Called when the window may have moved to a display of another refresh rate
+void RendererUpdateRefreshRate(Renderer *renderer);
+// Does the part of a redraw command buffer that belongs to the window thread
+void RendererExecute(Renderer *renderer, const char *commands, size_t size, bool start_maximized);
+// Called on WM_RENDERER_IME_UPDATE
+void RendererUpdateImePos(Renderer *renderer, int row, int col);
+void RendererGetStats(Renderer *renderer, RendererStats *stats);
 
 PixelSize RendererGridToPixelSize(Renderer *renderer, int rows, int cols);
 GridSize RendererPixelsToGridSize(Renderer *renderer, int width, int height);
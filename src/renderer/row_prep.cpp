@@ -0,0 +1,146 @@
+#include "row_prep.h"
+#include <cstdlib>
+
+bool RowPrepInitialize(RowPrep *prep, int thread_count) {
+	prep->packets = nullptr;
+	prep->packet_count = 0;
+	prep->capacity_rows = 0;
+	prep->capacity_cols = 0;
+	prep->memory = nullptr;
+	prep->stats = RowPrepStats {};
+	return WorkPoolInitialize(&prep->pool, thread_count);
+}
+
+static void FreePackets(RowPrep *prep) {
+	free(prep->packets);
+	free(prep->memory);
+	prep->packets = nullptr;
+	prep->memory = nullptr;
+	prep->packet_count = 0;
+	prep->capacity_rows = 0;
+	prep->capacity_cols = 0;
+}
+
+void RowPrepShutdown(RowPrep *prep) {
+	WorkPoolShutdown(&prep->pool);
+	FreePackets(prep);
+}
+
+bool RowPrepReserve(RowPrep *prep, int rows, int cols) {
+	if (rows <= prep->capacity_rows && cols <= prep->capacity_cols) {
+		return true;
+	}
+	FreePackets(prep);
+
+	// The arrays of a row, largest alignment first
+	size_t special_size = (cols + 63) / 64 * sizeof(uint64_t);
+	size_t u32_size = cols * sizeof(uint32_t);
+	size_t runs_size = cols * sizeof(GlyphRowRun);
+	size_t u16_size = cols * sizeof(uint16_t);
+	size_t row_size = special_size + 3 * u32_size + runs_size + 3 * u16_size;
+	row_size = (row_size + 7) & ~static_cast<size_t>(7);
+
+	prep->packets = static_cast<RowPacket *>(malloc(rows * sizeof(RowPacket)));
+	prep->memory = malloc(rows * row_size);
+	if (!prep->packets || !prep->memory) {
+		FreePackets(prep);
+		return false;
+	}
+	char *memory = static_cast<char *>(prep->memory);
+	for (int row = 0; row < rows; ++row) {
+		RowPacket *packet = &prep->packets[row];
+		char *p = memory + row * row_size;
+		packet->special_cells = reinterpret_cast<uint64_t *>(p);
+		p += special_size;
+		packet->run_starts = reinterpret_cast<uint32_t *>(p);
+		packet->style_starts = reinterpret_cast<uint32_t *>(p + u32_size);
+		packet->style_colors = reinterpret_cast<uint32_t *>(p + 2 * u32_size);
+		p += 3 * u32_size;
+		packet->glyph_runs = reinterpret_cast<GlyphRowRun *>(p);
+		p += runs_size;
+		packet->glyph_indices = reinterpret_cast<uint16_t *>(p);
+		// Surrogate pairs take two units
+		packet->text = reinterpret_cast<uint16_t *>(p + u16_size);
+	}
+	prep->capacity_rows = rows;
+	prep->capacity_cols = cols;
+	return true;
+}
+
+static void PrepareRow(void *context, int item, int) {
+	RowPrep *prep = static_cast<RowPrep *>(context);
+	RowPacket *packet = &prep->packets[item];
+	const Grid *grid = prep->grid;
+	StyleTable *styles = prep->styles;
+	size_t base = GridRowOffset(grid, packet->row);
+	const uint32_t *chars = &grid->chars[base];
+	const uint16_t *hl_ids = &grid->hl_ids[base];
+	const uint8_t *flags = &grid->flags[base];
+	int cols = grid->cols;
+
+	packet->run_count = TranscodeScanRow(chars, hl_ids, flags, cols, &prep->scan_rules,
+		packet->run_starts, packet->special_cells);
+
+	// Highlight ids drawn alike share a style, and a background fill
+	uint16_t style_id = StyleTableStyleId(styles, hl_ids[0]);
+	packet->style_starts[0] = 0;
+	packet->style_colors[0] = StyleTableStyle(styles, style_id)->background_rgb;
+	size_t style_run_count = 1;
+	for (size_t run = 1; run < packet->run_count; ++run) {
+		uint32_t i = packet->run_starts[run];
+		if (StyleTableStyleId(styles, hl_ids[i]) != style_id) {
+			style_id = StyleTableStyleId(styles, hl_ids[i]);
+			packet->style_starts[style_run_count] = i;
+			packet->style_colors[style_run_count++] = StyleTableStyle(styles, style_id)->background_rgb;
+		}
+	}
+	packet->style_run_count = style_run_count;
+
+	packet->direct = GlyphRowBuild(prep->glyph_row, styles, chars, hl_ids, packet->special_cells,
+		packet->run_starts, packet->run_count, cols, packet->glyph_indices, packet->glyph_runs,
+		&packet->glyph_run_count);
+	if (packet->direct) {
+		packet->text_length = 0;
+		packet->layout_hash = 0;
+		return;
+	}
+	packet->text_length = TranscodeCellsToUtf16(chars, cols, packet->text);
+	LayoutCacheRow key { chars, hl_ids, flags, cols };
+	packet->layout_hash = LayoutCacheHash(prep->layout_cache, &key);
+}
+
+bool RowPrepRun(RowPrep *prep, const Grid *grid, StyleTable *styles, const GlyphRow *glyph_row,
+	const LayoutCache *layout_cache, const TranscodeScanRules *scan_rules) {
+	prep->packet_count = 0;
+	if (grid->rows > prep->capacity_rows || grid->cols > prep->capacity_cols || grid->cols == 0) {
+		return false;
+	}
+	for (int row = GridNextDirtyRow(grid, 0); row >= 0; row = GridNextDirtyRow(grid, row + 1)) {
+		prep->packets[prep->packet_count++].row = row;
+	}
+
+	prep->grid = grid;
+	prep->styles = styles;
+	prep->glyph_row = glyph_row;
+	prep->layout_cache = layout_cache;
+	prep->scan_rules = *scan_rules;
+	if (static_cast<int64_t>(prep->packet_count) * grid->cols >= ROW_PREP_PARALLEL_CELLS) {
+		++prep->stats.parallel_runs;
+		WorkPoolRun(&prep->pool, prep->packet_count, PrepareRow, prep);
+	}
+	else {
+		for (int i = 0; i < prep->packet_count; ++i) {
+			PrepareRow(prep, i, 0);
+		}
+	}
+
+	for (int i = 0; i < prep->packet_count; ++i) {
+		const RowPacket *packet = &prep->packets[i];
+		prep->stats.rows_direct += packet->direct;
+		prep->stats.glyph_runs += packet->glyph_run_count;
+		prep->stats.hl_runs += packet->run_count;
+		prep->stats.style_runs += packet->style_run_count;
+	}
+	prep->stats.rows += prep->packet_count;
+	return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "common/transcode.h"
+#include "common/work_pool.h"
+#include "renderer/glyph_row.h"
+#include "renderer/grid.h"
+#include "renderer/layout_cache.h"
+#include "renderer/style_table.h"
+
+// The work on the dirty rows of a flush that needs no DirectWrite, done
+// for all of them at once on a WorkPool: the scan, the style runs and
+// their backgrounds, the glyph runs of rows drawn directly and the UTF-16
+// text and layout cache hash of the rest. Every row gets a packet of its
+// own, which nothing writes once RowPrepRun returns, so the render thread
+// then only plans backgrounds, lays out what the cache misses and draws,
+// in row order.
+//
+// Flushes of a few rows, most of them (typing, the cursor moving), are
+// prepared on the calling thread, waking the pool costs more than they do.
+constexpr int ROW_PREP_PARALLEL_CELLS = 4096;
+
+struct RowPacket {
+	int row;
+	// Runs of equal highlight ids and the special cells, see TranscodeScanRow
+	uint32_t *run_starts;
+	size_t run_count;
+	uint64_t *special_cells;
+	// Runs of equal styles and their backgrounds, see BackgroundPlanAddRow
+	uint32_t *style_starts;
+	uint32_t *style_colors;
+	size_t style_run_count;
+	// Drawn as glyph runs, see GlyphRowBuild
+	bool direct;
+	uint16_t *glyph_indices;
+	GlyphRowRun *glyph_runs;
+	int glyph_run_count;
+	// Otherwise laid out, from this text, unless the cache has the layout
+	uint16_t *text;
+	size_t text_length;
+	uint64_t layout_hash;
+};
+
+struct RowPrepStats {
+	uint64_t rows;
+	uint64_t rows_direct;
+	uint64_t glyph_runs;
+	// Runs of the rows split by highlight id and by style
+	uint64_t hl_runs;
+	uint64_t style_runs;
+	// Flushes large enough to go to the pool
+	uint64_t parallel_runs;
+};
+
+struct RowPrep {
+	WorkPool pool;
+
+	// A packet per dirty row of the last run, in row order
+	RowPacket *packets;
+	int packet_count;
+	int capacity_rows;
+	int capacity_cols;
+	// Single allocation behind the packets' arrays
+	void *memory;
+
+	// What the current run prepares from, read by all threads
+	const Grid *grid;
+	StyleTable *styles;
+	const GlyphRow *glyph_row;
+	const LayoutCache *layout_cache;
+	TranscodeScanRules scan_rules;
+
+	RowPrepStats stats;
+};
+
+// thread_count as for WorkPoolInitialize. Returns false when out of memory.
+bool RowPrepInitialize(RowPrep *prep, int thread_count);
+void RowPrepShutdown(RowPrep *prep);
+// Makes room for the packets of every row of a rows * cols grid. Returns
+// false when out of memory.
+bool RowPrepReserve(RowPrep *prep, int rows, int cols);
+
+// Prepares the dirty rows of the grid into packets. The grid, styles,
+// glyph row and layout cache must not change until it returns. Returns
+// false when the packets weren't reserved for the grid, nothing is
+// prepared then.
+bool RowPrepRun(RowPrep *prep, const Grid *grid, StyleTable *styles, const GlyphRow *glyph_row,
+	const LayoutCache *layout_cache, const TranscodeScanRules *scan_rules);
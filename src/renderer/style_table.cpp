@@ -0,0 +1,188 @@
+#include "style_table.h"
+#include <cstdlib>
+#include <cstring>
+
+static void ReleaseEffects(StyleTable *table) {
+	for (int i = 0; i < table->style_count; ++i) {
+		HighlightStyle *style = &table->styles[i];
+		if (style->drawing_effect) {
+			table->effects.release(table->effects.context, style->drawing_effect);
+			style->drawing_effect = nullptr;
+		}
+	}
+}
+
+static void Rebuild(StyleTable *table);
+
+bool StyleTableInitialize(StyleTable *table, const HighlightAttributes *hl_attribs) {
+	*table = StyleTable {};
+	table->hl_attribs = hl_attribs;
+	table->styles = static_cast<HighlightStyle *>(malloc(STYLE_TABLE_CAPACITY * sizeof(HighlightStyle)));
+	table->style_ids = static_cast<uint16_t *>(calloc(STYLE_TABLE_HIGHLIGHTS, sizeof(uint16_t)));
+	table->slots = static_cast<int32_t *>(malloc(STYLE_TABLE_SLOTS * sizeof(int32_t)));
+	if (!table->styles || !table->style_ids || !table->slots) {
+		StyleTableShutdown(table);
+		return false;
+	}
+
+	table->defined_limit = 1;
+	Rebuild(table);
+	return true;
+}
+
+void StyleTableShutdown(StyleTable *table) {
+	if (table->styles) {
+		ReleaseEffects(table);
+	}
+	free(table->styles);
+	free(table->style_ids);
+	free(table->slots);
+	table->styles = nullptr;
+	table->style_ids = nullptr;
+	table->slots = nullptr;
+	table->style_count = 0;
+}
+
+void StyleTableSetEffectSource(StyleTable *table, StyleEffectSource effects) {
+	ReleaseEffects(table);
+	table->effects = effects;
+}
+
+StyleColor StyleColorFromRgb(uint32_t rgb) {
+	return StyleColor {
+		static_cast<float>((rgb >> 16) & 0xFF) / 255.0f,
+		static_cast<float>((rgb >> 8) & 0xFF) / 255.0f,
+		static_cast<float>(rgb & 0xFF) / 255.0f,
+		1.0f
+	};
+}
+
+static HighlightStyle Resolve(const HighlightAttributes *defaults, const HighlightAttributes *hl_attribs) {
+	uint32_t foreground = hl_attribs->foreground == DEFAULT_COLOR ? defaults->foreground : hl_attribs->foreground;
+	uint32_t background = hl_attribs->background == DEFAULT_COLOR ? defaults->background : hl_attribs->background;
+	bool reverse = hl_attribs->flags & HL_ATTRIB_REVERSE;
+	HighlightStyle style {};
+	style.foreground = StyleColorFromRgb(reverse ? background : foreground);
+	style.background_rgb = (reverse ? foreground : background) & 0xFFFFFF;
+	style.background = StyleColorFromRgb(style.background_rgb);
+	style.font_weight = hl_attribs->flags & HL_ATTRIB_BOLD ? STYLE_FONT_WEIGHT_BOLD : STYLE_FONT_WEIGHT_NORMAL;
+	style.font_style = hl_attribs->flags & HL_ATTRIB_ITALIC ? STYLE_FONT_STYLE_ITALIC : STYLE_FONT_STYLE_NORMAL;
+	style.decorations = hl_attribs->flags & (HL_ATTRIB_STRIKETHROUGH | HL_ATTRIB_UNDERLINE | HL_ATTRIB_UNDERCURL);
+	if (style.decorations & (HL_ATTRIB_UNDERLINE | HL_ATTRIB_UNDERCURL)) {
+		style.special = StyleColorFromRgb(hl_attribs->special == DEFAULT_COLOR ? defaults->special : hl_attribs->special);
+	}
+	return style;
+}
+
+static bool ColorEquals(StyleColor a, StyleColor b) {
+	return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static bool StyleEquals(const HighlightStyle *a, const HighlightStyle *b) {
+	return ColorEquals(a->foreground, b->foreground) && ColorEquals(a->background, b->background) &&
+		ColorEquals(a->special, b->special) && a->font_weight == b->font_weight &&
+		a->font_style == b->font_style && a->decorations == b->decorations;
+}
+
+static uint32_t StyleSlot(const HighlightStyle *style) {
+	// Colors are multiples of 1/255, hash the bytes they came from
+	const StyleColor *colors[] { &style->foreground, &style->background, &style->special };
+	uint64_t hash = static_cast<uint64_t>(style->font_weight) << 16 | style->font_style << 8 | style->decorations;
+	for (const StyleColor *color : colors) {
+		uint32_t rgba = static_cast<uint32_t>(color->r * 255.0f + 0.5f) << 24 |
+			static_cast<uint32_t>(color->g * 255.0f + 0.5f) << 16 |
+			static_cast<uint32_t>(color->b * 255.0f + 0.5f) << 8 |
+			static_cast<uint32_t>(color->a * 255.0f + 0.5f);
+		hash = (hash ^ rgba) * 0x9E3779B97F4A7C15ull;
+		hash ^= hash >> 32;
+	}
+	return static_cast<uint32_t>(hash) & (STYLE_TABLE_SLOTS - 1);
+}
+
+// Returns -1 if the table is full
+static int32_t InternStyle(StyleTable *table, const HighlightStyle *style) {
+	++table->stats.resolved;
+	uint32_t slot = StyleSlot(style);
+	while (table->slots[slot] >= 0) {
+		if (StyleEquals(&table->styles[table->slots[slot]], style)) {
+			return table->slots[slot];
+		}
+		slot = (slot + 1) & (STYLE_TABLE_SLOTS - 1);
+	}
+	if (table->style_count == STYLE_TABLE_CAPACITY) {
+		return -1;
+	}
+	int32_t style_id = table->style_count++;
+	table->styles[style_id] = *style;
+	table->slots[slot] = style_id;
+	return style_id;
+}
+
+// Starts the styles over from the highlights, dropping unused ones. The
+// defaults come first, so they are style 0.
+static void Rebuild(StyleTable *table) {
+	ReleaseEffects(table);
+	table->style_count = 0;
+	memset(table->slots, 0xFF, STYLE_TABLE_SLOTS * sizeof(int32_t));
+	++table->stats.rebuilds;
+
+	// There are no more highlights than styles, every one fits
+	for (int id = 0; id < table->defined_limit; ++id) {
+		HighlightStyle style = Resolve(&table->hl_attribs[0], &table->hl_attribs[id]);
+		table->style_ids[id] = static_cast<uint16_t>(InternStyle(table, &style));
+	}
+}
+
+static uint16_t Intern(StyleTable *table, const HighlightAttributes *attributes) {
+	HighlightStyle style = Resolve(&table->hl_attribs[0], attributes);
+	int32_t style_id = InternStyle(table, &style);
+	if (style_id < 0) {
+		Rebuild(table);
+		style_id = InternStyle(table, &style);
+	}
+	// Only when every highlight id is defined and distinct
+	return style_id >= 0 ? static_cast<uint16_t>(style_id) : 0;
+}
+
+void StyleTableDefine(StyleTable *table, int id) {
+	if (id <= 0 || id >= STYLE_TABLE_HIGHLIGHTS) {
+		return;
+	}
+	// Ids skipped on the way are drawn as the zeroed attributes they have
+	// and count as defined only once they have a style, a rebuild on the
+	// way resolves the ones that do
+	while (table->defined_limit < id) {
+		HighlightAttributes undefined {};
+		uint16_t style_id = Intern(table, &undefined);
+		table->style_ids[table->defined_limit++] = style_id;
+	}
+	if (table->defined_limit == id) {
+		table->defined_limit = id + 1;
+	}
+	table->style_ids[id] = Intern(table, &table->hl_attribs[id]);
+}
+
+void StyleTableResolveAll(StyleTable *table) {
+	Rebuild(table);
+}
+
+uint16_t StyleTableIntern(StyleTable *table, const HighlightAttributes *attributes) {
+	return Intern(table, attributes);
+}
+
+void *StyleTableDrawingEffect(StyleTable *table, HighlightStyle *style) {
+	if (!style->drawing_effect && table->effects.create) {
+		style->drawing_effect = table->effects.create(table->effects.context, style);
+		++table->stats.effects_created;
+	}
+	return style->drawing_effect;
+}
+
+StyleRowRuns StyleTableCountRuns(const StyleTable *table, const uint16_t *hl_ids, int cols) {
+	StyleRowRuns runs { 1, 1 };
+	for (int i = 1; i < cols; ++i) {
+		runs.hl_runs += hl_ids[i] != hl_ids[i - 1];
+		runs.style_runs += table->style_ids[hl_ids[i]] != table->style_ids[hl_ids[i - 1]];
+	}
+	return runs;
+}
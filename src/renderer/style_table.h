@@ -0,0 +1,116 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "renderer/highlight.h"
+
+// Font weight and style as DirectWrite numbers them (DWRITE_FONT_WEIGHT,
+// DWRITE_FONT_STYLE), so the renderer passes them on as they are
+constexpr uint16_t STYLE_FONT_WEIGHT_NORMAL = 400;
+constexpr uint16_t STYLE_FONT_WEIGHT_BOLD = 700;
+constexpr uint8_t STYLE_FONT_STYLE_NORMAL = 0;
+constexpr uint8_t STYLE_FONT_STYLE_ITALIC = 2;
+
+// Same layout as D2D1_COLOR_F
+struct StyleColor {
+	float r;
+	float g;
+	float b;
+	float a;
+};
+
+// Same conversion as D2D1::ColorF(UINT32)
+StyleColor StyleColorFromRgb(uint32_t rgb);
+
+// A highlight as it is drawn: reverse and default colors resolved, the
+// colors ready for a brush
+struct HighlightStyle {
+	StyleColor foreground;
+	StyleColor background;
+	// The background as nvim sends colors, 0xRRGGBB, to compare fills by
+	uint32_t background_rgb;
+	// Only drawn under underlines, transparent black without one
+	StyleColor special;
+	uint16_t font_weight;
+	uint8_t font_style;
+	// HL_ATTRIB_STRIKETHROUGH, HL_ATTRIB_UNDERLINE and HL_ATTRIB_UNDERCURL,
+	// the rest is resolved into the fields above
+	uint16_t decorations;
+	// Created by the effect source on first use, nullptr until then
+	void *drawing_effect;
+};
+
+// Makes the drawing effect text of a style is laid out with, implemented by
+// the renderer with a refcounted COM object
+struct StyleEffectSource {
+	void *context;
+	void *(*create)(void *context, const HighlightStyle *style);
+	void (*release)(void *context, void *drawing_effect);
+};
+
+struct StyleTableStats {
+	uint64_t resolved;
+	uint64_t rebuilds;
+	uint64_t effects_created;
+};
+
+// Style ids are 16 bit, as many as there are highlight ids
+constexpr int STYLE_TABLE_CAPACITY = 0x10000;
+constexpr int STYLE_TABLE_HIGHLIGHTS = 0x10000;
+constexpr int STYLE_TABLE_SLOTS = STYLE_TABLE_CAPACITY * 2;
+static_assert((STYLE_TABLE_SLOTS & (STYLE_TABLE_SLOTS - 1)) == 0);
+
+// The distinct styles of the highlights nvim defined. nvim hands out many
+// highlight ids that are drawn alike, they all map to one style id, so rows
+// split into runs where the drawing changes rather than where the id does.
+// Styles never change once made. Ones no highlight uses anymore stay until
+// the table fills up or the default colors change, then it is rebuilt from
+// the highlights.
+struct StyleTable {
+	// The highlight attributes by id, the defaults at index 0, see UiState
+	const HighlightAttributes *hl_attribs;
+
+	HighlightStyle *styles;
+	int style_count;
+	// Style of every highlight id, ids never defined have the defaults' 0
+	uint16_t *style_ids;
+	// Highlight ids from here on were never defined
+	int defined_limit;
+	// Open addressed style ids by contents, -1 when empty
+	int32_t *slots;
+
+	StyleEffectSource effects;
+	StyleTableStats stats;
+};
+
+bool StyleTableInitialize(StyleTable *table, const HighlightAttributes *hl_attribs);
+// Releases every drawing effect and the table
+void StyleTableShutdown(StyleTable *table);
+// Releases the drawing effects made so far, later ones come from the source
+void StyleTableSetEffectSource(StyleTable *table, StyleEffectSource effects);
+
+// Gives a highlight id the style of its attributes, after they changed
+void StyleTableDefine(StyleTable *table, int id);
+// Resolves every defined highlight again, for when the defaults change
+void StyleTableResolveAll(StyleTable *table);
+// The style id of attributes that belong to no highlight id, e.g. the
+// cursor's. Valid until the next call that defines or interns a style.
+uint16_t StyleTableIntern(StyleTable *table, const HighlightAttributes *attributes);
+// The drawing effect of a style, created if it has none yet
+void *StyleTableDrawingEffect(StyleTable *table, HighlightStyle *style);
+
+inline uint16_t StyleTableStyleId(const StyleTable *table, uint16_t hl_id) {
+	return table->style_ids[hl_id];
+}
+inline HighlightStyle *StyleTableStyle(StyleTable *table, uint16_t style_id) {
+	return &table->styles[style_id];
+}
+inline HighlightStyle *StyleTableGet(StyleTable *table, uint16_t hl_id) {
+	return &table->styles[table->style_ids[hl_id]];
+}
+
+// Runs a row of highlight ids splits into, by id and by style
+struct StyleRowRuns {
+	int hl_runs;
+	int style_runs;
+};
+StyleRowRuns StyleTableCountRuns(const StyleTable *table, const uint16_t *hl_ids, int cols);
@@ -0,0 +1,115 @@
+#include "ui_state.h"
+#include <cstdlib>
+
+bool UiStateInitialize(UiState *ui, bool resolve_styles) {
+	ui->resolves_styles = resolve_styles;
+	ui->hl_attribs = static_cast<HighlightAttributes *>(
+		calloc(static_cast<size_t>(MAX_HIGHLIGHT_ATTRIBS) + 1, sizeof(HighlightAttributes)));
+	if (!ui->hl_attribs) {
+		return false;
+	}
+	return !resolve_styles || StyleTableInitialize(&ui->styles, ui->hl_attribs);
+}
+
+void UiStateShutdown(UiState *ui) {
+	GridFree(&ui->grid);
+	free(ui->hl_attribs);
+	ui->hl_attribs = nullptr;
+	if (ui->resolves_styles) {
+		StyleTableShutdown(&ui->styles);
+	}
+}
+
+void UiStateSetDefaultColors(UiState *ui, const RedrawCommandDefaultColorsSet *default_colors) {
+	// Default colors occupy the first index of the highlight attribs array
+	ui->hl_attribs[0].foreground = default_colors->rgb_fg;
+	ui->hl_attribs[0].background = default_colors->rgb_bg;
+	ui->hl_attribs[0].special = default_colors->rgb_sp;
+	ui->hl_attribs[0].flags = 0;
+	if (ui->resolves_styles) {
+		StyleTableResolveAll(&ui->styles);
+	}
+}
+
+void UiStateDefineHighlight(UiState *ui, const RedrawCommandHlAttrDefine *hl_attr_define) {
+	if (hl_attr_define->id < 0 || hl_attr_define->id > MAX_HIGHLIGHT_ATTRIBS) {
+		return;
+	}
+	HighlightAttributes *hl_attribs = &ui->hl_attribs[hl_attr_define->id];
+
+	// Colors missing from the map fall back to the defaults,
+	// flags missing from the map are left as they are
+	uint16_t flags = (hl_attribs->flags & ~hl_attr_define->flags_mask) | hl_attr_define->attributes.flags;
+	*hl_attribs = hl_attr_define->attributes;
+	hl_attribs->flags = flags;
+	if (ui->resolves_styles) {
+		StyleTableDefine(&ui->styles, hl_attr_define->id);
+	}
+}
+
+void UiStateSetCursorModeInfos(UiState *ui, const RedrawCommandModeInfoSet *mode_info_set) {
+	const RedrawCommandModeInfo *mode_infos = RedrawModeInfos(mode_info_set);
+	for (uint32_t i = 0; i < MAX_CURSOR_MODE_INFOS && i < mode_info_set->mode_info_count; ++i) {
+		CursorModeInfo *mode_info = &ui->cursor_mode_infos[i];
+		mode_info->shape = mode_infos[i].shape;
+		mode_info->hl_attrib_id = mode_infos[i].has_attr_id ? mode_infos[i].attr_id : 0;
+		mode_info->blinkwait = mode_infos[i].blinkwait;
+		mode_info->blinkon = mode_infos[i].blinkon;
+		mode_info->blinkoff = mode_infos[i].blinkoff;
+	}
+}
+
+void UiStateSetCursorMode(UiState *ui, const RedrawCommandModeChange *mode_change) {
+	if (mode_change->mode_index >= 0 && mode_change->mode_index < MAX_CURSOR_MODE_INFOS) {
+		ui->cursor.mode_info = &ui->cursor_mode_infos[mode_change->mode_index];
+	}
+}
+
+void UiStateSetCursorPos(UiState *ui, const RedrawCommandGridCursorGoto *cursor_goto) {
+	ui->cursor.row = cursor_goto->row;
+	ui->cursor.col = cursor_goto->col;
+}
+
+void UiStateApply(UiState *ui, const RedrawCommand *command) {
+	switch (command->event) {
+	case RedrawEvent::grid_resize: {
+		const RedrawCommandGridResize *grid_resize = reinterpret_cast<const RedrawCommandGridResize *>(command);
+		GridResize(&ui->grid, grid_resize->height, grid_resize->width);
+	} break;
+	case RedrawEvent::grid_clear: {
+		GridClear(&ui->grid);
+	} break;
+	case RedrawEvent::default_colors_set: {
+		UiStateSetDefaultColors(ui, reinterpret_cast<const RedrawCommandDefaultColorsSet *>(command));
+	} break;
+	case RedrawEvent::hl_attr_define: {
+		UiStateDefineHighlight(ui, reinterpret_cast<const RedrawCommandHlAttrDefine *>(command));
+	} break;
+	case RedrawEvent::grid_line: {
+		GridUpdateLine(&ui->grid, reinterpret_cast<const RedrawCommandGridLine *>(command));
+	} break;
+	case RedrawEvent::grid_cursor_goto: {
+		UiStateSetCursorPos(ui, reinterpret_cast<const RedrawCommandGridCursorGoto *>(command));
+	} break;
+	case RedrawEvent::mode_info_set: {
+		UiStateSetCursorModeInfos(ui, reinterpret_cast<const RedrawCommandModeInfoSet *>(command));
+	} break;
+	case RedrawEvent::mode_change: {
+		UiStateSetCursorMode(ui, reinterpret_cast<const RedrawCommandModeChange *>(command));
+	} break;
+	case RedrawEvent::busy_start: {
+		ui->busy = true;
+	} break;
+	case RedrawEvent::busy_stop: {
+		ui->busy = false;
+	} break;
+	case RedrawEvent::grid_scroll: {
+		GridScroll(&ui->grid, reinterpret_cast<const RedrawCommandGridScroll *>(command));
+	} break;
+	case RedrawEvent::option_set:
+	case RedrawEvent::set_title:
+	case RedrawEvent::flush:
+	case RedrawEvent::unknown: {
+	} break;
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include "nvim/redraw_commands.h"
+#include "renderer/cursor.h"
+#include "renderer/grid.h"
+#include "renderer/highlight.h"
+#include "renderer/style_table.h"
+
+// Highlight ids are 16 bit, hl_attribs has an entry for every one of them
+constexpr int MAX_HIGHLIGHT_ATTRIBS = 0xFFFF;
+constexpr int MAX_CURSOR_MODE_INFOS = 64;
+
+// Everything nvim's redraw events describe, short of how it is drawn.
+// The renderer draws from it, replays and benchmarks only update it.
+struct UiState {
+	Grid grid;
+	// MAX_HIGHLIGHT_ATTRIBS + 1 entries, the default colors are at index 0
+	HighlightAttributes *hl_attribs;
+	// hl_attribs as drawn, kept up to date with them unless the state was
+	// initialized without styles
+	StyleTable styles;
+	bool resolves_styles;
+	CursorModeInfo cursor_mode_infos[MAX_CURSOR_MODE_INFOS];
+	Cursor cursor;
+	bool busy;
+};
+
+// Without styles only hl_attribs are tracked, for states whose highlights
+// are resolved elsewhere
+bool UiStateInitialize(UiState *ui, bool resolve_styles = true);
+void UiStateShutdown(UiState *ui);
+
+void UiStateSetDefaultColors(UiState *ui, const RedrawCommandDefaultColorsSet *default_colors);
+void UiStateDefineHighlight(UiState *ui, const RedrawCommandHlAttrDefine *hl_attr_define);
+void UiStateSetCursorModeInfos(UiState *ui, const RedrawCommandModeInfoSet *mode_info_set);
+void UiStateSetCursorMode(UiState *ui, const RedrawCommandModeChange *mode_change);
+void UiStateSetCursorPos(UiState *ui, const RedrawCommandGridCursorGoto *cursor_goto);
+
+// Applies a command to the state alone. option_set, set_title and flush
+// only concern the window and are ignored.
+void UiStateApply(UiState *ui, const RedrawCommand *command);
@@ -2,30 +2,122 @@ add_rules("mode.release", "mode.debug")
 set_languages("c++20")
 set_runtimes(is_mode("release") and "MT" or "MTd")
 
+-- Platform independent parts of Nvy, these build on any platform
+-- so they can be benchmarked on Linux
+target("NvyCore")
+  set_kind("static")
+  add_headerfiles(
+    "src/common/clock.h",
+    "src/common/mapped_file.h",
+    "src/common/mpack_helper.h",
+    "src/common/mpack_cursor.h",
+    "src/common/spsc_queue.h",
+    "src/common/transcode.h",
+    "src/common/work_pool.h",
+    "src/nvim/input_batch.h",
+    "src/nvim/message_reader.h",
+    "src/nvim/nvim_messages.h",
+    "src/nvim/pending_requests.h",
+    "src/nvim/redraw_commands.h",
+    "src/nvim/redraw_events.h",
+    "src/nvim/stream_recorder.h",
+    "src/nvim/transport.h",
+    "src/renderer/background_plan.h",
+    "src/renderer/cursor.h",
+    "src/renderer/frame_scheduler.h",
+    "src/renderer/glyph_metrics.h",
+    "src/renderer/glyph_row.h",
+    "src/renderer/grid.h",
+    "src/renderer/grid_snapshot.h",
+    "src/renderer/layout_cache.h",
+    "src/renderer/row_prep.h",
+    "src/renderer/style_table.h",
+    "src/renderer/ui_state.h",
+    "src/renderer/highlight.h",
+    "src/third_party/mpack/mpack.h"
+  )
+  add_files(
+    "src/common/mapped_file.cpp",
+    "src/common/transcode.cpp",
+    "src/common/work_pool.cpp",
+    "src/nvim/input_batch.cpp",
+    "src/nvim/message_reader.cpp",
+    "src/nvim/nvim_messages.cpp",
+    "src/nvim/pending_requests.cpp",
+    "src/nvim/redraw_commands.cpp",
+    "src/nvim/redraw_events.cpp",
+    "src/nvim/stream_recorder.cpp",
+    "src/nvim/transport.cpp",
+    "src/renderer/background_plan.cpp",
+    "src/renderer/cursor.cpp",
+    "src/renderer/frame_scheduler.cpp",
+    "src/renderer/glyph_metrics.cpp",
+    "src/renderer/glyph_row.cpp",
+    "src/renderer/grid.cpp",
+    "src/renderer/grid_snapshot.cpp",
+    "src/renderer/layout_cache.cpp",
+    "src/renderer/row_prep.cpp",
+    "src/renderer/style_table.cpp",
+    "src/renderer/ui_state.cpp",
+    "src/third_party/mpack/mpack.c"
+  )
+  add_includedirs("src", {public = true})
+  add_defines("MPACK_EXTENSIONS", {public = true})
+  if is_plat("windows") then
+    add_defines("_CRT_SECURE_NO_WARNINGS")
+    add_syslinks("ws2_32", {public = true})
+  else
+    -- The row preparation pool
+    add_syslinks("pthread", {public = true})
+  end
+
+-- Portable benchmarks, build with `xmake build <name>`
+local benchmarks = {"background_plan_bench", "command_bench", "cursor_bench", "decode_bench", "dispatch_bench", "frame_scheduler_bench", "glyph_metrics_bench", "glyph_row_bench", "grid_bench", "layout_cache_bench", "reader_bench", "replay", "row_prep_bench", "scroll_bench", "snapshot_bench", "style_table_bench", "transcode_bench"}
+-- POSIX only, for the stub server and nvim's pipes respectively
+if not is_plat("windows") then
+  table.insert(benchmarks, "transport_bench")
+  table.insert(benchmarks, "headless")
+end
+for _, benchmark in ipairs(benchmarks) do
+  target(benchmark)
+    set_kind("binary")
+    set_default(false)
+    add_deps("NvyCore")
+    add_files("bench/" .. benchmark .. ".cpp")
+    add_headerfiles("bench/bench_util.h")
+    if not is_plat("windows") then
+      add_syslinks("pthread")
+    end
+    if is_plat("windows") and toolchain("msvc") then
+      add_cxxflags("/GR-", "/EHs-c-")
+    else
+      add_cxxflags("-fno-rtti", "-fno-exceptions")
+    end
+end
+
 target("Nvy")
   set_kind("binary")
+  set_enabled(is_plat("windows"))
+  add_deps("NvyCore")
   add_files("resources/third_party/nvim_icon.rc", "version_info.rc")
   add_headerfiles(
     "src/common/dx_helper.h",
-    "src/common/mpack_helper.h",
     "src/common/vec.h",
     "src/common/window_messages.h",
     "src/nvim/nvim.h",
     "src/renderer/glyph_renderer.h",
     "src/renderer/renderer.h",
-    "src/third_party/mpack/mpack.h",
     "src/pch.h"
   )
   add_files(
     "src/main.cpp",
     "src/nvim/nvim.cpp",
     "src/renderer/glyph_renderer.cpp",
-    "src/renderer/renderer.cpp",
-    "src/third_party/mpack/mpack.c"
+    "src/renderer/renderer.cpp"
   )
   add_includedirs("src")
   add_links("user32", "shell32", "advapi32", "d3d11", "d2d1", "dwrite", "Shcore", "Dwmapi", "imm32")
-  add_defines("MPACK_EXTENSIONS", "UNICODE")
+  add_defines("UNICODE")
   -- Check if the compiler is MSVC
   if is_plat("windows") and toolchain("msvc") then
     -- Replace /GR with /GR- and /EHsc with /EHs-c- for MSVC